@@ -0,0 +1,276 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "biquad16.h"
+
+#include <assert.h>
+#include <float.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BIQUAD16_X86 1
+#include <immintrin.h>
+#else
+#define BIQUAD16_X86 0
+#endif
+
+/* Indexes into struct biquad16's coef[k]. */
+#define BQ_B0 0
+#define BQ_B1 1
+#define BQ_B2 2
+#define BQ_A1 3
+#define BQ_A2 4
+
+/* Samples are centered on this. */
+#define BIQUAD16_MID 32768
+
+/* Adding and then subtracting this rounds a float in [0, 2^22) to
+ * the nearest integer, ties to even, just like cvtps2dq does. It's
+ * 1.5 * 2^23, so the sum's units bit is its last. */
+#define BIQUAD16_ROUND 12582912.0f
+
+typedef void (*biquad16_fn)(struct biquad16*, uint16_t*, const uint16_t*);
+
+/* A filter output, back in ADC counts. Written to match the AVX2
+ * version's max, min, and convert; in particular, NaN becomes 0. */
+static inline uint16_t biquad16_out(float y)
+{
+    float v = y + (float)BIQUAD16_MID;
+    v = v > 0.0f ? v : 0.0f;
+    v = v < 65535.0f ? v : 65535.0f;
+    return (uint16_t)((v + BIQUAD16_ROUND) - BIQUAD16_ROUND);
+}
+
+/*
+ * Filter channels [start, bq->nchans) of the next sample.
+ *
+ * The parentheses matter: the AVX2 version does the same operations
+ * in the same order. (-std=c99 keeps the compiler from fusing the
+ * multiplies and adds, which would round differently.)
+ */
+static void biquad16_run_range(struct biquad16 *bq, uint16_t *out,
+                               const uint16_t *in, size_t start)
+{
+    for (size_t i = start; i < bq->nchans; i++) {
+        float x = (float)((int32_t)in[i] - BIQUAD16_MID);
+        for (size_t k = 0; k < bq->nsections; k++) {
+            const float *c = bq->coef[k];
+            float y = c[BQ_B0] * x + bq->z1[k][i];
+            bq->z1[k][i] = (c[BQ_B1] * x - c[BQ_A1] * y) + bq->z2[k][i];
+            bq->z2[k][i] = c[BQ_B2] * x - c[BQ_A2] * y;
+            x = y;
+        }
+        out[i] = biquad16_out(x);
+    }
+}
+
+static void biquad16_run_scalar(struct biquad16 *bq, uint16_t *out,
+                                const uint16_t *in)
+{
+    biquad16_run_range(bq, out, in, 0);
+}
+
+#if BIQUAD16_X86
+/* The same as biquad16_run_range(), 8 channels at a time. Each
+ * section's coefficients are broadcast as it comes up, since there
+ * aren't enough registers to keep them all. */
+__attribute__((target("avx2")))
+static void biquad16_run_avx2(struct biquad16 *bq, uint16_t *out,
+                              const uint16_t *in)
+{
+    const __m256i mid = _mm256_set1_epi32(BIQUAD16_MID);
+    const __m256 fmid = _mm256_set1_ps((float)BIQUAD16_MID);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 top = _mm256_set1_ps(65535.0f);
+    size_t i;
+    for (i = 0; i + 8 <= bq->nchans; i += 8) {
+        __m128i v16 = _mm_loadu_si128((const __m128i*)(in + i));
+        __m256 x = _mm256_cvtepi32_ps(
+            _mm256_sub_epi32(_mm256_cvtepu16_epi32(v16), mid));
+        for (size_t k = 0; k < bq->nsections; k++) {
+            const float *c = bq->coef[k];
+            float *z1p = bq->z1[k] + i;
+            float *z2p = bq->z2[k] + i;
+            __m256 b0 = _mm256_broadcast_ss(c + BQ_B0);
+            __m256 b1 = _mm256_broadcast_ss(c + BQ_B1);
+            __m256 b2 = _mm256_broadcast_ss(c + BQ_B2);
+            __m256 a1 = _mm256_broadcast_ss(c + BQ_A1);
+            __m256 a2 = _mm256_broadcast_ss(c + BQ_A2);
+            __m256 y = _mm256_add_ps(_mm256_mul_ps(b0, x),
+                                     _mm256_loadu_ps(z1p));
+            __m256 z1 = _mm256_add_ps(
+                _mm256_sub_ps(_mm256_mul_ps(b1, x), _mm256_mul_ps(a1, y)),
+                _mm256_loadu_ps(z2p));
+            __m256 z2 = _mm256_sub_ps(_mm256_mul_ps(b2, x),
+                                      _mm256_mul_ps(a2, y));
+            _mm256_storeu_ps(z1p, z1);
+            _mm256_storeu_ps(z2p, z2);
+            x = y;
+        }
+        __m256 v = _mm256_add_ps(x, fmid);
+        v = _mm256_min_ps(_mm256_max_ps(v, zero), top);
+        __m256i r = _mm256_cvtps_epi32(v);
+        _mm_storeu_si128((__m128i*)(out + i),
+                         _mm_packus_epi32(_mm256_castsi256_si128(r),
+                                          _mm256_extracti128_si256(r, 1)));
+    }
+    biquad16_run_range(bq, out, in, i);
+}
+#endif
+
+static inline int biquad16_coef_ok(double c)
+{
+    return c >= -FLT_MAX && c <= FLT_MAX; /* false for NaN */
+}
+
+int biquad16_configure(struct biquad16 *bq, const float *sos,
+                       size_t nsections)
+{
+    float coef[BIQUAD16_MAX_SECTIONS][5];
+    float dc[BIQUAD16_MAX_SECTIONS];
+    if (nsections == 0 || nsections > BIQUAD16_MAX_SECTIONS) {
+        return -1;
+    }
+    for (size_t k = 0; k < nsections; k++) {
+        const float *s = sos + k * BIQUAD16_SOS_LEN;
+        double a0 = s[3];
+        if (!biquad16_coef_ok(a0) || a0 == 0) {
+            return -1;
+        }
+        double c[5] = {
+            [BQ_B0] = s[0] / a0,
+            [BQ_B1] = s[1] / a0,
+            [BQ_B2] = s[2] / a0,
+            [BQ_A1] = s[4] / a0,
+            [BQ_A2] = s[5] / a0,
+        };
+        for (size_t j = 0; j < 5; j++) {
+            if (!biquad16_coef_ok(c[j])) {
+                return -1;
+            }
+            coef[k][j] = (float)c[j];
+        }
+        /* The poles are inside the unit circle if and only if
+         * (a1, a2) is inside this triangle. This also keeps the DC
+         * gain's denominator, 1 + a1 + a2, positive. */
+        double a1 = coef[k][BQ_A1], a2 = coef[k][BQ_A2];
+        if (!(a2 < 1 && a1 < 1 + a2 && -a1 < 1 + a2)) {
+            return -1;
+        }
+        /* Using the rounded coefficients, since they're the ones
+         * whose DC gain biquad16_prime() needs. */
+        double b = ((double)coef[k][BQ_B0] + coef[k][BQ_B1] +
+                    coef[k][BQ_B2]);
+        dc[k] = (float)(b / (1 + a1 + a2));
+    }
+    bq->nsections = nsections;
+    memcpy(bq->coef, coef, nsections * sizeof(coef[0]));
+    memcpy(bq->dc, dc, nsections * sizeof(dc[0]));
+    return 0;
+}
+
+void biquad16_restart(struct biquad16 *bq, size_t nchans)
+{
+    assert(nchans <= BIQUAD16_MAX_CHANS);
+    bq->nchans = nchans;
+    bq->primed = 0;
+}
+
+/* Set each channel's state to what it would be after an eternity of
+ * its first sample, so that sample, and the ones after it if nothing
+ * changes, come out at the filter's DC gain. */
+static void biquad16_prime(struct biquad16 *bq, const uint16_t *in)
+{
+    for (size_t i = 0; i < bq->nchans; i++) {
+        float x = (float)((int32_t)in[i] - BIQUAD16_MID);
+        for (size_t k = 0; k < bq->nsections; k++) {
+            const float *c = bq->coef[k];
+            float y = x * bq->dc[k];
+            bq->z1[k][i] = y - c[BQ_B0] * x;
+            bq->z2[k][i] = c[BQ_B2] * x - c[BQ_A2] * y;
+            x = y;
+        }
+    }
+    bq->primed = 1;
+}
+
+static biquad16_fn biquad16_lookup(enum biquad16_impl impl)
+{
+    switch (impl) {
+    case BIQUAD16_AUTO:
+#if BIQUAD16_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return biquad16_run_avx2;
+        }
+#endif
+        return biquad16_run_scalar;
+    case BIQUAD16_SCALAR:
+        return biquad16_run_scalar;
+#if BIQUAD16_X86
+    case BIQUAD16_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? biquad16_run_avx2 : NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static void biquad16_first(struct biquad16*, uint16_t*, const uint16_t*);
+
+/* Atomic, so threads racing through the first call are harmless. */
+static biquad16_fn biquad16_impl_fn = biquad16_first;
+
+static void biquad16_first(struct biquad16 *bq, uint16_t *out,
+                           const uint16_t *in)
+{
+    biquad16_fn fn = biquad16_lookup(BIQUAD16_AUTO);
+    __atomic_store_n(&biquad16_impl_fn, fn, __ATOMIC_RELAXED);
+    fn(bq, out, in);
+}
+
+void biquad16_run(struct biquad16 *bq, uint16_t *out, const uint16_t *in)
+{
+    if (!bq->primed) {
+        biquad16_prime(bq, in);
+    }
+    __atomic_load_n(&biquad16_impl_fn, __ATOMIC_RELAXED)(bq, out, in);
+}
+
+int biquad16_use(enum biquad16_impl impl)
+{
+    biquad16_fn fn = biquad16_lookup(impl);
+    if (!fn) {
+        return -1;
+    }
+    __atomic_store_n(&biquad16_impl_fn, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+const char* biquad16_impl_str(void)
+{
+    biquad16_fn fn = __atomic_load_n(&biquad16_impl_fn, __ATOMIC_RELAXED);
+    if (fn == biquad16_first) {
+        fn = biquad16_lookup(BIQUAD16_AUTO);
+    }
+#if BIQUAD16_X86
+    if (fn == biquad16_run_avx2) {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
@@ -0,0 +1,129 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   biquad16.h
+ * @brief  IIR filtering of 16-bit sample arrays, one filter per channel
+ *
+ * A filter is a cascade of second-order sections ("biquads"), given
+ * the way scipy.signal's "sos" filters are: six coefficients per
+ * section, b0, b1, b2, a0, a1, a2, for
+ *
+ *     H(z) = (b0 + b1 z^-1 + b2 z^-2) / (a0 + a1 z^-1 + a2 z^-2).
+ *
+ * Every channel gets the same filter, each with its own state, so a
+ * high-pass for spikes, a band-pass for LFP, or a 50/60 Hz notch can
+ * run over a whole board sample at once.
+ *
+ * Samples are unsigned ADC counts centered on 32768, so the filter
+ * sees each one minus 32768, and its outputs get 32768 added back,
+ * then are rounded to the nearest integer and clamped to 0..65535.
+ * The arithmetic is single-precision float, in transposed direct
+ * form II. So that the filter doesn't ring for its first few
+ * thousand samples as it finds each channel's DC offset, its state
+ * starts out as if every channel had been sitting at its first
+ * sample forever.
+ *
+ * biquad16_run() uses AVX2 if the CPU we're running on has it,
+ * chosen at run time like bswap16_buf(), filtering 8 channels at a
+ * time. Both versions do the same float operations in the same
+ * order, without fused multiply-adds, so their outputs are exactly
+ * the same.
+ */
+
+#ifndef _LIB_BIQUAD16_H_
+#define _LIB_BIQUAD16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "raw_packets.h"
+
+/** Most channels a filter can have. */
+#define BIQUAD16_MAX_CHANS RAW_BSMP_NSAMP
+
+/** Most sections a filter can have (enough for a 16th order one). */
+#define BIQUAD16_MAX_SECTIONS 8
+
+/** Coefficients per section, as passed to biquad16_configure(). */
+#define BIQUAD16_SOS_LEN 6
+
+/**
+ * Filter state.
+ *
+ * The coefficients are normalized, so a0 is 1, and kept as b0, b1,
+ * b2, a1, a2.
+ */
+struct biquad16 {
+    /* Configuration; see biquad16_configure(). */
+    size_t nsections;
+    float coef[BIQUAD16_MAX_SECTIONS][5];
+    float dc[BIQUAD16_MAX_SECTIONS]; /**< Each section's gain at DC. */
+
+    /* State; see biquad16_restart(). */
+    size_t nchans;
+    int primed;                 /**< Zero until the first sample. */
+    float z1[BIQUAD16_MAX_SECTIONS][BIQUAD16_MAX_CHANS];
+    float z2[BIQUAD16_MAX_SECTIONS][BIQUAD16_MAX_CHANS];
+};
+
+/** Implementations of biquad16_run(). */
+enum biquad16_impl {
+    BIQUAD16_AUTO = 0,          /**< Best one the CPU supports */
+    BIQUAD16_SCALAR,
+    BIQUAD16_AVX2,
+};
+
+/**
+ * Configure a filter. Call biquad16_restart() before using it.
+ *
+ * @param sos nsections * BIQUAD16_SOS_LEN coefficients.
+ * @param nsections Number of sections, 1 to BIQUAD16_MAX_SECTIONS.
+ * @return 0 on success, -1 if there are too many or too few sections,
+ *         or some section has a0 of 0, a coefficient that isn't
+ *         finite, or poles on or outside the unit circle. bq is
+ *         unchanged then.
+ */
+int biquad16_configure(struct biquad16 *bq, const float *sos,
+                       size_t nsections);
+
+/**
+ * Start filtering from scratch, keeping the configuration.
+ *
+ * @param nchans Channels per sample, at most BIQUAD16_MAX_CHANS.
+ */
+void biquad16_restart(struct biquad16 *bq, size_t nchans);
+
+/**
+ * Filter the next sample.
+ *
+ * @param out Where to put the bq->nchans filtered values; may be in.
+ * @param in bq->nchans values, in host byte order.
+ */
+void biquad16_run(struct biquad16 *bq, uint16_t *out, const uint16_t *in);
+
+/**
+ * Choose the biquad16_run() implementation, e.g. for testing.
+ *
+ * They all give the same results.
+ *
+ * @return 0 on success, -1 if this CPU (or build) doesn't support it.
+ */
+int biquad16_use(enum biquad16_impl impl);
+
+/** Name of the biquad16_run() implementation in use. */
+const char* biquad16_impl_str(void);
+
+#endif  /* _LIB_BIQUAD16_H_ */
@@ -0,0 +1,162 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bsmp_gather.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BSMP_GATHER_X86 1
+#include <immintrin.h>
+#else
+#define BSMP_GATHER_X86 0
+#endif
+
+typedef void (*bsmp_gather_fn)(uint8_t*, const struct raw_pkt_bsmp*,
+                               const uint16_t*, size_t, int);
+
+/* dst is usually somewhere in a protobuf message, at any alignment,
+ * so samples go in with memcpy(), which compiles to plain stores. */
+static void bsmp_gather_scalar(uint8_t *dst,
+                               const struct raw_pkt_bsmp *bsmp,
+                               const uint16_t *chans, size_t n, int swap)
+{
+    const raw_samp_t *src = bsmp->b_samps;
+    if (swap) {
+        for (size_t i = 0; i < n; i++) {
+            raw_samp_t v = __builtin_bswap16(src[chans[i]]);
+            memcpy(dst + i * sizeof(v), &v, sizeof(v));
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            memcpy(dst + i * sizeof(raw_samp_t), &src[chans[i]],
+                   sizeof(raw_samp_t));
+        }
+    }
+}
+
+#if BSMP_GATHER_X86
+/* There's no 16-bit gather, so gather the 32 bits that end with each
+ * sample, and keep the top half. Going from the sample before avoids
+ * reading past the end of the packet; the first sample's "before" is
+ * the end of b_chip_live. */
+__attribute__((target("avx2")))
+static inline __m256i bsmp_gather8_avx2(const raw_samp_t *src,
+                                        const uint16_t *chans, int swap)
+{
+    __m128i idx16 = _mm_loadu_si128((const __m128i*)chans);
+    __m256i idx = _mm256_cvtepu16_epi32(idx16);
+    __m256i v = _mm256_i32gather_epi32((const int*)(src - 1), idx, 2);
+    if (swap) {
+        /* (low byte << 8) | high byte, of the top half */
+        return _mm256_or_si256(
+            _mm256_and_si256(_mm256_srli_epi32(v, 8),
+                             _mm256_set1_epi32(0xFF00)),
+            _mm256_srli_epi32(v, 24));
+    }
+    return _mm256_srli_epi32(v, 16);
+}
+
+__attribute__((target("avx2")))
+static void bsmp_gather_avx2(uint8_t *dst,
+                             const struct raw_pkt_bsmp *bsmp,
+                             const uint16_t *chans, size_t n, int swap)
+{
+    const raw_samp_t *src = bsmp->b_samps;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = bsmp_gather8_avx2(src, chans + i, swap);
+        __m256i b = bsmp_gather8_avx2(src, chans + i + 8, swap);
+        /* packus works within 128-bit lanes: a0-3 b0-3 a4-7 b4-7. */
+        __m256i ab = _mm256_packus_epi32(a, b);
+        _mm256_storeu_si256((__m256i*)(dst + i * sizeof(raw_samp_t)),
+                            _mm256_permute4x64_epi64(ab, 0xD8));
+    }
+    /* Avoid AVX-SSE transition penalties in whatever runs next. */
+    _mm256_zeroupper();
+    bsmp_gather_scalar(dst + i * sizeof(raw_samp_t), bsmp, chans + i,
+                       n - i, swap);
+}
+#endif  /* BSMP_GATHER_X86 */
+
+static bsmp_gather_fn bsmp_gather_lookup(enum bsmp_gather_impl impl)
+{
+    switch (impl) {
+    case BSMP_GATHER_AUTO:
+#if BSMP_GATHER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return bsmp_gather_avx2;
+        }
+#endif
+        return bsmp_gather_scalar;
+    case BSMP_GATHER_SCALAR:
+        return bsmp_gather_scalar;
+#if BSMP_GATHER_X86
+    case BSMP_GATHER_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? bsmp_gather_avx2 : NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static void bsmp_gather_first(uint8_t*, const struct raw_pkt_bsmp*,
+                              const uint16_t*, size_t, int);
+
+/* Atomic, so threads racing through the first call are harmless. */
+static bsmp_gather_fn bsmp_gather_impl_fn = bsmp_gather_first;
+
+static void bsmp_gather_first(uint8_t *dst,
+                              const struct raw_pkt_bsmp *bsmp,
+                              const uint16_t *chans, size_t n, int swap)
+{
+    bsmp_gather_fn fn = bsmp_gather_lookup(BSMP_GATHER_AUTO);
+    __atomic_store_n(&bsmp_gather_impl_fn, fn, __ATOMIC_RELAXED);
+    fn(dst, bsmp, chans, n, swap);
+}
+
+void bsmp_gather(uint8_t *dst, const struct raw_pkt_bsmp *bsmp,
+                 const uint16_t *chans, size_t n, int swap)
+{
+    __atomic_load_n(&bsmp_gather_impl_fn, __ATOMIC_RELAXED)(dst, bsmp,
+                                                            chans, n, swap);
+}
+
+int bsmp_gather_use(enum bsmp_gather_impl impl)
+{
+    bsmp_gather_fn fn = bsmp_gather_lookup(impl);
+    if (!fn) {
+        return -1;
+    }
+    __atomic_store_n(&bsmp_gather_impl_fn, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+const char* bsmp_gather_impl_str(void)
+{
+    bsmp_gather_fn fn = __atomic_load_n(&bsmp_gather_impl_fn,
+                                        __ATOMIC_RELAXED);
+    if (fn == bsmp_gather_first) {
+        fn = bsmp_gather_lookup(BSMP_GATHER_AUTO);
+    }
+#if BSMP_GATHER_X86
+    if (fn == bsmp_gather_avx2) {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
@@ -0,0 +1,64 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   bsmp_gather.h
+ * @brief  Pick a list of channels out of a board sample
+ *
+ * On x86, this uses AVX2 gathers if the CPU we're running on has
+ * them, and a scalar loop otherwise. As with bswap16_buf(), the
+ * choice is made at run time, on the first call.
+ */
+
+#ifndef _LIB_BSMP_GATHER_H_
+#define _LIB_BSMP_GATHER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "raw_packets.h"
+
+/** Implementations of bsmp_gather(). */
+enum bsmp_gather_impl {
+    BSMP_GATHER_AUTO = 0,       /**< Best one the CPU supports */
+    BSMP_GATHER_SCALAR,
+    BSMP_GATHER_AVX2,
+};
+
+/**
+ * Copy some of a board sample's samples into dst.
+ *
+ * The i'th sample at dst gets bsmp->b_samps[chans[i]], for i from 0
+ * to n - 1, in host byte order unless swap is set. Every chans[i]
+ * must be less than RAW_BSMP_NSAMP. dst needn't be aligned: it's
+ * bytes so it can point into a protobuf message.
+ *
+ * @param swap If nonzero, byte-swap the samples on the way, e.g. to
+ *             get them back to host order after raw_pkt_ntoh_hdr().
+ */
+void bsmp_gather(uint8_t *dst, const struct raw_pkt_bsmp *bsmp,
+                 const uint16_t *chans, size_t n, int swap);
+
+/**
+ * Choose the bsmp_gather() implementation, e.g. for testing.
+ *
+ * @return 0 on success, -1 if this CPU (or build) doesn't support it.
+ */
+int bsmp_gather_use(enum bsmp_gather_impl impl);
+
+/** Name of the bsmp_gather() implementation in use. */
+const char* bsmp_gather_impl_str(void);
+
+#endif  /* _LIB_BSMP_GATHER_H_ */
@@ -0,0 +1,49 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bsmp_split.h"
+
+#include <assert.h>
+#include <string.h>
+
+void bsmp_split(const struct bsmp_split_cols *cols,
+                const struct raw_pkt_bsmp *bsamps, size_t nsamps)
+{
+    const size_t nchans = cols->nchans;
+    const size_t naux = RAW_BSMP_NSAMP - nchans;
+    uint32_t *sidx = cols->sidx;
+    uint32_t *chip_live = cols->chip_live;
+    raw_samp_t *chans = cols->chans;
+    raw_samp_t *aux = cols->aux;
+
+    assert(nchans <= RAW_BSMP_NSAMP);
+    for (size_t i = 0; i < nsamps; i++) {
+        const struct raw_pkt_bsmp *bsmp = &bsamps[i];
+        if (sidx) {
+            sidx[i] = bsmp->b_sidx;
+        }
+        if (chip_live) {
+            chip_live[i] = bsmp->b_chip_live;
+        }
+        if (chans) {
+            memcpy(chans + i * nchans, bsmp->b_samps,
+                   nchans * sizeof(raw_samp_t));
+        }
+        if (aux) {
+            memcpy(aux + i * naux, bsmp->b_samps + nchans,
+                   naux * sizeof(raw_samp_t));
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   bsmp_split.h
+ * @brief  Split an array of board samples into columns
+ *
+ * Storage backends that keep each board sample field in its own
+ * array (like HDF5's datasets) need the fields of many board samples
+ * pulled apart. bsmp_split() does that in one pass over the board
+ * samples, so each one is read from memory once, no matter how many
+ * columns it goes into. The sample columns are block copies, which
+ * the C library already does with the widest vectors the CPU has.
+ *
+ * Samples are copied as they are, so they stay in whatever byte
+ * order they were in.
+ */
+
+#ifndef _LIB_BSMP_SPLIT_H_
+#define _LIB_BSMP_SPLIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "raw_packets.h"
+
+/**
+ * Where bsmp_split() puts each column. Each one is optional; NULL
+ * columns are skipped.
+ */
+struct bsmp_split_cols {
+    uint32_t *sidx;             /**< Each b_sidx */
+    uint32_t *chip_live;        /**< Each b_chip_live */
+    /** Each board sample's first nchans samples, one board sample
+     * after another. */
+    raw_samp_t *chans;
+    size_t nchans;              /**< At most RAW_BSMP_NSAMP. */
+    /** Each board sample's samples after its first nchans, one board
+     * sample after another. */
+    raw_samp_t *aux;
+};
+
+/**
+ * Split board samples into columns.
+ *
+ * @param cols Where to put them; each column has room for nsamps
+ *             board samples' worth.
+ * @param bsamps Board samples to split.
+ * @param nsamps Number of board samples.
+ */
+void bsmp_split(const struct bsmp_split_cols *cols,
+                const struct raw_pkt_bsmp *bsamps, size_t nsamps);
+
+#endif  /* _LIB_BSMP_SPLIT_H_ */
@@ -0,0 +1,154 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bswap16.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BSWAP16_X86 1
+#include <immintrin.h>
+#else
+#define BSWAP16_X86 0
+#endif
+
+typedef void (*bswap16_fn)(uint16_t*, const uint16_t*, size_t);
+
+static void bswap16_scalar(uint16_t *dst, const uint16_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = __builtin_bswap16(src[i]);
+    }
+}
+
+#if BSWAP16_X86
+/* These are compiled for their instruction sets regardless of the
+ * build flags, and are only ever called if the CPU has them. */
+
+__attribute__((target("ssse3")))
+static void bswap16_ssse3(uint16_t *dst, const uint16_t *src, size_t n)
+{
+    const __m128i shuf = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                       9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(a, shuf));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_shuffle_epi8(b, shuf));
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(a, shuf));
+    }
+    bswap16_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void bswap16_avx2(uint16_t *dst, const uint16_t *src, size_t n)
+{
+    /* vpshufb shuffles within each 128-bit lane. */
+    const __m256i shuf = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 16));
+        _mm256_storeu_si256((__m256i*)(dst + i),
+                            _mm256_shuffle_epi8(a, shuf));
+        _mm256_storeu_si256((__m256i*)(dst + i + 16),
+                            _mm256_shuffle_epi8(b, shuf));
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i),
+                            _mm256_shuffle_epi8(a, shuf));
+    }
+    /* Avoid AVX-SSE transition penalties in whatever runs next. */
+    _mm256_zeroupper();
+    bswap16_ssse3(dst + i, src + i, n - i);
+}
+#endif  /* BSWAP16_X86 */
+
+static bswap16_fn bswap16_lookup(enum bswap16_impl impl)
+{
+    switch (impl) {
+    case BSWAP16_AUTO:
+#if BSWAP16_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return bswap16_avx2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            return bswap16_ssse3;
+        }
+#endif
+        return bswap16_scalar;
+    case BSWAP16_SCALAR:
+        return bswap16_scalar;
+#if BSWAP16_X86
+    case BSWAP16_SSSE3:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("ssse3") ? bswap16_ssse3 : NULL;
+    case BSWAP16_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? bswap16_avx2 : NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static void bswap16_first(uint16_t*, const uint16_t*, size_t);
+
+/* Atomic, so threads racing through the first call are harmless. */
+static bswap16_fn bswap16_impl_fn = bswap16_first;
+
+static void bswap16_first(uint16_t *dst, const uint16_t *src, size_t n)
+{
+    bswap16_fn fn = bswap16_lookup(BSWAP16_AUTO);
+    __atomic_store_n(&bswap16_impl_fn, fn, __ATOMIC_RELAXED);
+    fn(dst, src, n);
+}
+
+void bswap16_buf(uint16_t *dst, const uint16_t *src, size_t n)
+{
+    __atomic_load_n(&bswap16_impl_fn, __ATOMIC_RELAXED)(dst, src, n);
+}
+
+int bswap16_use(enum bswap16_impl impl)
+{
+    bswap16_fn fn = bswap16_lookup(impl);
+    if (!fn) {
+        return -1;
+    }
+    __atomic_store_n(&bswap16_impl_fn, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+const char* bswap16_impl_str(void)
+{
+    bswap16_fn fn = __atomic_load_n(&bswap16_impl_fn, __ATOMIC_RELAXED);
+    if (fn == bswap16_first) {
+        fn = bswap16_lookup(BSWAP16_AUTO);
+    }
+#if BSWAP16_X86
+    if (fn == bswap16_avx2) {
+        return "avx2";
+    } else if (fn == bswap16_ssse3) {
+        return "ssse3";
+    }
+#endif
+    return "scalar";
+}
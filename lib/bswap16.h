@@ -0,0 +1,57 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   bswap16.h
+ * @brief  Byte-swap arrays of 16-bit values
+ *
+ * On x86, this uses AVX2 or SSSE3 if the CPU we're running on has
+ * them, and a scalar loop otherwise. The choice is made at run time,
+ * on the first call, so the same binary works anywhere.
+ */
+
+#ifndef _LIB_BSWAP16_H_
+#define _LIB_BSWAP16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Implementations of bswap16_buf(). */
+enum bswap16_impl {
+    BSWAP16_AUTO = 0,           /**< Best one the CPU supports */
+    BSWAP16_SCALAR,
+    BSWAP16_SSSE3,
+    BSWAP16_AVX2,
+};
+
+/**
+ * Byte-swap n 16-bit values from src into dst.
+ *
+ * dst and src may be the same, for swapping in place, but may not
+ * otherwise overlap. Neither needs any particular alignment.
+ */
+void bswap16_buf(uint16_t *dst, const uint16_t *src, size_t n);
+
+/**
+ * Choose the bswap16_buf() implementation, e.g. for testing.
+ *
+ * @return 0 on success, -1 if this CPU (or build) doesn't support it.
+ */
+int bswap16_use(enum bswap16_impl impl);
+
+/** Name of the bswap16_buf() implementation in use. */
+const char* bswap16_impl_str(void);
+
+#endif  /* _LIB_BSWAP16_H_ */
@@ -33,10 +33,18 @@
 struct ch_storage_ops;
 struct raw_pkt_bsmp;
 
+/* ch_storage.ch_flags values */
+/** Board samples' b_samps arrays are in network (big-endian) byte
+ * order, as they arrived from the data node; the header fields are
+ * in host byte order. The backend records this in the file instead
+ * of swapping the samples itself. Set before ch_storage_open(). */
+#define CH_STORAGE_WIRE_ORDER 0x1
+
 struct ch_storage {
     const char *ch_path;
     const struct ch_storage_ops *ops;
     void *priv;
+    unsigned ch_flags;          /* CH_STORAGE_* flags; initially 0 */
 };
 
 struct ch_storage_ops {
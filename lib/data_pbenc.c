@@ -0,0 +1,502 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "data_pbenc.h"
+
+#include <string.h>
+
+#include "bsmp_gather.h"
+#include "proto/data.pb-c.h"
+
+/*
+ * Wire format helpers. Fields go out in field number order, like
+ * protobuf-c does it.
+ */
+
+#define PBENC_WT_VARINT 0
+#define PBENC_WT_LEN    2
+#define PBENC_TAG(field, wt) ((uint8_t)((field) << 3 | (wt)))
+
+/* DnodeSample field numbers */
+#define DNSAMP_TYPE      1
+#define DNSAMP_SUBSAMPLE 2
+#define DNSAMP_SAMPLE    3
+#define DNSAMP_GAP_NSAMP 4
+#define DNSAMP_PREVIEW   5
+#define DNSAMP_SPIKES    6
+
+/* Field numbers 1 through 6 are the same in BoardSample and
+ * BoardSubsample. */
+#define BSAMP_IS_LIVE    1
+#define BSAMP_IS_LAST    2
+#define BSAMP_EXP_COOKIE 3
+#define BSAMP_BOARD_ID   4
+#define BSAMP_SAMP_IDX   5
+#define BSAMP_CHIP_LIVE  6
+
+/* BoardSample field numbers */
+#define BSMP_SAMPLES     7
+#define BSMP_IS_ERR      8
+#define BSMP_CHANNELS    9
+#define BSMP_SAMPS_DELTA 10
+#define BSMP_DELTA_REF   11
+
+/* BoardSubsample field numbers */
+#define BSUB_CHIPS       7
+#define BSUB_CHANNELS    8
+#define BSUB_SAMPLES     9
+#define BSUB_GPIO        10
+#define BSUB_DAC_CHANNEL 11
+#define BSUB_DAC_VALUE   12
+#define BSUB_IS_ERR      13
+
+/* BoardPreview field numbers */
+#define BPRV_EXP_COOKIE  1
+#define BPRV_BOARD_ID    2
+#define BPRV_CHIP_LIVE   3
+#define BPRV_SAMP_IDX    4
+#define BPRV_NSAMPLES    5
+#define BPRV_CHANNELS    6
+#define BPRV_MIN         7
+#define BPRV_MAX         8
+#define BPRV_MEAN        9
+#define BPRV_RMS         10
+
+/* BoardSpikes field numbers */
+#define BSPK_EXP_COOKIE  1
+#define BSPK_BOARD_ID    2
+#define BSPK_SAMP_IDX    3
+#define BSPK_CHANNELS    4
+#define BSPK_SNIPPETS    5
+#define BSPK_SNIPPET_PRE 6
+
+#define BSMP_SAMPS_LEN (RAW_BSMP_NSAMP * sizeof(raw_samp_t))
+
+static inline size_t pbenc_varint_size(uint64_t v)
+{
+    unsigned bits = 64 - (unsigned)__builtin_clzll(v | 1);
+    return (bits + 6) / 7;
+}
+
+size_t data_pbenc_varint(uint8_t *out, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static inline uint8_t* pbenc_uint(uint8_t *out, unsigned field, uint64_t v)
+{
+    *out++ = PBENC_TAG(field, PBENC_WT_VARINT);
+    return out + data_pbenc_varint(out, v);
+}
+
+static inline uint8_t* pbenc_bool(uint8_t *out, unsigned field, int v)
+{
+    *out++ = PBENC_TAG(field, PBENC_WT_VARINT);
+    *out++ = !!v;
+    return out;
+}
+
+static inline uint8_t* pbenc_len(uint8_t *out, unsigned field, size_t len)
+{
+    *out++ = PBENC_TAG(field, PBENC_WT_LEN);
+    return out + data_pbenc_varint(out, len);
+}
+
+/* Size of a tagged varint field. */
+static inline size_t pbenc_uint_size(uint64_t v)
+{
+    return 1 + pbenc_varint_size(v);
+}
+
+/* Size of a tagged, length-delimited field. */
+static inline size_t pbenc_len_size(size_t len)
+{
+    return 1 + pbenc_varint_size(len) + len;
+}
+
+/*
+ * Fields common to board samples and subsamples
+ */
+
+#define pbenc_common_size(pkt)                                  \
+    (2 * 2 +                                                    \
+     pbenc_uint_size(raw_exp_cookie(pkt)) +                     \
+     pbenc_uint_size((pkt)->b_id) +                             \
+     pbenc_uint_size((pkt)->b_sidx) +                           \
+     pbenc_uint_size((pkt)->b_chip_live))
+
+#define pbenc_common(out, pkt) ({                               \
+    uint8_t *__out = (out);                                     \
+    uint8_t __pflags = raw_pflags(pkt);                         \
+    __out = pbenc_bool(__out, BSAMP_IS_LIVE,                    \
+                       __pflags & RAW_PFLAG_B_LIVE);            \
+    __out = pbenc_bool(__out, BSAMP_IS_LAST,                    \
+                       __pflags & RAW_PFLAG_B_LAST);            \
+    __out = pbenc_uint(__out, BSAMP_EXP_COOKIE,                 \
+                       raw_exp_cookie(pkt));                    \
+    __out = pbenc_uint(__out, BSAMP_BOARD_ID, (pkt)->b_id);     \
+    __out = pbenc_uint(__out, BSAMP_SAMP_IDX, (pkt)->b_sidx);   \
+    __out = pbenc_uint(__out, BSAMP_CHIP_LIVE,                  \
+                       (pkt)->b_chip_live);                     \
+    __out; })
+
+/* Start a DnodeSample: its type, then the tag and length of the
+ * embedded message. */
+static uint8_t* pbenc_dnsample(uint8_t *out, DnodeSample__Type type,
+                               unsigned field, size_t msg_len)
+{
+    out = pbenc_uint(out, DNSAMP_TYPE, type);
+    return pbenc_len(out, field, msg_len);
+}
+
+static inline size_t pbenc_dnsample_size(DnodeSample__Type type,
+                                         size_t msg_len)
+{
+    return pbenc_uint_size(type) + pbenc_len_size(msg_len);
+}
+
+/*
+ * Board samples
+ */
+
+static size_t pbenc_bsmp_msg_size(const struct raw_pkt_bsmp *bsmp)
+{
+    return (pbenc_common_size(bsmp) + pbenc_len_size(BSMP_SAMPS_LEN) +
+            2 /* is_err */);
+}
+
+size_t data_pbenc_bsmp_size(const struct raw_pkt_bsmp *bsmp)
+{
+    return pbenc_dnsample_size(DNODE_SAMPLE__TYPE__SAMPLE,
+                               pbenc_bsmp_msg_size(bsmp));
+}
+
+size_t data_pbenc_bsmp(uint8_t *out, const struct raw_pkt_bsmp *bsmp,
+                       int wire)
+{
+    uint8_t *start = out;
+    out = pbenc_dnsample(out, DNODE_SAMPLE__TYPE__SAMPLE, DNSAMP_SAMPLE,
+                         pbenc_bsmp_msg_size(bsmp));
+    out = pbenc_common(out, bsmp);
+    out = pbenc_len(out, BSMP_SAMPLES, BSMP_SAMPS_LEN);
+    if (wire) {
+        /* out needn't be aligned for raw_samp_t, so swap them into
+         * something that is first. */
+        raw_samp_t samps[RAW_BSMP_NSAMP];
+        raw_samps_ntoh_copy(samps, bsmp->b_samps, RAW_BSMP_NSAMP);
+        memcpy(out, samps, BSMP_SAMPS_LEN);
+    } else {
+        memcpy(out, bsmp->b_samps, BSMP_SAMPS_LEN);
+    }
+    out += BSMP_SAMPS_LEN;
+    out = pbenc_bool(out, BSMP_IS_ERR, raw_pkt_is_err(bsmp));
+    return (size_t)(out - start);
+}
+
+/*
+ * Some of a board sample's channels
+ */
+
+int data_pbenc_chans_init(struct data_pbenc_chans *dchans,
+                          const uint16_t *chans, size_t n)
+{
+    if (n > RAW_BSMP_NSAMP) {
+        return -1;
+    }
+    uint8_t *out = dchans->packed;
+    for (size_t i = 0; i < n; i++) {
+        if (chans[i] >= RAW_BSMP_NSAMP) {
+            return -1;
+        }
+        dchans->chans[i] = chans[i];
+        out += data_pbenc_varint(out, chans[i]);
+    }
+    dchans->n = n;
+    dchans->packed_len = (size_t)(out - dchans->packed);
+    return 0;
+}
+
+static size_t pbenc_bsmp_chans_msg_size(const struct raw_pkt_bsmp *bsmp,
+                                        const struct data_pbenc_chans *dc)
+{
+    return (pbenc_common_size(bsmp) +
+            pbenc_len_size(dc->n * sizeof(raw_samp_t)) +
+            2 /* is_err */ +
+            pbenc_len_size(dc->packed_len));
+}
+
+size_t data_pbenc_bsmp_chans_size(const struct raw_pkt_bsmp *bsmp,
+                                  const struct data_pbenc_chans *dchans)
+{
+    return pbenc_dnsample_size(DNODE_SAMPLE__TYPE__SAMPLE,
+                               pbenc_bsmp_chans_msg_size(bsmp, dchans));
+}
+
+size_t data_pbenc_bsmp_chans(uint8_t *out, const struct raw_pkt_bsmp *bsmp,
+                             const struct data_pbenc_chans *dchans,
+                             int wire)
+{
+    uint8_t *start = out;
+    size_t samps_len = dchans->n * sizeof(raw_samp_t);
+    out = pbenc_dnsample(out, DNODE_SAMPLE__TYPE__SAMPLE, DNSAMP_SAMPLE,
+                         pbenc_bsmp_chans_msg_size(bsmp, dchans));
+    out = pbenc_common(out, bsmp);
+    out = pbenc_len(out, BSMP_SAMPLES, samps_len);
+    bsmp_gather(out, bsmp, dchans->chans, dchans->n, wire);
+    out += samps_len;
+    out = pbenc_bool(out, BSMP_IS_ERR, raw_pkt_is_err(bsmp));
+    out = pbenc_len(out, BSMP_CHANNELS, dchans->packed_len);
+    memcpy(out, dchans->packed, dchans->packed_len);
+    out += dchans->packed_len;
+    return (size_t)(out - start);
+}
+
+/*
+ * Compressed board samples
+ */
+
+static size_t pbenc_bsmp_delta_msg_size(const struct raw_pkt_bsmp *bsmp,
+                                        const struct data_pbenc_chans *dc,
+                                        const struct data_pbenc_delta *d)
+{
+    return (pbenc_common_size(bsmp) +
+            2 /* is_err */ +
+            (dc && dc->n ? pbenc_len_size(dc->packed_len) : 0) +
+            pbenc_len_size(d->len) +
+            (d->has_ref ? pbenc_uint_size(d->ref) : 0));
+}
+
+size_t data_pbenc_bsmp_delta_size(const struct raw_pkt_bsmp *bsmp,
+                                  const struct data_pbenc_chans *dchans,
+                                  const struct data_pbenc_delta *delta)
+{
+    return pbenc_dnsample_size(DNODE_SAMPLE__TYPE__SAMPLE,
+                               pbenc_bsmp_delta_msg_size(bsmp, dchans,
+                                                         delta));
+}
+
+size_t data_pbenc_bsmp_delta(uint8_t *out, const struct raw_pkt_bsmp *bsmp,
+                             const struct data_pbenc_chans *dchans,
+                             const struct data_pbenc_delta *delta)
+{
+    uint8_t *start = out;
+    out = pbenc_dnsample(out, DNODE_SAMPLE__TYPE__SAMPLE, DNSAMP_SAMPLE,
+                         pbenc_bsmp_delta_msg_size(bsmp, dchans, delta));
+    out = pbenc_common(out, bsmp);
+    out = pbenc_bool(out, BSMP_IS_ERR, raw_pkt_is_err(bsmp));
+    if (dchans && dchans->n) {
+        out = pbenc_len(out, BSMP_CHANNELS, dchans->packed_len);
+        memcpy(out, dchans->packed, dchans->packed_len);
+        out += dchans->packed_len;
+    }
+    out = pbenc_len(out, BSMP_SAMPS_DELTA, delta->len);
+    memcpy(out, delta->data, delta->len);
+    out += delta->len;
+    if (delta->has_ref) {
+        out = pbenc_uint(out, BSMP_DELTA_REF, delta->ref);
+    }
+    return (size_t)(out - start);
+}
+
+/*
+ * Board subsamples
+ */
+
+/* Lengths of the packed chips, channels, and samples fields */
+struct pbenc_bsub_lens {
+    size_t chips;
+    size_t chans;
+    size_t samps;
+};
+
+static size_t pbenc_bsub_msg_size(const struct raw_pkt_bsub *bsub,
+                                  struct pbenc_bsub_lens *lens)
+{
+    lens->chips = lens->chans = lens->samps = 0;
+    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
+        lens->chips += pbenc_varint_size(bsub->b_cfg[i].bs_chip);
+        lens->chans += pbenc_varint_size(bsub->b_cfg[i].bs_chan);
+        lens->samps += pbenc_varint_size(bsub->b_samps[i]);
+    }
+    return (pbenc_common_size(bsub) +
+            pbenc_len_size(lens->chips) +
+            pbenc_len_size(lens->chans) +
+            pbenc_len_size(lens->samps) +
+            pbenc_uint_size(bsub->b_gpio) +
+            pbenc_uint_size(bsub->b_dac_cfg) +
+            pbenc_uint_size(bsub->b_dac) +
+            2 /* is_err */);
+}
+
+size_t data_pbenc_bsub_size(const struct raw_pkt_bsub *bsub)
+{
+    struct pbenc_bsub_lens lens;
+    return pbenc_dnsample_size(DNODE_SAMPLE__TYPE__SUBSAMPLE,
+                               pbenc_bsub_msg_size(bsub, &lens));
+}
+
+size_t data_pbenc_bsub(uint8_t *out, const struct raw_pkt_bsub *bsub)
+{
+    uint8_t *start = out;
+    struct pbenc_bsub_lens lens;
+    out = pbenc_dnsample(out, DNODE_SAMPLE__TYPE__SUBSAMPLE,
+                         DNSAMP_SUBSAMPLE,
+                         pbenc_bsub_msg_size(bsub, &lens));
+    out = pbenc_common(out, bsub);
+    out = pbenc_len(out, BSUB_CHIPS, lens.chips);
+    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
+        out += data_pbenc_varint(out, bsub->b_cfg[i].bs_chip);
+    }
+    out = pbenc_len(out, BSUB_CHANNELS, lens.chans);
+    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
+        out += data_pbenc_varint(out, bsub->b_cfg[i].bs_chan);
+    }
+    out = pbenc_len(out, BSUB_SAMPLES, lens.samps);
+    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
+        out += data_pbenc_varint(out, bsub->b_samps[i]);
+    }
+    out = pbenc_uint(out, BSUB_GPIO, bsub->b_gpio);
+    out = pbenc_uint(out, BSUB_DAC_CHANNEL, bsub->b_dac_cfg);
+    out = pbenc_uint(out, BSUB_DAC_VALUE, bsub->b_dac);
+    out = pbenc_bool(out, BSUB_IS_ERR, raw_pkt_is_err(bsub));
+    return (size_t)(out - start);
+}
+
+/*
+ * Board sample previews
+ */
+
+static size_t pbenc_preview_msg_size(const struct data_pbenc_preview *pv)
+{
+    size_t vals_len = pv->nchans * sizeof(uint16_t);
+    return (pbenc_uint_size(pv->exp_cookie) +
+            pbenc_uint_size(pv->board_id) +
+            pbenc_uint_size(pv->chip_live) +
+            pbenc_uint_size(pv->samp_idx) +
+            pbenc_uint_size(pv->nsamples) +
+            (pv->dchans && pv->dchans->n ?
+             pbenc_len_size(pv->dchans->packed_len) : 0) +
+            4 * pbenc_len_size(vals_len));
+}
+
+size_t data_pbenc_preview_size(const struct data_pbenc_preview *pv)
+{
+    return pbenc_dnsample_size(DNODE_SAMPLE__TYPE__PREVIEW,
+                               pbenc_preview_msg_size(pv));
+}
+
+static inline uint8_t* pbenc_u16s(uint8_t *out, unsigned field,
+                                  const uint16_t *vals, size_t n)
+{
+    out = pbenc_len(out, field, n * sizeof(uint16_t));
+    memcpy(out, vals, n * sizeof(uint16_t));
+    return out + n * sizeof(uint16_t);
+}
+
+size_t data_pbenc_preview(uint8_t *out, const struct data_pbenc_preview *pv)
+{
+    uint8_t *start = out;
+    out = pbenc_dnsample(out, DNODE_SAMPLE__TYPE__PREVIEW, DNSAMP_PREVIEW,
+                         pbenc_preview_msg_size(pv));
+    out = pbenc_uint(out, BPRV_EXP_COOKIE, pv->exp_cookie);
+    out = pbenc_uint(out, BPRV_BOARD_ID, pv->board_id);
+    out = pbenc_uint(out, BPRV_CHIP_LIVE, pv->chip_live);
+    out = pbenc_uint(out, BPRV_SAMP_IDX, pv->samp_idx);
+    out = pbenc_uint(out, BPRV_NSAMPLES, pv->nsamples);
+    if (pv->dchans && pv->dchans->n) {
+        out = pbenc_len(out, BPRV_CHANNELS, pv->dchans->packed_len);
+        memcpy(out, pv->dchans->packed, pv->dchans->packed_len);
+        out += pv->dchans->packed_len;
+    }
+    out = pbenc_u16s(out, BPRV_MIN, pv->min, pv->nchans);
+    out = pbenc_u16s(out, BPRV_MAX, pv->max, pv->nchans);
+    out = pbenc_u16s(out, BPRV_MEAN, pv->mean, pv->nchans);
+    out = pbenc_u16s(out, BPRV_RMS, pv->rms, pv->nchans);
+    return (size_t)(out - start);
+}
+
+/*
+ * Spike events
+ */
+
+static size_t pbenc_spikes_chans_len(const struct data_pbenc_spikes *sp)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < sp->n; i++) {
+        len += pbenc_varint_size(sp->chans[i]);
+    }
+    return len;
+}
+
+static size_t pbenc_spikes_msg_size(const struct data_pbenc_spikes *sp,
+                                    size_t chans_len)
+{
+    size_t snippets_len = sp->n * sp->snippet_len * sizeof(uint16_t);
+    return (pbenc_uint_size(sp->exp_cookie) +
+            pbenc_uint_size(sp->board_id) +
+            pbenc_uint_size(sp->samp_idx) +
+            (sp->n ? pbenc_len_size(chans_len) : 0) +
+            (sp->snippet_len ?
+             pbenc_len_size(snippets_len) +
+             pbenc_uint_size(sp->snippet_pre) : 0));
+}
+
+size_t data_pbenc_spikes_size(const struct data_pbenc_spikes *sp)
+{
+    return pbenc_dnsample_size(
+        DNODE_SAMPLE__TYPE__SPIKES,
+        pbenc_spikes_msg_size(sp, pbenc_spikes_chans_len(sp)));
+}
+
+size_t data_pbenc_spikes(uint8_t *out, const struct data_pbenc_spikes *sp)
+{
+    uint8_t *start = out;
+    size_t chans_len = pbenc_spikes_chans_len(sp);
+    out = pbenc_dnsample(out, DNODE_SAMPLE__TYPE__SPIKES, DNSAMP_SPIKES,
+                         pbenc_spikes_msg_size(sp, chans_len));
+    out = pbenc_uint(out, BSPK_EXP_COOKIE, sp->exp_cookie);
+    out = pbenc_uint(out, BSPK_BOARD_ID, sp->board_id);
+    out = pbenc_uint(out, BSPK_SAMP_IDX, sp->samp_idx);
+    if (sp->n) {
+        out = pbenc_len(out, BSPK_CHANNELS, chans_len);
+        for (size_t i = 0; i < sp->n; i++) {
+            out += data_pbenc_varint(out, sp->chans[i]);
+        }
+    }
+    if (sp->snippet_len) {
+        out = pbenc_u16s(out, BSPK_SNIPPETS, sp->snippets,
+                         sp->n * sp->snippet_len);
+        out = pbenc_uint(out, BSPK_SNIPPET_PRE, sp->snippet_pre);
+    }
+    return (size_t)(out - start);
+}
+
+/*
+ * Gap markers
+ */
+
+size_t data_pbenc_gap(uint8_t *out, uint32_t nsamples)
+{
+    uint8_t *start = out;
+    out = pbenc_uint(out, DNSAMP_TYPE, DNODE_SAMPLE__TYPE__GAP);
+    out = pbenc_uint(out, DNSAMP_GAP_NSAMP, nsamples);
+    return (size_t)(out - start);
+}
@@ -0,0 +1,294 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   data_pbenc.h
+ * @brief  Fast DnodeSample encoding, straight from raw packets
+ *
+ * These write the same bytes as filling in a DnodeSample (see
+ * proto/data.proto) from a board sample or subsample and calling
+ * dnode_sample__pack(), without the intermediate protobuf-c structs
+ * or copies. Every field is always present, so the layout is fixed
+ * apart from the lengths of a few varints.
+ *
+ * If you change the BoardSample, BoardSubsample, or DnodeSample
+ * messages, change these too; test/test-data-pbenc will tell you if
+ * they don't match.
+ */
+
+#ifndef _LIB_DATA_PBENC_H_
+#define _LIB_DATA_PBENC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "delta16.h"
+#include "raw_packets.h"
+#include "spike16.h"
+
+/** Longest possible data_pbenc_bsmp() result. */
+#define DATA_PBENC_BSMP_MAX (RAW_BSMP_NSAMP * sizeof(raw_samp_t) + 64)
+
+/** Longest possible data_pbenc_bsmp_chans() result, for up to
+ * RAW_BSMP_NSAMP channels. Each channel index is a varint that's at
+ * most 2 bytes. */
+#define DATA_PBENC_BSMP_CHANS_MAX \
+    (RAW_BSMP_NSAMP * (sizeof(raw_samp_t) + 2) + 64)
+
+/** Longest possible data_pbenc_bsmp_delta() result, for up to
+ * RAW_BSMP_NSAMP channels. */
+#define DATA_PBENC_BSMP_DELTA_MAX \
+    (DELTA16_MAX_LEN(RAW_BSMP_NSAMP) + RAW_BSMP_NSAMP * 2 + 64)
+
+/** Longest possible data_pbenc_bsub() result. */
+#define DATA_PBENC_BSUB_MAX (RAW_BSUB_NSAMP * 7 + 64)
+
+/** Longest possible data_pbenc_preview() result, for up to
+ * RAW_BSMP_NSAMP channels. */
+#define DATA_PBENC_PREVIEW_MAX \
+    (RAW_BSMP_NSAMP * (4 * sizeof(uint16_t) + 2) + 96)
+
+/** Most events in one data_pbenc_spikes() message. */
+#define DATA_PBENC_SPIKES_MAX_EVENTS 64
+
+/** Longest possible data_pbenc_spikes() result. Each channel index is
+ * a varint that's at most 2 bytes. */
+#define DATA_PBENC_SPIKES_MAX                                   \
+    (DATA_PBENC_SPIKES_MAX_EVENTS *                             \
+     (SPIKE16_SNIPPET_MAX * sizeof(uint16_t) + 2) + 64)
+
+/** Longest possible data_pbenc_gap() result. */
+#define DATA_PBENC_GAP_MAX 16
+
+/** Longest possible varint, from data_pbenc_varint(). */
+#define DATA_PBENC_VARINT_MAX 10
+
+/**
+ * Encode a varint.
+ *
+ * @param out Where to put it; must have room for
+ *            DATA_PBENC_VARINT_MAX bytes.
+ * @return Number of bytes written.
+ */
+size_t data_pbenc_varint(uint8_t *out, uint64_t v);
+
+/**
+ * Packed size of a DnodeSample holding a board sample.
+ *
+ * This is what data_pbenc_bsmp() will return.
+ */
+size_t data_pbenc_bsmp_size(const struct raw_pkt_bsmp *bsmp);
+
+/**
+ * Pack a DnodeSample holding a board sample.
+ *
+ * @param out Output buffer; must have room for
+ *            data_pbenc_bsmp_size(bsmp) bytes. No alignment needed.
+ * @param bsmp Board sample, in host byte order.
+ * @param wire If nonzero, bsmp's samples (but not its header) are
+ *             still in network byte order; see raw_pkt_ntoh_hdr().
+ * @return Number of bytes written.
+ */
+size_t data_pbenc_bsmp(uint8_t *out, const struct raw_pkt_bsmp *bsmp,
+                       int wire);
+
+/**
+ * A list of board sample channels, for data_pbenc_bsmp_chans().
+ *
+ * Set one up with data_pbenc_chans_init(). Its packed form is worked
+ * out then, rather than for every board sample.
+ */
+struct data_pbenc_chans {
+    size_t n;                   /**< Number of channels. */
+    uint16_t chans[RAW_BSMP_NSAMP]; /**< Indexes into b_samps. */
+    size_t packed_len;          /**< Length of packed. */
+    uint8_t packed[RAW_BSMP_NSAMP * 2]; /**< chans, as varints. */
+};
+
+/**
+ * Set up a channel list.
+ *
+ * @param chans Indexes into a board sample's b_samps, each less
+ *              than RAW_BSMP_NSAMP.
+ * @param n Length of chans, at most RAW_BSMP_NSAMP.
+ * @return 0 on success, -1 if chans isn't valid.
+ */
+int data_pbenc_chans_init(struct data_pbenc_chans *dchans,
+                          const uint16_t *chans, size_t n);
+
+/**
+ * Packed size of a DnodeSample holding some of a board sample's
+ * channels.
+ *
+ * This is what data_pbenc_bsmp_chans() will return.
+ */
+size_t data_pbenc_bsmp_chans_size(const struct raw_pkt_bsmp *bsmp,
+                                  const struct data_pbenc_chans *dchans);
+
+/**
+ * Pack a DnodeSample holding some of a board sample's channels.
+ *
+ * The BoardSample's samples are bsmp->b_samps[chans[0]], ...,
+ * bsmp->b_samps[chans[n - 1]], and its channels field is chans.
+ *
+ * @param out Output buffer; must have room for
+ *            data_pbenc_bsmp_chans_size(bsmp, dchans) bytes.
+ * @param bsmp Board sample, as for data_pbenc_bsmp().
+ * @param dchans Channels to pack; dchans->n must be nonzero.
+ * @param wire As for data_pbenc_bsmp().
+ * @return Number of bytes written.
+ */
+size_t data_pbenc_bsmp_chans(uint8_t *out, const struct raw_pkt_bsmp *bsmp,
+                             const struct data_pbenc_chans *dchans,
+                             int wire);
+
+/**
+ * Samples compressed with delta16_encode(), for data_pbenc_bsmp_delta().
+ */
+struct data_pbenc_delta {
+    const uint8_t *data;        /**< delta16_encode() output. */
+    size_t len;                 /**< Length of data. */
+    int has_ref;                /**< Nonzero unless data is a key frame. */
+    uint32_t ref;               /**< samp_idx of the reference samples. */
+};
+
+/**
+ * Packed size of a DnodeSample holding compressed board samples.
+ *
+ * This is what data_pbenc_bsmp_delta() will return.
+ */
+size_t data_pbenc_bsmp_delta_size(const struct raw_pkt_bsmp *bsmp,
+                                  const struct data_pbenc_chans *dchans,
+                                  const struct data_pbenc_delta *delta);
+
+/**
+ * Pack a DnodeSample holding compressed board samples.
+ *
+ * The BoardSample has samples_delta (and delta_ref, if delta->has_ref)
+ * instead of samples.
+ *
+ * @param out Output buffer; must have room for
+ *            data_pbenc_bsmp_delta_size(bsmp, dchans, delta) bytes.
+ * @param bsmp Board sample the samples came from; only its header
+ *             is used.
+ * @param dchans Channels the samples came from, or NULL (or an empty
+ *               list) if they're all there.
+ * @param delta The compressed samples.
+ * @return Number of bytes written.
+ */
+size_t data_pbenc_bsmp_delta(uint8_t *out, const struct raw_pkt_bsmp *bsmp,
+                             const struct data_pbenc_chans *dchans,
+                             const struct data_pbenc_delta *delta);
+
+/**
+ * Packed size of a DnodeSample holding a board subsample.
+ *
+ * This is what data_pbenc_bsub() will return.
+ */
+size_t data_pbenc_bsub_size(const struct raw_pkt_bsub *bsub);
+
+/**
+ * Pack a DnodeSample holding a board subsample.
+ *
+ * @param out Output buffer; must have room for
+ *            data_pbenc_bsub_size(bsub) bytes.
+ * @param bsub Board subsample, in host byte order.
+ * @return Number of bytes written.
+ */
+size_t data_pbenc_bsub(uint8_t *out, const struct raw_pkt_bsub *bsub);
+
+/**
+ * Per-channel summaries of a window of board samples, for
+ * data_pbenc_preview(); see preview16_finish().
+ */
+struct data_pbenc_preview {
+    uint64_t exp_cookie;
+    uint32_t board_id;
+    uint32_t chip_live;
+    uint32_t samp_idx;          /**< First board sample in the window. */
+    uint32_t nsamples;          /**< Board samples in the window. */
+    /** Channels summarized, or NULL (or an empty list) if they all
+     * are. */
+    const struct data_pbenc_chans *dchans;
+    size_t nchans;              /**< Length of each array below. */
+    const uint16_t *min;        /**< Host byte order, like the rest. */
+    const uint16_t *max;
+    const uint16_t *mean;
+    const uint16_t *rms;
+};
+
+/**
+ * Packed size of a DnodeSample holding a BoardPreview.
+ *
+ * This is what data_pbenc_preview() will return.
+ */
+size_t data_pbenc_preview_size(const struct data_pbenc_preview *pv);
+
+/**
+ * Pack a DnodeSample holding a BoardPreview.
+ *
+ * @param out Output buffer; must have room for
+ *            data_pbenc_preview_size(pv) bytes.
+ * @param pv The summaries.
+ * @return Number of bytes written.
+ */
+size_t data_pbenc_preview(uint8_t *out, const struct data_pbenc_preview *pv);
+
+/**
+ * Threshold crossings from one board sample, for data_pbenc_spikes();
+ * see spike16_ready().
+ */
+struct data_pbenc_spikes {
+    uint64_t exp_cookie;
+    uint32_t board_id;
+    uint32_t samp_idx;          /**< Board sample they crossed in. */
+    const uint16_t *chans;      /**< Board sample channel indexes. */
+    size_t n;                   /**< Length of chans; at most
+                                 * DATA_PBENC_SPIKES_MAX_EVENTS. */
+    /** n snippets of snippet_len samples each, in host byte order;
+     * ignored if snippet_len is 0. */
+    const uint16_t *snippets;
+    size_t snippet_len;         /**< At most SPIKE16_SNIPPET_MAX. */
+    unsigned snippet_pre;
+};
+
+/**
+ * Packed size of a DnodeSample holding a BoardSpikes.
+ *
+ * This is what data_pbenc_spikes() will return.
+ */
+size_t data_pbenc_spikes_size(const struct data_pbenc_spikes *sp);
+
+/**
+ * Pack a DnodeSample holding a BoardSpikes.
+ *
+ * @param out Output buffer; must have room for
+ *            data_pbenc_spikes_size(sp) bytes.
+ * @param sp The events.
+ * @return Number of bytes written.
+ */
+size_t data_pbenc_spikes(uint8_t *out, const struct data_pbenc_spikes *sp);
+
+/**
+ * Pack a DnodeSample of type GAP.
+ *
+ * @param out Output buffer; must have room for DATA_PBENC_GAP_MAX
+ *            bytes.
+ * @param nsamples Number of DnodeSamples missing.
+ * @return Number of bytes written.
+ */
+size_t data_pbenc_gap(uint8_t *out, uint32_t nsamples);
+
+#endif  /* _LIB_DATA_PBENC_H_ */
@@ -0,0 +1,251 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "delta16.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DELTA16_X86 1
+#include <immintrin.h>
+#else
+#define DELTA16_X86 0
+#endif
+
+typedef size_t (*delta16_fn)(uint8_t*, const uint16_t*, const uint16_t*,
+                             size_t);
+
+static inline uint16_t delta16_zigzag(uint16_t cur, uint16_t ref)
+{
+    int16_t d = (int16_t)(uint16_t)(cur - ref);
+    return (uint16_t)(((uint16_t)d << 1) ^ (uint16_t)(d >> 15));
+}
+
+static inline uint16_t delta16_unzigzag(uint16_t z)
+{
+    return (uint16_t)((z >> 1) ^ (uint16_t)-(z & 1));
+}
+
+static inline unsigned delta16_width(unsigned or_all)
+{
+    return or_all ? 32 - (unsigned)__builtin_clz(or_all) : 0;
+}
+
+static inline uint8_t* delta16_put_word(uint8_t *out, uint32_t word)
+{
+    out[0] = (uint8_t)word;
+    out[1] = (uint8_t)(word >> 8);
+    out[2] = (uint8_t)(word >> 16);
+    out[3] = (uint8_t)(word >> 24);
+    return out + 4;
+}
+
+static inline uint32_t delta16_get_word(const uint8_t *in)
+{
+    return ((uint32_t)in[0] | (uint32_t)in[1] << 8 |
+            (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24);
+}
+
+/* Encode one block of up to DELTA16_BLOCK values. */
+static uint8_t* delta16_block_scalar(uint8_t *out, const uint16_t *cur,
+                                     const uint16_t *ref, size_t n)
+{
+    uint16_t z[DELTA16_BLOCK];
+    unsigned or_all = 0;
+    for (size_t i = 0; i < DELTA16_BLOCK; i++) {
+        z[i] = i < n ? delta16_zigzag(cur[i], ref ? ref[i] : 0) : 0;
+        or_all |= z[i];
+    }
+    unsigned w = delta16_width(or_all);
+    *out++ = (uint8_t)w;
+    for (unsigned b = 0; b < w; b++) {
+        uint32_t word = 0;
+        for (size_t i = 0; i < DELTA16_BLOCK; i++) {
+            word |= (uint32_t)((z[i] >> b) & 1) << i;
+        }
+        out = delta16_put_word(out, word);
+    }
+    return out;
+}
+
+static size_t delta16_encode_scalar(uint8_t *out, const uint16_t *cur,
+                                    const uint16_t *ref, size_t n)
+{
+    uint8_t *start = out;
+    for (size_t i = 0; i < n; i += DELTA16_BLOCK) {
+        size_t left = n - i;
+        out = delta16_block_scalar(out, cur + i, ref ? ref + i : NULL,
+                                   left < DELTA16_BLOCK ? left :
+                                   DELTA16_BLOCK);
+    }
+    return (size_t)(out - start);
+}
+
+#if DELTA16_X86
+/* Compiled for AVX2 regardless of the build flags, and only ever
+ * called if the CPU has it. */
+
+__attribute__((target("avx2")))
+static size_t delta16_encode_avx2(uint8_t *out, const uint16_t *cur,
+                                  const uint16_t *ref, size_t n)
+{
+    uint8_t *start = out;
+    size_t i = 0;
+    for (; i + DELTA16_BLOCK <= n; i += DELTA16_BLOCK) {
+        __m256i c0 = _mm256_loadu_si256((const __m256i*)(cur + i));
+        __m256i c1 = _mm256_loadu_si256((const __m256i*)(cur + i + 16));
+        __m256i d0 = c0, d1 = c1;
+        if (ref) {
+            d0 = _mm256_sub_epi16(
+                c0, _mm256_loadu_si256((const __m256i*)(ref + i)));
+            d1 = _mm256_sub_epi16(
+                c1, _mm256_loadu_si256((const __m256i*)(ref + i + 16)));
+        }
+        __m256i z0 = _mm256_xor_si256(_mm256_slli_epi16(d0, 1),
+                                      _mm256_srai_epi16(d0, 15));
+        __m256i z1 = _mm256_xor_si256(_mm256_slli_epi16(d1, 1),
+                                      _mm256_srai_epi16(d1, 15));
+
+        /* OR everything together to find the width. */
+        __m256i o = _mm256_or_si256(z0, z1);
+        __m128i o128 = _mm_or_si128(_mm256_castsi256_si128(o),
+                                    _mm256_extracti128_si256(o, 1));
+        o128 = _mm_or_si128(o128, _mm_srli_si128(o128, 8));
+        o128 = _mm_or_si128(o128, _mm_srli_si128(o128, 4));
+        o128 = _mm_or_si128(o128, _mm_srli_si128(o128, 2));
+        unsigned w = delta16_width((unsigned)_mm_extract_epi16(o128, 0));
+        *out++ = (uint8_t)w;
+
+        /* For each bit plane, move that bit to the top of each
+         * value, narrow to bytes keeping the sign, and collect the
+         * signs. packs works within 128-bit lanes, so put the 64-bit
+         * quarters back in order before movemask. */
+        for (unsigned b = 0; b < w; b++) {
+            __m128i sh = _mm_cvtsi32_si128((int)(15 - b));
+            __m256i p = _mm256_packs_epi16(_mm256_sll_epi16(z0, sh),
+                                           _mm256_sll_epi16(z1, sh));
+            p = _mm256_permute4x64_epi64(p, 0xD8);
+            out = delta16_put_word(out,
+                                   (uint32_t)_mm256_movemask_epi8(p));
+        }
+    }
+    /* Avoid AVX-SSE transition penalties in whatever runs next. */
+    _mm256_zeroupper();
+    if (i < n) {
+        out = delta16_block_scalar(out, cur + i, ref ? ref + i : NULL,
+                                   n - i);
+    }
+    return (size_t)(out - start);
+}
+#endif  /* DELTA16_X86 */
+
+int delta16_decode(uint16_t *cur, const uint8_t *in, size_t len,
+                   const uint16_t *ref, size_t n)
+{
+    const uint8_t *end = in + len;
+    for (size_t i = 0; i < n; i += DELTA16_BLOCK) {
+        uint16_t z[DELTA16_BLOCK];
+        if (in == end) {
+            return -1;
+        }
+        unsigned w = *in++;
+        if (w > 16 || (size_t)(end - in) < w * 4) {
+            return -1;
+        }
+        memset(z, 0, sizeof(z));
+        for (unsigned b = 0; b < w; b++) {
+            uint32_t word = delta16_get_word(in);
+            in += 4;
+            for (size_t j = 0; j < DELTA16_BLOCK; j++) {
+                z[j] |= (uint16_t)(((word >> j) & 1) << b);
+            }
+        }
+        size_t left = n - i;
+        size_t bn = left < DELTA16_BLOCK ? left : DELTA16_BLOCK;
+        for (size_t j = 0; j < bn; j++) {
+            uint16_t r = ref ? ref[i + j] : 0;
+            cur[i + j] = (uint16_t)(r + delta16_unzigzag(z[j]));
+        }
+    }
+    return in == end ? 0 : -1;
+}
+
+static delta16_fn delta16_lookup(enum delta16_impl impl)
+{
+    switch (impl) {
+    case DELTA16_AUTO:
+#if DELTA16_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return delta16_encode_avx2;
+        }
+#endif
+        return delta16_encode_scalar;
+    case DELTA16_SCALAR:
+        return delta16_encode_scalar;
+#if DELTA16_X86
+    case DELTA16_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? delta16_encode_avx2 : NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static size_t delta16_first(uint8_t*, const uint16_t*, const uint16_t*,
+                            size_t);
+
+/* Atomic, so threads racing through the first call are harmless. */
+static delta16_fn delta16_impl_fn = delta16_first;
+
+static size_t delta16_first(uint8_t *out, const uint16_t *cur,
+                            const uint16_t *ref, size_t n)
+{
+    delta16_fn fn = delta16_lookup(DELTA16_AUTO);
+    __atomic_store_n(&delta16_impl_fn, fn, __ATOMIC_RELAXED);
+    return fn(out, cur, ref, n);
+}
+
+size_t delta16_encode(uint8_t *out, const uint16_t *cur,
+                      const uint16_t *ref, size_t n)
+{
+    return __atomic_load_n(&delta16_impl_fn, __ATOMIC_RELAXED)(out, cur,
+                                                               ref, n);
+}
+
+int delta16_use(enum delta16_impl impl)
+{
+    delta16_fn fn = delta16_lookup(impl);
+    if (!fn) {
+        return -1;
+    }
+    __atomic_store_n(&delta16_impl_fn, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+const char* delta16_impl_str(void)
+{
+    delta16_fn fn = __atomic_load_n(&delta16_impl_fn, __ATOMIC_RELAXED);
+    if (fn == delta16_first) {
+        fn = delta16_lookup(DELTA16_AUTO);
+    }
+#if DELTA16_X86
+    if (fn == delta16_encode_avx2) {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
@@ -0,0 +1,99 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   delta16.h
+ * @brief  Lossless delta compression of 16-bit sample arrays
+ *
+ * This is the BoardSample.samples_delta encoding (see
+ * proto/data.proto). Each value is stored as its difference from the
+ * same channel in a reference array (usually the previous sample),
+ * modulo 2^16, zigzag encoded so small differences either way are
+ * small numbers.
+ *
+ * Values are grouped into blocks of DELTA16_BLOCK. Each block is one
+ * byte giving a bit width w (0 to 16), then w little-endian 32-bit
+ * words. Word b holds bit b of every zigzagged difference in the
+ * block: bit i of it is from the block's value i. The last block is
+ * padded with zero differences. This "bit plane" layout packs and
+ * unpacks a whole block per instruction or two with SIMD.
+ *
+ * The encoder uses AVX2 if the CPU we're running on has it, chosen at
+ * run time like bswap16_buf(). The decoder is scalar; it's for
+ * clients (see libsng), and keeps up with a board easily.
+ */
+
+#ifndef _LIB_DELTA16_H_
+#define _LIB_DELTA16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Number of values per block. */
+#define DELTA16_BLOCK 32
+
+/** Longest possible delta16_encode() result for n values. */
+#define DELTA16_MAX_LEN(n) \
+    (((n) + DELTA16_BLOCK - 1) / DELTA16_BLOCK * (1 + 16 * 4))
+
+/** Implementations of delta16_encode(). */
+enum delta16_impl {
+    DELTA16_AUTO = 0,           /**< Best one the CPU supports */
+    DELTA16_SCALAR,
+    DELTA16_AVX2,
+};
+
+/**
+ * Encode n values as differences from a reference.
+ *
+ * @param out Where to put the result; must have room for
+ *            DELTA16_MAX_LEN(n) bytes. No alignment needed.
+ * @param cur Values to encode.
+ * @param ref Reference values, or NULL for all zeroes (i.e., a "key
+ *            frame", which needs nothing else to decode).
+ * @param n Number of values.
+ * @return Number of bytes written.
+ */
+size_t delta16_encode(uint8_t *out, const uint16_t *cur,
+                      const uint16_t *ref, size_t n);
+
+/**
+ * Decode a delta16_encode() result.
+ *
+ * @param cur Where to put the n decoded values. This may be the same
+ *            as ref, to update it in place.
+ * @param in Encoded values.
+ * @param len Length of in.
+ * @param ref The reference values they were encoded against, or
+ *            NULL if that was all zeroes.
+ * @param n Number of values.
+ * @return 0 on success, -1 if in isn't a valid encoding of n values.
+ */
+int delta16_decode(uint16_t *cur, const uint8_t *in, size_t len,
+                   const uint16_t *ref, size_t n);
+
+/**
+ * Choose the delta16_encode() implementation, e.g. for testing.
+ *
+ * They all give the same results.
+ *
+ * @return 0 on success, -1 if this CPU (or build) doesn't support it.
+ */
+int delta16_use(enum delta16_impl impl);
+
+/** Name of the delta16_encode() implementation in use. */
+const char* delta16_impl_str(void);
+
+#endif  /* _LIB_DELTA16_H_ */
@@ -22,13 +22,19 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <hdf5.h>
 
+#include "biquad16.h"
+#include "bsmp_split.h"
+#include "bswap16.h"
 #include "logging.h"
+#include "safe_pthread.h"
 #include "type_attrs.h"
 #include "ch_storage.h"
 #include "raw_packets.h"
@@ -43,8 +49,25 @@
                                // bounded presently by sample.c, which
                                // uses nsamps=150000.
 /* This should be sized to be at least as large as the largest expected write.
- * This is the channel_data dataset, which uses CHUNK_DIM * 1024 * 2. */
+ * This is the channel_data dataset, which uses CHUNK_DIM * 1024 * 2.
+ * Chunks only go through the cache when HDF5_DIRECT_CHUNK is 0. */
 #define CHUNK_CACHE_SIZE (CHUNK_DIM * 1024 * sizeof(raw_samp_t))
+/* Start file objects (i.e. chunks) at least this big on multiples of
+ * FILE_ALIGN bytes, so chunk writes don't straddle RAID stripes or
+ * file system blocks. Channel and aux data chunks are over this;
+ * sample index and chip live chunks aren't worth padding out. */
+#define FILE_ALIGN_THRESHOLD (1024 * 1024)
+#define FILE_ALIGN           (1024 * 1024)
+
+/* Write whole chunks with H5Dwrite_chunk(), which skips hyperslab
+ * selection, the chunk cache, and the filter pipeline. Older HDF5s
+ * only have H5DOwrite_chunk(), in the high-level library, so they
+ * get H5Dwrite() instead. */
+#if H5_VERSION_GE(1, 10, 3)
+#define HDF5_DIRECT_CHUNK 1
+#else
+#define HDF5_DIRECT_CHUNK 0
+#endif
 
 static int hdf5_ch_open(struct ch_storage *chns, unsigned flags);
 static int hdf5_ch_close(struct ch_storage *chns);
@@ -120,51 +143,89 @@ static const struct exp_attr_info exp_attr_info[] = {
 #define H5_DSET_CHANNEL_DATA  1
 #define H5_DSET_AUX_DATA      2
 #define H5_DSET_CHIP_LIVE     3
-#define H5_DSET_MAX           4
+#define H5_DSET_CHANNEL_DATA_FILTERED 4 /* only with a filter */
+#define H5_DSET_MAX           5
 
 struct dset_info {
     size_t size;               // Size of each element in raw_pkt_bsmp
-    size_t offset;             // offset of element in raw_pkt_bsmp
     size_t nelems;             // number of elements per raw_pkt_bsmp
     hsize_t rank;              // Dimensional rank of the dataset, must be either 1 or 2
+    int samps;                 // Part of b_samps; see CH_STORAGE_WIRE_ORDER
     const char *name;
 };
 
 struct dset {
     hid_t dset;
     hid_t dspace;
-    void *buf;                 // Buffer to hold contiguous elements
+};
+
+/*
+ * Board samples are split into a stage, one buffer per dataset, which
+ * holds exactly one chunk of each dataset, laid out the way HDF5
+ * stores it. Once a stage is full, it's handed to the writer thread,
+ * which writes it out while the next stage fills up. That way, the
+ * copying and HDF5's writing happen at the same time.
+ *
+ * A stage that isn't full yet stays put when it's flushed: its rows
+ * are written out, and the rest of the chunk gets written (again)
+ * when it fills up. So stages always start on a chunk boundary.
+ */
+struct h5_stage {
+    void *bufs[H5_DSET_MAX];   /* Contiguous elements, CHUNK_DIM rows */
+    hsize_t off;               /* Dataset offset of the first row */
+    size_t nsamps;             /* Rows filled so far */
+    size_t nwritten;           /* Rows already in the file */
+};
+
+/* The writer thread. Fields are protected by mtx. */
+struct h5_writer {
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;          /* Signaled when any field changes */
+    pthread_t thread;
+    int running;                /* thread has been started */
+    int exit;                   /* thread should exit when idle */
+    int err;                    /* a write failed; sticky until open */
+    struct h5_ch_data *data;    /* whose stages these are */
+    struct h5_stage *pending;   /* stage to write, or NULL if idle */
+    struct hdf5_ch_stats stats;
 };
 
 static const struct dset_info dset_info[] = {
     [H5_DSET_SAMPLE_INDEX] = {
         .size = FIELD_SZ(struct raw_pkt_bsmp, b_sidx),
-        .offset = offsetof(struct raw_pkt_bsmp, b_sidx),
         .nelems = 1,
         .name = "sample_index",
         .rank = 1
     },
     [H5_DSET_CHANNEL_DATA] = {
         .size = sizeof(raw_samp_t),
-        .offset = offsetof(struct raw_pkt_bsmp, b_samps),
         .nelems = 1024, // XXX
         .name = "channel_data",
         .rank = 2,
+        .samps = 1,
     },
     [H5_DSET_AUX_DATA] = {
         .size = sizeof(uint16_t),
-        .offset = offsetof(struct raw_pkt_bsmp, b_samps) + (1024 * sizeof(raw_samp_t)),
         .nelems = 96, // XXX
         .name = "aux_data",
         .rank = 2,
+        .samps = 1,
     },
     [H5_DSET_CHIP_LIVE] = {
         .size = FIELD_SZ(struct raw_pkt_bsmp, b_chip_live),
-        .offset = offsetof(struct raw_pkt_bsmp, b_chip_live),
         .nelems = 1,
         .name = "chip_live",
         .rank = 1,
     },
+    /* Filtered copy of channel_data; see hdf5_filter(). Always in
+     * host byte order, since we have to swap the samples to filter
+     * them anyway. */
+    [H5_DSET_CHANNEL_DATA_FILTERED] = {
+        .size = sizeof(raw_samp_t),
+        .nelems = 1024, // XXX
+        .name = "channel_data_filtered",
+        .rank = 2,
+    },
 };
 
 struct h5_ch_data {
@@ -172,7 +233,13 @@ struct h5_ch_data {
     hid_t h5_file;              /* HDF5 file type */
     hsize_t h5_dset_off;        /* current dataset write offset */
     hsize_t h5_dset_size;       /* current dataset size */
+    int h5_wire_order;          /* samples are big-endian */
+    struct biquad16 *h5_filter; /* for channel_data_filtered, or NULL */
+    size_t h5_ndsets;           /* dsets in use */
     struct dset dsets[H5_DSET_MAX];
+    struct h5_stage h5_stages[2];
+    unsigned h5_fill;           /* index of the stage being filled */
+    struct h5_writer *h5_wr;    /* writes the other one */
 
     hid_t h5_attr_dspace;       /* attribute data space */
     hid_t h5_attrs[H5_NATTRS];  /* dataset-wide attributes (see H5_ATTR_*) */
@@ -204,11 +271,15 @@ static void h5_ch_data_init(struct h5_ch_data *data, const char *dset_name)
     for (size_t i = 0; i < H5_DSET_MAX; i++) {
         data->dsets[i].dset = -1;
         data->dsets[i].dspace = -1;
-        data->dsets[i].buf = NULL;
     }
+    memset(data->h5_stages, 0, sizeof(data->h5_stages));
+    data->h5_fill = 0;
 
     data->h5_dset_off = 0;
     data->h5_dset_size = 0;
+    data->h5_wire_order = 0;
+    data->h5_filter = NULL;
+    data->h5_ndsets = H5_DSET_CHANNEL_DATA_FILTERED;
     data->h5_attr_dspace = -1;
     for (size_t i = 0; i < H5_NATTRS; i++) {
         data->h5_attrs[i] = -1;
@@ -230,7 +301,7 @@ static int h5_ch_data_teardown(struct h5_ch_data *data)
         ret = -1;
     }
 
-    for (size_t i = 0; i < H5_DSET_MAX; i++) {
+    for (size_t i = 0; i < data->h5_ndsets; i++) {
         struct dset *dset = &data->dsets[i];
         const struct dset_info *dsinfo = &dset_info[i];
         /* Truncate dataset on close */
@@ -244,9 +315,12 @@ static int h5_ch_data_teardown(struct h5_ch_data *data)
         if (H5Sclose(dset->dspace) < 0) {
             ret = -1;
         }
-
-        free(data->dsets[i].buf);
-        data->dsets[i].buf = NULL;
+    }
+    for (size_t s = 0; s < 2; s++) {
+        for (size_t i = 0; i < H5_DSET_MAX; i++) {
+            free(data->h5_stages[s].bufs[i]);
+            data->h5_stages[s].bufs[i] = NULL;
+        }
     }
 
     if (data->h5_file >= 0 && H5Fclose(data->h5_file) < 0) {
@@ -270,32 +344,104 @@ struct ch_storage *hdf5_ch_storage_alloc(const char *out_file_path,
 {
     struct ch_storage *storage = malloc(sizeof(struct ch_storage));
     struct h5_ch_data *data = malloc(sizeof(struct h5_ch_data));
-    if (!storage || !data) {
-        free(storage);
-        free(data);
-        return NULL;
+    struct h5_writer *wr = malloc(sizeof(struct h5_writer));
+    int mtx_en = -1, cv_en = -1;
+    if (!storage || !data || !wr) {
+        goto fail;
+    }
+    memset(wr, 0, sizeof(*wr));
+    mtx_en = pthread_mutex_init(&wr->mtx, NULL);
+    if (mtx_en) {
+        goto fail;
+    }
+    cv_en = pthread_cond_init(&wr->cv, NULL);
+    if (cv_en) {
+        goto fail;
     }
     if (!dataset_name) {
         dataset_name = "wired-dataset";
     }
     h5_ch_data_init(data, dataset_name);
+    data->h5_wr = wr;
     storage->ch_path = out_file_path;
     storage->ops = &hdf5_ch_storage_ops;
     storage->priv = data;
+    storage->ch_flags = 0;
     return storage;
+
+ fail:
+    if (!mtx_en) {
+        pthread_mutex_destroy(&wr->mtx);
+    }
+    free(storage);
+    free(data);
+    free(wr);
+    return NULL;
+}
+
+int hdf5_ch_storage_set_filter(struct ch_storage *chns, const float *sos,
+                               size_t nsections)
+{
+    struct h5_ch_data *data = h5_data(chns);
+    struct biquad16 *bq = data->h5_filter;
+    if (!bq) {
+        bq = malloc(sizeof(struct biquad16));
+        if (!bq) {
+            return -1;
+        }
+    }
+    if (biquad16_configure(bq, sos, nsections)) {
+        if (bq != data->h5_filter) {
+            free(bq);
+        }
+        return -1;
+    }
+    data->h5_filter = bq;
+    return 0;
+}
+
+void hdf5_ch_storage_get_stats(struct ch_storage *chns,
+                               struct hdf5_ch_stats *stats)
+{
+    struct h5_writer *wr = h5_data(chns)->h5_wr;
+    safe_p_mutex_lock(&wr->mtx);
+    *stats = wr->stats;
+    safe_p_mutex_unlock(&wr->mtx);
 }
 
 static void hdf5_ch_free(struct ch_storage *chns)
 {
+    struct h5_writer *wr = h5_data(chns)->h5_wr;
+    assert(!wr->running);
+    pthread_mutex_destroy(&wr->mtx);
+    pthread_cond_destroy(&wr->cv);
+    free(wr);
+    free(h5_data(chns)->h5_filter);
     free(h5_data(chns));
     free(chns);
 }
 
+/* HDF5 type of a dataset's elements, both in memory and in the file.
+ *
+ * Samples that are still in network byte order get stored that way,
+ * with a big-endian type to say so. Readers convert them on the way
+ * out (h5py and friends do this automatically), which is cheaper than
+ * swapping them here at full sample rate. */
+static hid_t hdf5_dset_type(const struct h5_ch_data *data,
+                            const struct dset_info *dsinfo)
+{
+    if (dsinfo->samps && data->h5_wire_order) {
+        assert(dsinfo->size == sizeof(uint16_t));
+        return H5T_STD_U16BE;
+    }
+    return SIZE_TO_H5_UTYPE(dsinfo->size);
+}
+
 static int hdf5_create_dsets(struct h5_ch_data *data) {
     int rc = -1;
 
     /* Create the sample_index dataset */
-    for (size_t i = 0; i < H5_DSET_MAX; i++) {
+    for (size_t i = 0; i < data->h5_ndsets; i++) {
         const struct dset_info *dsinfo = &dset_info[i];
         hsize_t rank = dsinfo->rank;
 
@@ -309,7 +455,7 @@ static int hdf5_create_dsets(struct h5_ch_data *data) {
         hid_t dspace = H5Screate_simple(rank, cur_dim, max_dim);
         hid_t dset = H5Dcreate2(data->h5_file,
                                 dsinfo->name,
-                                SIZE_TO_H5_UTYPE(dsinfo->size),
+                                hdf5_dset_type(data, dsinfo),
                                 dspace,
                                 H5P_DEFAULT,
                                 cprops,
@@ -323,16 +469,16 @@ static int hdf5_create_dsets(struct h5_ch_data *data) {
         };
         H5Pclose(cprops);
 
-        void *buf = malloc(CHUNK_DIM_MAX * dsinfo->size * dsinfo->nelems);
-        if (!buf) {
-            H5Dclose(dset);
-            H5Sclose(dspace);
-            goto done;
-        };
-
         data->dsets[i].dset = dset;
         data->dsets[i].dspace = dspace;
-        data->dsets[i].buf = buf;
+
+        for (size_t s = 0; s < 2; s++) {
+            void *buf = malloc(CHUNK_DIM * dsinfo->size * dsinfo->nelems);
+            if (!buf) {
+                goto done;
+            }
+            data->h5_stages[s].bufs[i] = buf;
+        }
     };
 
     rc = 0;
@@ -340,48 +486,128 @@ done:
     return rc;
 }
 
-struct scatter_op_data {
-    const struct raw_pkt_bsmp *bsamps;
-    size_t scattered;                   // number of elements scattered, out of nsamps
-    const struct dset_info *dsinfo;
-};
+static uint64_t hdf5_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
 
-/**
- * @brief Scatter callback. Progressively fill up src_buf with board sample
- * data until we've filled up nsamps of data. Will get called repeatedly until
- * buffer is filled.
- *
- * This fills an intermediate buffer allocated for each dataset so that we can
- * do a single contiguous hyperslab write.
- * @param src_buf (out) buffer to fill
- * @param src_buf_bytes_used (out) number of bytes filled
- * @param op_data (in) callback context
- */
-static herr_t hdf5_scatter(const void **src_buf,
-                           size_t *src_buf_bytes_used,
-                           void *op_data) {
-    struct scatter_op_data *args = (struct scatter_op_data*)op_data;
-    const struct dset_info *dsinfo = args->dsinfo;
+/* Fill out rows [start, start + nsamps) of the stage's
+ * channel_data_filtered buffer by filtering its channel_data ones,
+ * which hdf5_split() has filled out. */
+static void hdf5_filter(struct h5_ch_data *data, struct h5_stage *stage,
+                        size_t start, size_t nsamps)
+{
+    const size_t nelems = dset_info[H5_DSET_CHANNEL_DATA_FILTERED].nelems;
+    const raw_samp_t *in = stage->bufs[H5_DSET_CHANNEL_DATA];
+    raw_samp_t *out = stage->bufs[H5_DSET_CHANNEL_DATA_FILTERED];
+    raw_samp_t host[RAW_BSMP_NSAMP];
+    for (size_t i = start; i < start + nsamps; i++) {
+        const raw_samp_t *samps = in + i * nelems;
+        if (data->h5_wire_order) {
+            bswap16_buf(host, samps, nelems);
+            samps = host;
+        }
+        biquad16_run(data->h5_filter, out + i * nelems, samps);
+    }
+}
 
-    /* First time through */
-    if (*src_buf_bytes_used == 0) {
-        args->scattered = 0;
+/* Add bsamps to the end of each of the stage's buffers, in one pass
+ * over them. */
+static void hdf5_split(struct h5_ch_data *data, struct h5_stage *stage,
+                       const struct raw_pkt_bsmp *bsamps, size_t nsamps)
+{
+    struct h5_writer *wr = data->h5_wr;
+    void **bufs = stage->bufs;
+    const size_t row = stage->nsamps;
+    const struct bsmp_split_cols cols = {
+        .sidx = (uint32_t*)bufs[H5_DSET_SAMPLE_INDEX] + row,
+        .chip_live = (uint32_t*)bufs[H5_DSET_CHIP_LIVE] + row,
+        .chans = ((raw_samp_t*)bufs[H5_DSET_CHANNEL_DATA] +
+                  row * dset_info[H5_DSET_CHANNEL_DATA].nelems),
+        .nchans = dset_info[H5_DSET_CHANNEL_DATA].nelems,
+        .aux = ((raw_samp_t*)bufs[H5_DSET_AUX_DATA] +
+                row * dset_info[H5_DSET_AUX_DATA].nelems),
+    };
+    assert(cols.nchans + dset_info[H5_DSET_AUX_DATA].nelems ==
+           RAW_BSMP_NSAMP);
+    assert(row + nsamps <= CHUNK_DIM);
+
+    uint64_t t0 = hdf5_now_ns();
+    bsmp_split(&cols, bsamps, nsamps);
+    uint64_t t1 = hdf5_now_ns(), t2 = t1;
+    if (data->h5_ndsets > H5_DSET_CHANNEL_DATA_FILTERED) {
+        hdf5_filter(data, stage, row, nsamps);
+        t2 = hdf5_now_ns();
     }
+    stage->nsamps += nsamps;
 
-    size_t count = dsinfo->size * dsinfo->nelems;
-    *src_buf = ((unsigned char*)&args->bsamps[args->scattered++] + dsinfo->offset);
-    *src_buf_bytes_used = count;
+    safe_p_mutex_lock(&wr->mtx);
+    wr->stats.split_ns += t1 - t0;
+    wr->stats.filter_ns += t2 - t1;
+    safe_p_mutex_unlock(&wr->mtx);
+}
 
-    return 0;
-};
+/* Increase the size of the dataset to make room for more samples. */
+static herr_t hdf5_extend(struct h5_ch_data *data, hsize_t minsize)
+{
+    int ret = 0;
+    hsize_t newsize;
+    if (data->h5_dset_size) {
+        newsize = (double)data->h5_dset_size * DSET_EXTEND_FACTOR + 0.5;
+    } else {
+        newsize = 1;
+    }
+    if (newsize < minsize) {
+        newsize = minsize;
+    }
 
-static int hdf5_write_dsets(struct h5_ch_data* data,
-                       const struct raw_pkt_bsmp *bsamps,
-                       size_t nsamps) {
+    for (size_t i = 0; i < data->h5_ndsets; i++) {
+        const struct dset_info *dsinfo = &dset_info[i];
+        hsize_t size[] = { newsize, dsinfo->nelems };
+        ret = H5Dset_extent(data->dsets[i].dset, size);
+        if (ret < 0) {
+            return -1;
+        };
+    }
+
+    data->h5_dset_size = newsize;
+    return ret;
+}
+
+#if HDF5_DIRECT_CHUNK
+/* Write a stage's buffers as its chunk of each dataset. Rows past
+ * the ones it's filled are zeroed; they're past the end of the
+ * dataset, unless they get filled and written again later. */
+static int hdf5_write_chunk(struct h5_ch_data *data, struct h5_stage *stage)
+{
+    const hsize_t offset[] = { stage->off, 0 };
+    assert(stage->off % CHUNK_DIM == 0);
+    for (size_t i = 0; i < data->h5_ndsets; i++) {
+        const struct dset_info *dsinfo = &dset_info[i];
+        const size_t row = dsinfo->size * dsinfo->nelems;
+        char *buf = stage->bufs[i];
+        memset(buf + stage->nsamps * row, 0,
+               (CHUNK_DIM - stage->nsamps) * row);
+        if (H5Dwrite_chunk(data->dsets[i].dset, H5P_DEFAULT, 0, offset,
+                           CHUNK_DIM * row, buf) < 0) {
+            log_ERR("failed to write chunk of dset '%s'", dsinfo->name);
+            return -1;
+        }
+    }
+    return 0;
+}
+#else
+/* Write the rows of a stage that aren't in the file yet. */
+static int hdf5_write_rows(struct h5_ch_data *data, struct h5_stage *stage)
+{
     int rc = -1;
     hid_t filespace = -1;
+    const size_t start = stage->nwritten;
+    const size_t nsamps = stage->nsamps - start;
 
-    for (size_t i = 0; i < H5_DSET_MAX; i++) {
+    for (size_t i = 0; i < data->h5_ndsets; i++) {
         const struct dset_info *dsinfo = &dset_info[i];
         struct dset *dset = &data->dsets[i];
         hsize_t count[] = { nsamps, dsinfo->nelems };
@@ -400,7 +626,7 @@ static int hdf5_write_dsets(struct h5_ch_data* data,
         }
 
         /* Create a count-sized selection */
-        hsize_t offset[] = { data->h5_dset_off, 0 };
+        hsize_t offset[] = { stage->off + start, 0 };
         rc = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset,
                                  NULL, count, NULL);
         if (rc < 0) {
@@ -410,23 +636,17 @@ static int hdf5_write_dsets(struct h5_ch_data* data,
             goto fail;
         }
 
-        /* Scatter bsamp data into the selection  */
-        struct scatter_op_data args;
-        args.bsamps = bsamps;
-        args.dsinfo = dsinfo;
-
-        H5Dscatter(hdf5_scatter, &args, SIZE_TO_H5_UTYPE(dsinfo->size),
-                   memspace, dset->buf);
-
-        rc = H5Dwrite(dset->dset, SIZE_TO_H5_UTYPE(dsinfo->size),
+        hid_t mtype = hdf5_dset_type(data, dsinfo);
+        const char *buf = stage->bufs[i];
+        rc = H5Dwrite(dset->dset, mtype,
                       memspace, filespace, H5P_DEFAULT,
-                      dset->buf);
-        if (rc < 0) {
-            log_ERR("failed to write h5dwriteee");
-        }
-
+                      buf + start * dsinfo->size * dsinfo->nelems);
         H5Sclose(filespace);
         H5Sclose(memspace);
+        if (rc < 0) {
+            log_ERR("failed to write dset '%s'", dsinfo->name);
+            goto fail;
+        }
     }
 
     rc = 0; // success!
@@ -436,6 +656,176 @@ fail:
     }
     return rc;
 }
+#endif
+
+/* Write a stage to its place in each dataset. */
+static int hdf5_write_stage(struct h5_ch_data *data, struct h5_stage *stage)
+{
+    /* If we're getting more board samples than will fit, we need to
+     * extend the dataset. */
+    hsize_t next_offset = stage->off + stage->nsamps;
+    if (next_offset >= data->h5_dset_size) {
+        if (hdf5_extend(data, next_offset) < 0) {
+            log_ERR("Can't increase space allocated for HDF5 dataset");
+            return -1;
+        }
+    }
+#if HDF5_DIRECT_CHUNK
+    int ret = hdf5_write_chunk(data, stage);
+#else
+    int ret = hdf5_write_rows(data, stage);
+#endif
+    if (!ret) {
+        stage->nwritten = stage->nsamps;
+    }
+    return ret;
+}
+
+/* hdf5_write_stage(), keeping track of how long it takes. Call
+ * without wr->mtx held. */
+static int hdf5_write_stage_timed(struct h5_writer *wr,
+                                  struct h5_ch_data *data,
+                                  struct h5_stage *stage)
+{
+    size_t fresh = stage->nsamps - stage->nwritten;
+    uint64_t start = hdf5_now_ns();
+    int err = hdf5_write_stage(data, stage);
+    uint64_t end = hdf5_now_ns();
+    safe_p_mutex_lock(&wr->mtx);
+    if (err) {
+        wr->err = 1;
+    } else {
+        wr->stats.nsamps += fresh;
+    }
+    wr->stats.write_ns += end - start;
+    wr->stats.nwrites++;
+    safe_p_mutex_unlock(&wr->mtx);
+    return err;
+}
+
+/*
+ * Writer thread
+ *
+ * The caller's thread splits board samples into one stage while this
+ * one writes the other. Only one thread makes HDF5 calls at a time:
+ * the caller's thread doesn't call into HDF5 again until it has waited
+ * for the writer to go idle (see hdf5_writer_wait()).
+ */
+
+static void* hdf5_writer_main(void *wrvp)
+{
+    struct h5_writer *wr = wrvp;
+    safe_p_mutex_lock(&wr->mtx);
+    while (1) {
+        while (!wr->pending && !wr->exit) {
+            safe_p_cond_wait(&wr->cv, &wr->mtx);
+        }
+        struct h5_stage *stage = wr->pending;
+        if (!stage) {
+            break;
+        }
+        safe_p_mutex_unlock(&wr->mtx);
+        hdf5_write_stage_timed(wr, wr->data, stage);
+        safe_p_mutex_lock(&wr->mtx);
+        wr->pending = NULL;
+        safe_p_cond_broadcast(&wr->cv);
+    }
+    safe_p_mutex_unlock(&wr->mtx);
+    return NULL;
+}
+
+/* Wait for the writer to finish whatever it's writing. Returns -1 if
+ * any write has failed since the file was opened, 0 otherwise. */
+static int hdf5_writer_wait(struct h5_writer *wr)
+{
+    safe_p_mutex_lock(&wr->mtx);
+    if (wr->pending) {
+        uint64_t start = hdf5_now_ns();
+        while (wr->pending) {
+            safe_p_cond_wait(&wr->cv, &wr->mtx);
+        }
+        wr->stats.stall_ns += hdf5_now_ns() - start;
+    }
+    int ret = wr->err ? -1 : 0;
+    safe_p_mutex_unlock(&wr->mtx);
+    return ret;
+}
+
+/* Hand the (full) stage being filled to the writer, and start filling
+ * the other one where it leaves off. */
+static int hdf5_writer_hand_off(struct h5_ch_data *data)
+{
+    struct h5_writer *wr = data->h5_wr;
+    struct h5_stage *stage = &data->h5_stages[data->h5_fill];
+    assert(stage->nsamps == CHUNK_DIM);
+    if (hdf5_writer_wait(wr)) {
+        return -1;
+    }
+    safe_p_mutex_lock(&wr->mtx);
+    wr->pending = stage;
+    safe_p_cond_signal(&wr->cv);
+    safe_p_mutex_unlock(&wr->mtx);
+
+    data->h5_fill ^= 1;
+    struct h5_stage *next = &data->h5_stages[data->h5_fill];
+    next->off = stage->off + stage->nsamps;
+    next->nsamps = 0;
+    next->nwritten = 0;
+    return 0;
+}
+
+/* Write out everything that's been staged. The writer finishes the
+ * stage it has, if any, and we write the one that's filling up
+ * ourselves, since the writer is idle by then. */
+static int hdf5_writer_flush(struct h5_ch_data *data)
+{
+    struct h5_writer *wr = data->h5_wr;
+    struct h5_stage *stage = &data->h5_stages[data->h5_fill];
+    if (hdf5_writer_wait(wr)) {
+        return -1;
+    }
+    if (stage->nsamps == stage->nwritten) {
+        return 0;
+    }
+    return hdf5_write_stage_timed(wr, data, stage);
+}
+
+static int hdf5_writer_start(struct h5_writer *wr, struct h5_ch_data *data)
+{
+    wr->exit = 0;
+    wr->err = 0;
+    wr->data = data;
+    wr->pending = NULL;
+    memset(&wr->stats, 0, sizeof(wr->stats));
+    if (pthread_create(&wr->thread, NULL, hdf5_writer_main, wr)) {
+        return -1;
+    }
+    wr->running = 1;
+    return 0;
+}
+
+static void hdf5_writer_stop(struct h5_writer *wr)
+{
+    if (!wr->running) {
+        return;
+    }
+    safe_p_mutex_lock(&wr->mtx);
+    wr->exit = 1;
+    safe_p_cond_signal(&wr->cv);
+    safe_p_mutex_unlock(&wr->mtx);
+    safe_p_join(wr->thread, NULL);
+    wr->running = 0;
+
+    const struct hdf5_ch_stats *st = &wr->stats;
+    double per = st->nsamps ? 1e-3 / (double)st->nsamps : 0.0;
+    log_INFO("HDF5: %llu samples in %llu writes; per sample: "
+             "split %.3f us, filter %.3f us, write %.3f us, "
+             "stalled %.3f us",
+             (unsigned long long)st->nsamps,
+             (unsigned long long)st->nwrites,
+             (double)st->split_ns * per, (double)st->filter_ns * per,
+             (double)st->write_ns * per, (double)st->stall_ns * per);
+}
 
 /* Add attributes for experiment-wide packet fields */
 static hid_t hdf5_create_attrs(struct h5_ch_data *data)
@@ -496,6 +886,14 @@ static int hdf5_ch_open(struct ch_storage *chns, unsigned flags)
 {
     struct h5_ch_data tmp;
     h5_ch_data_init(&tmp, h5_data(chns)->dset_name); /* initialize defaults */
+    tmp.h5_wire_order = !!(chns->ch_flags & CH_STORAGE_WIRE_ORDER);
+    tmp.h5_filter = h5_data(chns)->h5_filter;
+    tmp.h5_wr = h5_data(chns)->h5_wr;
+    if (tmp.h5_filter) {
+        tmp.h5_ndsets = H5_DSET_MAX;
+        biquad16_restart(tmp.h5_filter,
+                         dset_info[H5_DSET_CHANNEL_DATA_FILTERED].nelems);
+    }
 
     /* Set chunk cache to be at least as large as our largest expected write.
      * This is the channel_data dataset, which uses CHUNK_DIM * 1024 * 2
@@ -511,6 +909,7 @@ static int hdf5_ch_open(struct ch_storage *chns, unsigned flags)
                                        // recommended prime.
                  CHUNK_CACHE_SIZE,     // rdcc_nbytes: total size of the raw data chunk cache in bytes
                  1);                   // always preempt when full
+    H5Pset_alignment(fapl, FILE_ALIGN_THRESHOLD, FILE_ALIGN);
     tmp.h5_file = H5Fcreate(chns->ch_path, flags, H5P_DEFAULT, fapl);
     if (tmp.h5_file < 0) {
         goto fail;
@@ -523,6 +922,13 @@ static int hdf5_ch_open(struct ch_storage *chns, unsigned flags)
     if (hdf5_create_attrs(&tmp) < 0) {
         goto fail;
     }
+
+    /* The writer doesn't look at its data until the first stage is
+     * handed off, by which time tmp has been copied there. */
+    if (hdf5_writer_start(tmp.h5_wr, h5_data(chns)) < 0) {
+        log_ERR("can't start HDF5 writer thread");
+        goto fail;
+    }
     memcpy(h5_data(chns), &tmp, sizeof(tmp)); /* Success! */
 
     H5Pclose(fapl);
@@ -544,12 +950,26 @@ static int hdf5_ch_open(struct ch_storage *chns, unsigned flags)
 
 static int hdf5_ch_close(struct ch_storage *chns)
 {
-    return h5_ch_data_teardown(h5_data(chns));
+    struct h5_ch_data *data = h5_data(chns);
+    int ret = 0;
+    if (data->h5_wr->running && hdf5_writer_flush(data)) {
+        log_ERR("Failed to write staged samples");
+        ret = -1;
+    }
+    hdf5_writer_stop(data->h5_wr);
+    if (h5_ch_data_teardown(data)) {
+        ret = -1;
+    }
+    return ret;
 }
 
 static int hdf5_ch_datasync(struct ch_storage *chns)
 {
-    return H5Fflush(h5_data(chns)->h5_file, H5F_SCOPE_LOCAL);
+    struct h5_ch_data *data = h5_data(chns);
+    if (hdf5_writer_flush(data)) {
+        return -1;
+    }
+    return H5Fflush(data->h5_file, H5F_SCOPE_LOCAL);
 }
 
 /* Initialize dataset attributes that require a board sample to fill in. */
@@ -580,33 +1000,6 @@ static void hdf5_init_exp_attrs(struct ch_storage *chns,
     }
 }
 
-/* Increase the size of the dataset to make room for more samples. */
-static herr_t hdf5_extend(struct h5_ch_data *data, hsize_t minsize)
-{
-    int ret;
-    hsize_t newsize;
-    if (data->h5_dset_size) {
-        newsize = (double)data->h5_dset_size * DSET_EXTEND_FACTOR + 0.5;
-    } else {
-        newsize = 1;
-    }
-    if (newsize < minsize) {
-        newsize = minsize;
-    }
-
-    for (size_t i = 0; i < H5_DSET_MAX; i++) {
-        const struct dset_info *dsinfo = &dset_info[i];
-        hsize_t size[] = { newsize, dsinfo->nelems };
-        ret = H5Dset_extent(data->dsets[i].dset, size);
-        if (ret < 0) {
-            return -1;
-        };
-    }
-
-    data->h5_dset_size = newsize;
-    return ret;
-}
-
 static int hdf5_ch_write(struct ch_storage *chns,
                          const struct raw_pkt_bsmp *bsamps,
                          size_t nsamps)
@@ -631,24 +1024,20 @@ static int hdf5_ch_write(struct ch_storage *chns,
     /* Sanity-check that we're not getting packets from a different board. */
     assert(bsamps[0].b_id == data->h5_debug_board_id);
 
-    /* If we're getting more board samples than will fit, we need to
-     * extend the dataset. */
-    hsize_t next_offset = data->h5_dset_off + nsamps;
-    if (next_offset >= data->h5_dset_size) {
-        if (hdf5_extend(data, next_offset) < 0) {
-            log_ERR("Can't increase space allocated for HDF5 dataset");
+    /* Stage the samples, handing each stage to the writer once it
+     * has a whole chunk. Whatever's left over waits for the next
+     * write, or for hdf5_writer_flush(). */
+    while (nsamps) {
+        struct h5_stage *stage = &data->h5_stages[data->h5_fill];
+        size_t room = CHUNK_DIM - stage->nsamps;
+        size_t n = nsamps < room ? nsamps : room;
+        hdf5_split(data, stage, bsamps, n);
+        if (n == room && hdf5_writer_hand_off(data)) {
             return -1;
         }
+        data->h5_dset_off += n;
+        bsamps += n;
+        nsamps -= n;
     }
-
-    /* Write datasets */
-    int ret = hdf5_write_dsets(data, bsamps, nsamps);
-    if (ret < 0) {
-        goto fail;
-    };
-
-    data->h5_dset_off = next_offset;
-    ret = 0;
-fail:
-     return ret;
+    return 0;
 }
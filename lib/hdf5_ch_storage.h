@@ -22,12 +22,41 @@
 #ifndef _LIB_HDF5_CHANNEL_STORAGE_H_
 #define _LIB_HDF5_CHANNEL_STORAGE_H_
 
+#include <stdint.h>
+
 #include <hdf5.h>
 
 struct ch_storage;
 
+/* Where the time goes while storing board samples. Splitting and
+ * filtering happen on the thread calling ch_storage_write(), while a
+ * writer thread makes the HDF5 calls for the previous chunk; the
+ * caller only stalls when it gets a whole chunk ahead of the writer.
+ * Counted from ch_storage_open(), in nanoseconds unless noted. */
+struct hdf5_ch_stats {
+    uint64_t split_ns;          /* board samples into dataset columns */
+    uint64_t filter_ns;         /* channel_data_filtered, if any */
+    uint64_t stall_ns;          /* waiting for the writer thread */
+    uint64_t write_ns;          /* writing chunks out through HDF5 */
+    uint64_t nwrites;           /* stages written, each up to a chunk */
+    uint64_t nsamps;            /* board samples written */
+};
+
 /* Create new channel storage object; returns NULL on error. */
 struct ch_storage *hdf5_ch_storage_alloc(const char *out_file_path,
                                          const char *dataset_name);
 
+/* Also store each board sample's channel data run through a filter
+ * (see biquad16.h), in a channel_data_filtered dataset. The filter
+ * starts over with each ch_storage_open(); call this before then.
+ * The arguments are as for biquad16_configure(), and sos is copied.
+ * Returns 0 on success, -1 if the filter is invalid or we're out of
+ * memory. */
+int hdf5_ch_storage_set_filter(struct ch_storage *chns, const float *sos,
+                               size_t nsections);
+
+/* Get the timings so far; they're also logged on ch_storage_close(). */
+void hdf5_ch_storage_get_stats(struct ch_storage *chns,
+                               struct hdf5_ch_stats *stats);
+
 #endif
@@ -0,0 +1,235 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "live_ring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+
+struct live_ring {
+    char *name;
+    struct live_ring_hdr *hdr;
+    struct live_ring_slot *slots;
+    size_t maplen;
+    uint64_t mask;              /* nslots - 1 */
+    uint64_t next;              /* number of the next sample */
+};
+
+static inline size_t live_ring_maplen(uint64_t nslots)
+{
+    return LIVE_RING_HDR_SIZE + nslots * sizeof(struct live_ring_slot);
+}
+
+/*
+ * Writer
+ */
+
+struct live_ring* live_ring_new(const char *name, size_t nslots)
+{
+    assert(nslots && !(nslots & (nslots - 1)));
+    assert(sizeof(struct live_ring_hdr) <= LIVE_RING_HDR_SIZE);
+    int fd = -1;
+    struct live_ring *lr = malloc(sizeof(struct live_ring));
+    if (!lr) {
+        return NULL;
+    }
+    lr->hdr = MAP_FAILED;
+    lr->maplen = live_ring_maplen(nslots);
+    lr->mask = nslots - 1;
+    lr->next = 0;
+    lr->name = strdup(name);
+    if (!lr->name) {
+        goto fail;
+    }
+
+    /* Start from scratch, so readers of an old ring with the same
+     * name see it go stale instead of changing under them. */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        log_ERR("can't create shared memory %s: %m", name);
+        goto fail;
+    }
+    if (ftruncate(fd, (off_t)lr->maplen)) {
+        log_ERR("can't size shared memory %s: %m", name);
+        goto fail;
+    }
+    lr->hdr = mmap(NULL, lr->maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    if (lr->hdr == MAP_FAILED) {
+        log_ERR("can't map shared memory %s: %m", name);
+        goto fail;
+    }
+    close(fd);
+    fd = -1;
+    lr->slots = (struct live_ring_slot*)((uint8_t*)lr->hdr +
+                                         LIVE_RING_HDR_SIZE);
+
+    /* ftruncate() zeroed everything, so every slot's seq is already
+     * 0, which no sample ever has once it's published. The magic
+     * number goes in last, so readers don't trust a half-made
+     * header. */
+    lr->hdr->version = LIVE_RING_VERSION;
+    lr->hdr->hdr_size = LIVE_RING_HDR_SIZE;
+    lr->hdr->slot_size = sizeof(struct live_ring_slot);
+    lr->hdr->nslots = nslots;
+    lr->hdr->write_idx = 0;
+    __atomic_store_n(&lr->hdr->magic, LIVE_RING_MAGIC, __ATOMIC_RELEASE);
+    log_DEBUG("%s: %zu board samples (%zu MiB) in %s", __func__, nslots,
+              lr->maplen >> 20, name);
+    return lr;
+
+ fail:
+    if (fd != -1) {
+        close(fd);
+        shm_unlink(name);
+    }
+    live_ring_free(lr);
+    return NULL;
+}
+
+void live_ring_free(struct live_ring *lr)
+{
+    if (lr->hdr != MAP_FAILED) {
+        if (munmap(lr->hdr, lr->maplen)) {
+            log_WARNING("%s: munmap: %m", __func__);
+        }
+        shm_unlink(lr->name);
+    }
+    free(lr->name);
+    free(lr);
+}
+
+struct raw_pkt_bsmp* live_ring_reserve(struct live_ring *lr)
+{
+    struct live_ring_slot *slot = &lr->slots[lr->next & lr->mask];
+    __atomic_store_n(&slot->seq, 2 * lr->next + 1, __ATOMIC_RELAXED);
+    /* Readers must see the odd seq before any of the new sample. */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return &slot->bsmp;
+}
+
+void live_ring_publish(struct live_ring *lr)
+{
+    struct live_ring_slot *slot = &lr->slots[lr->next & lr->mask];
+    __atomic_store_n(&slot->seq, 2 * lr->next + 2, __ATOMIC_RELEASE);
+    lr->next++;
+    __atomic_store_n(&lr->hdr->write_idx, lr->next, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reader
+ */
+
+int live_ring_open(struct live_ring_reader *rd, const char *name)
+{
+    struct live_ring_hdr hdr;
+    void *map = MAP_FAILED;
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    /* Check the header before trusting nslots. */
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+        goto fail;
+    }
+    if (hdr.magic != LIVE_RING_MAGIC ||
+        hdr.version != LIVE_RING_VERSION ||
+        hdr.hdr_size != LIVE_RING_HDR_SIZE ||
+        hdr.slot_size != sizeof(struct live_ring_slot) ||
+        !hdr.nslots || (hdr.nslots & (hdr.nslots - 1))) {
+        errno = EINVAL;
+        goto fail;
+    }
+    struct stat st;
+    size_t maplen = live_ring_maplen(hdr.nslots);
+    if (fstat(fd, &st) || (size_t)st.st_size < maplen) {
+        errno = EINVAL;
+        goto fail;
+    }
+    map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        goto fail;
+    }
+    close(fd);
+    rd->hdr = map;
+    rd->slots = (const struct live_ring_slot*)((const uint8_t*)map +
+                                               LIVE_RING_HDR_SIZE);
+    rd->maplen = maplen;
+    rd->mask = hdr.nslots - 1;
+    rd->next = __atomic_load_n(&rd->hdr->write_idx, __ATOMIC_ACQUIRE);
+    rd->nlost = 0;
+    return 0;
+
+ fail:
+    close(fd);
+    return -1;
+}
+
+void live_ring_close(struct live_ring_reader *rd)
+{
+    munmap((void*)rd->hdr, rd->maplen);
+    rd->hdr = NULL;
+    rd->slots = NULL;
+}
+
+const struct raw_pkt_bsmp* live_ring_peek(struct live_ring_reader *rd)
+{
+    uint64_t nslots = rd->mask + 1;
+    while (1) {
+        uint64_t w = __atomic_load_n(&rd->hdr->write_idx, __ATOMIC_ACQUIRE);
+        if (rd->next == w) {
+            return NULL;
+        }
+        /* The writer may already be working on sample w, which
+         * shares a slot with w - nslots. */
+        if (w - rd->next >= nslots) {
+            rd->nlost += w - rd->next - (nslots - 1);
+            rd->next = w - (nslots - 1);
+        }
+        const struct live_ring_slot *slot = &rd->slots[rd->next & rd->mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == 2 * rd->next + 2) {
+            return &slot->bsmp;
+        }
+        /* Overwritten since we loaded write_idx. */
+        rd->nlost++;
+        rd->next++;
+    }
+}
+
+int live_ring_done(struct live_ring_reader *rd)
+{
+    const struct live_ring_slot *slot = &rd->slots[rd->next & rd->mask];
+    /* Whatever the caller read from the sample has to come before
+     * this second look at seq. */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    int ret = seq == 2 * rd->next + 2 ? 0 : -1;
+    if (ret) {
+        rd->nlost++;
+    }
+    rd->next++;
+    return ret;
+}
@@ -0,0 +1,153 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   live_ring.h
+ * @brief  Shared-memory ring of live board samples, for local readers
+ *
+ * One writer (the daemon) publishes board samples into a POSIX
+ * shared memory object (see shm_open(3); they live in /dev/shm). Any
+ * number of local readers map it read-only and follow along with no
+ * system calls and no copies. The writer never waits for readers,
+ * and doesn't know how many there are; a reader that falls more than
+ * a ring's worth behind misses samples, and finds out that it did.
+ *
+ * Layout, all in host byte order:
+ *
+ * - A struct live_ring_hdr, padded to LIVE_RING_HDR_SIZE bytes.
+ * - hdr.nslots (a power of two) struct live_ring_slots. Each holds
+ *   a struct raw_pkt_bsmp, in host byte order, and a sequence number.
+ *
+ * Board samples are numbered from 0 in the order they're published;
+ * sample n goes in slot n % nslots. To publish it, the writer sets
+ * that slot's seq to 2n + 1 (odd, so readers know it's changing),
+ * fills in the sample, sets seq to 2n + 2, and then sets
+ * hdr.write_idx to n + 1. A reader can use sample n once write_idx
+ * is past n, but only if the slot's seq is 2n + 2 both before and
+ * after it looks at the sample. Anything else means the writer got
+ * there first, and what the reader saw may be garbage.
+ *
+ * live_ring_peek() and live_ring_done() do all that for you.
+ */
+
+#ifndef _LIB_LIVE_RING_H_
+#define _LIB_LIVE_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "raw_packets.h"
+
+#define LIVE_RING_MAGIC 0x4c495645  /* "LIVE" */
+#define LIVE_RING_VERSION 1
+#define LIVE_RING_HDR_SIZE 128      /* offset of the first slot */
+
+/** Shared memory header. */
+struct live_ring_hdr {
+    uint32_t magic;             /**< LIVE_RING_MAGIC */
+    uint32_t version;           /**< LIVE_RING_VERSION */
+    uint32_t hdr_size;          /**< LIVE_RING_HDR_SIZE */
+    uint32_t slot_size;         /**< sizeof(struct live_ring_slot) */
+    uint64_t nslots;            /**< Number of slots; a power of two. */
+    /** Number of board samples published so far. Its own cache
+     * line, since it's the only thing readers poll. */
+    uint64_t write_idx __attribute__((aligned(64)));
+};
+
+/** One board sample in shared memory. */
+struct live_ring_slot {
+    uint64_t seq;               /**< See above. */
+    struct raw_pkt_bsmp bsmp;   /**< Host byte order. */
+} __attribute__((aligned(64)));
+
+/*
+ * Writer
+ */
+
+struct live_ring;
+
+/**
+ * Create (or replace) a shared memory ring.
+ *
+ * @param name Shared memory object name, as for shm_open(); it must
+ *             start with a slash, e.g. "/leafysd-live".
+ * @param nslots Number of board samples it holds; a power of two.
+ * @return New ring on success, NULL on failure.
+ */
+struct live_ring* live_ring_new(const char *name, size_t nslots);
+
+/** Unmap and remove a ring from live_ring_new(). */
+void live_ring_free(struct live_ring *lr);
+
+/**
+ * Start publishing a board sample.
+ *
+ * @return The next slot's board sample, to fill in. Call
+ *         live_ring_publish() once it's ready.
+ */
+struct raw_pkt_bsmp* live_ring_reserve(struct live_ring *lr);
+
+/** Finish publishing the board sample from live_ring_reserve(). */
+void live_ring_publish(struct live_ring *lr);
+
+/*
+ * Reader
+ */
+
+/** A reader's view of the ring; see live_ring_open(). */
+struct live_ring_reader {
+    const struct live_ring_hdr *hdr;
+    const struct live_ring_slot *slots;
+    size_t maplen;
+    uint64_t mask;              /* nslots - 1 */
+    uint64_t next;              /* next sample to read */
+    uint64_t nlost;             /* samples missed so far */
+};
+
+/**
+ * Map a ring from live_ring_new(), read-only.
+ *
+ * Reading starts with the next board sample published.
+ *
+ * @param name As for live_ring_new().
+ * @return 0 on success, -1 on failure (e.g. if there's no such ring,
+ *         or it has a different version or layout).
+ */
+int live_ring_open(struct live_ring_reader *rd, const char *name);
+
+/** Unmap a ring from live_ring_open(). */
+void live_ring_close(struct live_ring_reader *rd);
+
+/**
+ * Look at the next board sample, in place.
+ *
+ * If the reader's fallen too far behind, this skips ahead, adding
+ * what it skipped to rd->nlost.
+ *
+ * @return The board sample, or NULL if there's nothing new yet.
+ *         Call live_ring_done() when you're finished with it.
+ */
+const struct raw_pkt_bsmp* live_ring_peek(struct live_ring_reader *rd);
+
+/**
+ * Finish with the board sample from live_ring_peek(), and move on.
+ *
+ * @return 0 if the sample was intact the whole time, -1 if the
+ *         writer overwrote it while you were looking (in which case
+ *         it also counts towards rd->nlost).
+ */
+int live_ring_done(struct live_ring_reader *rd);
+
+#endif  /* _LIB_LIVE_RING_H_ */
@@ -0,0 +1,154 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msg_ring.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each message is a uint32_t length, then the message, padded to a
+ * multiple of MSG_RING_ALIGN bytes, so headers never straddle the
+ * end of buf. When a message won't fit before the end of buf, it
+ * goes at the start instead, and a MSG_RING_WRAP header (if there's
+ * room for one) marks the unused space.
+ */
+
+#define MSG_RING_HDR sizeof(uint32_t)
+#define MSG_RING_ALIGN MSG_RING_HDR
+#define MSG_RING_WRAP UINT32_MAX
+
+static inline size_t msg_ring_span(size_t len)
+{
+    return (MSG_RING_HDR + len + MSG_RING_ALIGN - 1) & ~(MSG_RING_ALIGN - 1);
+}
+
+static inline uint32_t msg_ring_hdr(const struct msg_ring *ring, size_t off)
+{
+    uint32_t hdr;
+    memcpy(&hdr, ring->buf + off, sizeof(hdr));
+    return hdr;
+}
+
+/* Where the message that should be at "off" really is. */
+static size_t msg_ring_skip_wrap(const struct msg_ring *ring, size_t off)
+{
+    if (off == ring->size || msg_ring_hdr(ring, off) == MSG_RING_WRAP) {
+        return 0;
+    }
+    return off;
+}
+
+/* Offset of the message after the one at "off". */
+static size_t msg_ring_next(const struct msg_ring *ring, size_t off)
+{
+    off = msg_ring_skip_wrap(ring, off);
+    return off + msg_ring_span(msg_ring_hdr(ring, off));
+}
+
+int msg_ring_init(struct msg_ring *ring, size_t size)
+{
+    size &= ~(MSG_RING_ALIGN - 1);
+    ring->buf = malloc(size);
+    if (!ring->buf) {
+        return -1;
+    }
+    ring->size = size;
+    msg_ring_clear(ring);
+    return 0;
+}
+
+void msg_ring_free(struct msg_ring *ring)
+{
+    free(ring->buf);
+    ring->buf = NULL;
+    ring->size = 0;
+    msg_ring_clear(ring);
+}
+
+void msg_ring_clear(struct msg_ring *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->count = 0;
+}
+
+/* Offset to put a message taking up "span" bytes, or -1 if there's
+ * no room without dropping something. */
+static ssize_t msg_ring_find_room(struct msg_ring *ring, size_t span)
+{
+    if (ring->count == 0) {
+        msg_ring_clear(ring);
+        return span <= ring->size ? 0 : -1;
+    }
+    if (ring->tail > ring->head) {
+        if (span <= ring->size - ring->tail) {
+            return (ssize_t)ring->tail;
+        }
+        return span <= ring->head ? 0 : -1;
+    }
+    if (ring->tail < ring->head && span <= ring->head - ring->tail) {
+        return (ssize_t)ring->tail;
+    }
+    return -1;                  /* full */
+}
+
+ssize_t msg_ring_push(struct msg_ring *ring, const void *msg, size_t len)
+{
+    size_t span = msg_ring_span(len);
+    if (len >= MSG_RING_WRAP || span > ring->size) {
+        return -1;
+    }
+    ssize_t dropped = 0;
+    ssize_t off;
+    while ((off = msg_ring_find_room(ring, span)) == -1) {
+        msg_ring_pop(ring, 1);
+        dropped++;
+    }
+    if ((size_t)off != ring->tail && ring->tail != ring->size) {
+        uint32_t wrap = MSG_RING_WRAP;
+        memcpy(ring->buf + ring->tail, &wrap, sizeof(wrap));
+    }
+    uint32_t hdr = (uint32_t)len;
+    memcpy(ring->buf + off, &hdr, sizeof(hdr));
+    memcpy(ring->buf + off + MSG_RING_HDR, msg, len);
+    ring->tail = (size_t)off + span;
+    ring->count++;
+    return dropped;
+}
+
+size_t msg_ring_peek(struct msg_ring *ring, struct iovec *iovs, size_t max)
+{
+    size_t n = ring->count < max ? ring->count : max;
+    size_t off = ring->head;
+    for (size_t i = 0; i < n; i++) {
+        off = msg_ring_skip_wrap(ring, off);
+        iovs[i].iov_base = ring->buf + off + MSG_RING_HDR;
+        iovs[i].iov_len = msg_ring_hdr(ring, off);
+        off += msg_ring_span(iovs[i].iov_len);
+    }
+    return n;
+}
+
+void msg_ring_pop(struct msg_ring *ring, size_t n)
+{
+    assert(n <= ring->count);
+    for (size_t i = 0; i < n; i++) {
+        ring->head = msg_ring_next(ring, ring->head);
+    }
+    ring->count -= n;
+}
@@ -0,0 +1,85 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   msg_ring.h
+ * @brief  Bounded FIFO of variable-length messages that drops the oldest
+ *
+ * For queueing messages to a consumer that may fall behind, without
+ * ever blocking the producer: when there's no room for a new
+ * message, the oldest ones are thrown away to make some.
+ *
+ * Messages are stored contiguously, each behind a small length
+ * header, so the oldest few can be handed to writev() or sendmsg()
+ * as they are; see msg_ring_peek(). Not thread safe.
+ */
+
+#ifndef _LIB_MSG_RING_H_
+#define _LIB_MSG_RING_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct msg_ring {
+    unsigned char *buf;
+    size_t size;                /* bytes in buf */
+    size_t head;                /* offset of the oldest message */
+    size_t tail;                /* offset where the next one goes */
+    size_t count;               /* number of messages */
+};
+
+/**
+ * Initialize an empty ring.
+ *
+ * @param size Bytes of storage to allocate. Each message takes up its
+ *             length plus a few bytes.
+ * @return 0 on success, -1 if out of memory.
+ */
+int msg_ring_init(struct msg_ring *ring, size_t size);
+
+/** Free a ring's storage. */
+void msg_ring_free(struct msg_ring *ring);
+
+/** Drop every message. */
+void msg_ring_clear(struct msg_ring *ring);
+
+/** Number of messages in the ring. */
+static inline size_t msg_ring_count(const struct msg_ring *ring)
+{
+    return ring->count;
+}
+
+/**
+ * Add a copy of a message, dropping the oldest ones if needed.
+ *
+ * @return Number of messages dropped to make room, or -1 if msg
+ *         wouldn't fit even in an empty ring (nothing is dropped).
+ */
+ssize_t msg_ring_push(struct msg_ring *ring, const void *msg, size_t len);
+
+/**
+ * Point iovecs at the oldest messages, without removing them.
+ *
+ * @param iovs Where to put the iovecs, one per message, oldest first.
+ * @param max Most iovecs to fill in.
+ * @return Number filled in.
+ */
+size_t msg_ring_peek(struct msg_ring *ring, struct iovec *iovs, size_t max);
+
+/** Remove the n oldest messages; there must be at least n. */
+void msg_ring_pop(struct msg_ring *ring, size_t n);
+
+#endif  /* _LIB_MSG_RING_H_ */
@@ -0,0 +1,269 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "packet_ring.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "logging.h"
+
+#define PACKET_RING_BLOCK_SIZE ((size_t)1 << 20)
+#define PACKET_RING_FRAME_SIZE ((size_t)1 << 12) /* just a hint for V3 */
+#define PACKET_RING_RETIRE_MSEC 2 /* max wait for a block to fill up */
+
+struct packet_ring {
+    int fd;
+    uint16_t port;              /* network byte order */
+    uint8_t *map;
+    size_t maplen;
+    unsigned nblocks;
+    unsigned blk;               /* next block to read */
+    struct tpacket_block_desc *cur; /* block being read, or NULL */
+    struct tpacket3_hdr *frame;     /* next frame in cur */
+    uint32_t nleft;                 /* frames left in cur */
+};
+
+static inline struct tpacket_block_desc*
+packet_ring_block(struct packet_ring *pr, unsigned blk)
+{
+    return (struct tpacket_block_desc*)(pr->map +
+                                        blk * PACKET_RING_BLOCK_SIZE);
+}
+
+/* Keep IPv4/UDP datagrams to our port that aren't fragments, so the
+ * ring doesn't fill up with unrelated traffic. Offsets are from the
+ * start of the IP header, since this is a SOCK_DGRAM packet socket. */
+static int packet_ring_attach_filter(int fd, uint16_t port)
+{
+    struct sock_filter code[] = {
+        /* Load IP protocol; must be UDP. */
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+        /* Load flags/fragment offset; drop fragments. */
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, IP_MF | IP_OFFMASK, 4, 0),
+        /* X = IP header length; load UDP destination port. */
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code,
+    };
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+struct packet_ring* packet_ring_new(unsigned iface, uint16_t port,
+                                    size_t mem)
+{
+    struct packet_ring *pr = malloc(sizeof(struct packet_ring));
+    if (!pr) {
+        return NULL;
+    }
+    pr->port = htons(port);
+    pr->map = MAP_FAILED;
+    pr->nblocks = mem / PACKET_RING_BLOCK_SIZE;
+    if (pr->nblocks < 2) {
+        pr->nblocks = 2;
+    }
+    pr->maplen = pr->nblocks * PACKET_RING_BLOCK_SIZE;
+    pr->blk = 0;
+    pr->cur = NULL;
+    pr->frame = NULL;
+    pr->nleft = 0;
+
+    /* Protocol 0 means we don't get anything until bind(), below, so
+     * nothing sneaks in before the filter's attached. */
+    pr->fd = socket(AF_PACKET, SOCK_DGRAM, 0);
+    if (pr->fd == -1) {
+        log_ERR("can't open packet socket: %m");
+        goto fail;
+    }
+    int version = TPACKET_V3;
+    if (setsockopt(pr->fd, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version))) {
+        log_ERR("%s: can't use TPACKET_V3: %m", __func__);
+        goto fail;
+    }
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PACKET_RING_BLOCK_SIZE;
+    req.tp_block_nr = pr->nblocks;
+    req.tp_frame_size = PACKET_RING_FRAME_SIZE;
+    req.tp_frame_nr = (pr->nblocks *
+                       (PACKET_RING_BLOCK_SIZE / PACKET_RING_FRAME_SIZE));
+    req.tp_retire_blk_tov = PACKET_RING_RETIRE_MSEC;
+    if (setsockopt(pr->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+        log_ERR("%s: can't set up receive ring: %m", __func__);
+        goto fail;
+    }
+    pr->map = mmap(NULL, pr->maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   pr->fd, 0);
+    if (pr->map == MAP_FAILED) {
+        log_ERR("%s: can't map receive ring: %m", __func__);
+        goto fail;
+    }
+    if (packet_ring_attach_filter(pr->fd, port)) {
+        log_ERR("%s: can't attach socket filter: %m", __func__);
+        goto fail;
+    }
+#ifdef PACKET_IGNORE_OUTGOING
+    /* Best effort; we also check each frame's packet type. */
+    int ignore = 1;
+    setsockopt(pr->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING,
+               &ignore, sizeof(ignore));
+#endif
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_IP);
+    sll.sll_ifindex = (int)iface;
+    if (bind(pr->fd, (struct sockaddr*)&sll, sizeof(sll))) {
+        log_ERR("%s: can't bind packet socket: %m", __func__);
+        goto fail;
+    }
+    log_DEBUG("%s: %u blocks of %zu KiB", __func__, pr->nblocks,
+              PACKET_RING_BLOCK_SIZE >> 10);
+    return pr;
+
+ fail:
+    packet_ring_free(pr);
+    return NULL;
+}
+
+void packet_ring_free(struct packet_ring *pr)
+{
+    if (pr->map != MAP_FAILED && munmap(pr->map, pr->maplen)) {
+        log_WARNING("%s: munmap: %m", __func__);
+    }
+    if (pr->fd != -1) {
+        close(pr->fd);
+    }
+    free(pr);
+}
+
+int packet_ring_fd(struct packet_ring *pr)
+{
+    return pr->fd;
+}
+
+/* Give the current block back to the kernel and move on. */
+static void packet_ring_release(struct packet_ring *pr)
+{
+    __atomic_store_n(&pr->cur->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                     __ATOMIC_RELEASE);
+    pr->cur = NULL;
+    pr->blk = (pr->blk + 1) % pr->nblocks;
+}
+
+/* Start reading the next block, if the kernel's done with it. */
+static int packet_ring_open_block(struct packet_ring *pr)
+{
+    struct tpacket_block_desc *bd = packet_ring_block(pr, pr->blk);
+    if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+          TP_STATUS_USER)) {
+        return -1;
+    }
+    pr->cur = bd;
+    pr->nleft = bd->hdr.bh1.num_pkts;
+    pr->frame = (struct tpacket3_hdr*)((uint8_t*)bd +
+                                       bd->hdr.bh1.offset_to_first_pkt);
+    return 0;
+}
+
+/* Find the UDP payload in a frame. The filter has already done most
+ * of this, but it doesn't hurt to be careful. */
+static ssize_t packet_ring_parse(struct packet_ring *pr,
+                                 struct tpacket3_hdr *frame,
+                                 void **data, struct sockaddr_in *from)
+{
+    struct sockaddr_ll *sll =
+        (struct sockaddr_ll*)((uint8_t*)frame +
+                              TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    if (sll->sll_pkttype == PACKET_OUTGOING) {
+        return -1;
+    }
+    if (frame->tp_snaplen < frame->tp_len) {
+        return -1;              /* truncated */
+    }
+    uint8_t *pkt = (uint8_t*)frame + frame->tp_net;
+    size_t caplen = frame->tp_snaplen;
+    struct iphdr *ip = (struct iphdr*)pkt;
+    if (caplen < sizeof(struct iphdr) || ip->version != 4) {
+        return -1;
+    }
+    size_t ihl = ip->ihl * 4U;
+    if (ihl < sizeof(struct iphdr) || caplen < ihl + sizeof(struct udphdr) ||
+        ip->protocol != IPPROTO_UDP ||
+        (ip->frag_off & htons(IP_MF | IP_OFFMASK))) {
+        return -1;
+    }
+    struct udphdr *udp = (struct udphdr*)(pkt + ihl);
+    size_t ulen = ntohs(udp->len);
+    if (udp->dest != pr->port || ulen < sizeof(struct udphdr) ||
+        ihl + ulen > caplen) {
+        return -1;
+    }
+    memset(from, 0, sizeof(*from));
+    from->sin_family = AF_INET;
+    from->sin_port = udp->source;
+    from->sin_addr.s_addr = ip->saddr;
+    *data = udp + 1;
+    return (ssize_t)(ulen - sizeof(struct udphdr));
+}
+
+ssize_t packet_ring_next(struct packet_ring *pr, void **data,
+                         struct sockaddr_in *from)
+{
+    while (1) {
+        if (!pr->cur && packet_ring_open_block(pr)) {
+            return -1;
+        }
+        if (pr->nleft == 0) {
+            packet_ring_release(pr);
+            continue;
+        }
+        struct tpacket3_hdr *frame = pr->frame;
+        pr->frame = (struct tpacket3_hdr*)((uint8_t*)frame +
+                                           frame->tp_next_offset);
+        pr->nleft--;
+        ssize_t len = packet_ring_parse(pr, frame, data, from);
+        if (len != -1) {
+            return len;
+        }
+    }
+}
+
+void packet_ring_flush(struct packet_ring *pr)
+{
+    while (pr->cur || !packet_ring_open_block(pr)) {
+        packet_ring_release(pr);
+    }
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   packet_ring.h
+ * @brief  Memory-mapped receive ring for UDP datagrams to one port
+ *
+ * This is an alternative to recvfrom() on a UDP socket. It opens an
+ * AF_PACKET socket on a network interface and sets up a TPACKET_V3
+ * receive ring shared with the kernel. The kernel copies datagrams
+ * addressed to the port into blocks in the ring, and hands each block
+ * to us when it fills up or a short timeout expires, so reading a
+ * whole block's worth of datagrams takes no system calls at all.
+ *
+ * Limitations:
+ *
+ * - IPv4 only.
+ * - IP fragments are ignored. The sender's datagrams must fit in the
+ *   interface's MTU (see util/expand_eth_buffers.sh).
+ * - Opening the ring requires CAP_NET_RAW.
+ * - This sees datagrams before the kernel's UDP layer does, so it
+ *   doesn't stop them from reaching any UDP socket bound to the same
+ *   port as well. Keep such a socket from queueing them (e.g. with a
+ *   socket filter) if you don't want to pay for both.
+ */
+
+#ifndef _LIB_PACKET_RING_H_
+#define _LIB_PACKET_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+struct packet_ring;
+
+/**
+ * Create a receive ring for UDP datagrams sent to a local port.
+ *
+ * @param iface Interface number (see <net/if.h>) to receive on.
+ * @param port Local UDP port, host byte order.
+ * @param mem Approximate ring size in bytes. This is rounded down to
+ *            a whole number of blocks, with a minimum of two.
+ * @return New ring on success, NULL on failure.
+ */
+struct packet_ring* packet_ring_new(unsigned iface, uint16_t port,
+                                    size_t mem);
+
+/** Unmap and close a ring from packet_ring_new(). */
+void packet_ring_free(struct packet_ring *pr);
+
+/**
+ * File descriptor to poll() for readability (or hand to libevent).
+ *
+ * It's readable as long as packet_ring_next() has something to
+ * return; the kernel may hold onto the most recent datagrams for up
+ * to a couple of milliseconds before that happens.
+ */
+int packet_ring_fd(struct packet_ring *pr);
+
+/**
+ * Get the next datagram, without copying it.
+ *
+ * @param data On success, points to the UDP payload inside the
+ *             ring. This stays valid (and writable) until the next
+ *             call to packet_ring_next() or packet_ring_flush().
+ * @param from On success, the datagram's source address.
+ * @return Payload length, or -1 if nothing is waiting.
+ */
+ssize_t packet_ring_next(struct packet_ring *pr, void **data,
+                         struct sockaddr_in *from);
+
+/** Throw away everything that's waiting, returning it to the kernel. */
+void packet_ring_flush(struct packet_ring *pr);
+
+#endif  /* _LIB_PACKET_RING_H_ */
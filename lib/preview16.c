@@ -0,0 +1,200 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "preview16.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PREVIEW16_X86 1
+#include <immintrin.h>
+#else
+#define PREVIEW16_X86 0
+#endif
+
+typedef void (*preview16_fn)(struct preview16*, const uint16_t*);
+
+static void preview16_add_range(struct preview16 *pv,
+                                const uint16_t *samps, size_t start)
+{
+    for (size_t i = start; i < pv->nchans; i++) {
+        uint16_t v = samps[i];
+        pv->min[i] = v < pv->min[i] ? v : pv->min[i];
+        pv->max[i] = v > pv->max[i] ? v : pv->max[i];
+        pv->sum[i] += v;
+        pv->sumsq[i] += (uint64_t)v * v;
+    }
+}
+
+static void preview16_add_scalar(struct preview16 *pv,
+                                 const uint16_t *samps)
+{
+    preview16_add_range(pv, samps, 0);
+}
+
+#if PREVIEW16_X86
+/* Add four squares to sumsq[0..3]. */
+__attribute__((target("avx2")))
+static inline void preview16_sumsq4_avx2(uint64_t *sumsq, __m128i sq)
+{
+    __m256i *p = (__m256i*)sumsq;
+    __m256i acc = _mm256_loadu_si256(p);
+    acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(sq));
+    _mm256_storeu_si256(p, acc);
+}
+
+/* Add eight values, widened to 32 bits, to sum[0..7], and their
+ * squares to sumsq[0..7]. A value's square fits in 32 bits. */
+__attribute__((target("avx2")))
+static inline void preview16_sums8_avx2(uint32_t *sum, uint64_t *sumsq,
+                                        __m128i v16)
+{
+    __m256i v = _mm256_cvtepu16_epi32(v16);
+    __m256i *p = (__m256i*)sum;
+    _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), v));
+    __m256i sq = _mm256_mullo_epi32(v, v);
+    preview16_sumsq4_avx2(sumsq, _mm256_castsi256_si128(sq));
+    preview16_sumsq4_avx2(sumsq + 4, _mm256_extracti128_si256(sq, 1));
+}
+
+__attribute__((target("avx2")))
+static void preview16_add_avx2(struct preview16 *pv, const uint16_t *samps)
+{
+    size_t i;
+    for (i = 0; i + 16 <= pv->nchans; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(samps + i));
+        __m256i *mn = (__m256i*)(pv->min + i);
+        __m256i *mx = (__m256i*)(pv->max + i);
+        _mm256_storeu_si256(mn, _mm256_min_epu16(_mm256_loadu_si256(mn), v));
+        _mm256_storeu_si256(mx, _mm256_max_epu16(_mm256_loadu_si256(mx), v));
+        preview16_sums8_avx2(pv->sum + i, pv->sumsq + i,
+                             _mm256_castsi256_si128(v));
+        preview16_sums8_avx2(pv->sum + i + 8, pv->sumsq + i + 8,
+                             _mm256_extracti128_si256(v, 1));
+    }
+    preview16_add_range(pv, samps, i);
+}
+#endif
+
+void preview16_reset(struct preview16 *pv, size_t nchans)
+{
+    assert(nchans <= PREVIEW16_MAX_CHANS);
+    pv->nchans = nchans;
+    pv->nsamps = 0;
+    memset(pv->min, 0xff, nchans * sizeof(pv->min[0]));
+    memset(pv->max, 0, nchans * sizeof(pv->max[0]));
+    memset(pv->sum, 0, nchans * sizeof(pv->sum[0]));
+    memset(pv->sumsq, 0, nchans * sizeof(pv->sumsq[0]));
+}
+
+/* floor(sqrt(v)), by Newton's method from above. */
+static uint64_t preview16_isqrt(uint64_t v)
+{
+    if (v == 0) {
+        return 0;
+    }
+    uint64_t x = (uint64_t)1 << ((65 - __builtin_clzll(v)) / 2);
+    while (1) {
+        uint64_t y = (x + v / x) / 2;
+        if (y >= x) {
+            return x;
+        }
+        x = y;
+    }
+}
+
+void preview16_finish(const struct preview16 *pv, uint16_t *min,
+                      uint16_t *max, uint16_t *mean, uint16_t *rms)
+{
+    uint64_t n = pv->nsamps;
+    assert(n > 0);
+    memcpy(min, pv->min, pv->nchans * sizeof(uint16_t));
+    memcpy(max, pv->max, pv->nchans * sizeof(uint16_t));
+    for (size_t i = 0; i < pv->nchans; i++) {
+        uint64_t sum = pv->sum[i];
+        mean[i] = (uint16_t)((sum + n / 2) / n);
+        /* n^2 times the variance. Neither term can overflow, since
+         * n and every value are less than 2^16. */
+        uint64_t var_n2 = n * pv->sumsq[i] - sum * sum;
+        rms[i] = (uint16_t)((preview16_isqrt(var_n2) + n / 2) / n);
+    }
+}
+
+static preview16_fn preview16_lookup(enum preview16_impl impl)
+{
+    switch (impl) {
+    case PREVIEW16_AUTO:
+#if PREVIEW16_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return preview16_add_avx2;
+        }
+#endif
+        return preview16_add_scalar;
+    case PREVIEW16_SCALAR:
+        return preview16_add_scalar;
+#if PREVIEW16_X86
+    case PREVIEW16_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? preview16_add_avx2 : NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static void preview16_first(struct preview16*, const uint16_t*);
+
+/* Atomic, so threads racing through the first call are harmless. */
+static preview16_fn preview16_impl_fn = preview16_first;
+
+static void preview16_first(struct preview16 *pv, const uint16_t *samps)
+{
+    preview16_fn fn = preview16_lookup(PREVIEW16_AUTO);
+    __atomic_store_n(&preview16_impl_fn, fn, __ATOMIC_RELAXED);
+    fn(pv, samps);
+}
+
+void preview16_add(struct preview16 *pv, const uint16_t *samps)
+{
+    assert(pv->nsamps < PREVIEW16_MAX_WINDOW);
+    __atomic_load_n(&preview16_impl_fn, __ATOMIC_RELAXED)(pv, samps);
+    pv->nsamps++;
+}
+
+int preview16_use(enum preview16_impl impl)
+{
+    preview16_fn fn = preview16_lookup(impl);
+    if (!fn) {
+        return -1;
+    }
+    __atomic_store_n(&preview16_impl_fn, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+const char* preview16_impl_str(void)
+{
+    preview16_fn fn = __atomic_load_n(&preview16_impl_fn, __ATOMIC_RELAXED);
+    if (fn == preview16_first) {
+        fn = preview16_lookup(PREVIEW16_AUTO);
+    }
+#if PREVIEW16_X86
+    if (fn == preview16_add_avx2) {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
@@ -0,0 +1,101 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   preview16.h
+ * @brief  Per-channel summaries of windows of 16-bit sample arrays
+ *
+ * This is what goes in a BoardPreview (see proto/data.proto): for
+ * each channel, the minimum, maximum, mean, and RMS of its values
+ * over a window of board samples. The RMS is taken about the mean,
+ * so it's the channel's noise (or signal) level, without the DC
+ * offset every channel has.
+ *
+ * Adding a sample is a handful of vector operations per 16 channels;
+ * it uses AVX2 if the CPU we're running on has it, chosen at run time
+ * like bswap16_buf(). Summaries are only worked out at the end of
+ * each window.
+ */
+
+#ifndef _LIB_PREVIEW16_H_
+#define _LIB_PREVIEW16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "raw_packets.h"
+
+/** Most channels a window can have. */
+#define PREVIEW16_MAX_CHANS RAW_BSMP_NSAMP
+
+/** Most samples a window can have, so the sums can't overflow. */
+#define PREVIEW16_MAX_WINDOW 65535
+
+/** A window's running totals. */
+struct preview16 {
+    size_t nchans;              /**< Channels per sample. */
+    uint32_t nsamps;            /**< Samples added so far. */
+    uint16_t min[PREVIEW16_MAX_CHANS];
+    uint16_t max[PREVIEW16_MAX_CHANS];
+    uint32_t sum[PREVIEW16_MAX_CHANS];
+    uint64_t sumsq[PREVIEW16_MAX_CHANS];
+};
+
+/** Implementations of preview16_add(). */
+enum preview16_impl {
+    PREVIEW16_AUTO = 0,         /**< Best one the CPU supports */
+    PREVIEW16_SCALAR,
+    PREVIEW16_AVX2,
+};
+
+/**
+ * Start a new window.
+ *
+ * @param nchans Channels per sample, at most PREVIEW16_MAX_CHANS.
+ */
+void preview16_reset(struct preview16 *pv, size_t nchans);
+
+/**
+ * Add a sample to the window.
+ *
+ * Don't add more than PREVIEW16_MAX_WINDOW samples per window.
+ *
+ * @param samps pv->nchans values, in host byte order.
+ */
+void preview16_add(struct preview16 *pv, const uint16_t *samps);
+
+/**
+ * Summarize the window so far.
+ *
+ * Each output array gets pv->nchans values. The mean is rounded to
+ * the nearest integer, and the RMS is within one of the exact value.
+ * The window must have at least one sample.
+ */
+void preview16_finish(const struct preview16 *pv, uint16_t *min,
+                      uint16_t *max, uint16_t *mean, uint16_t *rms);
+
+/**
+ * Choose the preview16_add() implementation, e.g. for testing.
+ *
+ * They all give the same results.
+ *
+ * @return 0 on success, -1 if this CPU (or build) doesn't support it.
+ */
+int preview16_use(enum preview16_impl impl);
+
+/** Name of the preview16_add() implementation in use. */
+const char* preview16_impl_str(void);
+
+#endif  /* _LIB_PREVIEW16_H_ */
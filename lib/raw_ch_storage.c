@@ -65,6 +65,7 @@ struct ch_storage *raw_ch_storage_alloc(const char *out_file_path, mode_t mode)
     storage->ch_path = out_file_path;
     storage->ops = &raw_ch_storage_ops;
     storage->priv = data;
+    storage->ch_flags = 0;
     return storage;
 }
 
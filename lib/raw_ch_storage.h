@@ -17,7 +17,10 @@
  * @file raw_ch_storage.h
  * @brief Raw (i.e. write()-based) channel storage backend
  *
- * This is just for benchmarking.
+ * This is just for benchmarking. It writes struct raw_pkt_bsmp
+ * values exactly as it gets them, so with CH_STORAGE_WIRE_ORDER set,
+ * the samples in the file are big-endian and everything else is in
+ * host byte order.
  *
  * @see ch_storage.h
  */
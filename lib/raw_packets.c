@@ -19,9 +19,11 @@
 
 #include <arpa/inet.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include "bswap16.h"
 #include "logging.h"
 
 /*********************************************************************
@@ -112,8 +114,13 @@ size_t raw_pkt_size(const void *pkt)
 
 #define raw_ph_hton(ph) ((void)0)
 #define raw_ph_ntoh(ph) ((void)0)
-#define raw_samp_hton(samp_val) htons(samp_val)
-#define raw_samp_ntoh(samp_val) ntohs(samp_val)
+/* Samples are swapped a whole array at a time; see bswap16.h. */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define raw_samps_hton(samps, n) bswap16_buf((samps), (samps), (n))
+#else
+#define raw_samps_hton(samps, n) ((void)0)
+#endif
+#define raw_samps_ntoh(samps, n) raw_samps_hton(samps, n)
 #define raw_err_hton(pkt) ((void)0)
 #define raw_err_ntoh(pkt) ((void)0)
 #define raw_mtype_hton(mtype) (mtype)
@@ -142,22 +149,23 @@ static void raw_bsub_hton(struct raw_pkt_bsub *bsub)
     bsub->b_id = htonl(bsub->b_id);
     bsub->b_sidx = htonl(bsub->b_sidx);
     bsub->b_chip_live = htonl(bsub->b_chip_live);
-    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
-        bsub->b_samps[i] = raw_samp_hton(bsub->b_samps[i]);
-    }
+    raw_samps_hton(bsub->b_samps, RAW_BSUB_NSAMP);
     bsub->b_gpio = htons(bsub->b_gpio);
 }
 
-static void raw_bsmp_hton(struct raw_pkt_bsmp *bsmp)
+static void raw_bsmp_hdr_hton(struct raw_pkt_bsmp *bsmp)
 {
     bsmp->b_cookie_h = htonl(bsmp->b_cookie_h);
     bsmp->b_cookie_l = htonl(bsmp->b_cookie_l);
     bsmp->b_id = htonl(bsmp->b_id);
     bsmp->b_sidx = htonl(bsmp->b_sidx);
     bsmp->b_chip_live = htonl(bsmp->b_chip_live);
-    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
-        bsmp->b_samps[i] = raw_samp_hton(bsmp->b_samps[i]);
-    }
+}
+
+static void raw_bsmp_hton(struct raw_pkt_bsmp *bsmp)
+{
+    raw_bsmp_hdr_hton(bsmp);
+    raw_samps_hton(bsmp->b_samps, RAW_BSMP_NSAMP);
 }
 
 int raw_pkt_hton(void *pkt)
@@ -212,23 +220,24 @@ static int raw_bsub_ntoh(struct raw_pkt_bsub *bsub)
     bsub->b_id = ntohl(bsub->b_id);
     bsub->b_sidx = ntohl(bsub->b_sidx);
     bsub->b_chip_live = ntohl(bsub->b_chip_live);
-    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
-        bsub->b_samps[i] = raw_samp_ntoh(bsub->b_samps[i]);
-    }
+    raw_samps_ntoh(bsub->b_samps, RAW_BSUB_NSAMP);
     bsub->b_gpio = ntohs(bsub->b_gpio);
     return 0;
 }
 
-static void raw_bsmp_ntoh(struct raw_pkt_bsmp *bsmp)
+static void raw_bsmp_hdr_ntoh(struct raw_pkt_bsmp *bsmp)
 {
     bsmp->b_cookie_h = ntohl(bsmp->b_cookie_h);
     bsmp->b_cookie_l = ntohl(bsmp->b_cookie_l);
     bsmp->b_id = ntohl(bsmp->b_id);
     bsmp->b_sidx = ntohl(bsmp->b_sidx);
     bsmp->b_chip_live = ntohl(bsmp->b_chip_live);
-    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
-        bsmp->b_samps[i] = raw_samp_ntoh(bsmp->b_samps[i]);
-    }
+}
+
+static void raw_bsmp_ntoh(struct raw_pkt_bsmp *bsmp)
+{
+    raw_bsmp_hdr_ntoh(bsmp);
+    raw_samps_ntoh(bsmp->b_samps, RAW_BSMP_NSAMP);
 }
 
 int raw_pkt_ntoh(void *pkt)
@@ -260,6 +269,45 @@ int raw_pkt_ntoh(void *pkt)
     }
 }
 
+void raw_samps_ntoh_copy(raw_samp_t *dst, const raw_samp_t *src, size_t n)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    bswap16_buf(dst, src, n);
+#else
+    memcpy(dst, src, n * sizeof(raw_samp_t));
+#endif
+}
+
+int raw_pkt_hton_hdr(void *pkt)
+{
+    struct raw_pkt_header *ph = pkt;
+    if ((ph->_p_magic != RAW_PKT_HEADER_MAGIC ||
+         ph->p_proto_vers > RAW_PKT_HEADER_PROTO_VERS)) {
+        return -1;
+    }
+    if (raw_mtype(pkt) == RAW_MTYPE_BSMP) {
+        raw_ph_hton(ph);
+        raw_bsmp_hdr_hton((struct raw_pkt_bsmp*)pkt);
+        return 0;
+    }
+    return raw_pkt_hton(pkt);
+}
+
+int raw_pkt_ntoh_hdr(void *pkt)
+{
+    struct raw_pkt_header *ph = pkt;
+    raw_ph_ntoh(ph);
+    if ((ph->_p_magic != RAW_PKT_HEADER_MAGIC ||
+         ph->p_proto_vers > RAW_PKT_HEADER_PROTO_VERS)) {
+        return -1;
+    }
+    if (raw_mtype(pkt) == RAW_MTYPE_BSMP) {
+        raw_bsmp_hdr_ntoh((struct raw_pkt_bsmp*)pkt);
+        return 0;
+    }
+    return raw_pkt_ntoh(pkt);
+}
+
 ssize_t raw_cmd_send(int sockfd, struct raw_pkt_cmd *pkt, int flags)
 {
     if (raw_pkt_hton(pkt) == -1) {
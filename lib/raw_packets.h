@@ -531,6 +531,19 @@ size_t raw_pkt_size(const void *pkt);
 ///@{
 int raw_pkt_hton(void *pkt);
 int raw_pkt_ntoh(void *pkt);
+
+/**
+ * Like raw_pkt_ntoh() and raw_pkt_hton(), but leave a board sample's
+ * b_samps array in network (big-endian) byte order. Only the header
+ * fields (cookie, board ID, sample index, etc.) are converted. Other
+ * packet types are converted in full.
+ */
+int raw_pkt_hton_hdr(void *pkt);
+int raw_pkt_ntoh_hdr(void *pkt);
+
+/** Copy n samples left in network byte order by raw_pkt_ntoh_hdr()
+ * to dst, in host byte order. */
+void raw_samps_ntoh_copy(raw_samp_t *dst, const raw_samp_t *src, size_t n);
 ///@}
 
 /* Send a command packet.
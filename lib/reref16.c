@@ -0,0 +1,337 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "reref16.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define REREF16_X86 1
+#include <immintrin.h>
+#else
+#define REREF16_X86 0
+#endif
+
+/* Samples are centered on this. */
+#define REREF16_MID 0x8000
+
+typedef void (*reref16_fn)(struct reref16*, uint16_t*, const uint16_t*);
+
+/* Put the k-th smallest of v[0..n) at v[k], with smaller ones before
+ * it and bigger ones after. This is Wirth's version of Hoare's
+ * selection algorithm. */
+static void reref16_select(uint16_t *v, size_t n, size_t k)
+{
+    ptrdiff_t lo = 0, hi = (ptrdiff_t)n - 1, kk = (ptrdiff_t)k;
+    while (lo < hi) {
+        uint16_t pivot = v[kk];
+        ptrdiff_t i = lo, j = hi;
+        do {
+            while (v[i] < pivot) {
+                i++;
+            }
+            while (pivot < v[j]) {
+                j--;
+            }
+            if (i <= j) {
+                uint16_t t = v[i];
+                v[i++] = v[j];
+                v[j--] = t;
+            }
+        } while (i <= j);
+        if (j < kk) {
+            lo = i;
+        }
+        if (kk < i) {
+            hi = j;
+        }
+    }
+}
+
+/* Work out every group's median into rr->ref. */
+static void reref16_medians(struct reref16 *rr, const uint16_t *in)
+{
+    const uint16_t *m = rr->members;
+    for (size_t g = 0; g < rr->ngroups; g++) {
+        size_t n = rr->gsize[g];
+        for (size_t i = 0; i < n; i++) {
+            rr->sel[i] = in[m[i]];
+        }
+        size_t k = n / 2;
+        reref16_select(rr->sel, n, k);
+        uint32_t med = rr->sel[k];
+        if (n % 2 == 0) {
+            /* The middle one below is the biggest of the rest. */
+            uint16_t below = rr->sel[0];
+            for (size_t i = 1; i < k; i++) {
+                below = rr->sel[i] > below ? rr->sel[i] : below;
+            }
+            med = (med + below + 1) / 2;
+        }
+        rr->ref[g] = (uint16_t)med;
+        m += n;
+    }
+}
+
+/* Turn the sums in rr->sum into means in rr->ref. */
+static void reref16_means(struct reref16 *rr)
+{
+    for (size_t g = 0; g < rr->ngroups; g++) {
+        uint32_t n = rr->gsize[g];
+        rr->ref[g] = (uint16_t)((rr->sum[g] + n / 2) / n);
+    }
+}
+
+/* The channel minus its reference, plus REREF16_MID, clamped. */
+static inline uint16_t reref16_sub(uint16_t x, uint16_t ref)
+{
+    int32_t v = (int32_t)x - ref + REREF16_MID;
+    return (uint16_t)(v < 0 ? 0 : v > UINT16_MAX ? UINT16_MAX : v);
+}
+
+/* Subtract references from channels [start, start + len) of in. */
+static void reref16_sub_range(uint16_t *out, const uint16_t *in,
+                              size_t start, size_t len, uint16_t ref)
+{
+    for (size_t i = start; i < start + len; i++) {
+        out[i] = reref16_sub(in[i], ref);
+    }
+}
+
+/* Copy channels that aren't in any group, if in isn't out. */
+static void reref16_copy_rest(struct reref16 *rr, uint16_t *out,
+                              const uint16_t *in)
+{
+    if (out == in) {
+        return;
+    }
+    size_t next = 0;
+    for (size_t r = 0; r < rr->nruns; r++) {
+        const struct reref16_run *run = &rr->runs[r];
+        memcpy(out + next, in + next, (run->start - next) * sizeof(*in));
+        next = run->start + (size_t)run->len;
+    }
+    memcpy(out + next, in + next, (rr->nchans - next) * sizeof(*in));
+}
+
+static void reref16_run_scalar(struct reref16 *rr, uint16_t *out,
+                               const uint16_t *in)
+{
+    if (rr->method == REREF16_MEAN) {
+        memset(rr->sum, 0, rr->ngroups * sizeof(rr->sum[0]));
+        for (size_t r = 0; r < rr->nruns; r++) {
+            const struct reref16_run *run = &rr->runs[r];
+            uint32_t sum = 0;
+            for (size_t i = run->start; i < run->start + run->len; i++) {
+                sum += in[i];
+            }
+            rr->sum[run->group] += sum;
+        }
+        reref16_means(rr);
+    } else {
+        reref16_medians(rr, in);
+    }
+    reref16_copy_rest(rr, out, in);
+    for (size_t r = 0; r < rr->nruns; r++) {
+        const struct reref16_run *run = &rr->runs[r];
+        reref16_sub_range(out, in, run->start, run->len,
+                          rr->ref[run->group]);
+    }
+}
+
+#if REREF16_X86
+/* Sum of 16 samples, as 8 32-bit partial sums. */
+__attribute__((target("avx2")))
+static inline __m256i reref16_sum16_avx2(__m256i acc, const uint16_t *in)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i v = _mm256_loadu_si256((const __m256i*)in);
+    acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+    return _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+}
+
+/* The same as reref16_run_scalar(), 16 channels of each run at a
+ * time. The subtraction works on samples with their top bits
+ * flipped, i.e. as signed offsets from REREF16_MID, so it can
+ * saturate like reref16_sub() clamps. */
+__attribute__((target("avx2")))
+static void reref16_run_avx2(struct reref16 *rr, uint16_t *out,
+                             const uint16_t *in)
+{
+    const __m256i flip = _mm256_set1_epi16((short)REREF16_MID);
+    if (rr->method == REREF16_MEAN) {
+        memset(rr->sum, 0, rr->ngroups * sizeof(rr->sum[0]));
+        for (size_t r = 0; r < rr->nruns; r++) {
+            const struct reref16_run *run = &rr->runs[r];
+            size_t i = run->start, end = i + run->len;
+            __m256i acc = _mm256_setzero_si256();
+            for (; i + 16 <= end; i += 16) {
+                acc = reref16_sum16_avx2(acc, in + i);
+            }
+            __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                      _mm256_extracti128_si256(acc, 1));
+            s = _mm_hadd_epi32(s, s);
+            s = _mm_hadd_epi32(s, s);
+            uint32_t sum = (uint32_t)_mm_cvtsi128_si32(s);
+            for (; i < end; i++) {
+                sum += in[i];
+            }
+            rr->sum[run->group] += sum;
+        }
+        reref16_means(rr);
+    } else {
+        reref16_medians(rr, in);
+    }
+    reref16_copy_rest(rr, out, in);
+    for (size_t r = 0; r < rr->nruns; r++) {
+        const struct reref16_run *run = &rr->runs[r];
+        uint16_t ref = rr->ref[run->group];
+        __m256i vref = _mm256_xor_si256(_mm256_set1_epi16((short)ref),
+                                        flip);
+        size_t i = run->start, end = i + run->len;
+        for (; i + 16 <= end; i += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+            v = _mm256_subs_epi16(_mm256_xor_si256(v, flip), vref);
+            _mm256_storeu_si256((__m256i*)(out + i),
+                                _mm256_xor_si256(v, flip));
+        }
+        reref16_sub_range(out, in, i, end - i, ref);
+    }
+}
+#endif
+
+int reref16_configure(struct reref16 *rr, enum reref16_method method,
+                      const uint16_t *groups, size_t nchans)
+{
+    uint16_t index[REREF16_MAX_CHANS];
+    uint16_t next[REREF16_MAX_CHANS];
+    if ((method != REREF16_MEAN && method != REREF16_MEDIAN) ||
+        nchans == 0 || nchans > REREF16_MAX_CHANS) {
+        return -1;
+    }
+    for (size_t i = 0; i < nchans; i++) {
+        if (groups[i] >= REREF16_MAX_CHANS &&
+            groups[i] != REREF16_NO_GROUP) {
+            return -1;
+        }
+    }
+
+    /* Renumber the groups and count their channels. */
+    memset(index, 0xFF, sizeof(index));
+    rr->method = method;
+    rr->nchans = nchans;
+    rr->ngroups = 0;
+    rr->nruns = 0;
+    for (size_t i = 0; i < nchans; i++) {
+        uint16_t id = groups[i];
+        if (id == REREF16_NO_GROUP) {
+            continue;
+        }
+        if (index[id] == REREF16_NO_GROUP) {
+            index[id] = (uint16_t)rr->ngroups;
+            rr->gsize[rr->ngroups++] = 0;
+        }
+        uint16_t g = index[id];
+        rr->gsize[g]++;
+        struct reref16_run *run = rr->nruns ? &rr->runs[rr->nruns - 1] : NULL;
+        if (run && run->group == g && run->start + (size_t)run->len == i) {
+            run->len++;
+        } else {
+            run = &rr->runs[rr->nruns++];
+            run->start = (uint16_t)i;
+            run->len = 1;
+            run->group = g;
+        }
+    }
+
+    /* List each group's channels. */
+    uint16_t off = 0;
+    for (size_t g = 0; g < rr->ngroups; g++) {
+        next[g] = off;
+        off += rr->gsize[g];
+    }
+    for (size_t i = 0; i < nchans; i++) {
+        if (groups[i] != REREF16_NO_GROUP) {
+            rr->members[next[index[groups[i]]]++] = (uint16_t)i;
+        }
+    }
+    return 0;
+}
+
+static reref16_fn reref16_lookup(enum reref16_impl impl)
+{
+    switch (impl) {
+    case REREF16_AUTO:
+#if REREF16_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return reref16_run_avx2;
+        }
+#endif
+        return reref16_run_scalar;
+    case REREF16_SCALAR:
+        return reref16_run_scalar;
+#if REREF16_X86
+    case REREF16_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? reref16_run_avx2 : NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static void reref16_first(struct reref16*, uint16_t*, const uint16_t*);
+
+/* Atomic, so threads racing through the first call are harmless. */
+static reref16_fn reref16_impl_fn = reref16_first;
+
+static void reref16_first(struct reref16 *rr, uint16_t *out,
+                          const uint16_t *in)
+{
+    reref16_fn fn = reref16_lookup(REREF16_AUTO);
+    __atomic_store_n(&reref16_impl_fn, fn, __ATOMIC_RELAXED);
+    fn(rr, out, in);
+}
+
+void reref16_run(struct reref16 *rr, uint16_t *out, const uint16_t *in)
+{
+    __atomic_load_n(&reref16_impl_fn, __ATOMIC_RELAXED)(rr, out, in);
+}
+
+int reref16_use(enum reref16_impl impl)
+{
+    reref16_fn fn = reref16_lookup(impl);
+    if (!fn) {
+        return -1;
+    }
+    __atomic_store_n(&reref16_impl_fn, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+const char* reref16_impl_str(void)
+{
+    reref16_fn fn = __atomic_load_n(&reref16_impl_fn, __ATOMIC_RELAXED);
+    if (fn == reref16_first) {
+        fn = reref16_lookup(REREF16_AUTO);
+    }
+#if REREF16_X86
+    if (fn == reref16_run_avx2) {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
@@ -0,0 +1,133 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   reref16.h
+ * @brief  Re-referencing 16-bit sample arrays to channel groups
+ *
+ * Channels are split into groups, e.g. one per chip or per shank.
+ * For each sample, a group's reference is the mean or the median of
+ * its channels, and each channel gets its group's reference
+ * subtracted. This takes out noise that all the group's channels
+ * pick up, like a common average reference (CAR) does for a whole
+ * probe.
+ *
+ * Samples are unsigned ADC counts centered on 32768, and so are the
+ * results: a channel that's right at its group's reference comes
+ * out as 32768. Results are clamped to 0..65535. Channels that
+ * aren't in any group come out unchanged.
+ *
+ * Group members needn't be next to each other, but it's fastest when
+ * they are, as they are for chips in a board sample (chip c's
+ * channel k is sample 32 * c + k). reref16_run() uses AVX2 for the
+ * means and the subtraction if the CPU we're running on has it,
+ * chosen at run time like bswap16_buf(), 16 channels at a time.
+ * Medians are found one group at a time, without it. Either way,
+ * the results are the same.
+ */
+
+#ifndef _LIB_REREF16_H_
+#define _LIB_REREF16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "raw_packets.h"
+
+/** Most channels a sample can have. */
+#define REREF16_MAX_CHANS RAW_BSMP_NSAMP
+
+/** Group of a channel that isn't in any group. */
+#define REREF16_NO_GROUP UINT16_MAX
+
+/** How a group's reference is worked out. */
+enum reref16_method {
+    REREF16_MEAN = 0,           /**< Mean, rounded to nearest */
+    REREF16_MEDIAN,             /**< Median; with an even number of
+                                 * channels, the mean of the middle
+                                 * two, rounded up */
+};
+
+/** A run of channels that are next to each other in one group. */
+struct reref16_run {
+    uint16_t start;             /**< First channel */
+    uint16_t len;               /**< Number of channels */
+    uint16_t group;             /**< Its group's index */
+};
+
+/**
+ * Re-referencing configuration, and scratch space for using it.
+ *
+ * Groups are renumbered 0 to ngroups - 1 in order of their first
+ * channel.
+ */
+struct reref16 {
+    /* Configuration; see reref16_configure(). */
+    enum reref16_method method;
+    size_t nchans;
+    size_t ngroups;
+    size_t nruns;
+    struct reref16_run runs[REREF16_MAX_CHANS];
+    uint16_t gsize[REREF16_MAX_CHANS]; /**< Channels in each group */
+    /** Each group's channels, one group after another. */
+    uint16_t members[REREF16_MAX_CHANS];
+
+    /* Scratch space for reref16_run(). */
+    uint32_t sum[REREF16_MAX_CHANS];
+    uint16_t ref[REREF16_MAX_CHANS];
+    uint16_t sel[REREF16_MAX_CHANS];
+};
+
+/** Implementations of reref16_run(). */
+enum reref16_impl {
+    REREF16_AUTO = 0,           /**< Best one the CPU supports */
+    REREF16_SCALAR,
+    REREF16_AVX2,
+};
+
+/**
+ * Configure re-referencing.
+ *
+ * @param groups nchans group numbers, one per channel. Channels with
+ *               the same number are in the same group. Numbers must
+ *               be less than REREF16_MAX_CHANS, or REREF16_NO_GROUP.
+ * @param nchans Channels per sample, 1 to REREF16_MAX_CHANS.
+ * @return 0 on success, -1 if the method, a group number, or nchans
+ *         is invalid. rr is unchanged then.
+ */
+int reref16_configure(struct reref16 *rr, enum reref16_method method,
+                      const uint16_t *groups, size_t nchans);
+
+/**
+ * Re-reference a sample.
+ *
+ * @param out Where to put the rr->nchans results; may be in.
+ * @param in rr->nchans values, in host byte order.
+ */
+void reref16_run(struct reref16 *rr, uint16_t *out, const uint16_t *in);
+
+/**
+ * Choose the reref16_run() implementation, e.g. for testing.
+ *
+ * They all give the same results.
+ *
+ * @return 0 on success, -1 if this CPU (or build) doesn't support it.
+ */
+int reref16_use(enum reref16_impl impl);
+
+/** Name of the reref16_run() implementation in use. */
+const char* reref16_impl_str(void);
+
+#endif  /* _LIB_REREF16_H_ */
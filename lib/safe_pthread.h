@@ -51,6 +51,9 @@
 #define safe_p_cond_signal(cv)                                  \
     do { SAFE_PTHREAD_LOG("%s: signal(%s)", __func__, #cv);     \
         __safe_p_cond_signal(cv); } while (0)
+#define safe_p_cond_broadcast(cv)                               \
+    do { SAFE_PTHREAD_LOG("%s: broadcast(%s)", __func__, #cv);  \
+        __safe_p_cond_broadcast(cv); } while (0)
 #define safe_p_join(t, rv)                                      \
     do { SAFE_PTHREAD_LOG("%s: join(%s)", __func__, #t);        \
          __safe_p_join(t, rv); } while (0)
@@ -112,6 +115,14 @@ static inline void __safe_p_cond_signal(pthread_cond_t *cv)
     }
 }
 
+static inline void __safe_p_cond_broadcast(pthread_cond_t *cv)
+{
+    int en = pthread_cond_broadcast(cv);
+    if (en) {
+        abort();
+    }
+}
+
 static inline void __safe_p_join(pthread_t t, void **retval)
 {
     void *rv;
@@ -54,6 +54,15 @@ int sockutil_ntop(struct sockaddr *a, char *dst, socklen_t size)
         in_s = inet_ntop(AF_INET6, &ain6->sin6_addr, dst, size);
         break;
     }
+    case AF_UNIX: {
+        struct sockaddr_un *aun = (struct sockaddr_un*)a;
+        if (size <= sizeof(aun->sun_path)) {
+            return -1;
+        }
+        memcpy(dst, aun->sun_path, sizeof(aun->sun_path));
+        dst[sizeof(aun->sun_path)] = '\0';
+        return 0;
+    }
     default:
         return -1;
     }
@@ -95,18 +104,31 @@ static int sockutil_a6_eq(struct sockaddr_in6 *a, struct sockaddr_in6 *b,
     return 1;
 }
 
+static int sockutil_un_eq(struct sockaddr_un *a, struct sockaddr_un *b)
+{
+    return !strncmp(a->sun_path, b->sun_path, sizeof(a->sun_path));
+}
+
 int sockutil_addr_eq(struct sockaddr *a, struct sockaddr *b, unsigned ignore)
 {
-    assert(a->sa_family == AF_INET || a->sa_family == AF_INET6);
-    assert(b->sa_family == AF_INET || b->sa_family == AF_INET6);
+    assert(a->sa_family == AF_INET || a->sa_family == AF_INET6 ||
+           a->sa_family == AF_UNIX);
+    assert(b->sa_family == AF_INET || b->sa_family == AF_INET6 ||
+           b->sa_family == AF_UNIX);
     if (a->sa_family != b->sa_family) {
         return 0;
     }
-    return (a->sa_family == AF_INET) ?
-        sockutil_a4_eq((struct sockaddr_in*)a, (struct sockaddr_in*)b,
-                       ignore) :
-        sockutil_a6_eq((struct sockaddr_in6*)a, (struct sockaddr_in6*)b,
-                       ignore);
+    switch (a->sa_family) {
+    case AF_INET:
+        return sockutil_a4_eq((struct sockaddr_in*)a,
+                              (struct sockaddr_in*)b, ignore);
+    case AF_INET6:
+        return sockutil_a6_eq((struct sockaddr_in6*)a,
+                              (struct sockaddr_in6*)b, ignore);
+    default:
+        return sockutil_un_eq((struct sockaddr_un*)a,
+                              (struct sockaddr_un*)b);
+    }
 }
 
 /* Socket configuration function, for sockutil_get_socket(). Takes a
@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 
 static inline socklen_t sockutil_addrlen(struct sockaddr *a)
@@ -34,6 +35,8 @@ static inline socklen_t sockutil_addrlen(struct sockaddr *a)
         return sizeof(struct sockaddr_in);
     case AF_INET6:
         return sizeof(struct sockaddr_in6);
+    case AF_UNIX:
+        return sizeof(struct sockaddr_un);
     default:
         assert(0);
         return 0;
@@ -45,6 +48,7 @@ static inline ssize_t sockutil_addrstrlen(struct sockaddr *a)
     switch (a->sa_family) {
     case AF_INET: return INET_ADDRSTRLEN;
     case AF_INET6: return INET6_ADDRSTRLEN;
+    case AF_UNIX: return sizeof(((struct sockaddr_un*)a)->sun_path) + 1;
     default: return -1;
     }
 }
@@ -70,8 +74,9 @@ int sockutil_ntop(struct sockaddr *a, char *dst, socklen_t size);
 /**
  * @brief Test if two socket addresses are equal.
  *
- * The socket addresses must have families that are either AF_INET or
- * AF_INET6.
+ * The socket addresses must have families that are AF_INET, AF_INET6,
+ * or AF_UNIX. Unix-domain addresses are equal if their paths are;
+ * "ignore" doesn't apply to them.
  *
  * @param a First socket address
  * @param b Second socket address
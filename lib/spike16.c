@@ -0,0 +1,328 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spike16.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPIKE16_X86 1
+#include <immintrin.h>
+#else
+#define SPIKE16_X86 0
+#endif
+
+/* How far each sample moves the median and MAD estimates, in 8.8
+ * fixed point. The baseline can follow slow drift, but not a spike;
+ * the MAD moves slower still, so it settles within a few hundred
+ * samples of noise. */
+#define SPIKE16_MED_STEP 256
+#define SPIKE16_MAD_STEP 16
+
+/* Adaptive thresholds follow the MAD every this many samples. */
+#define SPIKE16_THR_EVERY 32
+
+/* The MAD of Gaussian noise, in standard deviations. */
+#define SPIKE16_MAD_PER_SIGMA 0.67449
+
+typedef void (*spike16_fn)(struct spike16*, const uint16_t*);
+
+/*
+ * Update channels [start, sp->nchans) with their next samples, and
+ * set their bits in sp->crossed. Their bits must be clear already.
+ */
+static void spike16_add_range(struct spike16 *sp, const uint16_t *samps,
+                              size_t start)
+{
+    for (size_t i = start; i < sp->nchans; i++) {
+        int32_t d = (int32_t)samps[i] * 256 - sp->med[i];
+        sp->med[i] += (d > 0 ? SPIKE16_MED_STEP :
+                       d < 0 ? -SPIKE16_MED_STEP : 0);
+        int32_t a = d < 0 ? -d : d;
+        sp->mad[i] += (a > sp->mad[i] ? SPIKE16_MAD_STEP :
+                       a < sp->mad[i] ? -SPIKE16_MAD_STEP : 0);
+        /* Flip d's sign along with the threshold's, so we only need
+         * to look above it. */
+        int32_t t = sp->thr[i];
+        int32_t flip = t >> 31;
+        int32_t dd = (d ^ flip) - flip;
+        int32_t beyond = t != 0 && dd > (t ^ flip) - flip ? -1 : 0;
+        int cross = beyond && !sp->was_beyond[i] && !sp->refractory[i];
+        sp->was_beyond[i] = beyond;
+        if (cross) {
+            sp->refractory[i] = SPIKE16_REFRACTORY;
+            sp->crossed[i / 8] |= (uint8_t)(1U << (i % 8));
+        } else if (sp->refractory[i]) {
+            sp->refractory[i]--;
+        }
+    }
+}
+
+static void spike16_add_scalar(struct spike16 *sp, const uint16_t *samps)
+{
+    spike16_add_range(sp, samps, 0);
+}
+
+#if SPIKE16_X86
+/* The same as spike16_add_range(), 8 channels at a time, with
+ * compares standing in for the branches. */
+__attribute__((target("avx2")))
+static void spike16_add_avx2(struct spike16 *sp, const uint16_t *samps)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i med_step = _mm256_set1_epi32(SPIKE16_MED_STEP);
+    const __m256i mad_step = _mm256_set1_epi32(SPIKE16_MAD_STEP);
+    const __m256i refr = _mm256_set1_epi32(SPIKE16_REFRACTORY);
+    size_t i;
+    for (i = 0; i + 8 <= sp->nchans; i += 8) {
+        __m256i *medp = (__m256i*)(sp->med + i);
+        __m256i *madp = (__m256i*)(sp->mad + i);
+        __m256i *wasp = (__m256i*)(sp->was_beyond + i);
+        __m256i *refp = (__m256i*)(sp->refractory + i);
+        __m128i v16 = _mm_loadu_si128((const __m128i*)(samps + i));
+        __m256i med = _mm256_loadu_si256(medp);
+        __m256i mad = _mm256_loadu_si256(madp);
+        __m256i t = _mm256_loadu_si256((const __m256i*)(sp->thr + i));
+        __m256i was = _mm256_loadu_si256(wasp);
+        __m256i ref = _mm256_loadu_si256(refp);
+
+        __m256i d = _mm256_sub_epi32(
+            _mm256_slli_epi32(_mm256_cvtepu16_epi32(v16), 8), med);
+        med = _mm256_add_epi32(
+            med, _mm256_sub_epi32(
+                _mm256_and_si256(_mm256_cmpgt_epi32(d, zero), med_step),
+                _mm256_and_si256(_mm256_cmpgt_epi32(zero, d), med_step)));
+        __m256i a = _mm256_abs_epi32(d);
+        mad = _mm256_add_epi32(
+            mad, _mm256_sub_epi32(
+                _mm256_and_si256(_mm256_cmpgt_epi32(a, mad), mad_step),
+                _mm256_and_si256(_mm256_cmpgt_epi32(mad, a), mad_step)));
+
+        __m256i flip = _mm256_srai_epi32(t, 31);
+        __m256i dd = _mm256_sub_epi32(_mm256_xor_si256(d, flip), flip);
+        __m256i beyond = _mm256_andnot_si256(
+            _mm256_cmpeq_epi32(t, zero),
+            _mm256_cmpgt_epi32(dd, _mm256_abs_epi32(t)));
+        __m256i cross = _mm256_andnot_si256(
+            was, _mm256_and_si256(beyond, _mm256_cmpeq_epi32(ref, zero)));
+        ref = _mm256_max_epi32(_mm256_sub_epi32(ref, one), zero);
+        ref = _mm256_blendv_epi8(ref, refr, cross);
+
+        _mm256_storeu_si256(medp, med);
+        _mm256_storeu_si256(madp, mad);
+        _mm256_storeu_si256(wasp, beyond);
+        _mm256_storeu_si256(refp, ref);
+        sp->crossed[i / 8] =
+            (uint8_t)_mm256_movemask_ps(_mm256_castsi256_ps(cross));
+    }
+    spike16_add_range(sp, samps, i);
+}
+#endif
+
+int spike16_configure(struct spike16 *sp, const struct spike16_cfg *cfg)
+{
+    size_t nfixed = cfg->thresholds ? cfg->nthresholds : 0;
+    double mult = (nfixed ? 0 :
+                   cfg->sigmas / SPIKE16_MAD_PER_SIGMA * 256);
+    if (nfixed > SPIKE16_MAX_CHANS ||
+        !(mult > -0x10000 && mult < 0x10000) ||
+        cfg->snippet_pre >= SPIKE16_SNIPPET_MAX ||
+        cfg->snippet_pre + cfg->snippet_post > SPIKE16_SNIPPET_MAX) {
+        return -1;
+    }
+    for (size_t i = 0; i < nfixed; i++) {
+        int32_t t = cfg->thresholds[i];
+        if (t <= -0x10000 || t >= 0x10000) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < nfixed; i++) {
+        sp->fixed[i] = cfg->thresholds[i] * 256;
+    }
+    sp->nfixed = nfixed;
+    sp->mult = (int32_t)(mult < 0 ? mult - 0.5 : mult + 0.5);
+    sp->pre = cfg->snippet_pre;
+    sp->post = cfg->snippet_post;
+    sp->nchans = 0;
+    return 0;
+}
+
+int spike16_restart(struct spike16 *sp, size_t nchans)
+{
+    if (nchans > SPIKE16_MAX_CHANS ||
+        (sp->nfixed > 1 && sp->nfixed != nchans)) {
+        sp->nchans = 0;
+        return -1;
+    }
+    sp->nchans = nchans;
+    sp->nsamps = 0;
+    sp->nlost = 0;
+    sp->pending_head = 0;
+    sp->npending = 0;
+    for (size_t i = 0; i < nchans; i++) {
+        sp->thr[i] = (sp->nfixed == 0 ? 0 :
+                      sp->fixed[sp->nfixed == 1 ? 0 : i]);
+    }
+    memset(sp->mad, 0, nchans * sizeof(sp->mad[0]));
+    memset(sp->was_beyond, 0, nchans * sizeof(sp->was_beyond[0]));
+    memset(sp->refractory, 0, nchans * sizeof(sp->refractory[0]));
+    return 0;
+}
+
+/* Keep adaptive thresholds a fixed multiple of the MAD. Clamp them
+ * to the sample range, so their absolute values fit. */
+static void spike16_adapt(struct spike16 *sp)
+{
+    const int64_t lim = (int64_t)0x10000 * 256;
+    for (size_t i = 0; i < sp->nchans; i++) {
+        int64_t t = ((int64_t)sp->mad[i] * sp->mult) >> 8;
+        sp->thr[i] = (int32_t)(t < -lim ? -lim : t > lim ? lim : t);
+    }
+}
+
+static void spike16_first(struct spike16*, const uint16_t*);
+
+/* Atomic, so threads racing through the first call are harmless. */
+static spike16_fn spike16_impl_fn = spike16_first;
+
+static void spike16_queue(struct spike16 *sp, uint32_t sidx)
+{
+    for (size_t b = 0; b < (sp->nchans + 7) / 8; b++) {
+        unsigned bits = sp->crossed[b];
+        while (bits) {
+            unsigned i = (unsigned)__builtin_ctz(bits);
+            bits &= bits - 1;
+            if (sp->npending == SPIKE16_MAX_PENDING) {
+                sp->nlost++;
+                continue;
+            }
+            size_t at = ((sp->pending_head + sp->npending) %
+                         SPIKE16_MAX_PENDING);
+            sp->pending[at].when = sp->nsamps;
+            sp->pending[at].sidx = sidx;
+            sp->pending[at].chan = (uint16_t)(b * 8 + i);
+            sp->npending++;
+        }
+    }
+}
+
+void spike16_add(struct spike16 *sp, const uint16_t *samps, uint32_t sidx)
+{
+    if (sp->nsamps == 0) {
+        for (size_t i = 0; i < sp->nchans; i++) {
+            sp->med[i] = (int32_t)samps[i] * 256;
+        }
+    }
+    if (sp->nfixed == 0 && sp->nsamps % SPIKE16_THR_EVERY == 0) {
+        spike16_adapt(sp);
+    }
+    memset(sp->crossed, 0, (sp->nchans + 7) / 8);
+    __atomic_load_n(&spike16_impl_fn, __ATOMIC_RELAXED)(sp, samps);
+    if (sp->pre + sp->post) {
+        memcpy(sp->hist[sp->nsamps % SPIKE16_SNIPPET_MAX], samps,
+               sp->nchans * sizeof(uint16_t));
+    }
+    if (sp->nsamps >= SPIKE16_WARMUP) {
+        spike16_queue(sp, sidx);
+    }
+    sp->nsamps++;
+}
+
+size_t spike16_ready(struct spike16 *sp, uint32_t *sidx, uint16_t *chans,
+                     uint16_t *snippets, size_t max)
+{
+    /* A crossing's snippet is complete once we've got the last of its
+     * samples; if it has none from the crossing on, we still need the
+     * crossing itself to know about it. */
+    uint64_t wait = sp->post ? sp->post - 1 : 0;
+    size_t len = sp->pre + sp->post;
+    size_t n = 0;
+    if (!sp->npending ||
+        sp->pending[sp->pending_head].when + wait >= sp->nsamps) {
+        return 0;
+    }
+    uint64_t when = sp->pending[sp->pending_head].when;
+    *sidx = sp->pending[sp->pending_head].sidx;
+    while (n < max && sp->npending &&
+           sp->pending[sp->pending_head].when == when) {
+        uint16_t chan = sp->pending[sp->pending_head].chan;
+        chans[n] = chan;
+        for (size_t j = 0; j < len; j++) {
+            uint64_t at = when - sp->pre + j;
+            snippets[n * len + j] =
+                sp->hist[at % SPIKE16_SNIPPET_MAX][chan];
+        }
+        sp->pending_head = (sp->pending_head + 1) % SPIKE16_MAX_PENDING;
+        sp->npending--;
+        n++;
+    }
+    return n;
+}
+
+static spike16_fn spike16_lookup(enum spike16_impl impl)
+{
+    switch (impl) {
+    case SPIKE16_AUTO:
+#if SPIKE16_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return spike16_add_avx2;
+        }
+#endif
+        return spike16_add_scalar;
+    case SPIKE16_SCALAR:
+        return spike16_add_scalar;
+#if SPIKE16_X86
+    case SPIKE16_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? spike16_add_avx2 : NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static void spike16_first(struct spike16 *sp, const uint16_t *samps)
+{
+    spike16_fn fn = spike16_lookup(SPIKE16_AUTO);
+    __atomic_store_n(&spike16_impl_fn, fn, __ATOMIC_RELAXED);
+    fn(sp, samps);
+}
+
+int spike16_use(enum spike16_impl impl)
+{
+    spike16_fn fn = spike16_lookup(impl);
+    if (!fn) {
+        return -1;
+    }
+    __atomic_store_n(&spike16_impl_fn, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+const char* spike16_impl_str(void)
+{
+    spike16_fn fn = __atomic_load_n(&spike16_impl_fn, __ATOMIC_RELAXED);
+    if (fn == spike16_first) {
+        fn = spike16_lookup(SPIKE16_AUTO);
+    }
+#if SPIKE16_X86
+    if (fn == spike16_add_avx2) {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
@@ -0,0 +1,194 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   spike16.h
+ * @brief  Threshold crossing ("spike") detection on 16-bit samples
+ *
+ * This is what finds the events in a BoardSpikes (see
+ * proto/data.proto). Each channel's baseline is a running estimate of
+ * its median, and its noise level is a running estimate of the
+ * median absolute deviation (MAD) from that baseline. Both are
+ * nudged a fixed step towards each new sample, which is cheap and
+ * needs no history. A channel crosses when its distance from the
+ * baseline goes past its threshold, having been inside it the
+ * sample before. It then can't cross again for SPIKE16_REFRACTORY
+ * samples.
+ *
+ * Thresholds are either fixed, in ADC counts from the baseline, or
+ * adaptive, in multiples of the noise's standard deviation (which
+ * is about 1.4826 times the MAD). Either way, their sign says which
+ * way to look: negative thresholds catch samples below the
+ * baseline, and positive ones, above it. A threshold of 0 turns the
+ * channel off.
+ *
+ * Optionally, each event comes with a snippet of the channel's
+ * samples around the crossing. Events wait until their snippets
+ * are complete; see spike16_ready().
+ *
+ * spike16_add() uses AVX2 if the CPU we're running on has it,
+ * chosen at run time like bswap16_buf(), working on 8 channels at a
+ * time. The scalar version finds exactly the same events.
+ */
+
+#ifndef _LIB_SPIKE16_H_
+#define _LIB_SPIKE16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "raw_packets.h"
+
+/** Most channels a detector can have. */
+#define SPIKE16_MAX_CHANS RAW_BSMP_NSAMP
+
+/** Longest snippet, in samples. */
+#define SPIKE16_SNIPPET_MAX 64
+
+/** Samples after a crossing before the channel can cross again. */
+#define SPIKE16_REFRACTORY 30
+
+/** Samples after spike16_restart() before any crossings count, so
+ * the baseline and noise estimates can settle. */
+#define SPIKE16_WARMUP 3000
+
+/** Most events waiting for their snippets; more are dropped. */
+#define SPIKE16_MAX_PENDING 1024
+
+/** Detector configuration. */
+struct spike16_cfg {
+    /** Fixed thresholds, in ADC counts from the baseline: one per
+     * channel, or a single one for every channel. If NULL (or
+     * nthresholds is 0), thresholds are adaptive instead. */
+    const int32_t *thresholds;
+    size_t nthresholds;         /**< Length of thresholds. */
+    /** Adaptive threshold, in standard deviations of the noise,
+     * e.g. -4.5. Ignored with fixed thresholds. */
+    float sigmas;
+    /** Snippet samples before the crossing; less than
+     * SPIKE16_SNIPPET_MAX. */
+    unsigned snippet_pre;
+    /** Snippet samples from the crossing on. At most
+     * SPIKE16_SNIPPET_MAX - snippet_pre. If snippet_pre and this are
+     * both 0, there are no snippets. */
+    unsigned snippet_post;
+};
+
+/** An event waiting for the rest of its snippet. */
+struct spike16_event {
+    uint64_t when;              /**< Sample number of the crossing. */
+    uint32_t sidx;              /**< Caller's index for that sample. */
+    uint16_t chan;              /**< Channel that crossed. */
+};
+
+/**
+ * Detector state.
+ *
+ * The per-channel estimates are fixed point, with 8 fractional bits.
+ */
+struct spike16 {
+    /* Configuration; see spike16_configure(). */
+    int32_t fixed[SPIKE16_MAX_CHANS]; /**< If nfixed is nonzero. */
+    size_t nfixed;
+    int32_t mult;               /**< Adaptive threshold / MAD, 8.8. */
+    unsigned pre;
+    unsigned post;
+
+    /* State; see spike16_restart(). */
+    size_t nchans;
+    uint64_t nsamps;            /**< Samples added so far. */
+    uint64_t nlost;             /**< Events dropped; see
+                                 * SPIKE16_MAX_PENDING. */
+    int32_t med[SPIKE16_MAX_CHANS];
+    int32_t mad[SPIKE16_MAX_CHANS];
+    int32_t thr[SPIKE16_MAX_CHANS];
+    int32_t was_beyond[SPIKE16_MAX_CHANS]; /**< All ones or zero. */
+    int32_t refractory[SPIKE16_MAX_CHANS];
+    uint8_t crossed[(SPIKE16_MAX_CHANS + 7) / 8]; /**< Bitmap, from
+                                                    * the last sample */
+    uint16_t hist[SPIKE16_SNIPPET_MAX][SPIKE16_MAX_CHANS]; /**< Recent
+                                                             * samples */
+    struct spike16_event pending[SPIKE16_MAX_PENDING]; /**< A ring */
+    size_t pending_head;
+    size_t npending;
+};
+
+/** Implementations of spike16_add(). */
+enum spike16_impl {
+    SPIKE16_AUTO = 0,           /**< Best one the CPU supports */
+    SPIKE16_SCALAR,
+    SPIKE16_AVX2,
+};
+
+/**
+ * Configure a detector. Call spike16_restart() before using it.
+ *
+ * @return 0 on success, -1 if cfg is invalid: too many thresholds,
+ *         a threshold or sigmas out of range, or too long a snippet.
+ *         sp is unchanged then.
+ */
+int spike16_configure(struct spike16 *sp, const struct spike16_cfg *cfg);
+
+/**
+ * Start detecting from scratch, keeping the configuration.
+ *
+ * @param nchans Channels per sample, at most SPIKE16_MAX_CHANS. If
+ *               the thresholds are fixed, there must be one of them,
+ *               or nchans.
+ * @return 0 on success, -1 if nchans doesn't fit the configuration.
+ *         Then sp has no channels until the next restart.
+ */
+int spike16_restart(struct spike16 *sp, size_t nchans);
+
+/**
+ * Look for crossings in the next sample.
+ *
+ * Call spike16_ready() until it returns 0 after each call.
+ *
+ * @param samps sp->nchans values, in host byte order.
+ * @param sidx Caller's index for this sample, passed back by
+ *             spike16_ready().
+ */
+void spike16_add(struct spike16 *sp, const uint16_t *samps, uint32_t sidx);
+
+/**
+ * Collect events whose snippets are complete.
+ *
+ * Each call returns events from just one sample.
+ *
+ * @param sidx Where to put the crossing sample's index.
+ * @param chans Where to put the channels that crossed then.
+ * @param snippets If the configuration has snippets, where to put
+ *                 them: snippet_pre + snippet_post samples per event,
+ *                 one event after another.
+ * @param max Most events to return. Any others stay ready.
+ * @return Number of events returned; 0 if there are none ready.
+ */
+size_t spike16_ready(struct spike16 *sp, uint32_t *sidx, uint16_t *chans,
+                     uint16_t *snippets, size_t max);
+
+/**
+ * Choose the spike16_add() implementation, e.g. for testing.
+ *
+ * They all give the same results.
+ *
+ * @return 0 on success, -1 if this CPU (or build) doesn't support it.
+ */
+int spike16_use(enum spike16_impl impl);
+
+/** Name of the spike16_add() implementation in use. */
+const char* spike16_impl_str(void);
+
+#endif  /* _LIB_SPIKE16_H_ */
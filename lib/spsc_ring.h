@@ -0,0 +1,123 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   spsc_ring.h
+ * @brief  Lock-free single-producer, single-consumer ring indices
+ *
+ * This only tracks positions; callers own the slot storage, which
+ * must be an array of spsc_ring_size() elements. The producer asks
+ * for a contiguous span of free slots with spsc_ring_reserve(), fills
+ * them, then publishes them with spsc_ring_push(). The consumer does
+ * the same with spsc_ring_peek() and spsc_ring_pop().
+ *
+ * Exactly one thread may produce and exactly one thread may consume
+ * at any given time. Positions increase without bound and are reduced
+ * modulo the (power of two) ring size, so head - tail is always the
+ * number of slots in use.
+ */
+
+#ifndef _LIB_SPSC_RING_H_
+#define _LIB_SPSC_RING_H_
+
+#include <assert.h>
+#include <stddef.h>
+
+#define SPSC_RING_CACHELINE 64
+
+struct spsc_ring {
+    size_t mask;                /* size - 1; size is a power of two */
+    /* Written by producer only. */
+    size_t head __attribute__((aligned(SPSC_RING_CACHELINE)));
+    /* Written by consumer only. */
+    size_t tail __attribute__((aligned(SPSC_RING_CACHELINE)));
+};
+
+/** Initialize an empty ring with "size" slots (a power of two). */
+static inline void spsc_ring_init(struct spsc_ring *r, size_t size)
+{
+    assert(size && !(size & (size - 1)));
+    r->mask = size - 1;
+    r->head = 0;
+    r->tail = 0;
+}
+
+/** Number of slots in the ring. */
+static inline size_t spsc_ring_size(struct spsc_ring *r)
+{
+    return r->mask + 1;
+}
+
+/** Number of slots currently in use. Safe from either side. */
+static inline size_t spsc_ring_count(struct spsc_ring *r)
+{
+    return (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+            __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * Producer: find contiguous free slots.
+ *
+ * @param idx Set to the index of the first free slot.
+ * @return Number of free slots starting at *idx, stopping at the end
+ *         of the slot array; 0 if the ring is full.
+ */
+static inline size_t spsc_ring_reserve(struct spsc_ring *r, size_t *idx)
+{
+    size_t head = r->head;
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    size_t nfree = spsc_ring_size(r) - (head - tail);
+    size_t to_end = spsc_ring_size(r) - (head & r->mask);
+    *idx = head & r->mask;
+    return nfree < to_end ? nfree : to_end;
+}
+
+/** Producer: publish n slots previously returned by spsc_ring_reserve(). */
+static inline void spsc_ring_push(struct spsc_ring *r, size_t n)
+{
+    __atomic_store_n(&r->head, r->head + n, __ATOMIC_RELEASE);
+}
+
+/**
+ * Consumer: find contiguous filled slots.
+ *
+ * @param idx Set to the index of the oldest filled slot.
+ * @return Number of filled slots starting at *idx, stopping at the
+ *         end of the slot array; 0 if the ring is empty.
+ */
+static inline size_t spsc_ring_peek(struct spsc_ring *r, size_t *idx)
+{
+    size_t tail = r->tail;
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t used = head - tail;
+    size_t to_end = spsc_ring_size(r) - (tail & r->mask);
+    *idx = tail & r->mask;
+    return used < to_end ? used : to_end;
+}
+
+/** Consumer: release n slots previously returned by spsc_ring_peek(). */
+static inline void spsc_ring_pop(struct spsc_ring *r, size_t n)
+{
+    __atomic_store_n(&r->tail, r->tail + n, __ATOMIC_RELEASE);
+}
+
+/** Reset to empty. Neither side may be using the ring. */
+static inline void spsc_ring_clear(struct spsc_ring *r)
+{
+    __atomic_store_n(&r->head, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->tail, 0, __ATOMIC_RELEASE);
+}
+
+#endif  /* _LIB_SPSC_RING_H_ */
@@ -25,6 +25,10 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include "proto/control.pb-c.h"
+#include "proto/data.pb-c.h"
+
+/** Most samples a BoardSample can hold. */
+#define SNG_BSMP_NSAMP (32 * 35)
 
 /**
  * Open a connection to the daemon.
@@ -64,4 +68,118 @@ void sng_init_cmd_store(ControlCmdStore *store);
  */
 int sng_store_samples(ControlCmdStore *store, ControlResponse *response);
 
+/**
+ * Board sample decoder state.
+ *
+ * Compressed (BOARD_SAMPLE_DELTA) board samples can only be decoded
+ * in order, so keep one of these for each stream of them you get.
+ */
+struct sng_bsmp_decoder {
+    uint16_t samps[SNG_BSMP_NSAMP]; /**< Last decoded samples */
+    size_t nsamps;                  /**< Number of samps in use */
+    uint32_t samp_idx;              /**< samp_idx they're from */
+    int valid;                      /**< Zero until something's decoded */
+};
+
+/**
+ * Initialize a board sample decoder.
+ *
+ * @param dec Decoder to initialize.
+ */
+void sng_bsmp_decoder_init(struct sng_bsmp_decoder *dec);
+
+/**
+ * Get the samples out of a BoardSample.
+ *
+ * This handles plain and compressed board samples alike. On success,
+ * dec->samps holds the samples, in channel order if bsmp has a
+ * channels list, and dec->samp_idx is bsmp's samp_idx.
+ *
+ * @param dec Decoder to use; bsmp should be the next BoardSample
+ *            from the stream it's been decoding.
+ * @param bsmp Board sample to decode.
+ * @return 0 on success; 1 if bsmp is compressed against a board
+ *         sample that wasn't decoded (e.g. because it got lost), so
+ *         you'll need to skip to the next key frame; -1 if bsmp is
+ *         malformed. After a -1, dec needs a key frame too.
+ */
+int sng_bsmp_decode(struct sng_bsmp_decoder *dec, const BoardSample *bsmp);
+
+/**
+ * A board sample in the daemon's live sample ring.
+ *
+ * This is laid out like the daemon's struct raw_pkt_bsmp (see
+ * lib/raw_packets.h), in host byte order.
+ */
+struct sng_live_bsmp {
+    uint8_t magic;
+    uint8_t proto_vers;
+    uint8_t mtype;
+    uint8_t flags;                  /**< RAW_PFLAG_B_LIVE etc. */
+    uint32_t cookie_h;              /**< Experiment cookie, high word */
+    uint32_t cookie_l;              /**< Experiment cookie, low word */
+    uint32_t board_id;
+    uint32_t samp_idx;
+    uint32_t chip_live;
+    uint16_t samps[SNG_BSMP_NSAMP];
+};
+
+/**
+ * Reader for the daemon's live sample ring.
+ *
+ * If the daemon was started with --live-ring, it publishes every
+ * board sample it gets into shared memory. Any number of local
+ * programs can read them from there, in place, without system calls
+ * and without slowing the daemon down.
+ */
+struct sng_live_ring;
+
+/**
+ * Start reading the daemon's live sample ring.
+ *
+ * Reading starts with the next board sample the daemon gets.
+ *
+ * @param name The daemon's --live-ring argument, e.g. "/leafysd-live".
+ * @return New reader, or NULL on failure (e.g. if the daemon isn't
+ *         publishing to that ring).
+ */
+struct sng_live_ring* sng_live_open(const char *name);
+
+/**
+ * Stop reading a live sample ring.
+ *
+ * @param ring Reader from sng_live_open().
+ */
+void sng_live_close(struct sng_live_ring *ring);
+
+/**
+ * Look at the next board sample, without copying it.
+ *
+ * The sample is in shared memory, and the daemon can overwrite it at
+ * any time, so check with sng_live_done() before you believe anything
+ * you got from it.
+ *
+ * @param ring Reader from sng_live_open().
+ * @return The sample, or NULL if there's nothing new yet.
+ */
+const struct sng_live_bsmp* sng_live_peek(struct sng_live_ring *ring);
+
+/**
+ * Finish with the sample from sng_live_peek(), and move on.
+ *
+ * @param ring Reader from sng_live_open().
+ * @return 0 if the sample didn't change while you were looking at it,
+ *         -1 if it was overwritten, so you should throw away whatever
+ *         you got from it.
+ */
+int sng_live_done(struct sng_live_ring *ring);
+
+/**
+ * Number of board samples this reader has missed, by falling too far
+ * behind the daemon.
+ *
+ * @param ring Reader from sng_live_open().
+ */
+uint64_t sng_live_nlost(struct sng_live_ring *ring);
+
 #endif
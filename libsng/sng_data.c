@@ -0,0 +1,96 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file libsng/sng_data.c
+ * @brief libsng data protocol helpers
+ */
+
+#include "sng.h"
+
+#include <string.h>
+
+#include "delta16.h"
+
+void sng_bsmp_decoder_init(struct sng_bsmp_decoder *dec)
+{
+    dec->nsamps = 0;
+    dec->samp_idx = 0;
+    dec->valid = 0;
+}
+
+/* How many samples bsmp holds, if it's compressed. */
+static size_t sng_bsmp_delta_nsamps(const BoardSample *bsmp)
+{
+    return bsmp->n_channels ? bsmp->n_channels : SNG_BSMP_NSAMP;
+}
+
+static int sng_bsmp_decode_plain(struct sng_bsmp_decoder *dec,
+                                 const BoardSample *bsmp)
+{
+    size_t n = bsmp->samples.len / sizeof(uint16_t);
+    if (bsmp->samples.len % sizeof(uint16_t) || n > SNG_BSMP_NSAMP ||
+        (bsmp->n_channels && bsmp->n_channels != n)) {
+        return -1;
+    }
+    memcpy(dec->samps, bsmp->samples.data, bsmp->samples.len);
+    dec->nsamps = n;
+    return 0;
+}
+
+static int sng_bsmp_decode_delta(struct sng_bsmp_decoder *dec,
+                                 const BoardSample *bsmp)
+{
+    size_t n = sng_bsmp_delta_nsamps(bsmp);
+    const uint16_t *ref = NULL;
+    if (n > SNG_BSMP_NSAMP) {
+        return -1;
+    }
+    if (bsmp->has_delta_ref) {
+        if (!dec->valid || dec->samp_idx != bsmp->delta_ref ||
+            dec->nsamps != n) {
+            return 1;
+        }
+        ref = dec->samps;
+    }
+    if (delta16_decode(dec->samps, bsmp->samples_delta.data,
+                       bsmp->samples_delta.len, ref, n)) {
+        dec->valid = 0;         /* samps may be half decoded */
+        return -1;
+    }
+    dec->nsamps = n;
+    return 0;
+}
+
+int sng_bsmp_decode(struct sng_bsmp_decoder *dec, const BoardSample *bsmp)
+{
+    int ret;
+    if (!bsmp->has_samp_idx) {
+        return -1;
+    }
+    if (bsmp->has_samples_delta) {
+        ret = sng_bsmp_decode_delta(dec, bsmp);
+    } else if (bsmp->has_samples) {
+        ret = sng_bsmp_decode_plain(dec, bsmp);
+    } else {
+        return -1;
+    }
+    if (ret) {
+        return ret;
+    }
+    dec->samp_idx = bsmp->samp_idx;
+    dec->valid = 1;
+    return 0;
+}
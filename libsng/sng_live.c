@@ -0,0 +1,78 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file libsng/sng_live.c
+ * @brief libsng live sample ring reader
+ */
+
+#include "sng.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "live_ring.h"
+
+struct sng_live_ring {
+    struct live_ring_reader rd;
+};
+
+/* struct sng_live_bsmp is just struct raw_pkt_bsmp, spelled out for
+ * people who don't have lib/raw_packets.h. */
+static void sng_live_check_layout(void)
+{
+    assert(sizeof(struct sng_live_bsmp) == sizeof(struct raw_pkt_bsmp));
+    assert(offsetof(struct sng_live_bsmp, samp_idx) ==
+           offsetof(struct raw_pkt_bsmp, b_sidx));
+    assert(offsetof(struct sng_live_bsmp, samps) ==
+           offsetof(struct raw_pkt_bsmp, b_samps));
+    assert(SNG_BSMP_NSAMP == RAW_BSMP_NSAMP);
+}
+
+struct sng_live_ring* sng_live_open(const char *name)
+{
+    sng_live_check_layout();
+    struct sng_live_ring *ring = malloc(sizeof(struct sng_live_ring));
+    if (!ring) {
+        return NULL;
+    }
+    if (live_ring_open(&ring->rd, name)) {
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void sng_live_close(struct sng_live_ring *ring)
+{
+    live_ring_close(&ring->rd);
+    free(ring);
+}
+
+const struct sng_live_bsmp* sng_live_peek(struct sng_live_ring *ring)
+{
+    return (const struct sng_live_bsmp*)live_ring_peek(&ring->rd);
+}
+
+int sng_live_done(struct sng_live_ring *ring)
+{
+    return live_ring_done(&ring->rd);
+}
+
+uint64_t sng_live_nlost(struct sng_live_ring *ring)
+{
+    return ring->rd.nlost;
+}
@@ -33,7 +33,10 @@
 #include "raw_ch_storage.h"
 
 #include "config.h"
+#include "biquad16.h"
 #include "sample.h"
+#include "reref16.h"
+#include "spike16.h"
 
 #define LOCAL_DEBUG_LOGV 0
 
@@ -215,7 +218,8 @@ static void client_reset_state_locked(struct control_session *cs)
 }
 
 static struct ch_storage *client_new_ch_storage(const char *path,
-                                                StorageBackend backend)
+                                                StorageBackend backend,
+                                                int wire_byte_order)
 {
     struct ch_storage *chns;
     if (backend == STORAGE_BACKEND__STORE_HDF5) {
@@ -230,6 +234,9 @@ static struct ch_storage *client_new_ch_storage(const char *path,
         log_ERR("can't open channel storage at %s: %m", path);
         return NULL;
     }
+    if (wire_byte_order) {
+        chns->ch_flags |= CH_STORAGE_WIRE_ORDER;
+    }
     return chns;
 }
 
@@ -1508,6 +1515,223 @@ static void client_process_res_regio(struct control_session *cs)
     client_send_response(cs, &cr);
 }
 
+static enum sample_forward client_sample_forward(SampleType stype)
+{
+    return (stype == SAMPLE_TYPE__BOARD_SAMPLE ? SAMPLE_FWD_BSMP :
+            stype == SAMPLE_TYPE__BOARD_SUBSAMPLE ? SAMPLE_FWD_BSUB :
+            stype == SAMPLE_TYPE__BOARD_SUBSAMPLE_RAW ? SAMPLE_FWD_BSUB_RAW :
+            stype == SAMPLE_TYPE__BOARD_SAMPLE_RAW ? SAMPLE_FWD_BSMP_RAW :
+            stype == SAMPLE_TYPE__BOARD_SAMPLE_DELTA ? SAMPLE_FWD_BSMP_DELTA :
+            stype == SAMPLE_TYPE__BOARD_SAMPLE_PREVIEW ?
+            SAMPLE_FWD_BSMP_PREVIEW :
+            stype == SAMPLE_TYPE__BOARD_SAMPLE_SPIKES ?
+            SAMPLE_FWD_BSMP_SPIKES :
+            SAMPLE_FWD_NOTHING);
+}
+
+/* Fill in cfg from ControlCmdForward's spike detection fields. Returns
+ * 1 if there are any, 0 if there aren't, and -1 on error, after
+ * sending the response. cfg->thresholds points into forward. */
+static int client_forward_spikes(struct control_session *cs,
+                                 ControlCmdForward *forward,
+                                 struct spike16_cfg *cfg)
+{
+    if (!forward->n_spike_thresholds &&
+        !forward->has_spike_threshold_sigmas &&
+        !forward->has_spike_snippet_pre &&
+        !forward->has_spike_snippet_post) {
+        return 0;
+    }
+    if (forward->n_spike_thresholds > RAW_BSMP_NSAMP) {
+        CLIENT_RES_ERR_C_VALUE(cs, "too many spike_thresholds");
+        return -1;
+    }
+    cfg->thresholds = forward->spike_thresholds;
+    cfg->nthresholds = forward->n_spike_thresholds;
+    cfg->sigmas = (forward->has_spike_threshold_sigmas ?
+                   forward->spike_threshold_sigmas :
+                   SAMPLE_SPIKE_SIGMAS_DEFAULT);
+    cfg->snippet_pre = (forward->has_spike_snippet_pre ?
+                        forward->spike_snippet_pre : 0);
+    cfg->snippet_post = (forward->has_spike_snippet_post ?
+                         forward->spike_snippet_post : 0);
+    return 1;
+}
+
+/* The number of sections in a filter_sos field with n coefficients,
+ * or -1 after sending the response if that's not a valid number. */
+static ssize_t client_filter_nsections(struct control_session *cs,
+                                       size_t n)
+{
+    if (n % BIQUAD16_SOS_LEN) {
+        CLIENT_RES_ERR_C_VALUE(cs, "filter_sos needs 6 coefficients "
+                               "per section");
+        return -1;
+    }
+    if (n / BIQUAD16_SOS_LEN > BIQUAD16_MAX_SECTIONS) {
+        CLIENT_RES_ERR_C_VALUE(cs, "too many filter sections");
+        return -1;
+    }
+    return (ssize_t)(n / BIQUAD16_SOS_LEN);
+}
+
+/* Fill in groups, which has room for RAW_BSMP_NSAMP, from
+ * ControlCmdForward's re-referencing fields. Returns how many
+ * channels have groups, which is 0 if there are no such fields, or
+ * -1 on error, after sending the response. */
+static ssize_t client_forward_reref(struct control_session *cs,
+                                    ControlCmdForward *forward,
+                                    uint16_t *groups)
+{
+    if (forward->n_reref_groups && forward->has_reref_group_size) {
+        CLIENT_RES_ERR_C_PROTO(cs, "can't set reref_groups and "
+                               "reref_group_size");
+        return -1;
+    }
+    if (forward->has_reref_group_size) {
+        uint32_t size = forward->reref_group_size;
+        if (size == 0) {
+            CLIENT_RES_ERR_C_VALUE(cs, "reref_group_size can't be 0");
+            return -1;
+        }
+        for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+            groups[i] = (uint16_t)(i / size);
+        }
+        return RAW_BSMP_NSAMP;
+    }
+    if (forward->n_reref_groups > RAW_BSMP_NSAMP) {
+        CLIENT_RES_ERR_C_VALUE(cs, "too many reref_groups");
+        return -1;
+    }
+    if (!forward->n_reref_groups && forward->has_reref_median) {
+        CLIENT_RES_ERR_C_PROTO(cs, "reref_median needs reref_groups or "
+                               "reref_group_size");
+        return -1;
+    }
+    for (size_t i = 0; i < forward->n_reref_groups; i++) {
+        uint32_t g = forward->reref_groups[i];
+        groups[i] = g < RAW_BSMP_NSAMP ? (uint16_t)g : REREF16_NO_GROUP;
+    }
+    return (ssize_t)forward->n_reref_groups;
+}
+
+/* Copy ControlCmdForward's channel list into chans, which has room
+ * for RAW_BSMP_NSAMP. On error, sends the response and returns -1. */
+static int client_forward_chans(struct control_session *cs,
+                                ControlCmdForward *forward,
+                                uint16_t *chans)
+{
+    if (forward->n_channels > RAW_BSMP_NSAMP) {
+        CLIENT_RES_ERR_C_VALUE(cs, "too many channels");
+        return -1;
+    }
+    for (size_t i = 0; i < forward->n_channels; i++) {
+        if (forward->channels[i] >= RAW_BSMP_NSAMP) {
+            CLIENT_RES_ERR_C_VALUE(cs, "channel is out of range");
+            return -1;
+        }
+        chans[i] = (uint16_t)forward->channels[i];
+    }
+    return 0;
+}
+
+/* Handle ControlCmdForward's SUBSCRIBE and UNSUBSCRIBE ops. */
+static void client_process_cmd_forward_sub(struct control_session *cs,
+                                           ControlCmdForward *forward)
+{
+    ControlCmdForward__Transport transport =
+        (forward->has_transport ? forward->transport :
+         CONTROL_CMD_FORWARD__TRANSPORT__UDP);
+    struct sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    if (transport == CONTROL_CMD_FORWARD__TRANSPORT__UNIX) {
+        struct sockaddr_un *sun = (struct sockaddr_un*)&addr;
+        if (!forward->dest_unix_path || !forward->dest_unix_path[0]) {
+            CLIENT_RES_ERR_C_PROTO(cs, "UNIX transport needs dest_unix_path");
+            return;
+        }
+        if (strlen(forward->dest_unix_path) >= sizeof(sun->sun_path)) {
+            CLIENT_RES_ERR_C_VALUE(cs, "dest_unix_path is too long");
+            return;
+        }
+        sun->sun_family = AF_UNIX;
+        strcpy(sun->sun_path, forward->dest_unix_path);
+    } else if (transport == CONTROL_CMD_FORWARD__TRANSPORT__UDP ||
+               transport == CONTROL_CMD_FORWARD__TRANSPORT__TCP) {
+        struct sockaddr_in *sin = (struct sockaddr_in*)&addr;
+        if (!forward->has_dest_udp_addr4) {
+            CLIENT_RES_ERR_C_PROTO(cs, "subscriptions need UDP address/port");
+            return;
+        }
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons((uint16_t)forward->dest_udp_port);
+        sin->sin_addr.s_addr = htonl(forward->dest_udp_addr4);
+    } else {
+        CLIENT_RES_ERR_C_VALUE(cs, "unknown transport");
+        return;
+    }
+    if (forward->has_enable || forward->has_force_daq_reset) {
+        CLIENT_RES_ERR_C_PROTO(cs, "subscriptions can't enable or "
+                               "reset forwarding");
+        return;
+    }
+    if (forward->op == CONTROL_CMD_FORWARD__OP__UNSUBSCRIBE) {
+        if (sample_unsubscribe(cs->smpl, (struct sockaddr*)&addr)) {
+            CLIENT_RES_ERR_C_VALUE(cs, "no such subscriber");
+            return;
+        }
+        client_send_success(cs);
+        return;
+    }
+    uint16_t chans[RAW_BSMP_NSAMP];
+    if (client_forward_chans(cs, forward, chans)) {
+        return;
+    }
+    struct spike16_cfg spike_cfg;
+    int has_spikes = client_forward_spikes(cs, forward, &spike_cfg);
+    if (has_spikes < 0) {
+        return;
+    }
+    ssize_t filter_nsections = client_filter_nsections(cs,
+                                                       forward->n_filter_sos);
+    if (filter_nsections < 0) {
+        return;
+    }
+    uint16_t groups[RAW_BSMP_NSAMP];
+    ssize_t reref_nchans = client_forward_reref(cs, forward, groups);
+    if (reref_nchans < 0) {
+        return;
+    }
+    struct sample_sub_cfg cfg = {
+        .what = client_sample_forward(forward->sample_type),
+        .decimate = forward->has_decimate ? forward->decimate : 0,
+        .tee_every = forward->has_tee_every ? forward->tee_every : 0,
+        .chans = chans,
+        .nchans = forward->n_channels,
+        .batch_size = forward->has_batch_size ? forward->batch_size : 0,
+        .batch_max_usec = (forward->has_batch_max_latency_us ?
+                           forward->batch_max_latency_us : 0),
+        .preview_window = (forward->has_preview_window ?
+                           forward->preview_window : 0),
+        .spikes = has_spikes ? &spike_cfg : NULL,
+        .filter_sos = forward->filter_sos,
+        .filter_nsections = (size_t)filter_nsections,
+        .reref_groups = groups,
+        .reref_nchans = (size_t)reref_nchans,
+        .reref_median = forward->has_reref_median && forward->reref_median,
+        .stream = transport != CONTROL_CMD_FORWARD__TRANSPORT__UDP,
+    };
+    if (cfg.what == SAMPLE_FWD_NOTHING) {
+        CLIENT_RES_ERR_C_VALUE(cs, "unknown sample_type");
+        return;
+    }
+    if (sample_subscribe(cs->smpl, (struct sockaddr*)&addr, &cfg)) {
+        CLIENT_RES_ERR_DAEMON(cs, "can't add subscriber");
+        return;
+    }
+    client_send_success(cs);
+}
+
 static void client_process_cmd_forward(struct control_session *cs)
 {
     struct client_priv *cpriv = cs->cpriv;
@@ -1534,6 +1758,11 @@ static void client_process_cmd_forward(struct control_session *cs)
     if (!forward->has_sample_type) {
         forward->sample_type = SAMPLE_TYPE__BOARD_SUBSAMPLE;
     }
+    if (forward->has_op &&
+        forward->op != CONTROL_CMD_FORWARD__OP__CONFIGURE) {
+        client_process_cmd_forward_sub(cs, forward);
+        return;
+    }
 
     /*
      * Reconfigure sample conversion address/port if necessary
@@ -1551,6 +1780,87 @@ static void client_process_cmd_forward(struct control_session *cs)
             return;
         }
     }
+    if (forward->has_batch_size &&
+        sample_cfg_forward_batch(cs->smpl, forward->batch_size,
+                                 (forward->has_batch_max_latency_us ?
+                                  forward->batch_max_latency_us : 0))) {
+        CLIENT_RES_ERR_DAEMON(cs, "can't configure forwarding batches");
+        return;
+    }
+    if (forward->has_tee_every &&
+        sample_cfg_tee(cs->smpl, forward->tee_every)) {
+        CLIENT_RES_ERR_DAEMON(cs, "can't configure forwarding while storing");
+        return;
+    }
+    if (forward->has_decimate &&
+        sample_cfg_decimate(cs->smpl, forward->decimate)) {
+        CLIENT_RES_ERR_DAEMON(cs, "can't configure decimation");
+        return;
+    }
+    if (forward->has_preview_window &&
+        sample_cfg_preview(cs->smpl, forward->preview_window)) {
+        CLIENT_RES_ERR_C_VALUE(cs, "invalid preview_window");
+        return;
+    }
+    int all_chans = forward->has_all_channels && forward->all_channels;
+    if (all_chans && forward->n_channels) {
+        CLIENT_RES_ERR_C_PROTO(cs, "can't set channels and all_channels");
+        return;
+    }
+    if (all_chans || forward->n_channels) {
+        uint16_t chans[RAW_BSMP_NSAMP];
+        if (client_forward_chans(cs, forward, chans)) {
+            return;
+        }
+        if (sample_cfg_channels(cs->smpl, chans, forward->n_channels)) {
+            CLIENT_RES_ERR_DAEMON(cs, "can't configure channels");
+            return;
+        }
+    }
+    /* After the channels, which the thresholds have to match. */
+    struct spike16_cfg spike_cfg;
+    int has_spikes = client_forward_spikes(cs, forward, &spike_cfg);
+    if (has_spikes < 0) {
+        return;
+    }
+    if (has_spikes && sample_cfg_spikes(cs->smpl, &spike_cfg)) {
+        CLIENT_RES_ERR_C_VALUE(cs, "invalid spike detection settings");
+        return;
+    }
+    int no_filter = forward->has_no_filter && forward->no_filter;
+    if (no_filter && forward->n_filter_sos) {
+        CLIENT_RES_ERR_C_PROTO(cs, "can't set filter_sos and no_filter");
+        return;
+    }
+    if (no_filter || forward->n_filter_sos) {
+        ssize_t nsections = client_filter_nsections(cs,
+                                                    forward->n_filter_sos);
+        if (nsections < 0) {
+            return;
+        }
+        if (sample_cfg_filter(cs->smpl, forward->filter_sos,
+                              (size_t)nsections)) {
+            CLIENT_RES_ERR_C_VALUE(cs, "invalid filter");
+            return;
+        }
+    }
+    uint16_t groups[RAW_BSMP_NSAMP];
+    ssize_t reref_nchans = client_forward_reref(cs, forward, groups);
+    if (reref_nchans < 0) {
+        return;
+    }
+    int no_reref = forward->has_no_reref && forward->no_reref;
+    if (no_reref && reref_nchans) {
+        CLIENT_RES_ERR_C_PROTO(cs, "can't re-reference and set no_reref");
+        return;
+    }
+    if ((no_reref || reref_nchans) &&
+        sample_cfg_reref(cs->smpl, groups, (size_t)reref_nchans,
+                         forward->has_reref_median &&
+                         forward->reref_median)) {
+        CLIENT_RES_ERR_DAEMON(cs, "can't configure re-referencing");
+        return;
+    }
     /* If this is just a reconfigure command, then we're done here. */
     if (!forward->has_enable) {
         client_send_success(cs);
@@ -1569,7 +1879,10 @@ static void client_process_cmd_forward(struct control_session *cs)
             daq_udp_mode = RAW_DAQ_UDP_MODE_BSUB;
             break;
         case SAMPLE_TYPE__BOARD_SAMPLE: /* fall through */
-        case SAMPLE_TYPE__BOARD_SAMPLE_RAW:
+        case SAMPLE_TYPE__BOARD_SAMPLE_RAW: /* fall through */
+        case SAMPLE_TYPE__BOARD_SAMPLE_DELTA: /* fall through */
+        case SAMPLE_TYPE__BOARD_SAMPLE_PREVIEW: /* fall through */
+        case SAMPLE_TYPE__BOARD_SAMPLE_SPIKES:
             daq_udp_mode = RAW_DAQ_UDP_MODE_BSMP;
             break;
         default:
@@ -1633,12 +1946,8 @@ static void client_process_res_forward(struct control_session *cs)
         return;
     }
     SampleType stype = forward->sample_type;
-    enum sample_forward fwd = !forward->enable ? SAMPLE_FWD_NOTHING :
-        (stype == SAMPLE_TYPE__BOARD_SAMPLE ? SAMPLE_FWD_BSMP :
-         stype == SAMPLE_TYPE__BOARD_SUBSAMPLE ? SAMPLE_FWD_BSUB :
-         stype == SAMPLE_TYPE__BOARD_SUBSAMPLE_RAW ? SAMPLE_FWD_BSUB_RAW :
-         stype == SAMPLE_TYPE__BOARD_SAMPLE_RAW ? SAMPLE_FWD_BSMP_RAW :
-         SAMPLE_FWD_NOTHING);
+    enum sample_forward fwd = (!forward->enable ? SAMPLE_FWD_NOTHING :
+                               client_sample_forward(stype));
     if (fwd == SAMPLE_FWD_NOTHING && forward->enable) {
         CLIENT_RES_ERR_C_PROTO(cs, "unknown sample_type");
         return;
@@ -1679,6 +1988,19 @@ static void client_process_cmd_store(struct control_session *cs)
         store->has_backend = 1;
         store->backend = DEFAULT_STORAGE_BACKEND;
     }
+    if (!store->has_wire_byte_order) {
+        store->has_wire_byte_order = 1;
+        store->wire_byte_order = 0;
+    }
+    ssize_t filter_nsections = client_filter_nsections(cs,
+                                                       store->n_filter_sos);
+    if (filter_nsections < 0) {
+        goto bail;
+    }
+    if (filter_nsections && store->backend != STORAGE_BACKEND__STORE_HDF5) {
+        CLIENT_RES_ERR_C_VALUE(cs, "only HDF5 storage can be filtered");
+        goto bail;
+    }
 
     if (!cpriv->bs_restarted) {
         /* If this isn't a restarted storage operation, then create
@@ -1694,11 +2016,18 @@ static void client_process_cmd_store(struct control_session *cs)
                                 (ssize_t)store->start_sample : -1);
 
         assert(!cpriv->bs_cfg);
-        chns = client_new_ch_storage(store->path, store->backend);
+        chns = client_new_ch_storage(store->path, store->backend,
+                                     store->wire_byte_order);
         if (!chns) {
             CLIENT_RES_ERR_DAEMON_OOM(cs);
             goto bail;
         }
+        if (filter_nsections &&
+            hdf5_ch_storage_set_filter(chns, store->filter_sos,
+                                       (size_t)filter_nsections)) {
+            CLIENT_RES_ERR_C_VALUE(cs, "invalid filter");
+            goto bail;
+        }
         if (client_open_ch_storage(chns, store->backend) == -1) {
             CLIENT_RES_ERR_DAEMON_IO(cs, "can't open channel storage");
             goto bail;
@@ -89,6 +89,10 @@ static void usage(int exit_status)
            "Options:\n"
            "  -A, --dnode-address"
            "\tConnect to data node at this address, default %s\n"
+           "  -b, --busy-poll"
+           "\tBusy-poll data socket for this many usec (needs -T)\n"
+           "  -C, --ingest-cpu"
+           "\tPin the ingest thread to this CPU; implies -T\n"
            "  -c, --client-port"
            "\tListen here for client control socket connections, default %d\n"
            "  -d, --dnode-port"
@@ -97,10 +101,20 @@ static void usage(int exit_status)
            "\t\tPrint this message and quit\n"
            "  -I, --sample-iface"
            "\tNetwork interface to receive samples on, default %s\n"
+           "  -L, --live-ring"
+           "\tPublish board samples to this shared memory ring\n"
+           "  -m, --sample-mem"
+           "\tMiB of memory for buffering samples to disk\n"
            "  -N, --dont-daemonize"
            "\tSkip daemonization; logs also go to stderr\n"
+           "  -R, --packet-ring"
+           "\tReceive samples through a memory-mapped packet ring\n"
            "  -s, --sample-port"
-           "\tCreate data node data socket here, default %d\n",
+           "\tCreate data node data socket here, default %d\n"
+           "  -T, --ingest-thread"
+           "\tRead samples from a dedicated thread, not the event loop\n"
+           "  -w, --write-len"
+           "\tStore this many samples per disk write\n",
            program_name, DUMMY_DNODE_ADDRESS, DAEMON_CLIENT_PORT,
            DNODE_LISTEN_PORT, DAEMON_SAMPLE_IFACE, DAEMON_SAMPLE_PORT);
     exit(exit_status);
@@ -113,6 +127,13 @@ static void usage(int exit_status)
           .sample_iface = DAEMON_SAMPLE_IFACE,                  \
           .sample_port = DAEMON_SAMPLE_PORT,                    \
           .dont_daemonize = 0,                                  \
+          .ingest_thread = 0,                                   \
+          .ingest_cpu = -1,                                     \
+          .busy_poll_usec = 0,                                  \
+          .packet_ring = 0,                                     \
+          .sample_mem_mib = 0,                                  \
+          .write_len = 0,                                       \
+          .live_ring = NULL,                                    \
         }
 
 struct arguments {
@@ -122,18 +143,33 @@ struct arguments {
     char     *sample_iface;     /* Use this interface to receive samples */
     uint16_t  sample_port;      /* Receive dnode samples here */
     int       dont_daemonize;   /* Skip daemonization. */
+    int       ingest_thread;    /* Read samples in a dedicated thread */
+    int       ingest_cpu;       /* Pin that thread here, or -1 */
+    unsigned  busy_poll_usec;   /* SO_BUSY_POLL for data socket, or 0 */
+    int       packet_ring;      /* Receive samples with PACKET_RX_RING */
+    size_t    sample_mem_mib;   /* Sample buffer memory budget, or 0 */
+    size_t    write_len;        /* Samples per storage write, or 0 */
+    char     *live_ring;        /* Shared memory ring name, or NULL */
 };
 
 static void parse_args(struct arguments* args, int argc, char *const argv[])
 {
     int print_usage = 0;
-    const char shortopts[] = "A:c:d:hI:Ns:";
+    const char shortopts[] = "A:b:C:c:d:hI:L:m:NRs:Tw:";
     struct option longopts[] = {
         /* Keep these sorted with shortopts. */
         { .name = "dnode-address", /* -A */
           .has_arg = required_argument,
           .flag = NULL,
           .val = 'A' },
+        { .name = "busy-poll",  /* -b */
+          .has_arg = required_argument,
+          .flag = NULL,
+          .val = 'b' },
+        { .name = "ingest-cpu", /* -C */
+          .has_arg = required_argument,
+          .flag = NULL,
+          .val = 'C' },
         { .name = "client-port", /* -c */
           .has_arg = required_argument,
           .flag = NULL,
@@ -150,14 +186,34 @@ static void parse_args(struct arguments* args, int argc, char *const argv[])
           .has_arg = required_argument,
           .flag = NULL,
           .val = 'I' },
+        { .name = "live-ring",  /* -L */
+          .has_arg = required_argument,
+          .flag = NULL,
+          .val = 'L' },
+        { .name = "sample-mem", /* -m */
+          .has_arg = required_argument,
+          .flag = NULL,
+          .val = 'm' },
         { .name = "dont-daemonize", /* -N */
           .has_arg = no_argument,
           .flag = &args->dont_daemonize,
           .val = 1 },
+        { .name = "packet-ring", /* -R */
+          .has_arg = no_argument,
+          .flag = NULL,
+          .val = 'R' },
         { .name = "sample-port", /* -s */
           .has_arg = required_argument,
           .flag = NULL,
           .val = 's' },
+        { .name = "ingest-thread", /* -T */
+          .has_arg = no_argument,
+          .flag = NULL,
+          .val = 'T' },
+        { .name = "write-len",  /* -w */
+          .has_arg = required_argument,
+          .flag = NULL,
+          .val = 'w' },
         {0, 0, 0, 0},
     };
     /* TODO add error handling in strtol() argument conversion */
@@ -180,6 +236,17 @@ static void parse_args(struct arguments* args, int argc, char *const argv[])
                 panic("out of memory");
             }
             break;
+        case 'b':
+            args->busy_poll_usec = strtoul(optarg, (char**)0, 10);
+            break;
+        case 'C':
+            args->ingest_cpu = strtol(optarg, (char**)0, 10);
+            if (args->ingest_cpu < 0) {
+                fprintf(stderr, "ingest CPU must be nonnegative\n");
+                usage(EXIT_FAILURE);
+            }
+            args->ingest_thread = 1;
+            break;
         case 'c':
             args->client_port = strtol(optarg, (char**)0, 10);
             break;
@@ -192,17 +259,40 @@ static void parse_args(struct arguments* args, int argc, char *const argv[])
         case 'I':
             args->sample_iface = optarg;
             break;
+        case 'L':
+            if (optarg[0] != '/') {
+                fprintf(stderr, "live ring name must start with '/'\n");
+                usage(EXIT_FAILURE);
+            }
+            args->live_ring = optarg;
+            break;
+        case 'm':
+            args->sample_mem_mib = strtoul(optarg, (char**)0, 10);
+            break;
         case 'N':
             args->dont_daemonize = 1;
             break;
+        case 'R':
+            args->packet_ring = 1;
+            break;
         case 's':
             args->sample_port = strtol(optarg, (char**)0, 10);
             break;
+        case 'T':
+            args->ingest_thread = 1;
+            break;
+        case 'w':
+            args->write_len = strtoul(optarg, (char**)0, 10);
+            break;
         case '?': /* Fall through. */
         default:
             usage(EXIT_FAILURE);
         }
     }
+    if (args->busy_poll_usec && !args->ingest_thread) {
+        fprintf(stderr, "--busy-poll requires --ingest-thread\n");
+        usage(EXIT_FAILURE);
+    }
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -250,7 +340,16 @@ run_event_loop(struct arguments *args)
         log_EMERG("unknown network interface %s", args->sample_iface);
         goto nosample;
     }
-    struct sample_session *sample = sample_new(base, iface, args->sample_port);
+    struct sample_opts sopts = SAMPLE_OPTS_DEFAULT;
+    sopts.ingest_thread = args->ingest_thread;
+    sopts.ingest_cpu = args->ingest_cpu;
+    sopts.busy_poll_usec = args->busy_poll_usec;
+    sopts.packet_ring = args->packet_ring;
+    sopts.bsamp_mem = args->sample_mem_mib << 20;
+    sopts.bsamp_write_len = args->write_len;
+    sopts.live_ring = args->live_ring;
+    struct sample_session *sample = sample_new(base, iface, args->sample_port,
+                                               &sopts);
     if (!sample) {
         log_EMERG("can't create sample session, iface %u, port %u",
                   iface, args->sample_port);
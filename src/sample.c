@@ -17,9 +17,16 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/filter.h>
+#include <netinet/udp.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -27,14 +34,25 @@
 #include <event2/event.h>
 #include <event2/util.h>
 
+#include "biquad16.h"
+#include "bsmp_gather.h"
 #include "ch_storage.h"
+#include "client_socket.h"
+#include "data_pbenc.h"
+#include "delta16.h"
+#include "live_ring.h"
 #include "logging.h"
+#include "msg_ring.h"
+#include "packet_ring.h"
+#include "preview16.h"
 #include "raw_packets.h"
+#include "reref16.h"
 #include "safe_pthread.h"
 #include "sockutil.h"
+#include "spike16.h"
+#include "spsc_ring.h"
 #include "type_attrs.h"
 #include "proto/control.pb-c.h"
-#include "proto/data.pb-c.h"
 
 #define LOCAL_DEBUG_LOGV 0
 
@@ -46,16 +64,33 @@
 
 static void sample_ddatafd_callback(evutil_socket_t, short, void*);
 static void sample_timeout_callback(evutil_socket_t, short, void*);
+static void sample_pause_callback(evutil_socket_t, short, void*);
 #define SAMPLE_THREAD_DONE EV_READ /* hack? */
 #define SAMPLE_THREAD_ERR  EV_WRITE
 #define SAMPLE_THREAD_SLEEPING EV_TIMEOUT
 static void sample_worker_callback(evutil_socket_t, short, void*);
+static void sample_ingest_callback(evutil_socket_t, short, void*);
+static void sample_tee_bsamps(struct sample_session*, struct raw_pkt_bsmp*,
+                              size_t);
+static void sample_live_publish_bsamps(struct sample_session*,
+                                       struct raw_pkt_bsmp*, size_t);
+struct sample_sub;
+static void sample_fwd_flush(struct sample_sub*, int);
+static void sample_fwd_flush_callback(evutil_socket_t, short, void*);
+static void sample_stream_callback(evutil_socket_t, short, void*);
 
 union sample_packet {
     struct raw_pkt_bsub bsub;
     struct raw_pkt_bsmp bsmp;
 };
 
+/* A packet received by the ingest thread, waiting for the event loop */
+struct sample_ingest_slot {
+    union sample_packet pkt;
+    struct sockaddr_storage from;
+    size_t len;
+};
+
 /* Flags for why the worker thread woke up */
 enum sample_worker_why {
     SAMPLE_WHY_NONE = 0x00,     /* No reason; go back to sleep */
@@ -76,23 +111,130 @@ enum sample_stop_why {
     SAMPLE_STOP_PKT_ERR,
 };
 
-#define SAMPLE_PBUF_ARR_SIZE (1024 * 1024)
+#define SAMPLE_PBUF_ARR_SIZE DATA_PBENC_PREVIEW_MAX /* largest
+                                                   * DnodeSample */
+#define SAMPLE_DELTA_KEY_EVERY 1000 /* max compressed board samples
+                                     * per key frame */
 #define SAMPLE_BSAMP_KHZ 30 /* sample frequency; TODO: don't hard-code here */
-#define SAMPLE_BSAMP_SEC_P_BUF 5 /* seconds of data per sample buffer */
-#define SAMPLE_BSAMP_MAXLEN ((size_t)(SAMPLE_BSAMP_KHZ * 1000 * \
-                                      SAMPLE_BSAMP_SEC_P_BUF))
+#define SAMPLE_PREVIEW_WINDOW_DEFAULT (SAMPLE_BSAMP_KHZ * 10) /* board
+                                                               * samples
+                                                               * per preview,
+                                                               * ~100 Hz */
+#define SAMPLE_BSAMP_MEM_DEFAULT ((size_t)640 << 20) /* 2^18 samples,
+                                                      * ~8.7 sec */
+#define SAMPLE_BSAMP_WRITE_LEN_DEFAULT ((size_t)(SAMPLE_BSAMP_KHZ * 1000 / 2))
+#define SAMPLE_BSAMP_PAUSE_USEC 10000 /* retry period when ring is full */
+#define SAMPLE_HUGEPAGE_SIZE ((size_t)2 << 20) /* for MAP_HUGETLB rounding */
 #define SAMPLE_BSAMP_TIMEOUT_SEC 10 /* WISHLIST: be smarter */
 #define SAMPLE_BSAMP_TIMEOUT_USEC 0
 #define SAMPLE_MAX_CONSECUTIVE_BAD_PKTS 20
+#define SAMPLE_RECVMMSG_BATCH 64 /* max board samples per recvmmsg() */
+#define SAMPLE_INGEST_QLEN 8192 /* ingest queue slots; must be power of 2 */
+#define SAMPLE_INGEST_RCVTIMEO_USEC 100000 /* ingest thread exit latency */
+#define SAMPLE_INGEST_FULL_NSEC 100000 /* ingest backoff when queue's full */
+#define SAMPLE_INGEST_MAX_PER_CB 1024 /* max packets handled per callback */
+#define SAMPLE_PRING_MEM ((size_t)64 << 20) /* packet ring size, ~1 sec */
+#define SAMPLE_TEE_SHED_FRAC 4 /* stop teeing when the ring is this full */
+#define SAMPLE_FWD_NDGRAMS 16 /* max datagrams per sendmmsg() */
+#define SAMPLE_FWD_DGRAM_MAX 65507 /* largest UDP/IPv4 payload */
+#define SAMPLE_FWD_MTU_DEFAULT 1500 /* if we can't get the path MTU */
+#define SAMPLE_FWD_MAX_PER_CB 1024 /* max packets forwarded per callback */
+#define SAMPLE_NSUBS (1 + SAMPLE_MAX_SUBS) /* subscribers, with the client */
+#define SAMPLE_STREAM_RING_MEM ((size_t)32 << 20) /* per stream subscriber,
+                                                   * ~0.5 sec of bsamps */
+#define SAMPLE_STREAM_NMSGS 64 /* max DnodeSamples per sendmsg() */
+#define SAMPLE_LIVE_NSLOTS 16384 /* live ring size; must be power of 2.
+                                  * ~0.5 sec, 37 MiB */
+
+/*
+ * A place live samples get forwarded to: the client, or a subscriber
+ * from sample_subscribe().
+ *
+ * With batching (see sample_cfg_forward_batch()), DnodeSamples are
+ * packed into DnodeSampleBatch datagrams in bufs, which go out with
+ * one sendmmsg() at the end of each event loop wakeup. Only the last
+ * datagram can be partly full; it stays behind until it fills up or
+ * flush_evt fires.
+ *
+ * Stream subscribers (see sample_sub_cfg.stream) get each DnodeSample
+ * queued in stream_ring instead, and the queue goes out over
+ * stream_fd as fast as the connection takes it.
+ *
+ * Protected by smpl_mtx.
+ */
+struct sample_sub {
+    struct sample_session *smpl;
+    struct sockaddr_storage addr; /**< Destination; if unset,
+                                   * .ss_family==AF_UNSPEC. */
+    enum sample_forward what;   /**< What kind of packets to forward. */
+    unsigned decimate;  /**< Forward samples whose index is a multiple
+                         * of this; 0 or 1 for all of them. */
+    unsigned tee_every; /**< While storing, forward board samples whose
+                         * index is a multiple of this; 0 for none. */
+    struct data_pbenc_chans chans; /**< If chans.n is nonzero,
+                                    * protobuf board samples only get
+                                    * these channels. */
+    unsigned batch_size;        /**< Max per datagram; 0 to not batch. */
+    struct timeval batch_latency; /**< Max wait for a batch to fill. */
+    size_t dgram_max;           /**< Largest unfragmented datagram to addr. */
+    uint8_t *bufs;              /**< SAMPLE_FWD_NDGRAMS datagram buffers,
+                                 * once batching's been turned on. */
+    struct mmsghdr mmsgs[SAMPLE_FWD_NDGRAMS];
+    struct iovec iovs[SAMPLE_FWD_NDGRAMS];
+    unsigned ndgrams;           /**< Datagrams in use. */
+    unsigned nsamps;            /**< DnodeSamples in the last one. */
+    struct event *flush_evt;
+
+    /* Stream subscriber state; stream_fd is -1 for everyone else. */
+    int stream_fd;
+    int stream_connecting;      /**< connect() hasn't finished yet. */
+    int stream_blocked;         /**< Waiting for stream_evt. */
+    struct event *stream_evt;   /**< stream_fd is writable. */
+    struct msg_ring stream_ring; /**< DnodeSamples waiting to go out. */
+    uint32_t stream_gap;        /**< DnodeSamples dropped from
+                                 * stream_ring since the last GAP. */
+    uint8_t *stream_part;       /**< A message we've partly sent... */
+    size_t stream_part_len;     /**< ...its length... */
+    size_t stream_part_off;     /**< ...and how much of it went out. */
+
+    /* SAMPLE_FWD_BSMP_DELTA state: the last samples we sent, which
+     * the next ones get compressed against. */
+    int delta_have_ref;         /**< If zero, send a key frame next. */
+    uint32_t delta_ref_sidx;    /**< Board sample index of delta_ref. */
+    unsigned delta_nsent;       /**< Sent since the last key frame. */
+    uint16_t delta_ref[RAW_BSMP_NSAMP]; /**< Host byte order. */
+
+    /* SAMPLE_FWD_BSMP_PREVIEW state: the window so far. preview is
+     * allocated when the subscriber first asks for previews. */
+    unsigned preview_window;    /**< Board samples per window; 0 for
+                                 * SAMPLE_PREVIEW_WINDOW_DEFAULT. */
+    struct preview16 *preview;  /**< If nsamps is 0, start over. */
+    struct data_pbenc_preview preview_msg; /**< Window's header. */
+
+    /* SAMPLE_FWD_BSMP_SPIKES state: the detector, which holds its
+     * configuration. It's allocated, with the default configuration,
+     * when the subscriber first asks for spikes. */
+    struct spike16 *spikes;
+    int spikes_restart;         /**< Restart before the next sample. */
+    uint64_t spikes_cookie;     /**< Experiment it's been looking at. */
+
+    /* Filter for protobuf board samples, or NULL to send them as they
+     * come; see sample_cfg_filter(). It holds its configuration. */
+    struct biquad16 *filter;
+    int filter_restart;         /**< Restart before the next sample. */
+    uint64_t filter_cookie;     /**< Experiment it's been filtering. */
+
+    /* Re-referencing for protobuf board samples, or NULL for none;
+     * see sample_cfg_reref(). It comes before the filter. */
+    struct reref16 *reref;
+};
+
 struct sample_session {
     /*
-     * Lock ordering: smpl_mtx, then worker_mtx, then bsamp_mtx.
+     * Lock ordering: smpl_mtx, then worker_mtx.
      *
-     * WISHLIST simplify the locking, probably by having the worker
-     * flip the sample buffers instead of the packet receive handlers
-     * (unlike the packet receivers, which can't block the event loop,
-     * the worker is free to sleep while grabbing the double-buffer
-     * write lock).
+     * Board samples themselves pass from the reader to the worker
+     * through bsamp_ring, which needs no locks.
      */
 
     struct event_base *base;
@@ -102,21 +244,90 @@ struct sample_session {
                        * Treat as constant. */
     evutil_socket_t ddatafd; /* Daemon data socket, open entire session.
                               *
-                              * Event loop thread only. */
+                              * Event loop thread only, except that
+                              * the ingest thread (if any) reads
+                              * from it. */
     struct iovec dpktbuf; /* Points to raw packet buffer for ddatafd.
                            * Event loop thread only. */
+    sa_family_t ddatafamily; /* ddatafd's address family. Source
+                              * addresses of received packets are in
+                              * this family. Treat as constant. */
+
+    /* Memory-mapped receive ring, if opts.packet_ring is set. In
+     * that case, packets are read from here instead of ddatafd,
+     * which is only used for sending. Same thread rules as for
+     * reading ddatafd. */
+    struct packet_ring *pring;
 
-    /* Buffers for initializing and packing data protocol
-     * messages. Event loop thread only. */
-    uint32_t c_bsub_chips[RAW_BSUB_NSAMP];
-    uint32_t c_bsub_chans[RAW_BSUB_NSAMP];
-    uint32_t c_bsub_samps[RAW_BSUB_NSAMP];
-    uint8_t c_bsmp_samps[RAW_BSMP_NSAMP * sizeof(raw_samp_t)];
+    /* recvmmsg() state for batched board sample reads; the iovecs
+     * point into free bsamp_slots, or relay_pkts when relaying.
+     * Event loop thread only. */
+    struct mmsghdr bsamp_mmsgs[SAMPLE_RECVMMSG_BATCH];
+    struct iovec bsamp_iovs[SAMPLE_RECVMMSG_BATCH];
+    struct sockaddr_storage bsamp_sas[SAMPLE_RECVMMSG_BATCH];
+
+    /* Buffers for packing data protocol messages when we're not
+     * batching them, and for packets going back out raw. Event loop
+     * thread only. */
     uint8_t *c_sample_pbuf_arr;
+    union sample_packet c_raw_pkt;
+
+    /* Raw relay state; see sample_ddatafd_relay(). relay_iovs hold
+     * the packets being relayed, and relay_srcs their sources. Each
+     * of relay_mmsgs sends one of them to one subscriber. Event loop
+     * thread only. */
+    union sample_packet *relay_pkts; /* SAMPLE_RECVMMSG_BATCH of them */
+    struct iovec relay_iovs[SAMPLE_RECVMMSG_BATCH];
+    struct sockaddr_storage *relay_srcs[SAMPLE_RECVMMSG_BATCH];
+    struct mmsghdr relay_mmsgs[SAMPLE_RECVMMSG_BATCH * SAMPLE_NSUBS];
+
+    /* Scratch space for SAMPLE_FWD_BSMP_DELTA,
+     * SAMPLE_FWD_BSMP_PREVIEW, SAMPLE_FWD_BSMP_SPIKES, filtering, and
+     * re-referencing.
+     * Event loop thread only. */
+    uint16_t c_bsmp_samps[RAW_BSMP_NSAMP];
+    uint16_t c_filt_samps[RAW_BSMP_NSAMP];
+    struct raw_pkt_bsmp c_filt_bsmp;
+    struct raw_pkt_bsmp c_reref_bsmp;
+    uint8_t c_delta_buf[DELTA16_MAX_LEN(RAW_BSMP_NSAMP)];
+    uint16_t c_preview[4][RAW_BSMP_NSAMP]; /* min, max, mean, rms */
+    uint16_t c_spike_chans[DATA_PBENC_SPIKES_MAX_EVENTS];
+    uint16_t c_spike_snips[DATA_PBENC_SPIKES_MAX_EVENTS *
+                           SPIKE16_SNIPPET_MAX];
+
+    /* Shared memory ring for local readers, if opts.live_ring is
+     * set. Event loop thread only. */
+    struct live_ring *live;
 
     /* Data socket event. Event loop thread only. */
     struct event *ddataevt;
 
+    /* Options from sample_new(). Treat as constant. */
+    struct sample_opts opts;
+    size_t bsamp_ringlen;    /* Board sample ring slots; from opts.
+                              * Treat as constant. */
+    size_t bsamp_write_len;  /* Worker write size; from opts.
+                              * Treat as constant. */
+
+    /*
+     * Ingest thread, if opts.ingest_thread is set.
+     *
+     * The ingest thread is the only producer for ingest_ring, and the
+     * event loop thread is the only consumer. Apart from the ring,
+     * the threads share only ingest_exit and ingest_efd; no locks.
+     */
+    pthread_t ingest;           /**< Ingest thread */
+    int ingest_running;         /**< Event loop thread only. */
+    int ingest_exit;            /**< Atomic; nonzero tells ingest to exit. */
+    int ingest_efd;             /**< eventfd, written after each push. */
+    struct event *ingest_evt;   /**< Event loop thread only. */
+    struct spsc_ring ingest_ring; /**< Indexes ingest_slots. */
+    struct sample_ingest_slot *ingest_slots;
+    size_t ingest_maplen;       /**< Mapped size of ingest_slots. */
+    /* recvmmsg() state; ingest thread only. */
+    struct mmsghdr ingest_mmsgs[SAMPLE_RECVMMSG_BATCH];
+    struct iovec ingest_iovs[SAMPLE_RECVMMSG_BATCH];
+
     /*
      * This group of fields is shared with worker threads (as in
      * plural, i.e., NOT JUST THE SAMPLE WORKER THREAD), and are
@@ -126,10 +337,12 @@ struct sample_session {
     struct sockaddr_storage dnaddr; /* Data node address; receive
                                      * [sub]samples from here only. If
                                      * unset, .ss_family==AF_UNSPEC. */
-    struct sockaddr_storage caddr; /* Client address; forward
-                                    * subsamples to here. If unset,
-                                    * .ss_family==AF_UNSPEC. */
-    enum sample_forward forward_what; /**< What kind of packets to forward. */
+    /* Where to forward samples. subs[0] is the client, set up with
+     * sample_set_addr() and sample_cfg_forwarding(); the rest are
+     * from sample_subscribe(). */
+    struct sample_sub subs[SAMPLE_NSUBS];
+    size_t tee_nsent;   /**< Board samples teed this transfer. */
+    size_t tee_nshed;   /**< Board samples we didn't tee, to keep up. */
     sample_bsamp_cb smpl_cb; /**<
                                * Callback function for sample
                                * retrieval and storage. */
@@ -155,41 +368,54 @@ struct sample_session {
     pthread_cond_t         worker_cv;  /**< Worker waits on this */
     enum sample_worker_why worker_why; /**< Why worker_cv was signaled */
     /**
-     * worker_using_buf[i] == 0 initially, and subsequently == 1 iff
-     * there's data in bsamp_bufs[i] that the worker has yet to finish
-     * writing to disk.
-     *
-     * Reader thread (i.e. event loop thread) sets these to 1, worker
-     * thread clears them when it's done.
-     */
-    int worker_using_buf[2];
+     * Nonzero while the worker is writing samples from bsamp_ring.
+     * The worker broadcasts worker_idle_cv when it clears this. */
+    int worker_draining;
+    pthread_cond_t worker_idle_cv;
+    /**
+     * Set to make the worker stop draining at the next opportunity,
+     * e.g. because the transfer is being torn down. */
+    int worker_cancel;
     /**
      * Number of samples worker has written during this sample storage
      * operation, or 0. */
     size_t worker_nwritten;
 
     /*
-     * Board sample double-buffering
+     * Board sample ring
      *
-     * This group of fields is shared between the worker and reader
-     * threads. (The reader grabs samples off the network in ->base's
-     * event loop thread).
+     * The reader (which grabs samples off the network in ->base's
+     * event loop thread) is the only producer, and the worker is the
+     * only consumer. The reader receives packets straight into free
+     * slots and publishes them; the worker writes whatever spans are
+     * published to disk, then releases them. See spsc_ring.h.
      *
-     * The worker takes a read lock when it's storing
-     * bsamp_bufs[bsamp_widx] to disk. It never writes to any of these
-     * fields.
-     *
-     * The reader thread has exclusive ownership over the non-worker
-     * buffer and its length. It tries to take a write lock when it's
-     * time to flip buffers. Failure to do so means samples get lost.
+     * bsamp_slots is mapped once by sample_new() and reused by every
+     * transfer. bsamp_active and bsamp_cfg are set up (under
+     * worker_mtx) before the worker hears about a transfer, and are
+     * only torn down (also under worker_mtx) once the worker is done
+     * draining, so neither side needs to lock them while the transfer
+     * is running. The worker only ever reads bsamp_cfg.chns.
      */
-    pthread_rwlock_t bsamp_mtx;
-    struct raw_pkt_bsmp *bsamp_bufs[2]; /**< Buffer expected board samples. */
-    size_t bsamp_buflen[2];  /**< Number of samples in each bsamp_bufs. */
-    size_t bsamp_widx;       /**< Worker index into bsamp_bufs/bsamp_buflen. */
+    struct spsc_ring bsamp_ring;
+    struct raw_pkt_bsmp *bsamp_slots; /**< bsamp_ringlen slots. */
+    size_t bsamp_maplen;              /**< Mapped size of bsamp_slots. */
+    int bsamp_active;                 /**< Transfer in progress. */
     /** Cached sample storage configuration. */
     struct sample_bsamp_cfg bsamp_cfg;
 
+    /*
+     * Back-pressure when the ring is full; event loop thread only.
+     *
+     * Rather than give up on the transfer, the reader stops pulling
+     * packets off the data socket (or ingest queue) and lets the
+     * kernel buffer them while the worker catches up, checking back
+     * every SAMPLE_BSAMP_PAUSE_USEC.
+     */
+    int bsamp_paused;
+    struct event *bsamp_pause_evt;
+    int bsamp_warned_full;   /**< Logged high-water warning already. */
+
     /*
      * Debugging; event loop thread only.
      */
@@ -249,30 +475,282 @@ static inline void sample_must_signal_worker(struct sample_session *smpl)
     safe_p_cond_signal(&smpl->worker_cv);
 }
 
-static inline void sample_must_rdlock_dbuf(struct sample_session *smpl)
+static inline void sample_must_wait_worker_idle(struct sample_session *smpl)
+{
+    while (smpl->worker_draining) {
+        safe_p_cond_wait(&smpl->worker_idle_cv, &smpl->worker_mtx);
+    }
+}
+
+/*
+ * Buffer memory
+ *
+ * The big packet buffers are mapped once, up front, with huge pages
+ * if we can get them, then faulted in and locked, so the receive
+ * path never takes a page fault on them.
+ */
+
+static void sample_prefault(void *buf, size_t len)
+{
+    const size_t pgsz = (size_t)sysconf(_SC_PAGESIZE);
+    volatile uint8_t *p = buf;
+    for (size_t off = 0; off < len; off += pgsz) {
+        p[off] = 0;
+    }
+}
+
+/* Map at least *len bytes; on success, *len is the mapped size. */
+static void* sample_map_buffer(size_t *len)
+{
+    void *buf = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    /* This only works if the administrator has reserved huge pages
+     * (see vm.nr_hugepages), so failure is routine. */
+    size_t hlen = ((*len + SAMPLE_HUGEPAGE_SIZE - 1) &
+                   ~(SAMPLE_HUGEPAGE_SIZE - 1));
+    buf = mmap(NULL, hlen, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+               -1, 0);
+    if (buf != MAP_FAILED) {
+        *len = hlen;
+        log_DEBUG("%s: mapped %zu MiB with huge pages", __func__,
+                  hlen >> 20);
+    }
+#endif
+    if (buf == MAP_FAILED) {
+        buf = mmap(NULL, *len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED) {
+            log_ERR("%s: can't map %zu bytes: %m", __func__, *len);
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        /* Ask for transparent huge pages instead; best effort. */
+        madvise(buf, *len, MADV_HUGEPAGE);
+#endif
+    }
+    /* mlock() faults everything in. If we can't lock (e.g. because
+     * of RLIMIT_MEMLOCK), at least do that much. */
+    if (mlock(buf, *len)) {
+        log_WARNING("can't lock %zu MiB of sample buffers in memory: %m",
+                    *len >> 20);
+        sample_prefault(buf, *len);
+    }
+    return buf;
+}
+
+static void sample_unmap_buffer(void *buf, size_t len)
+{
+    if (buf && munmap(buf, len)) {
+        log_WARNING("%s: munmap: %m", __func__);
+    }
+}
+
+/*
+ * Data socket reads
+ *
+ * Everything that reads packets from the data node does it with
+ * sample_recvmmsg(). That's recvmmsg() on ddatafd by default. With a
+ * packet ring, it reads from the ring instead, with the same
+ * semantics, so the callers don't need to care which it is.
+ */
+
+/* Convert an IPv4 address to ddatafd's address family, as an
+ * IPv4-mapped IPv6 address if need be. Returns its length. */
+static socklen_t sample_ddata_addr(struct sample_session *smpl,
+                                   const struct sockaddr_in *in,
+                                   struct sockaddr_storage *out)
+{
+    if (smpl->ddatafamily != AF_INET6) {
+        memcpy(out, in, sizeof(*in));
+        return sizeof(*in);
+    }
+    struct sockaddr_in6 *out6 = (struct sockaddr_in6*)out;
+    memset(out6, 0, sizeof(*out6));
+    out6->sin6_family = AF_INET6;
+    out6->sin6_port = in->sin_port;
+    out6->sin6_addr.s6_addr[10] = 0xFF;
+    out6->sin6_addr.s6_addr[11] = 0xFF;
+    memcpy(&out6->sin6_addr.s6_addr[12], &in->sin_addr, 4);
+    return sizeof(*out6);
+}
+
+/* Fill in a received packet's source address as recvmmsg() on
+ * ddatafd would have. */
+static void sample_pring_name(struct sample_session *smpl,
+                              struct sockaddr_in *from,
+                              struct msghdr *hdr)
+{
+    if (hdr->msg_name) {
+        struct sockaddr_storage ss;
+        socklen_t len = sample_ddata_addr(smpl, from, &ss);
+        memcpy(hdr->msg_name, &ss, len);
+        hdr->msg_namelen = len;
+    }
+}
+
+static int sample_pring_recvmmsg(struct sample_session *smpl,
+                                 struct mmsghdr *msgs, unsigned vlen,
+                                 int flags)
 {
-    safe_p_rwlock_rdlock(&smpl->bsamp_mtx);
+    if (flags & MSG_WAITFORONE) {
+        /* Like SO_RCVTIMEO on the data socket, for the ingest thread. */
+        struct pollfd pfd = {
+            .fd = packet_ring_fd(smpl->pring),
+            .events = POLLIN,
+        };
+        int p = poll(&pfd, 1, SAMPLE_INGEST_RCVTIMEO_USEC / 1000);
+        if (p <= 0) {
+            if (p == 0) {
+                errno = EAGAIN;
+            }
+            return -1;
+        }
+    }
+    unsigned n;
+    for (n = 0; n < vlen; n++) {
+        struct msghdr *hdr = &msgs[n].msg_hdr;
+        struct sockaddr_in from;
+        void *data;
+        ssize_t len = packet_ring_next(smpl->pring, &data, &from);
+        if (len == -1) {
+            break;
+        }
+        size_t copylen = hdr->msg_iov[0].iov_len;
+        hdr->msg_flags = 0;
+        if ((size_t)len < copylen) {
+            copylen = (size_t)len;
+        } else if ((size_t)len > copylen) {
+            hdr->msg_flags |= MSG_TRUNC;
+        }
+        memcpy(hdr->msg_iov[0].iov_base, data, copylen);
+        msgs[n].msg_len = (unsigned)copylen;
+        sample_pring_name(smpl, &from, hdr);
+    }
+    if (n == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return (int)n;
 }
 
-static inline void sample_must_wrlock_dbuf(struct sample_session *smpl)
+/* Each message must have exactly one iovec. */
+static int sample_recvmmsg(struct sample_session *smpl,
+                           struct mmsghdr *msgs, unsigned vlen, int flags)
 {
-    safe_p_rwlock_wrlock(&smpl->bsamp_mtx);
+    if (smpl->pring) {
+        return sample_pring_recvmmsg(smpl, msgs, vlen, flags);
+    }
+    return recvmmsg(smpl->ddatafd, msgs, vlen, flags, NULL);
 }
 
-static inline int sample_must_trywrlock_dbuf(struct sample_session *smpl)
+/* File descriptor that's readable when there are packets to read. */
+static int sample_recv_fd(struct sample_session *smpl)
 {
-    return safe_p_rwlock_trywrlock(&smpl->bsamp_mtx);
+    return smpl->pring ? packet_ring_fd(smpl->pring) : smpl->ddatafd;
 }
 
-static inline void sample_must_rwunlock_dbuf(struct sample_session *smpl)
+/*
+ * Kernel-side data socket filtering
+ *
+ * Rather than wake up for every packet that lands on ddatafd and
+ * throw away the ones we don't want, ddatafd is connect()ed to the
+ * data node, so the kernel drops packets from anywhere else, and
+ * carries a socket filter that accepts only the packet type we're
+ * currently after (or nothing). The userspace checks stay, since
+ * they're cheap for good packets, and packets that were already
+ * queued when the filter changed still need them.
+ */
+
+#define SAMPLE_FILTER_NOTHING (-1) /* sample_ddatafd_filter(): drop all */
+#define SAMPLE_FILTER_ANY (-2)     /* ... or accept any mtype */
+
+/* Accept only raw packets of type "mtype", with the right magic and
+ * protocol version. Accept nothing if mtype is SAMPLE_FILTER_NOTHING,
+ * and packets of any type if it's SAMPLE_FILTER_ANY. */
+static int sample_ddatafd_filter(struct sample_session *smpl, int mtype)
 {
-    safe_p_rwlock_unlock(&smpl->bsamp_mtx);
+    const uint32_t mask = (mtype == SAMPLE_FILTER_ANY ?
+                           0xFFFF0000 : 0xFFFFFF00);
+    const uint32_t hdr = ((uint32_t)RAW_PKT_HEADER_MAGIC << 24 |
+                          (uint32_t)RAW_PKT_HEADER_PROTO_VERS << 16 |
+                          ((uint32_t)(mtype & 0xFF) << 8 & mask));
+    struct sock_filter accept_mtype[] = {
+        /* UDP socket filters start at the UDP header. Load the
+         * magic, version, mtype, and flags, and ignore the flags
+         * (and maybe the mtype). */
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, sizeof(struct udphdr)),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, mask),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, hdr, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_filter accept_nothing[] = {
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog;
+    if (mtype == SAMPLE_FILTER_NOTHING) {
+        prog.len = sizeof(accept_nothing) / sizeof(accept_nothing[0]);
+        prog.filter = accept_nothing;
+    } else {
+        prog.len = sizeof(accept_mtype) / sizeof(accept_mtype[0]);
+        prog.filter = accept_mtype;
+    }
+    return setsockopt(smpl->ddatafd, SOL_SOCKET, SO_ATTACH_FILTER,
+                      &prog, sizeof(prog));
 }
 
 /*
  * Worker thread
  */
 
+/*
+ * Write everything that's waiting in bsamp_ring to disk, a span at a
+ * time, until the ring is empty, a write fails, or we're cancelled.
+ *
+ * Call with worker_mtx held; it's released while writing. Returns 0
+ * on success, -1 on write error.
+ */
+static int sample_worker_drain(struct sample_session *smpl)
+{
+    struct spsc_ring *ring = &smpl->bsamp_ring;
+    int ret = 0;
+
+    if (!smpl->bsamp_active) {
+        /* Transfer was torn down before we got here. */
+        return 0;
+    }
+    smpl->worker_draining = 1;
+    while (!smpl->worker_cancel) {
+        size_t idx;
+        size_t len = spsc_ring_peek(ring, &idx);
+        if (len == 0) {
+            break;
+        }
+        if (len > smpl->bsamp_write_len) {
+            len = smpl->bsamp_write_len;
+        }
+        sample_must_unlock_worker(smpl);
+        int write_err = ch_storage_write(smpl->bsamp_cfg.chns,
+                                         &smpl->bsamp_slots[idx], len);
+        if (!write_err) {
+            spsc_ring_pop(ring, len);
+        }
+        sample_must_lock_worker(smpl);
+        if (write_err) {
+            log_DEBUG("%s: ERROR storing packets: %m", __func__);
+            ret = -1;
+            break;
+        }
+        smpl->worker_nwritten += len;
+        log_DEBUG("%s: stored %zu samples, total %zu", __func__,
+                  len, smpl->worker_nwritten);
+    }
+    smpl->worker_draining = 0;
+    safe_p_cond_broadcast(&smpl->worker_idle_cv);
+    return ret;
+}
+
 static void* sample_worker_main(void *smplvp)
 {
     struct sample_session *smpl = smplvp;
@@ -288,34 +766,9 @@ static void* sample_worker_main(void *smplvp)
             pthread_exit(NULL);
         }
         if (smpl->worker_why & SAMPLE_WHY_BSAMPS) {
-            int write_err = 0;
-
-            /* Reader thread has a buffer of samples waiting for us to
-             * store. */
+            /* Reader thread has samples waiting for us to store. */
             smpl->worker_why &= ~SAMPLE_WHY_BSAMPS;
-            sample_must_unlock_worker(smpl);
-
-            /* Try to store the samples. */
-            sample_must_rdlock_dbuf(smpl);
-            size_t i = smpl->bsamp_widx;
-            size_t len = smpl->bsamp_buflen[i];
-            if (len) {
-                write_err = ch_storage_write(smpl->bsamp_cfg.chns,
-                                             smpl->bsamp_bufs[i], len);
-            }
-            sample_must_rwunlock_dbuf(smpl);
-
-            /* Set the state which tells the reader thread we're not
-             * using the buffer anymore. */
-            sample_must_lock_worker(smpl);
-            smpl->worker_using_buf[i] = 0;
-            if (!write_err) {
-                smpl->worker_nwritten += len;
-                log_DEBUG("%s: stored %zu samples, total %zu", __func__,
-                          len, smpl->worker_nwritten);
-            } else {
-                log_DEBUG("%s: ERROR storing packets: %m", __func__);
-            }
+            int write_err = sample_worker_drain(smpl);
             sample_must_unlock_worker(smpl);
 
             /* Wake up the reader thread and let it know what happened. */
@@ -334,16 +787,17 @@ static void* sample_worker_main(void *smplvp)
             event_active(smpl->smpl_worker_evt, what, 0);
             sample_must_unlock(smpl);
 
-            /* Re-grab the worker lock (which we released so we could
-             * block in ch_storage_write(), above) for the next
+            /* Re-grab the worker lock (which we released so we
+             * could grab smpl_mtx, above) for the next
              * conditional. */
             sample_must_lock_worker(smpl);
         }
         if (smpl->worker_why & SAMPLE_WHY_STOP) {
             /* Reader thread wants us to know that this transfer has
-             * ended for some reason. Let it know know we heard it and
-             * go back to sleep. */
-            smpl->worker_why &= ~SAMPLE_WHY_STOP;
+             * ended for some reason. Flush what we've got, let it
+             * know we heard it, and go back to sleep. */
+            smpl->worker_why &= ~(SAMPLE_WHY_STOP | SAMPLE_WHY_BSAMPS);
+            sample_worker_drain(smpl);
             sample_must_unlock_worker(smpl);
             sample_must_lock(smpl);
             event_active(smpl->smpl_worker_evt, SAMPLE_THREAD_SLEEPING, 0);
@@ -356,6 +810,191 @@ static void* sample_worker_main(void *smplvp)
     return NULL;
 }
 
+/*
+ * Ingest thread
+ */
+
+static void* sample_ingest_main(void *smplvp)
+{
+    struct sample_session *smpl = smplvp;
+    struct spsc_ring *ring = &smpl->ingest_ring;
+    const uint64_t one = 1;
+    int logged_err = 0;
+
+    while (!__atomic_load_n(&smpl->ingest_exit, __ATOMIC_ACQUIRE)) {
+        size_t idx;
+        size_t max = spsc_ring_reserve(ring, &idx);
+        if (max == 0) {
+            /* The event loop is behind. Leave packets in the socket
+             * buffer and give it a chance to catch up. */
+            struct timespec ts = {
+                .tv_sec = 0,
+                .tv_nsec = SAMPLE_INGEST_FULL_NSEC,
+            };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        if (max > SAMPLE_RECVMMSG_BATCH) {
+            max = SAMPLE_RECVMMSG_BATCH;
+        }
+        for (size_t j = 0; j < max; j++) {
+            struct sample_ingest_slot *slot = &smpl->ingest_slots[idx + j];
+            struct msghdr *hdr = &smpl->ingest_mmsgs[j].msg_hdr;
+            smpl->ingest_iovs[j].iov_base = &slot->pkt;
+            smpl->ingest_iovs[j].iov_len = sizeof(slot->pkt);
+            hdr->msg_name = &slot->from;
+            hdr->msg_namelen = sizeof(slot->from);
+            hdr->msg_iov = &smpl->ingest_iovs[j];
+            hdr->msg_iovlen = 1;
+            hdr->msg_control = NULL;
+            hdr->msg_controllen = 0;
+            hdr->msg_flags = 0;
+        }
+        /* Blocks (up to SO_RCVTIMEO) for the first packet only. */
+        int n = sample_recvmmsg(smpl, smpl->ingest_mmsgs, (unsigned)max,
+                                MSG_WAITFORONE);
+        if (n == -1) {
+            switch (errno) {
+#if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:   /* fall through */
+#endif
+            case EAGAIN:        /* fall through */
+            case EINTR:
+                continue;
+            default:
+                if (!logged_err) {
+                    log_WARNING("%s: recvmmsg: %m", __func__);
+                    logged_err = 1;
+                }
+                continue;
+            }
+        }
+        logged_err = 0;
+        for (int j = 0; j < n; j++) {
+            smpl->ingest_slots[idx + j].len = smpl->ingest_mmsgs[j].msg_len;
+        }
+        spsc_ring_push(ring, (size_t)n);
+        __unused ssize_t w = write(smpl->ingest_efd, &one, sizeof(one));
+    }
+    return NULL;
+}
+
+/* Pop the oldest queued packet into "pkt"/"from".
+ * Returns its length, or -1 if the queue is empty.
+ * Event loop thread only. */
+static ssize_t sample_ingest_pop(struct sample_session *smpl, void *pkt,
+                                 struct sockaddr_storage *from)
+{
+    size_t idx;
+    if (spsc_ring_peek(&smpl->ingest_ring, &idx) == 0) {
+        return -1;
+    }
+    struct sample_ingest_slot *slot = &smpl->ingest_slots[idx];
+    size_t len = slot->len;
+    memcpy(pkt, &slot->pkt, len);
+    memcpy(from, &slot->from, sizeof(*from));
+    spsc_ring_pop(&smpl->ingest_ring, 1);
+    return (ssize_t)len;
+}
+
+/* Event loop thread only. */
+static int sample_start_ingest(struct sample_session *smpl)
+{
+    struct spsc_ring *ring = &smpl->ingest_ring;
+
+    smpl->ingest_maplen = (SAMPLE_INGEST_QLEN *
+                           sizeof(struct sample_ingest_slot));
+    smpl->ingest_slots = sample_map_buffer(&smpl->ingest_maplen);
+    if (!smpl->ingest_slots) {
+        return -1;
+    }
+    spsc_ring_init(ring, SAMPLE_INGEST_QLEN);
+
+    /* The ingest thread blocks on the data socket, waking up every
+     * so often to see if it should exit. (The packet ring does its
+     * own timeout.) */
+    struct timeval rcvtimeo = {
+        .tv_sec = 0,
+        .tv_usec = SAMPLE_INGEST_RCVTIMEO_USEC,
+    };
+    if (!smpl->pring &&
+        setsockopt(smpl->ddatafd, SOL_SOCKET, SO_RCVTIMEO,
+                   &rcvtimeo, sizeof(rcvtimeo))) {
+        log_ERR("%s: can't set data socket timeout: %m", __func__);
+        return -1;
+    }
+    if (smpl->opts.busy_poll_usec) {
+#ifdef SO_BUSY_POLL
+        int usec = (int)smpl->opts.busy_poll_usec;
+        if (setsockopt(sample_recv_fd(smpl), SOL_SOCKET, SO_BUSY_POLL,
+                       &usec, sizeof(usec))) {
+            log_WARNING("can't enable busy polling on data socket: %m");
+        }
+#else
+        log_WARNING("busy polling is unsupported; ignoring");
+#endif
+    }
+
+    smpl->ingest_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (smpl->ingest_efd == -1) {
+        log_ERR("%s: eventfd: %m", __func__);
+        return -1;
+    }
+    smpl->ingest_evt = event_new(smpl->base, smpl->ingest_efd,
+                                 EV_READ | EV_PERSIST,
+                                 sample_ingest_callback, smpl);
+    if (!smpl->ingest_evt || event_add(smpl->ingest_evt, NULL)) {
+        log_ERR("%s: can't create ingest queue event", __func__);
+        return -1;
+    }
+
+    smpl->ingest_exit = 0;
+    if (pthread_create(&smpl->ingest, NULL, sample_ingest_main, smpl)) {
+        log_ERR("%s: can't create ingest thread", __func__);
+        return -1;
+    }
+    smpl->ingest_running = 1;
+    if (smpl->opts.ingest_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(smpl->opts.ingest_cpu, &cpus);
+        int err = pthread_setaffinity_np(smpl->ingest, sizeof(cpus), &cpus);
+        if (err) {
+            log_ERR("can't pin ingest thread to CPU %d: %s",
+                    smpl->opts.ingest_cpu, strerror(err));
+            return -1;
+        }
+    }
+    if (smpl->opts.ingest_cpu >= 0) {
+        log_INFO("reading data socket from ingest thread on CPU %d",
+                 smpl->opts.ingest_cpu);
+    } else {
+        log_INFO("reading data socket from ingest thread");
+    }
+    return 0;
+}
+
+/* Event loop thread only. */
+static void sample_stop_ingest(struct sample_session *smpl)
+{
+    if (smpl->ingest_running) {
+        __atomic_store_n(&smpl->ingest_exit, 1, __ATOMIC_RELEASE);
+        safe_p_join(smpl->ingest, NULL);
+        smpl->ingest_running = 0;
+    }
+    if (smpl->ingest_evt) {
+        event_free(smpl->ingest_evt);
+        smpl->ingest_evt = NULL;
+    }
+    if (smpl->ingest_efd != -1) {
+        close(smpl->ingest_efd);
+        smpl->ingest_efd = -1;
+    }
+    sample_unmap_buffer(smpl->ingest_slots, smpl->ingest_maplen);
+    smpl->ingest_slots = NULL;
+    smpl->ingest_maplen = 0;
+}
+
 /*
  * Other helpers
  */
@@ -380,15 +1019,130 @@ static inline int sample_expecting_bsamps(struct sample_session *smpl)
             smpl->smpl_stop_why == SAMPLE_STOP_NONE);
 }
 
+/* NOT SYNCHRONIZED (smpl_mtx) */
+static inline int sample_sub_active(struct sample_sub *sub)
+{
+    return (sub->what != SAMPLE_FWD_NOTHING &&
+            sub->addr.ss_family != AF_UNSPEC);
+}
+
 /* NOT SYNCHRONIZED (smpl_mtx) */
 static inline int sample_forwarding_data(struct sample_session *smpl)
 {
-    return (smpl->forward_what != SAMPLE_FWD_NOTHING &&
-            smpl->dnaddr.ss_family != AF_UNSPEC &&
-            smpl->caddr.ss_family != AF_UNSPEC);
+    if (smpl->dnaddr.ss_family == AF_UNSPEC) {
+        return 0;
+    }
+    if (smpl->live) {
+        return 1;
+    }
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        if (sample_sub_active(&smpl->subs[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* NOT SYNCHRONIZED (smpl_mtx) */
+static uint8_t sample_sub_mtype(struct sample_sub *sub)
+{
+    switch (sub->what) {
+    case SAMPLE_FWD_BSMP:       /* fall through */
+    case SAMPLE_FWD_BSMP_RAW:   /* fall through */
+    case SAMPLE_FWD_BSMP_DELTA: /* fall through */
+    case SAMPLE_FWD_BSMP_PREVIEW: /* fall through */
+    case SAMPLE_FWD_BSMP_SPIKES:
+        return RAW_MTYPE_BSMP;
+    case SAMPLE_FWD_BSUB:       /* fall through */
+    case SAMPLE_FWD_BSUB_RAW:
+        return RAW_MTYPE_BSUB;
+    case SAMPLE_FWD_NOTHING:    /* shouldn't happen; fall through */
+    default:
+        assert(0);
+        return RAW_MTYPE_ERR;
+    }
+}
+
+/* Does anyone (counting the live ring) want packets of this type?
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_forwarding_mtype(struct sample_session *smpl,
+                                   uint8_t mtype)
+{
+    if (mtype == RAW_MTYPE_BSMP && smpl->live) {
+        return 1;
+    }
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        if (sample_sub_active(sub) && sample_sub_mtype(sub) == mtype) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* The packet type all the subscribers (and the live ring) want, or
+ * SAMPLE_FILTER_ANY if they don't agree.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_forward_filter_mtype(struct sample_session *smpl)
+{
+    int mtype = smpl->live ? RAW_MTYPE_BSMP : SAMPLE_FILTER_NOTHING;
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        if (!sample_sub_active(sub)) {
+            continue;
+        }
+        int sub_mtype = sample_sub_mtype(sub);
+        if (mtype != SAMPLE_FILTER_NOTHING && mtype != sub_mtype) {
+            return SAMPLE_FILTER_ANY;
+        }
+        mtype = sub_mtype;
+    }
+    return mtype;
+}
+
+/* Point ddatafd's socket filter at whatever we're doing now.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_update_ddatafd_filter(struct sample_session *smpl)
+{
+    int mtype = SAMPLE_FILTER_NOTHING;
+    if (smpl->pring) {
+        return;                 /* ddatafd drops everything */
+    }
+    if (sample_expecting_bsamps(smpl)) {
+        mtype = RAW_MTYPE_BSMP;
+    } else if (sample_forwarding_data(smpl)) {
+        mtype = sample_forward_filter_mtype(smpl);
+    }
+    if (sample_ddatafd_filter(smpl, mtype)) {
+        /* Better to let everything through than to drop what we
+         * want; the userspace checks can cope. */
+        log_WARNING("can't update data socket filter: %m");
+        if (setsockopt(smpl->ddatafd, SOL_SOCKET, SO_DETACH_FILTER,
+                       NULL, 0) && errno != ENOENT) {
+            log_ERR("can't remove data socket filter: %m");
+        }
+    }
+}
+
+/* Have the kernel drop packets to ddatafd that aren't from the data
+ * node. NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_connect_dnode(struct sample_session *smpl)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    if (smpl->dnaddr.ss_family == AF_INET) {
+        len = sample_ddata_addr(smpl, (struct sockaddr_in*)&smpl->dnaddr,
+                                &ss);
+    } else {
+        len = sockutil_addrlen((struct sockaddr*)&smpl->dnaddr);
+        memcpy(&ss, &smpl->dnaddr, len);
+    }
+    if (connect(smpl->ddatafd, (struct sockaddr*)&ss, len)) {
+        log_WARNING("can't connect data socket to data node: %m");
+    }
 }
 
-/* NOT SYNCHRONIZED (wr bsamp_mtx) */
+/* NOT SYNCHRONIZED (worker_mtx) */
 static void sample_init_bsamp_cfg(struct sample_session *smpl)
 {
     smpl->bsamp_cfg.nsamples = 0;
@@ -396,34 +1150,63 @@ static void sample_init_bsamp_cfg(struct sample_session *smpl)
     smpl->bsamp_cfg.chns = NULL;
 }
 
+/* Stop reading the data socket (or ingest queue) for a little while,
+ * because there's nowhere to put board samples.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_pause_reading(struct sample_session *smpl)
+{
+    struct timeval retry = {
+        .tv_sec = 0,
+        .tv_usec = SAMPLE_BSAMP_PAUSE_USEC,
+    };
+    if (!smpl->bsamp_warned_full) {
+        log_WARNING("sample buffer is full; waiting for storage to catch up");
+        smpl->bsamp_warned_full = 1;
+    }
+    if (!smpl->bsamp_paused && smpl->ddataevt) {
+        event_del(smpl->ddataevt);
+    }
+    smpl->bsamp_paused = 1;
+    evtimer_add(smpl->bsamp_pause_evt, &retry);
+}
+
+/* NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_resume_reading(struct sample_session *smpl)
+{
+    if (!smpl->bsamp_paused) {
+        return;
+    }
+    smpl->bsamp_paused = 0;
+    evtimer_del(smpl->bsamp_pause_evt);
+    if (smpl->ddataevt) {
+        event_add(smpl->ddataevt, NULL);
+    } else if (smpl->ingest_evt) {
+        event_active(smpl->ingest_evt, EV_READ, 0);
+    }
+}
+
 /*
  * Release non-timeout resources acquired while expecting board samples.
  *
- * IMPORTANT: this takes the write lock on the sample buffer, so DO
- * NOT CALL THIS FUNCTION FROM THE EVENT LOOP THREAD unless the worker
- * is sleeping, or you'll block the event loop if the worker is
- * writing samples.
+ * IMPORTANT: this waits for the worker to finish any write it's in
+ * the middle of, so DO NOT CALL THIS FUNCTION FROM THE EVENT LOOP
+ * THREAD unless the worker is sleeping, or you'll block the event
+ * loop for as long as the write takes.
  */
-/* ACQUIRES worker_mtx, ACQUIRES (wr) bsamp_mtx */
+/* ACQUIRES worker_mtx */
 static void sample_finished_with_bsamps(struct sample_session *smpl)
 {
-    sample_must_wrlock_dbuf(smpl);
-    assert(smpl->bsamp_bufs[0] && smpl->bsamp_bufs[1]);
-    free(smpl->bsamp_bufs[0]);
-    free(smpl->bsamp_bufs[1]);
-    smpl->bsamp_bufs[0] = NULL;
-    smpl->bsamp_bufs[1] = NULL;
-    smpl->bsamp_buflen[0] = 0;
-    smpl->bsamp_buflen[1] = 0;
-    smpl->bsamp_widx = 0;
-    sample_init_bsamp_cfg(smpl);
-    sample_must_rwunlock_dbuf(smpl);
-
+    sample_resume_reading(smpl);
     sample_must_lock_worker(smpl);
-    smpl->worker_using_buf[0] = 0;
-    smpl->worker_using_buf[1] = 0;
     smpl->worker_why &= ~SAMPLE_WHY_BSAMPS;
+    smpl->worker_cancel = 1;
+    sample_must_wait_worker_idle(smpl);
+    assert(smpl->bsamp_active);
+    smpl->bsamp_active = 0;
+    spsc_ring_clear(&smpl->bsamp_ring);
+    sample_init_bsamp_cfg(smpl);
     sample_must_unlock_worker(smpl);
+    sample_update_ddatafd_filter(smpl);
 }
 
 /* NOT SYNCHRONIZED (smpl_mtx) */
@@ -472,9 +1255,10 @@ static void __sample_reject_bsamps_internal(struct sample_session *smpl)
     } while (0)
 
 /* Timeout or dropped packet occurred while reading board samples. Get
- * the worker thread to acknowledge and go back to sleep.
+ * the worker thread to flush what it has, acknowledge, and go back
+ * to sleep.
  *
- * NOT SYNCHRONIZED (smpl_mtx), ACQUIRES worker_mtx, (wr) bsamp_mtx */
+ * NOT SYNCHRONIZED (smpl_mtx), ACQUIRES worker_mtx */
 static void sample_stop_worker(struct sample_session *smpl,
                                enum sample_stop_why why)
 {
@@ -491,7 +1275,7 @@ static int sample_init_pthreads(struct sample_session *smpl)
     int ret = -1;
     int smpl_destroy = 0;
     int work_destroy = 0;
-    int dbuf_destroy = 0;
+    int idle_destroy = 0;
     int cv_destroy = 0;
     int t_destroy = 0;
 
@@ -507,8 +1291,8 @@ static int sample_init_pthreads(struct sample_session *smpl)
     if (!cv_destroy) {
         goto out;
     }
-    dbuf_destroy = !pthread_rwlock_init(&smpl->bsamp_mtx, NULL);
-    if (!dbuf_destroy) {
+    idle_destroy = !pthread_cond_init(&smpl->worker_idle_cv, NULL);
+    if (!idle_destroy) {
         goto out;
     }
     t_destroy = !pthread_create(&smpl->worker, NULL, sample_worker_main,
@@ -528,8 +1312,8 @@ static int sample_init_pthreads(struct sample_session *smpl)
         if (cv_destroy) {
             pthread_cond_destroy(&smpl->worker_cv);
         }
-        if (dbuf_destroy) {
-            pthread_rwlock_destroy(&smpl->bsamp_mtx);
+        if (idle_destroy) {
+            pthread_cond_destroy(&smpl->worker_idle_cv);
         }
         /* No need to clean up smpl->worker; we did that last, so
          * either it hasn't been created or creation failed. */
@@ -538,6 +1322,133 @@ static int sample_init_pthreads(struct sample_session *smpl)
     return ret;
 }
 
+/* Close a stream subscriber's connection, dropping whatever hasn't
+ * gone out yet. Does nothing for other subscribers.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_stream_close(struct sample_sub *sub)
+{
+    if (sub->stream_evt) {
+        event_free(sub->stream_evt);
+        sub->stream_evt = NULL;
+    }
+    if (sub->stream_fd != -1) {
+        close(sub->stream_fd);
+        sub->stream_fd = -1;
+    }
+    msg_ring_free(&sub->stream_ring);
+    free(sub->stream_part);
+    sub->stream_part = NULL;
+    sub->stream_connecting = 0;
+    sub->stream_blocked = 0;
+}
+
+/* Connect to a stream subscriber at sub->addr, and set up its queue.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_stream_open(struct sample_sub *sub)
+{
+    struct sockaddr *addr = (struct sockaddr*)&sub->addr;
+    assert(sub->stream_fd == -1);
+    sub->stream_fd = socket(addr->sa_family,
+                            SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sub->stream_fd == -1) {
+        log_WARNING("can't create stream socket: %m");
+        goto fail;
+    }
+    if (addr->sa_family != AF_UNIX &&
+        sockutil_set_tcp_nodelay(sub->stream_fd)) {
+        log_WARNING("can't disable Nagle's algorithm for stream: %m");
+    }
+    sub->stream_connecting = 0;
+    if (connect(sub->stream_fd, addr, sockutil_addrlen(addr))) {
+        if (errno != EINPROGRESS) {
+            log_WARNING("can't connect to stream subscriber: %m");
+            goto fail;
+        }
+        sub->stream_connecting = 1;
+    }
+    if (msg_ring_init(&sub->stream_ring, SAMPLE_STREAM_RING_MEM)) {
+        log_WARNING("can't allocate stream queue");
+        goto fail;
+    }
+    sub->stream_part = malloc(CLIENT_CMDLEN_SIZE + SAMPLE_PBUF_ARR_SIZE);
+    if (!sub->stream_part) {
+        goto fail;
+    }
+    sub->stream_evt = event_new(sub->smpl->base, sub->stream_fd, EV_WRITE,
+                                sample_stream_callback, sub);
+    if (!sub->stream_evt) {
+        log_WARNING("%s: can't create stream event", __func__);
+        goto fail;
+    }
+    sub->stream_blocked = sub->stream_connecting;
+    if (sub->stream_blocked && event_add(sub->stream_evt, NULL)) {
+        goto fail;
+    }
+    sub->stream_gap = 0;
+    sub->stream_part_len = 0;
+    sub->stream_part_off = 0;
+    return 0;
+
+ fail:
+    sample_stream_close(sub);
+    return -1;
+}
+
+/* Stop forwarding to a subscriber, and close its stream if it has
+ * one, leaving its buffers and timer for whoever takes its place.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_clear_sub(struct sample_sub *sub)
+{
+    sample_stream_close(sub);
+    sub->addr.ss_family = AF_UNSPEC;
+    sub->what = SAMPLE_FWD_NOTHING;
+    sub->decimate = 0;
+    sub->tee_every = 0;
+    sub->chans.n = 0;
+    sub->delta_have_ref = 0;
+    sub->preview_window = 0;
+    free(sub->preview);
+    sub->preview = NULL;
+    free(sub->spikes);
+    sub->spikes = NULL;
+    free(sub->filter);
+    sub->filter = NULL;
+    free(sub->reref);
+    sub->reref = NULL;
+    sub->batch_size = 0;
+    sub->batch_latency.tv_sec = 0;
+    sub->batch_latency.tv_usec = 0;
+    sub->dgram_max = 0;
+    sub->ndgrams = 0;
+    sub->nsamps = 0;
+}
+
+static void sample_init_sub(struct sample_session *smpl,
+                            struct sample_sub *sub)
+{
+    sub->smpl = smpl;
+    sub->bufs = NULL;
+    sub->flush_evt = NULL;
+    sub->stream_fd = -1;
+    sub->stream_evt = NULL;
+    memset(&sub->stream_ring, 0, sizeof(sub->stream_ring));
+    sub->stream_part = NULL;
+    sub->preview = NULL;
+    sub->spikes = NULL;
+    sub->filter = NULL;
+    sub->reref = NULL;
+    for (size_t i = 0; i < SAMPLE_FWD_NDGRAMS; i++) {
+        struct msghdr *hdr = &sub->mmsgs[i].msg_hdr;
+        sub->iovs[i].iov_base = NULL;
+        sub->iovs[i].iov_len = 0;
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_name = &sub->addr;
+        hdr->msg_iov = &sub->iovs[i];
+        hdr->msg_iovlen = 1;
+    }
+    sample_clear_sub(sub);
+}
+
 /* NOT SYNCHRONIZED */
 static void sample_init(struct sample_session *smpl)
 {
@@ -546,11 +1457,26 @@ static void sample_init(struct sample_session *smpl)
     smpl->ddatafd = -1;
     smpl->dpktbuf.iov_base = NULL;
     smpl->dpktbuf.iov_len = 0;
+    smpl->ddatafamily = AF_UNSPEC;
+    smpl->pring = NULL;
     smpl->c_sample_pbuf_arr = NULL;
+    smpl->relay_pkts = NULL;
+    memset(smpl->relay_mmsgs, 0, sizeof(smpl->relay_mmsgs));
+    smpl->live = NULL;
     smpl->ddataevt = NULL;
+    struct sample_opts opts = SAMPLE_OPTS_DEFAULT;
+    smpl->opts = opts;
+    smpl->ingest_running = 0;
+    smpl->ingest_exit = 0;
+    smpl->ingest_efd = -1;
+    smpl->ingest_evt = NULL;
+    smpl->ingest_slots = NULL;
     smpl->dnaddr.ss_family = AF_UNSPEC;
-    smpl->caddr.ss_family = AF_UNSPEC;
-    smpl->forward_what = SAMPLE_FWD_NOTHING;
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        sample_init_sub(smpl, &smpl->subs[i]);
+    }
+    smpl->tee_nsent = 0;
+    smpl->tee_nshed = 0;
     smpl->smpl_cb = NULL;
     smpl->smpl_cb_arg = NULL;
     smpl->smpl_timeout_evt = NULL;
@@ -558,26 +1484,57 @@ static void sample_init(struct sample_session *smpl)
     smpl->smpl_next_sidx = 0;
     smpl->smpl_stop_why = SAMPLE_STOP_NONE;
     smpl->worker_why = SAMPLE_WHY_NONE;
-    smpl->worker_using_buf[0] = 0;
-    smpl->worker_using_buf[1] = 0;
+    smpl->worker_draining = 0;
+    smpl->worker_cancel = 0;
     smpl->worker_nwritten = 0;
-    smpl->bsamp_bufs[0] = NULL;
-    smpl->bsamp_bufs[1] = NULL;
-    smpl->bsamp_buflen[0] = 0;
-    smpl->bsamp_buflen[1] = 0;
-    smpl->bsamp_widx = 0;
+    smpl->bsamp_ringlen = 0;
+    smpl->bsamp_write_len = 0;
+    smpl->bsamp_slots = NULL;
+    smpl->bsamp_maplen = 0;
+    smpl->bsamp_active = 0;
     sample_init_bsamp_cfg(smpl);
+    smpl->bsamp_paused = 0;
+    smpl->bsamp_pause_evt = NULL;
+    smpl->bsamp_warned_full = 0;
     smpl->debug_last_sub_idx = 0;
     smpl->debug_print_ddatafd = 1;
 }
 
+/* Size the board sample ring to fit the memory budget.
+ * NOT SYNCHRONIZED */
+static int sample_size_bsamp_ring(struct sample_session *smpl)
+{
+    size_t mem = (smpl->opts.bsamp_mem ? smpl->opts.bsamp_mem :
+                  SAMPLE_BSAMP_MEM_DEFAULT);
+    size_t wlen = (smpl->opts.bsamp_write_len ? smpl->opts.bsamp_write_len :
+                   SAMPLE_BSAMP_WRITE_LEN_DEFAULT);
+    size_t nslots = mem / sizeof(struct raw_pkt_bsmp);
+    size_t len = 1;
+    while (len <= nslots / 2) {
+        len <<= 1;
+    }
+    if (nslots == 0 || len < 2 * wlen) {
+        log_ERR("sample memory budget of %zu bytes can't hold two "
+                "%zu-sample writes", mem, wlen);
+        return -1;
+    }
+    smpl->bsamp_ringlen = len;
+    smpl->bsamp_write_len = wlen;
+    spsc_ring_init(&smpl->bsamp_ring, len);
+    log_INFO("buffering up to %zu board samples (%zu MiB, %.1f sec at %d kHz)",
+             len, len * sizeof(struct raw_pkt_bsmp) >> 20,
+             (double)len / (SAMPLE_BSAMP_KHZ * 1000), SAMPLE_BSAMP_KHZ);
+    return 0;
+}
+
 /*
  * Public API
  */
 
 struct sample_session *sample_new(struct event_base *base,
                                   unsigned iface,
-                                  uint16_t port)
+                                  uint16_t port,
+                                  const struct sample_opts *opts)
 {
     /* Allocate/init the sample_session and initialize pthreads before doing
      * anything else. */
@@ -586,6 +1543,13 @@ struct sample_session *sample_new(struct event_base *base,
         return NULL;
     }
     sample_init(smpl);
+    if (opts) {
+        smpl->opts = *opts;
+    }
+    if (sample_size_bsamp_ring(smpl)) {
+        free(smpl);
+        return NULL;
+    }
     if (sample_init_pthreads(smpl) == -1) {
         log_ERR("%s: threading error during initialization", __func__);
         free(smpl);
@@ -595,15 +1559,42 @@ struct sample_session *sample_new(struct event_base *base,
     /* Bring up the sample_session. */
     smpl->base = base;
     smpl->ddataif = iface;
+    smpl->bsamp_maplen = smpl->bsamp_ringlen * sizeof(struct raw_pkt_bsmp);
+    smpl->bsamp_slots = sample_map_buffer(&smpl->bsamp_maplen);
+    if (!smpl->bsamp_slots) {
+        log_ERR("can't allocate sample buffer");
+        goto fail;
+    }
     smpl->ddatafd = sockutil_get_udp_socket(port);
     if (smpl->ddatafd == -1) {
         log_ERR("can't create data socket");
         goto fail;
     }
-    if (evutil_make_socket_nonblocking(smpl->ddatafd) == -1) {
-        log_ERR("data socket doesn't support nonblocking I/O");
+    struct sockaddr_storage ddataaddr;
+    socklen_t ddataaddr_len = sizeof(ddataaddr);
+    if (getsockname(smpl->ddatafd, (struct sockaddr*)&ddataaddr,
+                    &ddataaddr_len)) {
+        log_ERR("can't get data socket address: %m");
         goto fail;
     }
+    smpl->ddatafamily = ddataaddr.ss_family;
+    if (smpl->opts.packet_ring) {
+        /* Keep ddatafd bound, so the port stays ours and we have
+         * something to send from, but read from the ring. */
+        smpl->pring = packet_ring_new(iface, port, SAMPLE_PRING_MEM);
+        if (!smpl->pring) {
+            log_ERR("can't create packet ring for data socket");
+            goto fail;
+        }
+        /* Nothing reads ddatafd, so don't let anything queue up
+         * there. */
+        if (sample_ddatafd_filter(smpl, SAMPLE_FILTER_NOTHING)) {
+            log_ERR("can't attach data socket filter: %m");
+            goto fail;
+        }
+        log_INFO("receiving samples through packet ring");
+    }
+    sample_update_ddatafd_filter(smpl);
     smpl->dpktbuf.iov_base = malloc(sizeof(union sample_packet));
     if (!smpl->dpktbuf.iov_base) {
         goto fail;
@@ -613,13 +1604,52 @@ struct sample_session *sample_new(struct event_base *base,
     if (!smpl->c_sample_pbuf_arr) {
         goto fail;
     }
-    smpl->ddataevt = event_new(base, smpl->ddatafd, EV_READ | EV_PERSIST,
-                               sample_ddatafd_callback, smpl);
-    if (!smpl->ddataevt) {
-        log_ERR("can't create data socket event");
+    smpl->relay_pkts = malloc(SAMPLE_RECVMMSG_BATCH *
+                              sizeof(union sample_packet));
+    if (!smpl->relay_pkts) {
         goto fail;
     }
-    if (event_add(smpl->ddataevt, NULL)) {
+    if (smpl->opts.live_ring) {
+        smpl->live = live_ring_new(smpl->opts.live_ring, SAMPLE_LIVE_NSLOTS);
+        if (!smpl->live) {
+            log_ERR("can't create live sample ring");
+            goto fail;
+        }
+        log_INFO("publishing board samples to %s", smpl->opts.live_ring);
+    }
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        sub->flush_evt = evtimer_new(base, sample_fwd_flush_callback, sub);
+        if (!sub->flush_evt) {
+            log_ERR("%s: can't create forwarding flush event", __func__);
+            goto fail;
+        }
+    }
+    if (smpl->opts.ingest_thread) {
+        /* The ingest thread owns reads from the data socket. */
+        if (sample_start_ingest(smpl)) {
+            goto fail;
+        }
+    } else {
+        if (evutil_make_socket_nonblocking(smpl->ddatafd) == -1) {
+            log_ERR("data socket doesn't support nonblocking I/O");
+            goto fail;
+        }
+        smpl->ddataevt = event_new(base, sample_recv_fd(smpl),
+                                   EV_READ | EV_PERSIST,
+                                   sample_ddatafd_callback, smpl);
+        if (!smpl->ddataevt) {
+            log_ERR("can't create data socket event");
+            goto fail;
+        }
+        if (event_add(smpl->ddataevt, NULL)) {
+            goto fail;
+        }
+    }
+    smpl->bsamp_pause_evt = evtimer_new(smpl->base, sample_pause_callback,
+                                        smpl);
+    if (!smpl->bsamp_pause_evt) {
+        log_ERR("%s: can't create sample buffer retry event", __func__);
         goto fail;
     }
     smpl->smpl_worker_evt = event_new(smpl->base, -1,
@@ -642,7 +1672,10 @@ struct sample_session *sample_new(struct event_base *base,
 
 void sample_free(struct sample_session *smpl)
 {
-    /* Bring down the worker thread first. */
+    /* Stop reading packets before anything else. */
+    sample_stop_ingest(smpl);
+
+    /* Bring down the worker thread. */
     sample_must_lock_worker(smpl);
     smpl->worker_why |= SAMPLE_WHY_EXIT;
     sample_must_unlock_worker(smpl);
@@ -660,15 +1693,38 @@ void sample_free(struct sample_session *smpl)
     if (smpl->ddataevt) {
         event_free(smpl->ddataevt);
     }
+    if (smpl->bsamp_pause_evt) {
+        event_free(smpl->bsamp_pause_evt);
+    }
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        if (sub->flush_evt) {
+            event_free(sub->flush_evt);
+        }
+        free(sub->bufs);
+        free(sub->preview);
+        free(sub->spikes);
+        free(sub->filter);
+        free(sub->reref);
+        sample_stream_close(sub);
+    }
+    if (smpl->live) {
+        live_ring_free(smpl->live);
+    }
     free(smpl->c_sample_pbuf_arr);
+    free(smpl->relay_pkts);
     free(smpl->dpktbuf.iov_base);
+    if (smpl->pring) {
+        packet_ring_free(smpl->pring);
+    }
     if (smpl->ddatafd != -1 && evutil_closesocket(smpl->ddatafd)) {
         log_ERR("can't close data socket");
     }
     pthread_mutex_destroy(&smpl->smpl_mtx);
     pthread_mutex_destroy(&smpl->worker_mtx);
     pthread_cond_destroy(&smpl->worker_cv);
-    pthread_rwlock_destroy(&smpl->bsamp_mtx);
+    pthread_cond_destroy(&smpl->worker_idle_cv);
+    sample_unmap_buffer(smpl->bsamp_slots, smpl->bsamp_maplen);
     free(smpl);
 }
 
@@ -693,7 +1749,7 @@ int sample_get_mac48(struct sample_session *smpl, uint8_t mac48[6])
 static struct sockaddr_storage* sample_addr(struct sample_session *smpl,
                                             enum sample_addr what)
 {
-    return (what == SAMPLE_ADDR_CLIENT ? &smpl->caddr :
+    return (what == SAMPLE_ADDR_CLIENT ? &smpl->subs[0].addr :
             what == SAMPLE_ADDR_DNODE ? &smpl->dnaddr :
             NULL);
 }
@@ -720,6 +1776,257 @@ int sample_get_addr(struct sample_session *smpl,
     return ret;
 }
 
+/* Figure out how big a datagram we can send a subscriber without it
+ * getting fragmented.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_fwd_update_dgram_max(struct sample_sub *sub)
+{
+    struct sockaddr *addr = (struct sockaddr*)&sub->addr;
+    int mtu = SAMPLE_FWD_MTU_DEFAULT;
+    size_t hdrs = (addr->sa_family == AF_INET6 ?
+                   40 + sizeof(struct udphdr) :
+                   20 + sizeof(struct udphdr));
+    /* Connecting a UDP socket doesn't send anything, but it does look
+     * up the route, which is what IP_MTU reports on. */
+    int fd = socket(addr->sa_family, SOCK_DGRAM, 0);
+    if (fd == -1 || connect(fd, addr, sockutil_addrlen(addr))) {
+        log_WARNING("can't look up route to client: %m");
+    } else {
+        int level = addr->sa_family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+        int opt = addr->sa_family == AF_INET6 ? IPV6_MTU : IP_MTU;
+        socklen_t len = sizeof(mtu);
+        if (getsockopt(fd, level, opt, &mtu, &len)) {
+            log_WARNING("can't get MTU of route to client: %m");
+            mtu = SAMPLE_FWD_MTU_DEFAULT;
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    sub->dgram_max = (size_t)mtu > hdrs ? (size_t)mtu - hdrs : 0;
+    if (sub->dgram_max > SAMPLE_FWD_DGRAM_MAX) {
+        sub->dgram_max = SAMPLE_FWD_DGRAM_MAX;
+    }
+    log_DEBUG("forwarding datagrams up to %zu bytes", sub->dgram_max);
+}
+
+/* Start sub's filter, compression, previews, and spike detection
+ * over, e.g. because its configuration changed.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_sub_restart(struct sample_sub *sub)
+{
+    sub->filter_restart = 1;
+    sub->delta_have_ref = 0;
+    if (sub->preview) {
+        sub->preview->nsamps = 0;
+    }
+    sub->spikes_restart = 1;
+}
+
+static const struct spike16_cfg sample_spike_cfg_default = {
+    .sigmas = SAMPLE_SPIKE_SIGMAS_DEFAULT,
+};
+
+/* Give sub a spike detector, with the default configuration, if it
+ * doesn't have one yet.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_spikes_init(struct sample_sub *sub)
+{
+    if (sub->spikes) {
+        return 0;
+    }
+    sub->spikes = malloc(sizeof(struct spike16));
+    if (!sub->spikes) {
+        log_ERR("out of memory for spike detection");
+        return -1;
+    }
+    /* Can't fail with the default configuration. */
+    spike16_configure(sub->spikes, &sample_spike_cfg_default);
+    return 0;
+}
+
+/* A spike detector configured with cfg, for nchans channels, or NULL
+ * if cfg is invalid or we're out of memory. */
+static struct spike16* sample_spikes_new(const struct spike16_cfg *cfg,
+                                         size_t nchans)
+{
+    if (cfg->thresholds && cfg->nthresholds > 1 &&
+        cfg->nthresholds != nchans) {
+        log_WARNING("need 1 spike threshold or %zu, not %zu",
+                    nchans, cfg->nthresholds);
+        return NULL;
+    }
+    struct spike16 *sp = malloc(sizeof(struct spike16));
+    if (!sp) {
+        log_ERR("out of memory for spike detection");
+        return NULL;
+    }
+    if (spike16_configure(sp, cfg)) {
+        log_WARNING("invalid spike detection configuration");
+        free(sp);
+        return NULL;
+    }
+    return sp;
+}
+
+/* Replace sub's spike detector with sp.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_sub_set_spikes(struct sample_sub *sub,
+                                  struct spike16 *sp)
+{
+    free(sub->spikes);
+    sub->spikes = sp;
+    sub->spikes_restart = 1;
+}
+
+/* NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_cfg_spikes(struct sample_sub *sub,
+                                 const struct spike16_cfg *cfg)
+{
+    size_t nchans = sub->chans.n ? sub->chans.n : RAW_BSMP_NSAMP;
+    struct spike16 *sp = sample_spikes_new(cfg, nchans);
+    if (!sp) {
+        return -1;
+    }
+    sample_sub_set_spikes(sub, sp);
+    return 0;
+}
+
+/* A filter with nsections sections from sos, or NULL if they're
+ * invalid or we're out of memory. */
+static struct biquad16* sample_filter_new(const float *sos,
+                                          size_t nsections)
+{
+    struct biquad16 *bq = malloc(sizeof(struct biquad16));
+    if (!bq) {
+        log_ERR("out of memory for filtering");
+        return NULL;
+    }
+    if (biquad16_configure(bq, sos, nsections)) {
+        log_WARNING("invalid filter");
+        free(bq);
+        return NULL;
+    }
+    return bq;
+}
+
+/* Replace sub's filter with bq, or take it away if bq is NULL.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_sub_set_filter(struct sample_sub *sub,
+                                  struct biquad16 *bq)
+{
+    free(sub->filter);
+    sub->filter = bq;
+    if (bq) {
+        sample_sub_restart(sub);
+    }
+}
+
+/* Give sub a filter, or take it away if nsections is 0. On error,
+ * sub's filter is unchanged.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_cfg_filter(struct sample_sub *sub, const float *sos,
+                                 size_t nsections)
+{
+    struct biquad16 *bq = NULL;
+    if (nsections && !(bq = sample_filter_new(sos, nsections))) {
+        return -1;
+    }
+    sample_sub_set_filter(sub, bq);
+    return 0;
+}
+
+/* A re-referencer for the groups of board sample channels 0 through
+ * nchans - 1 (nchans > 0), or NULL if they're invalid or we're out of
+ * memory. */
+static struct reref16* sample_reref_new(const uint16_t *groups,
+                                        size_t nchans, int median)
+{
+    uint16_t all[RAW_BSMP_NSAMP];
+    if (nchans > RAW_BSMP_NSAMP) {
+        log_WARNING("can't re-reference more than %d channels",
+                    RAW_BSMP_NSAMP);
+        return NULL;
+    }
+    memcpy(all, groups, nchans * sizeof(all[0]));
+    for (size_t i = nchans; i < RAW_BSMP_NSAMP; i++) {
+        all[i] = REREF16_NO_GROUP;
+    }
+    struct reref16 *rr = malloc(sizeof(struct reref16));
+    if (!rr) {
+        log_ERR("out of memory for re-referencing");
+        return NULL;
+    }
+    if (reref16_configure(rr, median ? REREF16_MEDIAN : REREF16_MEAN,
+                          all, RAW_BSMP_NSAMP)) {
+        log_WARNING("invalid re-referencing groups");
+        free(rr);
+        return NULL;
+    }
+    return rr;
+}
+
+/* Replace sub's re-referencer with rr, or stop re-referencing if rr
+ * is NULL.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_sub_set_reref(struct sample_sub *sub,
+                                 struct reref16 *rr)
+{
+    if (!rr && !sub->reref) {
+        return;
+    }
+    free(sub->reref);
+    sub->reref = rr;
+    sample_sub_restart(sub);
+}
+
+/* Have sub re-reference its samples to groups of channels, or stop
+ * if nchans is 0. On error, sub's re-referencing is unchanged.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_cfg_reref(struct sample_sub *sub,
+                                const uint16_t *groups, size_t nchans,
+                                int median)
+{
+    struct reref16 *rr = NULL;
+    if (nchans && !(rr = sample_reref_new(groups, nchans, median))) {
+        return -1;
+    }
+    sample_sub_set_reref(sub, rr);
+    return 0;
+}
+
+/* Give sub a preview window, if it doesn't have one yet.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_preview_init(struct sample_sub *sub)
+{
+    if (sub->preview) {
+        return 0;
+    }
+    sub->preview = malloc(sizeof(struct preview16));
+    if (!sub->preview) {
+        log_ERR("out of memory for board sample previews");
+        return -1;
+    }
+    return 0;
+}
+
+/* Can't fail once sub has the preview window or spike detector
+ * "what" needs.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_set_what(struct sample_sub *sub,
+                               enum sample_forward what)
+{
+    if (what == SAMPLE_FWD_BSMP_PREVIEW && sample_sub_preview_init(sub)) {
+        return -1;
+    }
+    if (what == SAMPLE_FWD_BSMP_SPIKES && sample_sub_spikes_init(sub)) {
+        return -1;
+    }
+    sub->what = what;
+    sample_sub_restart(sub);
+    return 0;
+}
+
 int sample_set_addr(struct sample_session *smpl,
                     struct sockaddr *addr, enum sample_addr what)
 {
@@ -730,38 +2037,34 @@ int sample_set_addr(struct sample_session *smpl,
         ret = -1;
         goto out;
     }
+    if (what == SAMPLE_ADDR_CLIENT) {
+        /* These belong to the old client. */
+        sample_fwd_flush(&smpl->subs[0], 1);
+    }
     memcpy(dst, addr, sockutil_addrlen(addr));
+    if (what == SAMPLE_ADDR_DNODE) {
+        sample_connect_dnode(smpl);
+    } else if (what == SAMPLE_ADDR_CLIENT) {
+        sample_fwd_update_dgram_max(&smpl->subs[0]);
+        sample_sub_restart(&smpl->subs[0]);
+    }
+    sample_update_ddatafd_filter(smpl);
  out:
     sample_must_unlock(smpl);
     return ret;
 }
 
-/* NOT SYNCHRONIZED (smpl_mtx) */
-static uint8_t sample_forward_mtype(struct sample_session *smpl)
-{
-    switch (smpl->forward_what) {
-    case SAMPLE_FWD_BSMP:       /* fall through */
-    case SAMPLE_FWD_BSMP_RAW:
-        return RAW_MTYPE_BSMP;
-    case SAMPLE_FWD_BSUB:       /* fall through */
-    case SAMPLE_FWD_BSUB_RAW:
-        return RAW_MTYPE_BSUB;
-    case SAMPLE_FWD_NOTHING:    /* shouldn't happen; fall through */
-    default:
-        assert(0);
-        return RAW_MTYPE_ERR;
-    }
-}
-
 /* NOT SYNCHRONIZED (smpl_mtx) */
 static int sample_enable_forwarding(struct sample_session *smpl,
                                     enum sample_forward what)
 {
     if (smpl->dnaddr.ss_family == AF_UNSPEC ||
-        smpl->caddr.ss_family == AF_UNSPEC) {
+        smpl->subs[0].addr.ss_family == AF_UNSPEC) {
+        return -1;
+    }
+    if (sample_sub_set_what(&smpl->subs[0], what)) {
         return -1;
     }
-    smpl->forward_what = what;
     smpl->debug_last_sub_idx = 0;
     return 0;
 }
@@ -769,7 +2072,7 @@ static int sample_enable_forwarding(struct sample_session *smpl,
 /* NOT SYNCHRONIZED (smpl_mtx) */
 static int sample_disable_forwarding(struct sample_session *smpl)
 {
-    smpl->forward_what = SAMPLE_FWD_NOTHING;
+    smpl->subs[0].what = SAMPLE_FWD_NOTHING;
     return 0;
 }
 
@@ -790,6 +2093,15 @@ static const char* sample_forward_what_str(enum sample_forward what)
     case SAMPLE_FWD_BSUB_RAW:
         ret = "raw board subsample";
         break;
+    case SAMPLE_FWD_BSMP_DELTA:
+        ret = "compressed board sample";
+        break;
+    case SAMPLE_FWD_BSMP_PREVIEW:
+        ret = "board sample preview";
+        break;
+    case SAMPLE_FWD_BSMP_SPIKES:
+        ret = "spike";
+        break;
     case SAMPLE_FWD_NOTHING:
         ret = "nothing";
         break;
@@ -806,9 +2118,11 @@ int sample_cfg_forwarding(struct sample_session *smpl,
 {
     int ret;
     sample_must_lock(smpl);
+    sample_fwd_flush(&smpl->subs[0], 1);
     ret = (what != SAMPLE_FWD_NOTHING ?
            sample_enable_forwarding(smpl, what) :
            sample_disable_forwarding(smpl));
+    sample_update_ddatafd_filter(smpl);
     sample_must_unlock(smpl);
     if (!ret) {
         if (what == SAMPLE_FWD_NOTHING) {
@@ -820,108 +2134,376 @@ int sample_cfg_forwarding(struct sample_session *smpl,
     return ret;
 }
 
-/* ACQUIRES (worker_mtx) */
-static void sample_setup_bsamp_worker(struct sample_session *smpl)
+/* Give sub room for batches, if it doesn't have it yet.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_batch_init(struct sample_sub *sub)
 {
-    sample_must_lock_worker(smpl);
-    assert(!(smpl->worker_why & (SAMPLE_WHY_STOP | SAMPLE_WHY_BSAMPS)));
-    assert(smpl->worker_using_buf[0] == 0 && smpl->worker_using_buf[1] == 0);
-    smpl->worker_using_buf[0] = 0;
-    smpl->worker_using_buf[1] = 0;
-    smpl->worker_nwritten = 0;
-    sample_must_unlock_worker(smpl);
+    if (sub->bufs) {
+        return 0;
+    }
+    sub->bufs = malloc(SAMPLE_FWD_NDGRAMS * SAMPLE_FWD_DGRAM_MAX);
+    if (!sub->bufs) {
+        log_ERR("out of memory for forwarding batches");
+        return -1;
+    }
+    for (size_t i = 0; i < SAMPLE_FWD_NDGRAMS; i++) {
+        sub->iovs[i].iov_base = sub->bufs + i * SAMPLE_FWD_DGRAM_MAX;
+    }
+    return 0;
 }
 
-/* ACQUIRES (wr bsamp_mtx) */
-static int sample_setup_dbuf(struct sample_session *smpl,
-                             struct sample_bsamp_cfg *cfg)
+/* Can't fail if nsamps is 0, or after sample_sub_batch_init().
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_cfg_batch(struct sample_sub *sub,
+                                unsigned nsamps, unsigned max_usec)
 {
-    const size_t bufsize = SAMPLE_BSAMP_MAXLEN * sizeof(struct raw_pkt_bsmp);
-    int ret = 0;
-    if (sample_must_trywrlock_dbuf(smpl) == EBUSY) {
-        log_ERR("%s: not expecting samples, but can't wrlock sample buffers",
-                __func__);
+    sample_fwd_flush(sub, 1);
+    if (nsamps && sample_sub_batch_init(sub)) {
         return -1;
     }
-    assert(!smpl->bsamp_bufs[0] && !smpl->bsamp_bufs[1]);
-    smpl->bsamp_buflen[0] = 0;
-    smpl->bsamp_buflen[1] = 0;
-    smpl->bsamp_widx = 0;
-    smpl->bsamp_bufs[0] = malloc(bufsize);
-    smpl->bsamp_bufs[1] = malloc(bufsize);
-    if (!smpl->bsamp_bufs[0] || !smpl->bsamp_bufs[1]) {
-        log_ERR("%s: out of memory", __func__);
-        free(smpl->bsamp_bufs[0]);
-        free(smpl->bsamp_bufs[1]);
-        smpl->bsamp_bufs[0] = NULL;
-        smpl->bsamp_bufs[1] = NULL;
-        sample_init_bsamp_cfg(smpl);
-        ret = -1;
-        goto out;
-    }
-    memcpy(&smpl->bsamp_cfg, cfg, sizeof(smpl->bsamp_cfg));
- out:
-    sample_must_rwunlock_dbuf(smpl);
-    return ret;
+    sub->batch_size = nsamps;
+    sub->batch_latency.tv_sec = max_usec / 1000000;
+    sub->batch_latency.tv_usec = max_usec % 1000000;
+    return 0;
 }
 
-/* NOT SYNCHRONIZED (smpl_mtx) */
-static int sample_setup_bsamp_events(struct sample_session *smpl)
+int sample_cfg_forward_batch(struct sample_session *smpl,
+                             unsigned nsamps, unsigned max_usec)
 {
-    assert(!smpl->smpl_timeout_evt);
-    smpl->smpl_timeout_evt = evtimer_new(smpl->base, sample_timeout_callback,
-                                         smpl);
-    if (!smpl->smpl_timeout_evt) {
-        log_ERR("%s: can't create timeout event", __func__);
-        goto fail;
+    sample_must_lock(smpl);
+    int ret = sample_sub_cfg_batch(&smpl->subs[0], nsamps, max_usec);
+    sample_must_unlock(smpl);
+    if (ret) {
+        return ret;
     }
-    if (sample_reset_timeout(smpl) == -1) {
-        log_ERR("%s: can't configure data timeout", __func__);
-        goto fail;
+    if (nsamps) {
+        log_DEBUG("forwarding up to %u samples per datagram, "
+                  "waiting up to %u usec", nsamps, max_usec);
+    } else {
+        log_DEBUG("forwarding one sample per datagram");
     }
     return 0;
-
- fail:
-    sample_clear_timeout(smpl);
-    return -1;
 }
 
-int sample_expect_bsamps(struct sample_session *smpl,
-                         struct sample_bsamp_cfg *cfg,
-                         sample_bsamp_cb cb, void *arg)
+int sample_cfg_tee(struct sample_session *smpl, unsigned every)
 {
-    int ret = -1;
-    if (cb == NULL) {
-        log_ERR("%s: received NULL callback argument", __func__);
-        assert(0);
-        return -1;
-    }
-    if (cfg->nsamples == 0) {
-        log_ERR("%s: cfg->nsamples==0", __func__);
-        assert(0);
-        return -1;
+    sample_must_lock(smpl);
+    smpl->subs[0].tee_every = every;
+    sample_must_unlock(smpl);
+    if (every) {
+        log_DEBUG("forwarding 1 in %u stored board samples", every);
+    } else {
+        log_DEBUG("disabled forwarding of stored board samples");
     }
+    return 0;
+}
 
-    log_DEBUG("expecting %zu board samples, start index %zd",
-              cfg->nsamples, cfg->start_sample);
-
+int sample_cfg_decimate(struct sample_session *smpl, unsigned every)
+{
     sample_must_lock(smpl);
-    assert(!sample_expecting_bsamps(smpl));
-    if (smpl->dnaddr.ss_family == AF_UNSPEC) {
-        log_ERR("can't expect board samples with missing data node address");
+    smpl->subs[0].decimate = every;
+    sample_must_unlock(smpl);
+    if (every > 1) {
+        log_DEBUG("forwarding 1 in %u live samples", every);
+    } else {
+        log_DEBUG("forwarding every live sample");
+    }
+    return 0;
+}
+
+int sample_cfg_channels(struct sample_session *smpl,
+                        const uint16_t *chans, size_t n)
+{
+    sample_must_lock(smpl);
+    int ret = data_pbenc_chans_init(&smpl->subs[0].chans, chans, n);
+    sample_sub_restart(&smpl->subs[0]);
+    sample_must_unlock(smpl);
+    if (ret) {
+        log_WARNING("invalid channel list");
+    } else if (n) {
+        log_DEBUG("forwarding %zu channels of each board sample", n);
+    } else {
+        log_DEBUG("forwarding all channels of each board sample");
+    }
+    return ret;
+}
+
+int sample_cfg_preview(struct sample_session *smpl, unsigned window)
+{
+    if (window > PREVIEW16_MAX_WINDOW) {
+        log_WARNING("preview window can't be more than %d board samples",
+                    PREVIEW16_MAX_WINDOW);
+        return -1;
+    }
+    sample_must_lock(smpl);
+    smpl->subs[0].preview_window = window;
+    sample_sub_restart(&smpl->subs[0]);
+    sample_must_unlock(smpl);
+    log_DEBUG("previewing %u board samples at a time",
+              window ? window : SAMPLE_PREVIEW_WINDOW_DEFAULT);
+    return 0;
+}
+
+int sample_cfg_spikes(struct sample_session *smpl,
+                      const struct spike16_cfg *cfg)
+{
+    sample_must_lock(smpl);
+    int ret = sample_sub_cfg_spikes(&smpl->subs[0], cfg);
+    sample_must_unlock(smpl);
+    if (!ret) {
+        log_DEBUG("spike thresholds: %s; snippets: %u+%u samples",
+                  cfg->thresholds && cfg->nthresholds ? "fixed" : "adaptive",
+                  cfg->snippet_pre, cfg->snippet_post);
+    }
+    return ret;
+}
+
+int sample_cfg_filter(struct sample_session *smpl, const float *sos,
+                      size_t nsections)
+{
+    sample_must_lock(smpl);
+    int ret = sample_sub_cfg_filter(&smpl->subs[0], sos, nsections);
+    sample_must_unlock(smpl);
+    if (!ret) {
+        log_DEBUG("filtering with %zu sections", nsections);
+    }
+    return ret;
+}
+
+int sample_cfg_reref(struct sample_session *smpl, const uint16_t *groups,
+                     size_t nchans, int median)
+{
+    sample_must_lock(smpl);
+    int ret = sample_sub_cfg_reref(&smpl->subs[0], groups, nchans, median);
+    size_t ngroups = smpl->subs[0].reref ? smpl->subs[0].reref->ngroups : 0;
+    sample_must_unlock(smpl);
+    if (!ret && nchans) {
+        log_DEBUG("re-referencing to the %s of %zu channel groups",
+                  median ? "median" : "mean", ngroups);
+    } else if (!ret) {
+        log_DEBUG("not re-referencing");
+    }
+    return ret;
+}
+
+/* Find the subscriber at addr, which isn't the client.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static struct sample_sub* sample_find_sub(struct sample_session *smpl,
+                                          struct sockaddr *addr)
+{
+    for (size_t i = 1; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        if (sub->addr.ss_family != AF_UNSPEC &&
+            sockutil_addr_eq((struct sockaddr*)&sub->addr, addr, 0)) {
+            return sub;
+        }
+    }
+    return NULL;
+}
+
+int sample_subscribe(struct sample_session *smpl, struct sockaddr *addr,
+                     const struct sample_sub_cfg *cfg)
+{
+    if (cfg->what == SAMPLE_FWD_NOTHING ||
+        (addr->sa_family != AF_INET && addr->sa_family != AF_INET6 &&
+         !(cfg->stream && addr->sa_family == AF_UNIX))) {
+        return -1;
+    }
+    if (cfg->preview_window > PREVIEW16_MAX_WINDOW) {
+        log_WARNING("preview window can't be more than %d board samples",
+                    PREVIEW16_MAX_WINDOW);
+        return -1;
+    }
+    if (cfg->stream && (cfg->what == SAMPLE_FWD_BSMP_RAW ||
+                        cfg->what == SAMPLE_FWD_BSUB_RAW ||
+                        cfg->batch_size)) {
+        log_WARNING("stream subscribers can't have raw packets "
+                    "or batching");
+        return -1;
+    }
+    struct data_pbenc_chans chans;
+    struct spike16 *spikes = NULL;
+    struct biquad16 *filter = NULL;
+    struct reref16 *reref = NULL;
+    sample_must_lock(smpl);
+    struct sample_sub *sub = sample_find_sub(smpl, addr);
+    int is_new = !sub;
+    if (!sub) {
+        for (size_t i = 1; i < SAMPLE_NSUBS; i++) {
+            if (smpl->subs[i].addr.ss_family == AF_UNSPEC) {
+                sub = &smpl->subs[i];
+                break;
+            }
+        }
+        if (!sub) {
+            log_WARNING("can't have more than %d subscribers",
+                        SAMPLE_MAX_SUBS);
+            goto fail;
+        }
+        memcpy(&sub->addr, addr, sockutil_addrlen(addr));
+    }
+
+    /* Build the new configuration before touching sub's, so an
+     * existing subscriber keeps its old one if anything's wrong. The
+     * batch buffers and preview window are just storage; it doesn't
+     * hurt to keep them if we fail. */
+    if (data_pbenc_chans_init(&chans, cfg->chans, cfg->nchans)) {
+        log_WARNING("invalid channel list");
+        goto fail;
+    }
+    if (cfg->what == SAMPLE_FWD_BSMP_SPIKES &&
+        !(spikes = sample_spikes_new((cfg->spikes ? cfg->spikes :
+                                      &sample_spike_cfg_default),
+                                     chans.n ? chans.n : RAW_BSMP_NSAMP))) {
+        goto fail;
+    }
+    if (cfg->filter_nsections &&
+        !(filter = sample_filter_new(cfg->filter_sos,
+                                     cfg->filter_nsections))) {
+        goto fail;
+    }
+    if (cfg->reref_nchans &&
+        !(reref = sample_reref_new(cfg->reref_groups, cfg->reref_nchans,
+                                   cfg->reref_median))) {
+        goto fail;
+    }
+    if ((cfg->batch_size && sample_sub_batch_init(sub)) ||
+        (cfg->what == SAMPLE_FWD_BSMP_PREVIEW &&
+         sample_sub_preview_init(sub))) {
+        goto fail;
+    }
+    if (is_new || !cfg->stream != (sub->stream_fd == -1)) {
+        /* New subscriber, or switching transports. A failed
+         * sample_stream_open() leaves a UDP subscriber as it was. */
+        sample_fwd_flush(sub, 1);
+        if (!cfg->stream) {
+            sample_stream_close(sub);
+            sample_fwd_update_dgram_max(sub);
+        } else if (sample_stream_open(sub)) {
+            goto fail;
+        }
+    }
+
+    /* Nothing can fail from here on. */
+    memcpy(&sub->chans, &chans, sizeof(chans));
+    sample_sub_cfg_batch(sub, cfg->batch_size, cfg->batch_max_usec);
+    sub->preview_window = cfg->preview_window;
+    if (spikes) {
+        sample_sub_set_spikes(sub, spikes);
+    }
+    sample_sub_set_filter(sub, filter);
+    sample_sub_set_reref(sub, reref);
+    sample_sub_set_what(sub, cfg->what);
+    sub->decimate = cfg->decimate;
+    sub->tee_every = cfg->tee_every;
+    sample_update_ddatafd_filter(smpl);
+    log_DEBUG("subscriber %zu gets %s forwarding%s",
+              (size_t)(sub - smpl->subs),
+              sample_forward_what_str(cfg->what),
+              cfg->stream ? " over a stream" : "");
+    sample_must_unlock(smpl);
+    return 0;
+
+ fail:
+    free(spikes);
+    free(filter);
+    free(reref);
+    if (is_new && sub) {
+        sample_clear_sub(sub);
+    }
+    sample_must_unlock(smpl);
+    return -1;
+}
+
+int sample_unsubscribe(struct sample_session *smpl, struct sockaddr *addr)
+{
+    int ret = 0;
+    sample_must_lock(smpl);
+    struct sample_sub *sub = sample_find_sub(smpl, addr);
+    if (!sub) {
+        ret = -1;
         goto out;
     }
+    sample_fwd_flush(sub, 1);
+    log_DEBUG("removed subscriber %zu", (size_t)(sub - smpl->subs));
+    sample_clear_sub(sub);
+    sample_update_ddatafd_filter(smpl);
+ out:
+    sample_must_unlock(smpl);
+    return ret;
+}
+
+/* ACQUIRES (worker_mtx) */
+static void sample_setup_bsamp_worker(struct sample_session *smpl,
+                                     struct sample_bsamp_cfg *cfg)
+{
+    sample_must_lock_worker(smpl);
+    assert(!(smpl->worker_why & (SAMPLE_WHY_STOP | SAMPLE_WHY_BSAMPS)));
+    assert(!smpl->worker_draining);
+    assert(!smpl->bsamp_active);
+    assert(smpl->bsamp_slots);
+    spsc_ring_clear(&smpl->bsamp_ring);
+    memcpy(&smpl->bsamp_cfg, cfg, sizeof(smpl->bsamp_cfg));
+    smpl->worker_cancel = 0;
+    smpl->worker_nwritten = 0;
+    smpl->bsamp_warned_full = 0;
+    smpl->bsamp_active = 1;
+    sample_must_unlock_worker(smpl);
+}
+
+/* NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_setup_bsamp_events(struct sample_session *smpl)
+{
+    assert(!smpl->smpl_timeout_evt);
+    smpl->smpl_timeout_evt = evtimer_new(smpl->base, sample_timeout_callback,
+                                         smpl);
+    if (!smpl->smpl_timeout_evt) {
+        log_ERR("%s: can't create timeout event", __func__);
+        goto fail;
+    }
+    if (sample_reset_timeout(smpl) == -1) {
+        log_ERR("%s: can't configure data timeout", __func__);
+        goto fail;
+    }
+    return 0;
+
+ fail:
+    sample_clear_timeout(smpl);
+    return -1;
+}
+
+int sample_expect_bsamps(struct sample_session *smpl,
+                         struct sample_bsamp_cfg *cfg,
+                         sample_bsamp_cb cb, void *arg)
+{
+    int ret = -1;
+    if (cb == NULL) {
+        log_ERR("%s: received NULL callback argument", __func__);
+        assert(0);
+        return -1;
+    }
+    if (cfg->nsamples == 0) {
+        log_ERR("%s: cfg->nsamples==0", __func__);
+        assert(0);
+        return -1;
+    }
 
-    /* Set up worker */
-    sample_setup_bsamp_worker(smpl);
+    log_DEBUG("expecting %zu board samples, start index %zd",
+              cfg->nsamples, cfg->start_sample);
 
-    /* Set up sample double-buffering */
-    if (sample_setup_dbuf(smpl, cfg)) {
+    sample_must_lock(smpl);
+    assert(!sample_expecting_bsamps(smpl));
+    if (smpl->dnaddr.ss_family == AF_UNSPEC) {
+        log_ERR("can't expect board samples with missing data node address");
         goto out;
     }
 
+    /* Set up worker and sample ring */
+    sample_setup_bsamp_worker(smpl, cfg);
+
     /* Set up timeout and thread notifier events */
     if (sample_setup_bsamp_events(smpl)) {
+        sample_finished_with_bsamps(smpl);
         goto out;
     }
 
@@ -930,6 +2512,9 @@ int sample_expect_bsamps(struct sample_session *smpl,
     smpl->smpl_cb = cb;
     smpl->smpl_cb_arg = arg;
     smpl->smpl_next_sidx = (size_t)cfg->start_sample;
+    smpl->tee_nsent = 0;
+    smpl->tee_nshed = 0;
+    sample_update_ddatafd_filter(smpl);
     ret = 0;
  out:
     sample_must_unlock(smpl);
@@ -971,6 +2556,17 @@ static void sample_timeout_callback(__unused evutil_socket_t ignored,
     sample_stop_worker(smpl, SAMPLE_STOP_TIMEOUT);
 }
 
+/* Board sample ring was full a little while ago; try reading again. */
+static void sample_pause_callback(__unused evutil_socket_t ignored,
+                                  short events, void *smplvp)
+{
+    struct sample_session *smpl = smplvp;
+    assert(events == EV_TIMEOUT);
+    sample_must_lock(smpl);
+    sample_resume_reading(smpl);
+    sample_must_unlock(smpl);
+}
+
 /* The worker uses this to let the reader know about things that
  * happen, and to acknowledge when the main thread needs it to go to
  * sleep.
@@ -988,14 +2584,12 @@ static void sample_worker_callback(__unused evutil_socket_t ignored,
      * Decide what to do about whatever happened to the worker.
      */
     if (what & SAMPLE_THREAD_DONE) {
-        /* Worker finished storing its buffer; mark it unused. */
+        /* Worker drained the ring; see if that's everything. */
         sample_must_lock_worker(smpl);
-        sample_must_rdlock_dbuf(smpl);
-        smpl->worker_using_buf[smpl->bsamp_widx] = 0;
-        if (smpl->worker_nwritten == smpl->bsamp_cfg.nsamples) {
+        if (smpl->bsamp_active &&
+            smpl->worker_nwritten == smpl->bsamp_cfg.nsamples) {
             cb_flags |= SAMPLE_BS_DONE;
         }
-        sample_must_rwunlock_dbuf(smpl);
         sample_must_unlock_worker(smpl);
     }
     if (what & SAMPLE_THREAD_SLEEPING) {
@@ -1034,11 +2628,9 @@ static void sample_worker_callback(__unused evutil_socket_t ignored,
      * be sleeping. We'll still grab the locks in case of bugs. */
     sample_must_lock_worker(smpl);
     size_t nwritten = smpl->worker_nwritten;
-    sample_must_unlock_worker(smpl);
-    sample_must_rdlock_dbuf(smpl);
     assert(!(cb_flags & SAMPLE_BS_DONE) ||
            (nwritten == smpl->bsamp_cfg.nsamples));
-    sample_must_rwunlock_dbuf(smpl);
+    sample_must_unlock_worker(smpl);
 
     sample_must_lock(smpl);
     if (sample_expecting_bsamps(smpl)) {
@@ -1050,6 +2642,10 @@ static void sample_worker_callback(__unused evutil_socket_t ignored,
          * the samples have been read. */
         sample_finished_with_bsamps(smpl);
     }
+    if (smpl->tee_nsent || smpl->tee_nshed) {
+        log_INFO("forwarded %zu stored board samples, skipped %zu",
+                 smpl->tee_nsent, smpl->tee_nshed);
+    }
     assert(smpl->smpl_cb);
     smpl->smpl_cb(cb_flags, nwritten, smpl->smpl_cb_arg);
     smpl->smpl_cb = NULL;
@@ -1085,7 +2681,7 @@ static void sample_log_address_mismatch(struct sample_session *smpl,
               dnaddr_addrstr, got_addrstr);
 }
 
-/* NOT SYNCHRONIZED (rd bsamp_mtx) */
+/* Event loop thread only. */
 static inline size_t sample_last_sidx(struct sample_session *smpl)
 {
     struct sample_bsamp_cfg *bcfg = &smpl->bsamp_cfg;
@@ -1093,7 +2689,7 @@ static inline size_t sample_last_sidx(struct sample_session *smpl)
     return (size_t)bcfg->start_sample + bcfg->nsamples - 1;
 }
 
-/* NOT SYNCHRONIZED (smpl_mtx, rd bsamp_mtx) */
+/* NOT SYNCHRONIZED (smpl_mtx) */
 static inline size_t sample_samps_left(struct sample_session *smpl)
 {
     struct sample_bsamp_cfg *bcfg = &smpl->bsamp_cfg;
@@ -1105,148 +2701,207 @@ static inline size_t sample_samps_left(struct sample_session *smpl)
     }
 }
 
-/* Read new samples into the free buffer.
- * NOT SYNCHRONIZED (smpl_mtx) */
+/* sample_ddatafd_grab_bsamps() return values */
 #define GOT_BSAMPS 0
-#define FILLED_BUFFER 1
 #define GOT_LAST_BSAMP 2
 #define DROPPED_PKT (-1)
 #define SOCKET_ERR (-2)
 #define GOT_NOTHING (-3)
 #define GOT_PKT_ERR (-4)
-static int sample_ddatafd_grab_bsamps(struct sample_session *smpl)
+#define RING_FULL (-5)
+
+/* Check a freshly-received board sample in place.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+#define BSAMP_OK 0
+#define BSAMP_BAD 1
+static int sample_check_bsamp(struct sample_session *smpl,
+                              struct raw_pkt_bsmp *bsmp,
+                              struct sockaddr *from)
 {
-    struct sockaddr_storage sas;
-    socklen_t sas_len = sizeof(sas);
-    int ret = GOT_NOTHING;
+    if (!sockutil_addr_eq((struct sockaddr*)&smpl->dnaddr, from, 0)) {
+        sample_log_address_mismatch(smpl, from);
+        return BSAMP_BAD;
+    }
+    /* Make sure the packet is a well-formed board sample. The mtype
+     * is a single byte, so check it before byte-swapping the rest. */
+    uint8_t mtype = raw_mtype(bsmp);
+    if (mtype != RAW_MTYPE_BSMP) {
+        log_DEBUG("ignoring data packet with wrong mtype %s",
+                  raw_mtype_str(mtype));
+        return BSAMP_BAD;
+    }
+    /* If the storage backend can take samples as they came off the
+     * wire, only swap what we need to look at. */
+    int wire = smpl->bsamp_cfg.chns->ch_flags & CH_STORAGE_WIRE_ORDER;
+    if (wire ? raw_pkt_ntoh_hdr(bsmp) : raw_pkt_ntoh(bsmp)) {
+        log_WARNING("dropping malformed data packet");
+        return BSAMP_BAD;
+    }
+    if (raw_pkt_is_err(bsmp)) {
+        log_INFO("board sample %u has error flag set", bsmp->b_sidx);
+        return GOT_PKT_ERR;
+    }
+    /* If this is the first packet, and we don't care about
+     * indexes, then start counting from here. */
+    if (smpl->bsamp_cfg.start_sample == -1) {
+        smpl->bsamp_cfg.start_sample = bsmp->b_sidx;
+        smpl->smpl_next_sidx = bsmp->b_sidx;
+    }
+    /* Check for dropped or reordered packets. */
+    if (bsmp->b_sidx != smpl->smpl_next_sidx++) {
+        log_DEBUG("%s: dropped packet; expected index %zu, got %u",
+                  __func__, smpl->smpl_next_sidx - 1, bsmp->b_sidx);
+        return DROPPED_PKT;
+    }
+    return BSAMP_OK;
+}
+
+/* Receive up to "max" packets directly into consecutive slots
+ * starting at "first". Returns the number of packets received, 0 if
+ * nothing was waiting, or -1 on socket error.
+ *
+ * Event loop thread only. */
+static int sample_recv_bsamp_batch(struct sample_session *smpl,
+                                   struct raw_pkt_bsmp *first,
+                                   size_t max)
+{
+    if (max > SAMPLE_RECVMMSG_BATCH) {
+        max = SAMPLE_RECVMMSG_BATCH;
+    }
+    if (smpl->opts.ingest_thread) {
+        /* The ingest thread already did the receiving. */
+        size_t n = 0;
+        while (n < max &&
+               sample_ingest_pop(smpl, &first[n],
+                                 &smpl->bsamp_sas[n]) != -1) {
+            n++;
+        }
+        return (int)n;
+    }
+    for (size_t j = 0; j < max; j++) {
+        struct msghdr *hdr = &smpl->bsamp_mmsgs[j].msg_hdr;
+        smpl->bsamp_iovs[j].iov_base = &first[j];
+        smpl->bsamp_iovs[j].iov_len = sizeof(struct raw_pkt_bsmp);
+        hdr->msg_name = &smpl->bsamp_sas[j];
+        hdr->msg_namelen = sizeof(smpl->bsamp_sas[j]);
+        hdr->msg_iov = &smpl->bsamp_iovs[j];
+        hdr->msg_iovlen = 1;
+        hdr->msg_control = NULL;
+        hdr->msg_controllen = 0;
+        hdr->msg_flags = 0;
+    }
+    while (1) {
+        int n = sample_recvmmsg(smpl, smpl->bsamp_mmsgs, (unsigned)max,
+                                MSG_DONTWAIT);
+        if (n != -1) {
+            return n;
+        }
+        switch (errno) {
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:   /* fall through */
+#endif
+        case EAGAIN:
+            return 0;
+        case EINTR:
+            continue;
+        default:
+            log_WARNING("%s: recvmmsg: %m", __func__);
+            return -1;
+        }
+    }
+}
 
-    sample_must_rdlock_dbuf(smpl);
-    size_t myidx = 0x1 ^ smpl->bsamp_widx;
-    struct raw_pkt_bsmp *mybufs = smpl->bsamp_bufs[myidx];
+/* Read new samples into free slots in the ring.
+ *
+ * Packets are received in batches of up to SAMPLE_RECVMMSG_BATCH
+ * straight into the ring's next free slots, then checked as a
+ * group. Bad packets are squeezed out by moving the good ones behind
+ * them down, and only good ones are published to the worker.
+ *
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_ddatafd_grab_bsamps(struct sample_session *smpl)
+{
+    struct spsc_ring *ring = &smpl->bsamp_ring;
+    struct raw_pkt_bsmp *slots = smpl->bsamp_slots;
     const size_t s_left = sample_samps_left(smpl);
-    const size_t b_start = smpl->bsamp_buflen[myidx];
-    const size_t b_avail = SAMPLE_BSAMP_MAXLEN - b_start;
-    const size_t b_end = b_start + (b_avail > s_left ? s_left : b_avail);
+    int ret = GOT_NOTHING;
 
-    size_t i = b_start;
+    size_t got = 0;
     size_t n_bad = 0; /* number of bad packets since last good packet. */
-    while (i < b_end) {
+    while (got < s_left) {
         if (n_bad > SAMPLE_MAX_CONSECUTIVE_BAD_PKTS) {
             log_WARNING("%s: too many bad packets; returning early", __func__);
             break;
         }
 
-        ssize_t s = recvfrom(smpl->ddatafd, &mybufs[i],
-                             sizeof(struct raw_pkt_bsmp), 0,
-                             (struct sockaddr*)&sas, &sas_len);
-        if (s == -1) {
-            switch (errno) {
-#if EWOULDBLOCK != EAGAIN
-            case EWOULDBLOCK:   /* fall through */
-#endif
-            case EAGAIN:
-                goto done;
-            case EINTR:
-                continue;
-            default:
-                log_WARNING("%s: recvfrom: %m", __func__);
-                ret = SOCKET_ERR;
-                goto done;
-            }
-        }
-
-        /*
-         * Check the packet.
-         */
-        if (!sockutil_addr_eq((struct sockaddr*)&smpl->dnaddr,
-                              (struct sockaddr*)&sas, 0)) {
-            sample_log_address_mismatch(smpl, (struct sockaddr*)&sas);
-            n_bad++;
-            continue;
-        }
-        /* Make sure the packet is a well-formed board sample. */
-        if (raw_pkt_ntoh(&mybufs[i])) {
-            log_WARNING("dropping malformed data packet");
-            n_bad++;
-            continue;
+        size_t i;
+        size_t avail = spsc_ring_reserve(ring, &i);
+        if (avail == 0) {
+            ret = RING_FULL;
+            break;
         }
-        uint8_t mtype = raw_mtype(&mybufs[i]);
-        if (mtype != RAW_MTYPE_BSMP) {
-            log_DEBUG("ignoring data packet with wrong mtype %s",
-                      raw_mtype_str(mtype));
-            n_bad++;
-            continue;
+        if (avail > s_left - got) {
+            avail = s_left - got;
         }
-        if (raw_pkt_is_err(&mybufs[i])) {
-            log_INFO("board sample %u has error flag set", mybufs[i].b_sidx);
-            ret = GOT_PKT_ERR;
+        int n = sample_recv_bsamp_batch(smpl, &slots[i], avail);
+        if (n == -1) {
+            ret = SOCKET_ERR;
             break;
-        }
-        /* If this is the first packet, and we don't care about
-         * indexes, then start counting from here. */
-        if (smpl->bsamp_cfg.start_sample == -1) {
-            smpl->bsamp_cfg.start_sample = mybufs[i].b_sidx;
-            smpl->smpl_next_sidx = mybufs[i].b_sidx;
-        }
-        /* Check for dropped or reordered packets. */
-        if (mybufs[i].b_sidx != smpl->smpl_next_sidx++) {
-            log_DEBUG("%s: dropped packet; expected index %zu, got %u",
-                      __func__, smpl->smpl_next_sidx - 1, mybufs[i].b_sidx);
-            ret = DROPPED_PKT;
+        } else if (n == 0) {
             break;
         }
 
         /*
-         * Packet retrieved successfully!
+         * Check the batch. Slot i + j holds the j-th packet we just
+         * received; good packets get compacted down to slot w.
          */
-        i++;
-        n_bad = 0;
-    }
- done:
-    /* Check if we actually got any board samples. */
-    if (i > b_start && ret != GOT_PKT_ERR) {
-        ret = GOT_BSAMPS;
-    }
-    /* If we did, update the buffer length, and see if it's time to flip
-     * the buffer, or if we're done altogether. */
-    if (ret == GOT_BSAMPS) {
-        smpl->bsamp_buflen[myidx] = i;
-        if (smpl->smpl_next_sidx > sample_last_sidx(smpl)) {
-            ret = GOT_LAST_BSAMP;
-        } else if (smpl->bsamp_buflen[myidx] == SAMPLE_BSAMP_MAXLEN) {
-            ret = FILLED_BUFFER;
+        size_t w = i;
+        for (size_t j = 0; j < (size_t)n; j++) {
+            struct raw_pkt_bsmp *bsmp = &slots[i + j];
+            struct sockaddr *from = (struct sockaddr*)&smpl->bsamp_sas[j];
+            int check = sample_check_bsamp(smpl, bsmp, from);
+            if (check == BSAMP_BAD) {
+                n_bad++;
+                continue;
+            } else if (check != BSAMP_OK) {
+                /* Fatal to the transfer; the rest of the batch is
+                 * useless. */
+                ret = check;
+                break;
+            }
+            if (w != i + j) {
+                memcpy(&slots[w], bsmp, sizeof(*bsmp));
+            }
+            w++;
+            n_bad = 0;
+        }
+        /* Hand the good ones to the worker, then pass some along to
+         * the client if there's time. */
+        spsc_ring_push(ring, w - i);
+        got += w - i;
+        sample_tee_bsamps(smpl, &slots[i], w - i);
+        sample_live_publish_bsamps(smpl, &slots[i], w - i);
+        if (ret != GOT_NOTHING) {
+            break;
         }
     }
-    sample_must_rwunlock_dbuf(smpl);
+    /* Check if we actually got any board samples, and if so, whether
+     * we're done altogether. */
+    if (got && ret == GOT_NOTHING) {
+        ret = (smpl->smpl_next_sidx > sample_last_sidx(smpl) ?
+               GOT_LAST_BSAMP : GOT_BSAMPS);
+    }
     return ret;
 }
 
-static void sample_flip_bsamp_bufs(struct sample_session *smpl)
+/* Let the worker know there are samples in the ring.
+ * ACQUIRES worker_mtx */
+static void sample_wake_worker(struct sample_session *smpl)
 {
-    /* Try to swap buffers with the worker thread. */
     sample_must_lock_worker(smpl);
-    if (smpl->worker_using_buf[smpl->bsamp_widx]) {
-        log_DEBUG("%s: worker's using the other buffer; dropping packets",
-                  __func__);
-        sample_must_unlock_worker(smpl);
-        sample_stop_worker(smpl, SAMPLE_STOP_PKTDROP);
-        return;
-    }
-    if (sample_must_trywrlock_dbuf(smpl) == EBUSY) {
-        log_DEBUG("%s: can't write-lock buffer; dropping packets",
-                  __func__);
-        sample_must_unlock_worker(smpl);
-        sample_stop_worker(smpl, SAMPLE_STOP_PKTDROP);
-        return;
-    }
-    smpl->bsamp_buflen[smpl->bsamp_widx] = 0;
-    smpl->bsamp_widx ^= 1;
-    smpl->worker_using_buf[smpl->bsamp_widx] = 1;
     smpl->worker_why |= SAMPLE_WHY_BSAMPS;
-    sample_must_rwunlock_dbuf(smpl);
     sample_must_unlock_worker(smpl);
     sample_must_signal_worker(smpl);
-    return;
 }
 
 /* NOT SYNCHRONIZED (smpl_mtx) */
@@ -1254,18 +2909,22 @@ static void sample_ddatafd_store_bsamps(struct sample_session *smpl)
 {
     switch (sample_ddatafd_grab_bsamps(smpl)) {
     case GOT_BSAMPS:
-        /* Samples are safely buffered; we're done. */
-        sample_reset_timeout(smpl);
-        return;
-    case FILLED_BUFFER:
-        /* Read buffer is full; get the worker to store the samples. */
+        /* Samples are safely queued. Get the worker going once
+         * there's enough to make a decent-sized write. */
         sample_reset_timeout(smpl);
-        sample_flip_bsamp_bufs(smpl);
+        if (spsc_ring_count(&smpl->bsamp_ring) >= smpl->bsamp_write_len) {
+            sample_wake_worker(smpl);
+        }
         return;
     case GOT_LAST_BSAMP:
         /* That's the last one; time to stop. */
         sample_clear_timeout(smpl);
-        sample_flip_bsamp_bufs(smpl);
+        sample_wake_worker(smpl);
+        return;
+    case RING_FULL:
+        /* Worker's behind; hold off until it catches up. */
+        sample_pause_reading(smpl);
+        sample_wake_worker(smpl);
         return;
     case DROPPED_PKT:
         sample_stop_worker(smpl, SAMPLE_STOP_PKTDROP);
@@ -1282,41 +2941,62 @@ static void sample_ddatafd_store_bsamps(struct sample_session *smpl)
     }
 }
 
-/* NOT SYNCHRONIZED */
-static int sample_get_data_packet(struct sample_session *smpl)
+/* Read and check a packet to forward. Returns 0 on success,
+ * GOT_NOTHING if nothing was waiting, or -1 if the packet was bad or
+ * there was an error. Nothing waiting is worth a warning if "first"
+ * is set, since we only get called when the socket is readable.
+ *
+ * NOT SYNCHRONIZED */
+static int sample_get_data_packet(struct sample_session *smpl, int first)
 {
     struct iovec *iov = &smpl->dpktbuf;
     struct sockaddr_storage sas;
     struct sockaddr *sas_sa = (struct sockaddr*)&sas;
-    socklen_t sas_len = sizeof(sas);
     ssize_t s;
     struct sockaddr *dnaddr = (struct sockaddr*)&smpl->dnaddr;
-    const uint8_t mtype_expected = sample_forward_mtype(smpl);
     assert(iov->iov_base);
-    while (1) {
-        s = recvfrom(smpl->ddatafd, iov->iov_base, iov->iov_len, 0,
-                     sas_sa, &sas_len);
+    if (smpl->opts.ingest_thread) {
+        s = sample_ingest_pop(smpl, iov->iov_base, &sas);
         if (s == -1) {
-            switch (errno) {
+            return GOT_NOTHING;
+        }
+    } else {
+        struct mmsghdr msg = {
+            .msg_hdr = {
+                .msg_name = &sas,
+                .msg_namelen = sizeof(sas),
+                .msg_iov = iov,
+                .msg_iovlen = 1,
+            },
+        };
+        while (1) {
+            s = sample_recvmmsg(smpl, &msg, 1, 0);
+            if (s == -1) {
+                switch (errno) {
 #if EWOULDBLOCK != EAGAIN
-            case EWOULDBLOCK:   /* fall through */
+                case EWOULDBLOCK:   /* fall through */
 #endif
-            case EAGAIN:
-                log_WARNING("%s: spurious call; invoked with no data to read",
-                            __func__);
-                return -1;
-            case EINTR:
-                continue;
-            default:
-                log_WARNING("%s: error: %m", __func__);
-                return -1;
+                case EAGAIN:
+                    if (first) {
+                        log_WARNING("%s: spurious call; "
+                                    "invoked with no data to read",
+                                    __func__);
+                    }
+                    return GOT_NOTHING;
+                case EINTR:
+                    continue;
+                default:
+                    log_WARNING("%s: error: %m", __func__);
+                    return -1;
+                }
             }
+            break;
         }
-        break;
-    }
-    if ((size_t)s > iov->iov_len) {
-        log_WARNING("truncated read getting sample from data node");
-        return -1;
+        if (msg.msg_hdr.msg_flags & MSG_TRUNC) {
+            log_WARNING("truncated read getting sample from data node");
+            return -1;
+        }
+        s = msg.msg_len;
     }
     if (sas.ss_family != AF_INET && sas.ss_family != AF_INET6) {
         log_WARNING("data packet has unexpected remote address family %d",
@@ -1327,237 +3007,1133 @@ static int sample_get_data_packet(struct sample_session *smpl)
         sample_log_address_mismatch(smpl, sas_sa);
         return -1;
     }
+    uint8_t mtype = raw_mtype(iov->iov_base);
+    if (!sample_forwarding_mtype(smpl, mtype)) {
+        log_DEBUG("unexpected data message type %s (%u)",
+                  raw_mtype_str(mtype), mtype);
+        return -1;
+    }
     if (raw_pkt_ntoh(iov->iov_base)) {
         log_INFO("dropping malformed data node packet");
         return -1;
     }
-    uint8_t mtype = raw_mtype(iov->iov_base);
-    if (mtype != mtype_expected) {
-        log_DEBUG("unexpected data message type %s (%u); expecting %s",
-                  raw_mtype_str(mtype), mtype, raw_mtype_str(mtype_expected));
+    return 0;
+}
+
+/*
+ * Live sample ring: publishing board samples to local readers
+ */
+
+/* Publish a board sample. Its samples are in network byte order if
+ * "wire" is set, and so is the rest of it if "net" is.
+ * Event loop thread only. */
+static void sample_live_publish(struct sample_session *smpl,
+                                const struct raw_pkt_bsmp *bsmp,
+                                int wire, int net)
+{
+    struct raw_pkt_bsmp *out = live_ring_reserve(smpl->live);
+    memcpy(out, bsmp, offsetof(struct raw_pkt_bsmp, b_samps));
+    if (net) {
+        /* Already checked by sample_relay_check(). */
+        __unused int ret = raw_pkt_ntoh_hdr(out);
+        assert(!ret);
+    }
+    if (wire) {
+        raw_samps_ntoh_copy(out->b_samps, bsmp->b_samps, RAW_BSMP_NSAMP);
+    } else {
+        memcpy(out->b_samps, bsmp->b_samps, sizeof(out->b_samps));
+    }
+    live_ring_publish(smpl->live);
+}
+
+/* Publish n board samples that were just put in bsamp_ring. As with
+ * sample_tee_bsamps(), storage comes first: if the worker's falling
+ * behind, they're skipped.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_live_publish_bsamps(struct sample_session *smpl,
+                                       struct raw_pkt_bsmp *bsmps, size_t n)
+{
+    if (!smpl->live || (spsc_ring_count(&smpl->bsamp_ring) >
+                        smpl->bsamp_ringlen / SAMPLE_TEE_SHED_FRAC)) {
+        return;
+    }
+    int wire = smpl->bsamp_cfg.chns->ch_flags & CH_STORAGE_WIRE_ORDER;
+    for (size_t i = 0; i < n; i++) {
+        sample_live_publish(smpl, &bsmps[i], wire, 0);
+    }
+}
+
+/*
+ * Stream subscribers
+ *
+ * These get DnodeSamples over a TCP or Unix domain socket connection,
+ * each behind a length prefix like the control protocol's. Samples
+ * wait in the subscriber's stream_ring until the connection takes
+ * them, so a slow reader never holds up anyone else. If it falls too
+ * far behind, the oldest queued samples are dropped, and a GAP
+ * message saying how many takes their place.
+ */
+
+/* Queue a DnodeSample for a stream subscriber.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_stream_queue(struct sample_sub *sub, const void *buf,
+                               size_t len)
+{
+    ssize_t dropped = msg_ring_push(&sub->stream_ring, buf, len);
+    if (dropped == -1) {
         return -1;
     }
+    if (dropped) {
+        sub->stream_gap += (uint32_t)dropped;
+        /* The compressed samples still queued may refer to ones that
+         * just got dropped. */
+        sub->delta_have_ref = 0;
+    }
     return 0;
 }
 
-/* Ship the latest data packet raw and direct to the client. */
-static void sample_forward_raw_packet(struct sample_session *smpl)
+/* Stop forwarding to a stream subscriber whose connection failed.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_stream_drop(struct sample_sub *sub)
 {
-    /* Actually, make a copy and ship that.
-     *
-     * If this is too slow, we can optimize by skipping the original
-     * raw_pkt_ntoh() and just sending smpl->dpktbuf.iov_base, but
-     * that requires more care when validating the packet. */
-    struct sockaddr *caddr = (struct sockaddr*)&smpl->caddr;
-    socklen_t caddr_len = sockutil_addrlen(caddr);
-    void *copy;
-    size_t copylen;
-    union sample_packet pkt;
-    uint8_t mtype = raw_mtype(smpl->dpktbuf.iov_base);
-    if (mtype == RAW_MTYPE_BSMP) {
-        copy = &pkt.bsmp;
-        copylen = sizeof(pkt.bsmp);
-    } else if (mtype == RAW_MTYPE_BSUB) {
-        copy = &pkt.bsub;
-        copylen = sizeof(pkt.bsub);
-    } else {
-        assert(0);
+    struct sample_session *smpl = sub->smpl;
+    log_WARNING("dropping stream subscriber %zu: %m",
+                (size_t)(sub - smpl->subs));
+    sample_clear_sub(sub);
+    sample_update_ddatafd_filter(smpl);
+}
+
+/* Send as much of a stream subscriber's queue as the connection will
+ * take without blocking, then wait for stream_evt if that wasn't
+ * all of it.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_stream_flush(struct sample_sub *sub)
+{
+    struct iovec queued[SAMPLE_STREAM_NMSGS];
+    client_cmd_len_t lens[SAMPLE_STREAM_NMSGS];
+    struct iovec iovs[1 + 2 * SAMPLE_STREAM_NMSGS];
+    if (sub->stream_fd == -1 || sub->stream_blocked) {
+        return;
     }
-    memcpy(copy, smpl->dpktbuf.iov_base, copylen);
-    __unused int rph = raw_pkt_hton(copy);
-    assert(rph == 0);
-    __unused ssize_t n = sendto(smpl->ddatafd, copy, sizeof(copy), 0,
-                                caddr, caddr_len);
-}
-
-static void sample_init_pmsg_from_bsub(BoardSubsample *msg_bsub,
-                                       struct raw_pkt_bsub *bsub)
-{
-    uint8_t pflags = raw_pflags(bsub);
-    msg_bsub->has_is_live = 1;
-    msg_bsub->is_live = !!(pflags & RAW_PFLAG_B_LIVE);
-    msg_bsub->has_is_last = 1;
-    msg_bsub->is_last = !!(pflags & RAW_PFLAG_B_LAST);
-    msg_bsub->has_is_err = 1;
-    msg_bsub->is_err = !!raw_pkt_is_err(bsub);
-    msg_bsub->has_exp_cookie = 1;
-    msg_bsub->exp_cookie = raw_exp_cookie(bsub);
-    msg_bsub->has_board_id = 1;
-    msg_bsub->board_id = bsub->b_id;
-    msg_bsub->has_samp_idx = 1;
-    msg_bsub->samp_idx = bsub->b_sidx;
-    msg_bsub->has_chip_live = 1;
-    msg_bsub->chip_live = bsub->b_chip_live;
-    msg_bsub->n_chips = RAW_BSUB_NSAMP;
-    msg_bsub->n_channels = RAW_BSUB_NSAMP;
-    msg_bsub->n_samples = RAW_BSUB_NSAMP;
-    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
-        msg_bsub->chips[i] = bsub->b_cfg[i].bs_chip;
-        msg_bsub->channels[i] = bsub->b_cfg[i].bs_chan;
-        msg_bsub->samples[i] = bsub->b_samps[i];
-    }
-    msg_bsub->has_gpio = 1;
-    msg_bsub->gpio = bsub->b_gpio;
-    msg_bsub->has_dac_channel = 1;
-    msg_bsub->dac_channel = bsub->b_dac_cfg;
-    msg_bsub->has_dac_value = 1;
-    msg_bsub->dac_value = bsub->b_dac;
+    while (1) {
+        /* The rest of a partly sent message goes first, then any
+         * GAP, then whatever's queued. */
+        size_t niovs = 0;
+        if (sub->stream_part_off == sub->stream_part_len &&
+            sub->stream_gap) {
+            size_t len = data_pbenc_gap(sub->stream_part + CLIENT_CMDLEN_SIZE,
+                                        sub->stream_gap);
+            client_cmd_len_t clen = client_cmd_hton((client_cmd_len_t)len);
+            memcpy(sub->stream_part, &clen, CLIENT_CMDLEN_SIZE);
+            sub->stream_part_len = CLIENT_CMDLEN_SIZE + len;
+            sub->stream_part_off = 0;
+            sub->stream_gap = 0;
+        }
+        size_t part_left = sub->stream_part_len - sub->stream_part_off;
+        if (part_left) {
+            iovs[niovs].iov_base = sub->stream_part + sub->stream_part_off;
+            iovs[niovs++].iov_len = part_left;
+        }
+        size_t nqueued = msg_ring_peek(&sub->stream_ring, queued,
+                                       SAMPLE_STREAM_NMSGS);
+        for (size_t i = 0; i < nqueued; i++) {
+            lens[i] = client_cmd_hton((client_cmd_len_t)queued[i].iov_len);
+            iovs[niovs].iov_base = &lens[i];
+            iovs[niovs++].iov_len = CLIENT_CMDLEN_SIZE;
+            iovs[niovs++] = queued[i];
+        }
+        if (niovs == 0) {
+            return;             /* caught up */
+        }
+
+        struct msghdr hdr = { .msg_iov = iovs, .msg_iovlen = niovs };
+        ssize_t s = sendmsg(sub->stream_fd, &hdr,
+                            MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (s == -1) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                sample_stream_drop(sub);
+                return;
+            }
+            s = 0;
+        }
+
+        size_t sent = (size_t)s;
+        size_t n = sent < part_left ? sent : part_left;
+        sub->stream_part_off += n;
+        sent -= n;
+        size_t ndone = 0;
+        while (ndone < nqueued &&
+               sent >= CLIENT_CMDLEN_SIZE + queued[ndone].iov_len) {
+            sent -= CLIENT_CMDLEN_SIZE + queued[ndone].iov_len;
+            ndone++;
+        }
+        if (sent) {
+            /* Take what's left of a partly sent message out of the
+             * queue, so it can't be dropped out from under us. */
+            assert(ndone < nqueued);
+            memcpy(sub->stream_part, &lens[ndone], CLIENT_CMDLEN_SIZE);
+            memcpy(sub->stream_part + CLIENT_CMDLEN_SIZE,
+                   queued[ndone].iov_base, queued[ndone].iov_len);
+            sub->stream_part_len = (CLIENT_CMDLEN_SIZE +
+                                    queued[ndone].iov_len);
+            sub->stream_part_off = sent;
+            ndone++;
+        }
+        msg_ring_pop(&sub->stream_ring, ndone);
+        if (sub->stream_part_off < sub->stream_part_len ||
+            ndone < nqueued) {
+            break;              /* connection's full */
+        }
+        if (sub->stream_part_off == sub->stream_part_len) {
+            sub->stream_part_off = sub->stream_part_len = 0;
+        }
+    }
+    if (event_add(sub->stream_evt, NULL)) {
+        log_ERR("%s: can't wait for stream subscriber", __func__);
+        sample_stream_drop(sub);
+        return;
+    }
+    sub->stream_blocked = 1;
 }
 
-/* NOT SYNCHRONIZED */
-static int sample_pack_and_ship_pmsg(struct sample_session *smpl,
-                                     DnodeSample *dnsample)
-{
-    struct sockaddr *caddr = (struct sockaddr*)&smpl->caddr;
-    size_t dnsample_psize = dnode_sample__get_packed_size(dnsample);
-    if (dnsample_psize > SAMPLE_PBUF_ARR_SIZE) {
-        log_WARNING("packed subsample buffer size %zu exceeds "
-                    "preallocated buffer size %d; "
-                    "falling back on malloc().",
-                    dnsample_psize, SAMPLE_PBUF_ARR_SIZE);
-        uint8_t *out = malloc(dnsample_psize);
-        if (!out) {
-            log_ERR("out of memory");
-            return -1;
+/* A stream subscriber's connection finished connecting, or has room
+ * again. */
+static void sample_stream_callback(__unused evutil_socket_t ignored,
+                                   short events, void *subvp)
+{
+    struct sample_sub *sub = subvp;
+    struct sample_session *smpl = sub->smpl;
+    assert(events == EV_WRITE);
+    sample_must_lock(smpl);
+    sub->stream_blocked = 0;
+    if (sub->stream_connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(sub->stream_fd, SOL_SOCKET, SO_ERROR, &err, &len)) {
+            err = errno;
         }
-        dnode_sample__pack(dnsample, out);
-        int ret = sendto(smpl->ddatafd, out, dnsample_psize, 0,
-                         caddr, sockutil_addrlen(caddr));
-        free(out);
-        return ret;
+        if (err) {
+            errno = err;
+            sample_stream_drop(sub);
+            goto out;
+        }
+        sub->stream_connecting = 0;
+        log_DEBUG("stream subscriber %zu connected",
+                  (size_t)(sub - smpl->subs));
     }
-    dnode_sample__pack(dnsample, smpl->c_sample_pbuf_arr);
-    ssize_t s = sendto(smpl->ddatafd, smpl->c_sample_pbuf_arr,
-                       dnsample_psize, 0, caddr, sockutil_addrlen(caddr));
+    sample_stream_flush(sub);
+ out:
+    sample_must_unlock(smpl);
+}
 
-    return s == (ssize_t)dnsample_psize ? 0 : -1;
+/*
+ * Forwarding batches
+ */
+
+/* Send a datagram to a subscriber, or queue a DnodeSample for a
+ * stream subscriber.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_send(struct sample_sub *sub, const void *buf,
+                           size_t len)
+{
+    if (sub->stream_fd != -1) {
+        return sample_stream_queue(sub, buf, len);
+    }
+    struct sockaddr *addr = (struct sockaddr*)&sub->addr;
+    ssize_t s = sendto(sub->smpl->ddatafd, buf, len, MSG_DONTWAIT,
+                       addr, sockutil_addrlen(addr));
+    return s == (ssize_t)len ? 0 : -1;
 }
 
-/* NOT SYNCHRONIZED */
-static int sample_convert_and_ship_subsample(struct sample_session *smpl)
-{
-    struct raw_pkt_bsub *bsub = (struct raw_pkt_bsub*)smpl->dpktbuf.iov_base;
-    BoardSubsample msg_bsub = BOARD_SUBSAMPLE__INIT;
-    msg_bsub.chips = smpl->c_bsub_chips;
-    msg_bsub.channels = smpl->c_bsub_chans;
-    msg_bsub.samples = smpl->c_bsub_samps;
-    DnodeSample dnsample = DNODE_SAMPLE__INIT;
-    sample_init_pmsg_from_bsub(&msg_bsub, bsub);
-    dnsample.subsample = &msg_bsub;
-    dnsample.has_type = 1;
-    dnsample.type = DNODE_SAMPLE__TYPE__SUBSAMPLE;
-    uint32_t idx_gap = msg_bsub.samp_idx - smpl->debug_last_sub_idx - 1;
-    if (idx_gap) {
-        log_DEBUG("bsub GAP: %u", idx_gap);
-    }
-    smpl->debug_last_sub_idx = msg_bsub.samp_idx;
-    return sample_pack_and_ship_pmsg(smpl, &dnsample);
+/* Send the first n datagrams in sub's bufs. Whatever the socket won't
+ * take right now is dropped, like it would be for sendto().
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_fwd_send(struct sample_sub *sub, unsigned n)
+{
+    socklen_t addr_len = sockutil_addrlen((struct sockaddr*)&sub->addr);
+    for (unsigned i = 0; i < n; i++) {
+        sub->mmsgs[i].msg_hdr.msg_namelen = addr_len;
+    }
+    unsigned sent = 0;
+    while (sent < n) {
+        int s = sendmmsg(sub->smpl->ddatafd, sub->mmsgs + sent, n - sent,
+                         MSG_DONTWAIT);
+        if (s == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_DEBUG("%s: dropping %u datagrams: %m", __func__, n - sent);
+            return;
+        }
+        sent += (unsigned)s;
+    }
 }
 
-/* NOT SYNCHRONIZED */
-static void sample_ddatafd_forward_bsub(struct sample_session *smpl)
+/* Send the batched datagrams that are full. If "all" is set, send
+ * the last one even if it's only partly full.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_fwd_flush(struct sample_sub *sub, int all)
 {
-    assert(smpl->forward_what == SAMPLE_FWD_BSUB ||
-           smpl->forward_what == SAMPLE_FWD_BSUB_RAW);
-    if (smpl->forward_what == SAMPLE_FWD_BSUB) {
-        /* Convert the raw packet to protobuf and ship that to the client. */
-        if (sample_convert_and_ship_subsample(smpl)) {
-            log_DEBUG("%s: can't forward board subsample to client", __func__);
+    unsigned n = sub->ndgrams;
+    if (n == 0) {
+        return;
+    }
+    int keep_last = !all && sub->nsamps < sub->batch_size;
+    if (keep_last) {
+        n--;
+    }
+    if (n) {
+        sample_fwd_send(sub, n);
+    }
+    if (keep_last) {
+        /* Move the partial datagram to the front; the flush timer's
+         * still running for it. */
+        if (n) {
+            memcpy(sub->iovs[0].iov_base, sub->iovs[n].iov_base,
+                   sub->iovs[n].iov_len);
+            sub->iovs[0].iov_len = sub->iovs[n].iov_len;
         }
+        sub->ndgrams = 1;
     } else {
-        sample_forward_raw_packet(smpl);
+        sub->ndgrams = 0;
+        sub->nsamps = 0;
+        evtimer_del(sub->flush_evt);
     }
 }
 
-static void sample_init_pmsg_from_bsmp(BoardSample *msg_bsmp,
-                                       struct raw_pkt_bsmp *bsmp)
+/* Nothing's filled the last datagram in a while; send it anyway. */
+static void sample_fwd_flush_callback(__unused evutil_socket_t ignored,
+                                      short events, void *subvp)
 {
-    uint8_t pflags = raw_pflags(bsmp);
+    struct sample_sub *sub = subvp;
+    struct sample_session *smpl = sub->smpl;
+    assert(events == EV_TIMEOUT);
+    sample_must_lock(smpl);
+    sample_fwd_flush(sub, 1);
+    sample_must_unlock(smpl);
+}
+
+/* Flush at the end of an event loop wakeup. */
+static void sample_fwd_wakeup_done(struct sample_session *smpl)
+{
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        const struct timeval *lat = &sub->batch_latency;
+        if (sub->stream_fd != -1) {
+            sample_stream_flush(sub);
+            continue;
+        }
+        sample_fwd_flush(sub, lat->tv_sec == 0 && lat->tv_usec == 0);
+    }
+}
+
+/* Make room for a psize byte DnodeSample at the end of the batch,
+ * starting a new datagram when the current one is full. Returns
+ * where to pack it, or NULL if it won't fit in any datagram.
+ *
+ * A DnodeSampleBatch is just its "samples" field repeated, so each
+ * one goes in as that field's tag and length, then the packed
+ * DnodeSample itself.
+ *
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static uint8_t* sample_fwd_batch_add(struct sample_sub *sub, size_t psize)
+{
+    const uint8_t tag = (1 << 3) | 2; /* field 1, length-delimited */
+    uint8_t hdr[1 + DATA_PBENC_VARINT_MAX];
+    size_t hdrlen = 0;
+    hdr[hdrlen++] = tag;
+    hdrlen += data_pbenc_varint(hdr + hdrlen, psize);
+    if (hdrlen + psize > SAMPLE_FWD_DGRAM_MAX) {
+        log_WARNING("%zu byte sample won't fit in a datagram", psize);
+        return NULL;
+    }
+
+    struct iovec *iov = sub->ndgrams ? &sub->iovs[sub->ndgrams - 1] : NULL;
+    if (!iov || sub->nsamps == sub->batch_size ||
+        iov->iov_len + hdrlen + psize > sub->dgram_max) {
+        /* Start a new datagram; it's OK if the sample's too big for
+         * the MTU by itself, it'll just get fragmented. */
+        if (sub->ndgrams == SAMPLE_FWD_NDGRAMS) {
+            sample_fwd_flush(sub, 1);
+        }
+        if (sub->ndgrams == 0) {
+            evtimer_add(sub->flush_evt, &sub->batch_latency);
+        }
+        iov = &sub->iovs[sub->ndgrams++];
+        iov->iov_len = 0;
+        sub->nsamps = 0;
+    }
+    uint8_t *out = (uint8_t*)iov->iov_base + iov->iov_len;
+    memcpy(out, hdr, hdrlen);
+    iov->iov_len += hdrlen + psize;
+    sub->nsamps++;
+    return out + hdrlen;
+}
+
+/* Where to pack a psize byte DnodeSample for sub: the end of its
+ * current batch if it's batching, or c_sample_pbuf_arr if not.
+ * Call sample_fwd_commit() once it's packed.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static uint8_t* sample_fwd_reserve(struct sample_sub *sub, size_t psize)
+{
+    if (sub->batch_size) {
+        return sample_fwd_batch_add(sub, psize);
+    }
+    assert(psize <= SAMPLE_PBUF_ARR_SIZE);
+    return sub->smpl->c_sample_pbuf_arr;
+}
+
+/* Send a DnodeSample packed where sample_fwd_reserve() said. Batched
+ * ones go out when the batch does.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_fwd_commit(struct sample_sub *sub, size_t psize)
+{
+    if (sub->batch_size) {
+        return 0;
+    }
+    return sample_sub_send(sub, sub->smpl->c_sample_pbuf_arr, psize);
+}
+
+/*
+ * Fan-out to subscribers
+ */
+
+/* A board sample or subsample on its way to the subscribers. Each
+ * form it goes out in is made once, by the first subscriber that
+ * wants it, and reused by the rest. */
+struct sample_fwd_pkt {
+    void *pkt;          /**< In host byte order, except... */
+    int wire;           /**< ...if set, bsmp samples are in network
+                         * byte order; see raw_pkt_ntoh_hdr(). */
+    /** As a DnodeSample, once packed into a subscriber's batch. Never
+     * c_sample_pbuf_arr, which every unbatched subscriber packs its
+     * own DnodeSamples into. */
+    const uint8_t *packed;
+    size_t psize;       /**< Length of packed. */
+    int raw_ready;      /**< c_raw_pkt holds pkt in network order. */
+};
+
+static inline uint32_t sample_pkt_sidx(const void *pkt)
+{
+    if (raw_mtype(pkt) == RAW_MTYPE_BSMP) {
+        return ((const struct raw_pkt_bsmp*)pkt)->b_sidx;
+    }
+    return ((const struct raw_pkt_bsub*)pkt)->b_sidx;
+}
+
+/* Does sub want the mtype packet with index sidx? "storing" means
+ * it's a board sample on its way to disk.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_wants(struct sample_sub *sub, uint8_t mtype,
+                            uint32_t sidx, int storing)
+{
+    if (!sample_sub_active(sub) || sample_sub_mtype(sub) != mtype) {
+        return 0;
+    }
+    unsigned every = storing ? sub->tee_every : sub->decimate;
+    if (storing && every == 0) {
+        return 0;
+    }
+    return every <= 1 || sidx % every == 0;
+}
+
+/* The board sample sub's samples come from: fp's, or, if sub
+ * re-references them, a copy of it in host byte order with that done.
+ * Sets *wire to whether its samples are in wire byte order.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static const struct raw_pkt_bsmp* sample_sub_bsmp(struct sample_sub *sub,
+                                                  struct sample_fwd_pkt *fp,
+                                                  int *wire)
+{
+    const struct raw_pkt_bsmp *bsmp = fp->pkt;
+    if (!sub->reref) {
+        *wire = fp->wire;
+        return bsmp;
+    }
+    struct raw_pkt_bsmp *rr = &sub->smpl->c_reref_bsmp;
+    const uint16_t *samps = bsmp->b_samps;
+    memcpy(rr, bsmp, offsetof(struct raw_pkt_bsmp, b_samps));
+    if (fp->wire) {
+        raw_samps_ntoh_copy(rr->b_samps, samps, RAW_BSMP_NSAMP);
+        samps = rr->b_samps;
+    }
+    reref16_run(sub->reref, rr->b_samps, samps);
+    *wire = 0;
+    return rr;
+}
 
-    msg_bsmp->has_is_live = 1;
-    msg_bsmp->is_live = !!(pflags & RAW_PFLAG_B_LIVE);
+/* The board sample fp's samples from the channels sub wants, in
+ * host byte order, re-referenced but before any filtering. Sets *n
+ * to how many there are.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static const uint16_t* sample_sub_gather(struct sample_sub *sub,
+                                         struct sample_fwd_pkt *fp,
+                                         size_t *n)
+{
+    struct sample_session *smpl = sub->smpl;
+    int wire;
+    const struct raw_pkt_bsmp *bsmp = sample_sub_bsmp(sub, fp, &wire);
+    if (sub->chans.n) {
+        *n = sub->chans.n;
+        bsmp_gather((uint8_t*)smpl->c_bsmp_samps, bsmp,
+                    sub->chans.chans, *n, wire);
+        return smpl->c_bsmp_samps;
+    }
+    *n = RAW_BSMP_NSAMP;
+    if (wire) {
+        raw_samps_ntoh_copy(smpl->c_bsmp_samps, bsmp->b_samps, *n);
+        return smpl->c_bsmp_samps;
+    }
+    return bsmp->b_samps;
+}
 
-    msg_bsmp->has_is_last = 1;
-    msg_bsmp->is_last = !!(pflags & RAW_PFLAG_B_LAST);
+/* Does sub's filter see the board samples fanning out now? "storing"
+ * is as for sample_sub_wants().
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static inline int sample_sub_filtering(struct sample_sub *sub,
+                                       int storing)
+{
+    return (sub->filter && sample_sub_active(sub) &&
+            sub->what != SAMPLE_FWD_BSMP_RAW &&
+            sample_sub_mtype(sub) == RAW_MTYPE_BSMP &&
+            (!storing || sub->tee_every != 0));
+}
 
-    msg_bsmp->has_is_err = 1;
-    msg_bsmp->is_err = !!raw_pkt_is_err(bsmp);
+/* Run board sample fp through sub's filter, leaving the results in
+ * c_filt_samps for sample_sub_samps(). This happens whether or not
+ * sub gets fp, so the filter doesn't see the gaps decimation leaves.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_sub_filter(struct sample_sub *sub,
+                              struct sample_fwd_pkt *fp)
+{
+    struct sample_session *smpl = sub->smpl;
+    const struct raw_pkt_bsmp *bsmp = fp->pkt;
+    struct biquad16 *bq = sub->filter;
+    uint64_t cookie = raw_exp_cookie(bsmp);
+    size_t n;
+    const uint16_t *samps = sample_sub_gather(sub, fp, &n);
+    if (sub->filter_restart || cookie != sub->filter_cookie) {
+        /* Don't filter one experiment into the next. */
+        sub->filter_restart = 0;
+        sub->filter_cookie = cookie;
+        biquad16_restart(bq, n);
+    }
+    biquad16_run(bq, smpl->c_filt_samps, samps);
+}
 
-    msg_bsmp->has_exp_cookie = 1;
-    msg_bsmp->exp_cookie = raw_exp_cookie(bsmp);
+/* The samples from board sample fp that sub gets: the ones from the
+ * channels it wants, in host byte order, and re-referenced and
+ * filtered if it does those. Sets *n to how many there are.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static const uint16_t* sample_sub_samps(struct sample_sub *sub,
+                                        struct sample_fwd_pkt *fp,
+                                        size_t *n)
+{
+    if (sub->filter) {
+        *n = sub->filter->nchans;
+        return sub->smpl->c_filt_samps;
+    }
+    return sample_sub_gather(sub, fp, n);
+}
 
-    msg_bsmp->has_board_id = 1;
-    msg_bsmp->board_id = bsmp->b_id;
+/* Send a board sample to sub as a compressed DnodeSample. Each
+ * subscriber has its own reference samples, so there's nothing to
+ * share with the others.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_ship_delta(struct sample_sub *sub,
+                                 struct sample_fwd_pkt *fp)
+{
+    struct sample_session *smpl = sub->smpl;
+    const struct raw_pkt_bsmp *bsmp = fp->pkt;
+    const struct data_pbenc_chans *dchans = sub->chans.n ? &sub->chans : NULL;
+    size_t n;
+    const uint16_t *samps = sample_sub_samps(sub, fp, &n);
 
-    msg_bsmp->has_samp_idx = 1;
-    msg_bsmp->samp_idx = bsmp->b_sidx;
+    int key = (!sub->delta_have_ref ||
+               sub->delta_nsent >= SAMPLE_DELTA_KEY_EVERY);
+    struct data_pbenc_delta delta = {
+        .data = smpl->c_delta_buf,
+        .has_ref = !key,
+        .ref = sub->delta_ref_sidx,
+    };
+    delta.len = delta16_encode(smpl->c_delta_buf, samps,
+                               key ? NULL : sub->delta_ref, n);
+    size_t psize = data_pbenc_bsmp_delta_size(bsmp, dchans, &delta);
+    uint8_t *out = sample_fwd_reserve(sub, psize);
+    if (!out) {
+        goto lost;
+    }
+    data_pbenc_bsmp_delta(out, bsmp, dchans, &delta);
+    /* Update the reference first: committing to a stream
+     * subscriber's queue can reset it. */
+    memcpy(sub->delta_ref, samps, n * sizeof(uint16_t));
+    sub->delta_ref_sidx = bsmp->b_sidx;
+    sub->delta_nsent = key ? 1 : sub->delta_nsent + 1;
+    sub->delta_have_ref = 1;
+    if (sample_fwd_commit(sub, psize)) {
+        goto lost;
+    }
+    return 0;
+
+ lost:
+    /* The subscriber can't decode anything against a sample it
+     * didn't get, so start over. */
+    sub->delta_have_ref = 0;
+    return -1;
+}
+
+/* Add a board sample to sub's preview window, and send the window's
+ * summaries once it's full. Each subscriber has its own window, with
+ * its own size and channels, so the summaries aren't shared.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_ship_preview(struct sample_sub *sub,
+                                   struct sample_fwd_pkt *fp)
+{
+    struct sample_session *smpl = sub->smpl;
+    const struct raw_pkt_bsmp *bsmp = fp->pkt;
+    struct preview16 *pv = sub->preview;
+    struct data_pbenc_preview *msg = &sub->preview_msg;
+    size_t n;
+    const uint16_t *samps = sample_sub_samps(sub, fp, &n);
+
+    if (pv->nsamps && raw_exp_cookie(bsmp) != msg->exp_cookie) {
+        /* Don't mix experiments. */
+        pv->nsamps = 0;
+    }
+    if (pv->nsamps == 0) {
+        preview16_reset(pv, n);
+        msg->exp_cookie = raw_exp_cookie(bsmp);
+        msg->board_id = bsmp->b_id;
+        msg->chip_live = bsmp->b_chip_live;
+        msg->samp_idx = bsmp->b_sidx;
+    }
+    preview16_add(pv, samps);
+    unsigned window = (sub->preview_window ? sub->preview_window :
+                       SAMPLE_PREVIEW_WINDOW_DEFAULT);
+    if (pv->nsamps < window) {
+        return 0;
+    }
 
-    msg_bsmp->has_chip_live = 1;
-    msg_bsmp->chip_live = bsmp->b_chip_live;
+    preview16_finish(pv, smpl->c_preview[0], smpl->c_preview[1],
+                     smpl->c_preview[2], smpl->c_preview[3]);
+    msg->nsamples = pv->nsamps;
+    msg->dchans = sub->chans.n ? &sub->chans : NULL;
+    msg->nchans = n;
+    msg->min = smpl->c_preview[0];
+    msg->max = smpl->c_preview[1];
+    msg->mean = smpl->c_preview[2];
+    msg->rms = smpl->c_preview[3];
+    pv->nsamps = 0;
+    size_t psize = data_pbenc_preview_size(msg);
+    uint8_t *out = sample_fwd_reserve(sub, psize);
+    if (!out) {
+        return -1;
+    }
+    data_pbenc_preview(out, msg);
+    return sample_fwd_commit(sub, psize);
+}
+
+/* Look for spikes in a board sample, and send sub the ones whose
+ * snippets are complete. Each subscriber has its own detector, with
+ * its own thresholds, baselines, and pending snippets.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_ship_spikes(struct sample_sub *sub,
+                                  struct sample_fwd_pkt *fp)
+{
+    struct sample_session *smpl = sub->smpl;
+    const struct raw_pkt_bsmp *bsmp = fp->pkt;
+    struct spike16 *sp = sub->spikes;
+    uint64_t cookie = raw_exp_cookie(bsmp);
+    int ret = 0;
+    size_t n;
+    const uint16_t *samps = sample_sub_samps(sub, fp, &n);
+
+    if (sub->spikes_restart || cookie != sub->spikes_cookie) {
+        /* Don't mix experiments, either. */
+        sub->spikes_restart = 0;
+        sub->spikes_cookie = cookie;
+        if (spike16_restart(sp, n)) {
+            log_WARNING("%zu spike thresholds don't match %zu channels; "
+                        "not looking for spikes", sp->nfixed, n);
+        }
+    }
+    if (sp->nchans != n) {
+        return 0;
+    }
+    spike16_add(sp, samps, bsmp->b_sidx);
 
-    msg_bsmp->has_samples = 1;
-    ProtobufCBinaryData *samples = &msg_bsmp->samples;
-    memcpy(samples->data, bsmp->b_samps, samples->len);
+    struct data_pbenc_spikes msg = {
+        .exp_cookie = cookie,
+        .board_id = bsmp->b_id,
+        .chans = smpl->c_spike_chans,
+        .snippets = smpl->c_spike_snips,
+        .snippet_len = sp->pre + sp->post,
+        .snippet_pre = sp->pre,
+    };
+    while ((msg.n = spike16_ready(sp, &msg.samp_idx, smpl->c_spike_chans,
+                                  smpl->c_spike_snips,
+                                  DATA_PBENC_SPIKES_MAX_EVENTS))) {
+        if (sub->chans.n) {
+            for (size_t i = 0; i < msg.n; i++) {
+                uint16_t *chan = &smpl->c_spike_chans[i];
+                *chan = sub->chans.chans[*chan];
+            }
+        }
+        size_t psize = data_pbenc_spikes_size(&msg);
+        uint8_t *out = sample_fwd_reserve(sub, psize);
+        if (!out) {
+            ret = -1;
+            continue;
+        }
+        data_pbenc_spikes(out, &msg);
+        if (sample_fwd_commit(sub, psize)) {
+            ret = -1;
+        }
+    }
+    return ret;
 }
 
-static int sample_convert_and_ship_sample(struct sample_session *smpl)
+/* Send sub a board sample holding its re-referenced or filtered
+ * samples in place of fp's. Each subscriber has its own filter and
+ * re-referencing state, so these samples are its alone.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_ship_processed(struct sample_sub *sub,
+                                     struct sample_fwd_pkt *fp)
 {
-    struct raw_pkt_bsmp *bsmp = (struct raw_pkt_bsmp*)smpl->dpktbuf.iov_base;
-    BoardSample msg_bsmp = BOARD_SAMPLE__INIT;
-    assert(sizeof(smpl->c_bsmp_samps) >= RAW_BSMP_NSAMP * sizeof(raw_samp_t));
-    msg_bsmp.samples.data = smpl->c_bsmp_samps;
-    msg_bsmp.samples.len = sizeof(smpl->c_bsmp_samps);
-    sample_init_pmsg_from_bsmp(&msg_bsmp, bsmp);
-    DnodeSample dnsample = DNODE_SAMPLE__INIT;
-    dnsample.sample = &msg_bsmp;
-    dnsample.has_type = 1;
-    dnsample.type = DNODE_SAMPLE__TYPE__SAMPLE;
-    uint32_t idx_gap = msg_bsmp.samp_idx - smpl->debug_last_sub_idx - 1;
-    if (idx_gap) {
-        log_DEBUG("bsmp GAP: %u", idx_gap);
+    struct sample_session *smpl = sub->smpl;
+    struct raw_pkt_bsmp *filt = &smpl->c_filt_bsmp;
+    const struct data_pbenc_chans *dchans = sub->chans.n ? &sub->chans : NULL;
+    size_t n;
+    const uint16_t *samps = sample_sub_samps(sub, fp, &n);
+
+    memcpy(filt, fp->pkt, offsetof(struct raw_pkt_bsmp, b_samps));
+    if (dchans) {
+        /* Put them back where the encoder will gather them from. */
+        for (size_t i = 0; i < n; i++) {
+            filt->b_samps[dchans->chans[i]] = samps[i];
+        }
+    } else {
+        memcpy(filt->b_samps, samps, n * sizeof(uint16_t));
+    }
+    size_t psize = (dchans ? data_pbenc_bsmp_chans_size(filt, dchans) :
+                    data_pbenc_bsmp_size(filt));
+    uint8_t *out = sample_fwd_reserve(sub, psize);
+    if (!out) {
+        return -1;
     }
-    smpl->debug_last_sub_idx = msg_bsmp.samp_idx;
-    return sample_pack_and_ship_pmsg(smpl, &dnsample);
+    if (dchans) {
+        data_pbenc_bsmp_chans(out, filt, dchans, 0);
+    } else {
+        data_pbenc_bsmp(out, filt, 0);
+    }
+    return sample_fwd_commit(sub, psize);
 }
 
-static void sample_ddatafd_forward_bsamp(struct sample_session *smpl)
+/* Send fp to sub, raw or as a DnodeSample.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_sub_ship(struct sample_sub *sub,
+                           struct sample_fwd_pkt *fp)
 {
-    assert(smpl->forward_what == SAMPLE_FWD_BSMP ||
-           smpl->forward_what == SAMPLE_FWD_BSMP_RAW);
-    if (smpl->forward_what == SAMPLE_FWD_BSMP) {
-        if (sample_convert_and_ship_sample(smpl)) {
-            log_DEBUG("%s: can't forward board sample to client", __func__);
+    struct sample_session *smpl = sub->smpl;
+    uint8_t mtype = raw_mtype(fp->pkt);
+    if (sub->what == SAMPLE_FWD_BSMP_RAW ||
+        sub->what == SAMPLE_FWD_BSUB_RAW) {
+        if (!fp->raw_ready) {
+            raw_pkt_copy(&smpl->c_raw_pkt, fp->pkt);
+            if (fp->wire ? raw_pkt_hton_hdr(&smpl->c_raw_pkt) :
+                raw_pkt_hton(&smpl->c_raw_pkt)) {
+                return -1;
+            }
+            fp->raw_ready = 1;
+        }
+        return sample_sub_send(sub, &smpl->c_raw_pkt,
+                               raw_pkt_size(fp->pkt));
+    }
+
+    if (sub->what == SAMPLE_FWD_BSMP_DELTA) {
+        return sample_sub_ship_delta(sub, fp);
+    } else if (sub->what == SAMPLE_FWD_BSMP_PREVIEW) {
+        return sample_sub_ship_preview(sub, fp);
+    } else if (sub->what == SAMPLE_FWD_BSMP_SPIKES) {
+        return sample_sub_ship_spikes(sub, fp);
+    } else if (mtype == RAW_MTYPE_BSMP && (sub->filter || sub->reref)) {
+        return sample_sub_ship_processed(sub, fp);
+    }
+
+    if (mtype == RAW_MTYPE_BSMP && sub->chans.n) {
+        /* Nobody else is likely to want the same channels. */
+        size_t psize = data_pbenc_bsmp_chans_size(fp->pkt, &sub->chans);
+        uint8_t *out = sample_fwd_reserve(sub, psize);
+        if (!out) {
+            return -1;
         }
+        data_pbenc_bsmp_chans(out, fp->pkt, &sub->chans, fp->wire);
+        return sample_fwd_commit(sub, psize);
+    }
+
+    if (!fp->psize) {
+        fp->psize = (mtype == RAW_MTYPE_BSMP ?
+                     data_pbenc_bsmp_size(fp->pkt) :
+                     data_pbenc_bsub_size(fp->pkt));
+    }
+    uint8_t *out = sample_fwd_reserve(sub, fp->psize);
+    if (!out) {
+        return -1;
+    }
+    if (fp->packed) {
+        memcpy(out, fp->packed, fp->psize);
     } else {
-        sample_forward_raw_packet(smpl);
+        if (mtype == RAW_MTYPE_BSMP) {
+            data_pbenc_bsmp(out, fp->pkt, fp->wire);
+        } else {
+            data_pbenc_bsub(out, fp->pkt);
+        }
+        if (sub->batch_size) {
+            /* Nobody else touches sub's batch during the fan-out. */
+            fp->packed = out;
+        }
     }
+    return sample_fwd_commit(sub, fp->psize);
 }
 
-/* NOT SYNCHRONIZED */
+/* Send fp to every subscriber that wants it.
+ *
+ * If "shed" is NULL, fp is live. Otherwise, it's being stored, and
+ * *shed is a bitmask of subscribers to skip; ones we can't send to
+ * get added to it.
+ *
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_fwd_fanout(struct sample_session *smpl,
+                              struct sample_fwd_pkt *fp, unsigned *shed)
+{
+    uint8_t mtype = raw_mtype(fp->pkt);
+    uint32_t sidx = sample_pkt_sidx(fp->pkt);
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        if (mtype == RAW_MTYPE_BSMP &&
+            sample_sub_filtering(sub, shed != NULL)) {
+            sample_sub_filter(sub, fp);
+        }
+        if (!sample_sub_wants(sub, mtype, sidx, shed != NULL)) {
+            continue;
+        }
+        if (shed && (*shed & (1U << i))) {
+            smpl->tee_nshed++;
+            continue;
+        }
+        if (sample_sub_ship(sub, fp)) {
+            if (shed) {
+                *shed |= 1U << i;
+                smpl->tee_nshed++;
+            } else {
+                log_DEBUG("%s: can't forward %s to subscriber %zu",
+                          __func__, raw_mtype_str(mtype), i);
+            }
+        } else if (shed) {
+            smpl->tee_nsent++;
+        }
+    }
+}
+
+/* NOT SYNCHRONIZED (smpl_mtx) */
 static void sample_ddatafd_forward(struct sample_session *smpl)
 {
-    /* Fill the data node sample packet buffer. */
-    if (sample_get_data_packet(smpl) == -1) {
+    /* When batching, take everything that's waiting on the socket,
+     * so it can share datagrams. (The ingest callback already hands
+     * us packets in bunches.) */
+    int batching = 0;
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        batching |= sample_sub_active(sub) && sub->batch_size;
+    }
+    size_t max = (batching && !smpl->opts.ingest_thread ?
+                  SAMPLE_FWD_MAX_PER_CB : 1);
+    for (size_t i = 0; i < max; i++) {
+        /* Fill the data node sample packet buffer. */
+        int got = sample_get_data_packet(smpl, i == 0);
+        if (got == GOT_NOTHING) {
+            break;
+        } else if (got == -1) {
+            continue;
+        }
+        struct sample_fwd_pkt fp = { .pkt = smpl->dpktbuf.iov_base };
+        uint32_t sidx = sample_pkt_sidx(fp.pkt);
+        uint32_t idx_gap = sidx - smpl->debug_last_sub_idx - 1;
+        if (idx_gap) {
+            log_DEBUG("%s GAP: %u",
+                      raw_mtype(fp.pkt) == RAW_MTYPE_BSMP ? "bsmp" : "bsub",
+                      idx_gap);
+        }
+        smpl->debug_last_sub_idx = sidx;
+        if (smpl->live && raw_mtype(fp.pkt) == RAW_MTYPE_BSMP) {
+            sample_live_publish(smpl, fp.pkt, 0, 0);
+        }
+        sample_fwd_fanout(smpl, &fp, NULL);
+    }
+}
+
+/*
+ * Raw relay: forwarding raw packets without unpacking them
+ *
+ * When every subscriber wants raw packets, there's no reason to
+ * byte-swap them into host order and back again. Instead, we check
+ * their headers where they landed, in network byte order, and send
+ * the same bytes straight back out, a recvmmsg() batch at a time, to
+ * everyone who wants them with a single sendmmsg().
+ */
+
+/* Is everyone we're forwarding to getting raw packets?
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_relaying(struct sample_session *smpl)
+{
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        if (sample_sub_active(sub) &&
+            sub->what != SAMPLE_FWD_BSMP_RAW &&
+            sub->what != SAMPLE_FWD_BSUB_RAW) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Receive up to SAMPLE_RECVMMSG_BATCH packets into relay_pkts, and
+ * point relay_iovs and relay_srcs at them. Truncated packets get
+ * zero length. Returns how many, or 0 if nothing was waiting or
+ * there was an error.
+ *
+ * Event loop thread only. */
+static int sample_relay_recv(struct sample_session *smpl)
+{
+    for (size_t j = 0; j < SAMPLE_RECVMMSG_BATCH; j++) {
+        struct msghdr *hdr = &smpl->bsamp_mmsgs[j].msg_hdr;
+        smpl->bsamp_iovs[j].iov_base = &smpl->relay_pkts[j];
+        smpl->bsamp_iovs[j].iov_len = sizeof(union sample_packet);
+        hdr->msg_name = &smpl->bsamp_sas[j];
+        hdr->msg_namelen = sizeof(smpl->bsamp_sas[j]);
+        hdr->msg_iov = &smpl->bsamp_iovs[j];
+        hdr->msg_iovlen = 1;
+        hdr->msg_control = NULL;
+        hdr->msg_controllen = 0;
+        hdr->msg_flags = 0;
+    }
+    int n;
+    while ((n = sample_recvmmsg(smpl, smpl->bsamp_mmsgs,
+                                SAMPLE_RECVMMSG_BATCH,
+                                MSG_DONTWAIT)) == -1) {
+        switch (errno) {
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:   /* fall through */
+#endif
+        case EAGAIN:
+            return 0;
+        case EINTR:
+            continue;
+        default:
+            log_WARNING("%s: recvmmsg: %m", __func__);
+            return 0;
+        }
+    }
+    for (int j = 0; j < n; j++) {
+        struct mmsghdr *msg = &smpl->bsamp_mmsgs[j];
+        smpl->relay_iovs[j].iov_base = &smpl->relay_pkts[j];
+        smpl->relay_iovs[j].iov_len = (msg->msg_hdr.msg_flags & MSG_TRUNC ?
+                                       0 : msg->msg_len);
+        smpl->relay_srcs[j] = &smpl->bsamp_sas[j];
+    }
+    return n;
+}
+
+/* Point relay_iovs and relay_srcs at up to SAMPLE_RECVMMSG_BATCH
+ * packets the ingest thread queued, without copying them. Returns
+ * how many; pop them off ingest_ring once they've been sent.
+ *
+ * Event loop thread only. */
+static int sample_relay_peek_ingest(struct sample_session *smpl)
+{
+    size_t idx;
+    size_t n = spsc_ring_peek(&smpl->ingest_ring, &idx);
+    if (n > SAMPLE_RECVMMSG_BATCH) {
+        n = SAMPLE_RECVMMSG_BATCH;
+    }
+    for (size_t j = 0; j < n; j++) {
+        struct sample_ingest_slot *slot = &smpl->ingest_slots[idx + j];
+        smpl->relay_iovs[j].iov_base = &slot->pkt;
+        smpl->relay_iovs[j].iov_len = slot->len;
+        smpl->relay_srcs[j] = &slot->from;
+    }
+    return (int)n;
+}
+
+/* Check a packet we're about to relay, without byte-swapping it.
+ * Returns its type, or -1 if it shouldn't go anywhere.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static int sample_relay_check(struct sample_session *smpl,
+                              const struct iovec *iov,
+                              struct sockaddr_storage *from)
+{
+    const struct raw_pkt_header *ph = iov->iov_base;
+    if (iov->iov_len < sizeof(*ph)) {
+        return -1;
+    }
+    if (!sockutil_addr_eq((struct sockaddr*)&smpl->dnaddr,
+                          (struct sockaddr*)from, 0)) {
+        sample_log_address_mismatch(smpl, (struct sockaddr*)from);
+        return -1;
+    }
+    uint8_t mtype = ph->p_mtype;
+    if (ph->_p_magic != RAW_PKT_HEADER_MAGIC ||
+        ph->p_proto_vers > RAW_PKT_HEADER_PROTO_VERS ||
+        (mtype != RAW_MTYPE_BSMP && mtype != RAW_MTYPE_BSUB) ||
+        !sample_forwarding_mtype(smpl, mtype)) {
+        return -1;
+    }
+    if (iov->iov_len != raw_pkt_size(ph)) {
+        log_INFO("dropping malformed data node packet");
+        return -1;
+    }
+    return mtype;
+}
+
+/* Send the first n relay_mmsgs. A destination that won't take one
+ * (e.g., it's unreachable) doesn't hold up the others, but when
+ * the socket buffer's full, the rest get dropped, like sendto()
+ * would.
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_relay_send(struct sample_session *smpl, unsigned n)
+{
+    unsigned sent = 0;
+    while (sent < n) {
+        int s = sendmmsg(smpl->ddatafd, smpl->relay_mmsgs + sent,
+                         n - sent, MSG_DONTWAIT);
+        if (s != -1) {
+            sent += (unsigned)s;
+            continue;
+        }
+        switch (errno) {
+        case EINTR:
+            continue;
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:   /* fall through */
+#endif
+        case EAGAIN:        /* fall through */
+        case ENOBUFS:
+            log_DEBUG("%s: dropping %u packets: %m", __func__, n - sent);
+            return;
+        default:
+            log_DEBUG("%s: dropping a packet: %m", __func__);
+            sent++;
+            break;
+        }
+    }
+}
+
+/* NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_ddatafd_relay(struct sample_session *smpl)
+{
+    int n = (smpl->opts.ingest_thread ?
+             sample_relay_peek_ingest(smpl) :
+             sample_relay_recv(smpl));
+    unsigned nmsgs = 0;
+    for (int i = 0; i < n; i++) {
+        struct iovec *iov = &smpl->relay_iovs[i];
+        int mtype = sample_relay_check(smpl, iov, smpl->relay_srcs[i]);
+        if (mtype == -1) {
+            continue;
+        }
+        /* b_sidx is in the same place in both packet types. */
+        const struct raw_pkt_bsmp *bsmp = iov->iov_base;
+        uint32_t sidx = ntohl(bsmp->b_sidx);
+        uint32_t idx_gap = sidx - smpl->debug_last_sub_idx - 1;
+        if (idx_gap) {
+            log_DEBUG("%s GAP: %u",
+                      mtype == RAW_MTYPE_BSMP ? "bsmp" : "bsub", idx_gap);
+        }
+        smpl->debug_last_sub_idx = sidx;
+        if (smpl->live && mtype == RAW_MTYPE_BSMP) {
+            sample_live_publish(smpl, iov->iov_base, 1, 1);
+        }
+        for (size_t j = 0; j < SAMPLE_NSUBS; j++) {
+            struct sample_sub *sub = &smpl->subs[j];
+            if (!sample_sub_wants(sub, (uint8_t)mtype, sidx, 0)) {
+                continue;
+            }
+            struct msghdr *hdr = &smpl->relay_mmsgs[nmsgs++].msg_hdr;
+            hdr->msg_name = &sub->addr;
+            hdr->msg_namelen = sockutil_addrlen((struct sockaddr*)&sub->addr);
+            hdr->msg_iov = iov;
+            hdr->msg_iovlen = 1;
+        }
+    }
+    if (nmsgs) {
+        sample_relay_send(smpl, nmsgs);
+    }
+    if (smpl->opts.ingest_thread) {
+        spsc_ring_pop(&smpl->ingest_ring, (size_t)n);
+    }
+}
+
+/*
+ * Tee mode: forwarding some board samples while storing them
+ */
+
+/* NOT SYNCHRONIZED (smpl_mtx) */
+static inline int sample_teeing(struct sample_session *smpl)
+{
+    if (smpl->dnaddr.ss_family == AF_UNSPEC) {
+        return 0;
+    }
+    /* Only board samples arrive while we're storing. */
+    for (size_t i = 0; i < SAMPLE_NSUBS; i++) {
+        struct sample_sub *sub = &smpl->subs[i];
+        if (sample_sub_active(sub) && sub->tee_every != 0 &&
+            sample_sub_mtype(sub) == RAW_MTYPE_BSMP) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Forward the board samples each subscriber wants (see its
+ * tee_every), out of n that were just put in the ring.
+ *
+ * Storage comes first. If the worker is falling behind, or a
+ * subscriber's socket buffer fills up, we skip ("shed") forwarding
+ * (to that subscriber) until the next batch rather than spend time
+ * on it.
+ *
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_tee_bsamps(struct sample_session *smpl,
+                              struct raw_pkt_bsmp *bsmps, size_t n)
+{
+    if (!sample_teeing(smpl)) {
         return;
     }
-    /* Forward the packet. */
-    switch (smpl->forward_what) {
-    case SAMPLE_FWD_BSMP_RAW:
-    case SAMPLE_FWD_BSMP:
-        sample_ddatafd_forward_bsamp(smpl);
-        break;
-    case SAMPLE_FWD_BSUB_RAW:
-    case SAMPLE_FWD_BSUB:
-        sample_ddatafd_forward_bsub(smpl);
-        break;
-    default:
-        log_DEBUG("%s: spurious call!", __func__);
-        break;
+    int wire = smpl->bsamp_cfg.chns->ch_flags & CH_STORAGE_WIRE_ORDER;
+    unsigned shed = (spsc_ring_count(&smpl->bsamp_ring) >
+                     smpl->bsamp_ringlen / SAMPLE_TEE_SHED_FRAC ? ~0U : 0);
+    for (size_t i = 0; i < n; i++) {
+        struct sample_fwd_pkt fp = { .pkt = &bsmps[i], .wire = wire };
+        sample_fwd_fanout(smpl, &fp, &shed);
     }
 }
 
 static void sample_ddatafd_empty_recv_queue(struct sample_session *smpl)
 {
+    if (smpl->opts.ingest_thread) {
+        size_t idx;
+        size_t n;
+        while ((n = spsc_ring_peek(&smpl->ingest_ring, &idx)) != 0) {
+            spsc_ring_pop(&smpl->ingest_ring, n);
+        }
+        return;
+    }
+    if (smpl->pring) {
+        packet_ring_flush(smpl->pring);
+        return;
+    }
     do {
         switch (recv(smpl->ddatafd, NULL, 0, 0)) {
 #if EAGAIN != EWOULDBLOCK
@@ -1572,19 +4148,19 @@ static void sample_ddatafd_empty_recv_queue(struct sample_session *smpl)
     } while (1);
 }
 
-static void sample_ddatafd_callback(evutil_socket_t ddatafd, short events,
-                                    void *smplvp)
+/* Handle whatever's waiting on the data socket (or ingest queue).
+ * NOT SYNCHRONIZED (smpl_mtx) */
+static void sample_handle_data(struct sample_session *smpl)
 {
-    struct sample_session *smpl = smplvp;
-    assert(smpl->ddatafd == ddatafd);
-    assert(events & EV_READ);
-
-    sample_must_lock(smpl);
     if (sample_expecting_bsamps(smpl)) {
         sample_ddatafd_store_bsamps(smpl);
         smpl->debug_print_ddatafd = 1;
     } else if (sample_forwarding_data(smpl)) {
-        sample_ddatafd_forward(smpl);
+        if (sample_relaying(smpl)) {
+            sample_ddatafd_relay(smpl);
+        } else {
+            sample_ddatafd_forward(smpl);
+        }
         smpl->debug_print_ddatafd = 1;
     } else {
         if (smpl->debug_print_ddatafd) {
@@ -1593,6 +4169,43 @@ static void sample_ddatafd_callback(evutil_socket_t ddatafd, short events,
         }
         sample_ddatafd_empty_recv_queue(smpl);
     }
+}
+
+static void sample_ddatafd_callback(evutil_socket_t ddatafd, short events,
+                                    void *smplvp)
+{
+    struct sample_session *smpl = smplvp;
+    assert(sample_recv_fd(smpl) == ddatafd);
+    assert(events & EV_READ);
+
+    sample_must_lock(smpl);
+    sample_handle_data(smpl);
+    sample_fwd_wakeup_done(smpl);
+    sample_must_unlock(smpl);
+}
+
+/* The ingest thread pushed some packets; handle them. */
+static void sample_ingest_callback(evutil_socket_t efd, short events,
+                                   void *smplvp)
+{
+    struct sample_session *smpl = smplvp;
+    struct spsc_ring *ring = &smpl->ingest_ring;
+    uint64_t count;
+    assert(smpl->ingest_efd == efd);
+    assert(events & EV_READ);
+
+    __unused ssize_t r = read(efd, &count, sizeof(count));
+    sample_must_lock(smpl);
+    size_t i = 0;
+    while (spsc_ring_count(ring) && i++ < SAMPLE_INGEST_MAX_PER_CB &&
+           !smpl->bsamp_paused) {
+        sample_handle_data(smpl);
+    }
+    if (spsc_ring_count(ring) && !smpl->bsamp_paused) {
+        /* Give other events a turn, but come back for the rest. */
+        event_active(smpl->ingest_evt, EV_READ, 0);
+    }
+    sample_fwd_wakeup_done(smpl);
     sample_must_unlock(smpl);
 }
 
@@ -27,6 +27,76 @@
 
 struct sample_session;
 struct event_base;
+struct spike16_cfg;
+
+/**
+ * Sample handler options, fixed for the lifetime of the handler.
+ *
+ * Initialize with SAMPLE_OPTS_DEFAULT and override what you need.
+ */
+struct sample_opts {
+    /**
+     * If nonzero, read the data socket from a dedicated ingest thread
+     * instead of the event loop.
+     *
+     * The ingest thread hands packets to the event loop through a
+     * lock-free queue, so slow control traffic can't hold up socket
+     * reads. */
+    int ingest_thread;
+
+    /**
+     * CPU to pin the ingest thread to, or -1 to let the scheduler
+     * decide. Ignored unless ingest_thread is set. */
+    int ingest_cpu;
+
+    /**
+     * If nonzero, set SO_BUSY_POLL on the data socket to this many
+     * microseconds. Only has an effect with ingest_thread, since the
+     * event loop never blocks on the data socket. */
+    unsigned busy_poll_usec;
+
+    /**
+     * If nonzero, receive packets from the data node through a
+     * memory-mapped packet ring (see packet_ring.h) instead of the
+     * data socket. The data socket is still used for sending.
+     *
+     * This needs CAP_NET_RAW, and only works over IPv4 with an MTU
+     * big enough for whole board samples. */
+    int packet_ring;
+
+    /**
+     * Memory budget, in bytes, for buffering board samples on their
+     * way to disk, or 0 for a default.
+     *
+     * The buffer holds the largest power of two number of board
+     * samples that fits. This is how long a disk stall can be
+     * absorbed before samples start getting lost. */
+    size_t bsamp_mem;
+
+    /**
+     * Maximum number of board samples to hand to ch_storage_write()
+     * at once, or 0 for a default. The worker starts writing as
+     * soon as this many samples are buffered. */
+    size_t bsamp_write_len;
+
+    /**
+     * If not NULL, also publish every board sample that arrives into
+     * a shared memory ring with this name (see live_ring.h), for
+     * local programs to read. Board samples are then received
+     * whenever the data node sends them, even if nobody else wants
+     * them. */
+    const char *live_ring;
+};
+
+#define SAMPLE_OPTS_DEFAULT                     \
+    { .ingest_thread = 0,                       \
+      .ingest_cpu = -1,                         \
+      .busy_poll_usec = 0,                      \
+      .packet_ring = 0,                         \
+      .bsamp_mem = 0,                           \
+      .bsamp_write_len = 0,                     \
+      .live_ring = NULL,                        \
+    }
 
 /**
  * Create a new sample packet handler.
@@ -40,11 +110,13 @@ struct event_base;
  * @param base Event loop base
  * @param iface Interface number (see <net/if.h>) for sample data socket.
  * @param port Port to bind to on iface.
+ * @param opts Handler options, or NULL for SAMPLE_OPTS_DEFAULT.
  * @return New sample handler on success, NULL on failure.
  */
 struct sample_session* sample_new(struct event_base *base,
                                   unsigned iface,
-                                  uint16_t port);
+                                  uint16_t port,
+                                  const struct sample_opts *opts);
 /**
  * Free resources allocated by a sample packet handler.
  *
@@ -79,6 +151,14 @@ enum sample_forward {
     SAMPLE_FWD_BSUB = 2,        /**< Forward board samples as protobuf */
     SAMPLE_FWD_BSMP_RAW = 4,    /**< Forward board samples as raw packets */
     SAMPLE_FWD_BSUB_RAW = 8,    /**< Forward board subsamples as raw packets */
+    SAMPLE_FWD_BSMP_DELTA = 16, /**< Forward board samples as protobuf,
+                                 * delta compressed */
+    SAMPLE_FWD_BSMP_PREVIEW = 32, /**< Forward per-channel summaries of
+                                   * board samples; see
+                                   * sample_cfg_preview() */
+    SAMPLE_FWD_BSMP_SPIKES = 64, /**< Forward threshold crossings in
+                                  * board samples; see
+                                  * sample_cfg_spikes() */
 };
 
 /**
@@ -93,6 +173,239 @@ enum sample_forward {
 int sample_cfg_forwarding(struct sample_session *smpl,
                           enum sample_forward what);
 
+/**
+ * Configure batching of forwarded protobuf samples.
+ *
+ * When batching is on, forwarded samples are sent as DnodeSampleBatch
+ * messages (see data.proto) holding up to "nsamps" DnodeSamples each,
+ * or as many as fit in a datagram that won't be fragmented on the
+ * way to the client. Batches that don't fill up are sent after at
+ * most "max_usec" microseconds. Raw packets aren't batched.
+ *
+ * @param smpl Sample handler
+ * @param nsamps Maximum samples per datagram, or 0 to send each
+ *               DnodeSample in its own datagram (the default).
+ * @param max_usec Longest time a sample may wait for its batch to
+ *                 fill up. If 0, batches are sent at the end of each
+ *                 event loop callback.
+ */
+int sample_cfg_forward_batch(struct sample_session *smpl,
+                             unsigned nsamps, unsigned max_usec);
+
+/**
+ * Forward some board samples to the client while storing them
+ * ("tee" mode).
+ *
+ * While sample_expect_bsamps() is in effect, and the client's board
+ * sample forwarding (SAMPLE_FWD_BSMP or SAMPLE_FWD_BSMP_RAW) is
+ * enabled, each stored board sample whose index is a multiple of
+ * "every" is also forwarded to the client address.
+ *
+ * This only configures the client. Each subscriber has its own
+ * setting, sample_sub_cfg.tee_every (see sample_subscribe()), which
+ * picks the stored board samples that subscriber is sent.
+ *
+ * This is best-effort. Storage always comes first, so samples aren't
+ * forwarded while the storage buffer is backing up, or to a
+ * destination that can't keep up.
+ *
+ * @param smpl Sample handler
+ * @param every Forward one of every this many stored board samples;
+ *              0 (the default) forwards nothing while storing.
+ */
+int sample_cfg_tee(struct sample_session *smpl, unsigned every);
+
+/**
+ * Forward only some live samples to the client.
+ *
+ * Only samples whose index is a multiple of "every" are forwarded
+ * while sample_cfg_forwarding() is in effect. This doesn't affect
+ * tee mode; see sample_cfg_tee() for that.
+ *
+ * @param smpl Sample handler
+ * @param every Forward one of every this many samples; 0 or 1 (the
+ *              default) forwards them all.
+ */
+int sample_cfg_decimate(struct sample_session *smpl, unsigned every);
+
+/**
+ * Forward only some channels of each board sample to the client.
+ *
+ * This only affects protobuf board samples (SAMPLE_FWD_BSMP), which
+ * then hold just these channels, in this order; their "channels"
+ * field (see proto/data.proto) says which ones they are.
+ *
+ * @param smpl Sample handler
+ * @param chans Channels to forward, as indexes into a board sample's
+ *              b_samps. Each must be less than RAW_BSMP_NSAMP.
+ * @param n Length of chans, at most RAW_BSMP_NSAMP; 0 (the default)
+ *          means all channels.
+ * @return 0 on success, -1 if chans is invalid.
+ */
+int sample_cfg_channels(struct sample_session *smpl,
+                        const uint16_t *chans, size_t n);
+
+/**
+ * Configure board sample previews (SAMPLE_FWD_BSMP_PREVIEW).
+ *
+ * Previews are BoardPreview messages (see proto/data.proto), each
+ * holding the minimum, maximum, mean, and RMS of every channel (or
+ * just the ones from sample_cfg_channels()) over a window of
+ * forwarded board samples. Changing this starts a new window.
+ *
+ * @param smpl Sample handler
+ * @param window Board samples per preview, at most 65535; 0 (the
+ *               default) means about 100 previews a second.
+ * @return 0 on success, -1 if window is too big.
+ */
+int sample_cfg_preview(struct sample_session *smpl, unsigned window);
+
+/**
+ * Configure spike detection (SAMPLE_FWD_BSMP_SPIKES).
+ *
+ * Spikes are sent as BoardSpikes messages (see proto/data.proto),
+ * one per board sample with any in it (or more, if there are lots).
+ * They're found by a per-channel threshold detector (see
+ * lib/spike16.h) that runs on every forwarded board sample, over the
+ * channels from sample_cfg_channels(). Changing this or the channels
+ * starts detection over.
+ *
+ * The default is adaptive thresholds at SAMPLE_SPIKE_SIGMAS_DEFAULT
+ * standard deviations of each channel's noise, without snippets.
+ *
+ * @param smpl Sample handler
+ * @param cfg Detector configuration; cfg->thresholds is copied. If
+ *            it has more than one threshold, there must be one for
+ *            each channel from sample_cfg_channels().
+ * @return 0 on success, -1 if cfg is invalid.
+ */
+int sample_cfg_spikes(struct sample_session *smpl,
+                      const struct spike16_cfg *cfg);
+
+/** Default adaptive spike threshold; see sample_cfg_spikes(). */
+#define SAMPLE_SPIKE_SIGMAS_DEFAULT (-4.5f)
+
+/**
+ * Filter the client's protobuf board samples.
+ *
+ * Each channel from sample_cfg_channels() goes through the same IIR
+ * filter, a cascade of second-order sections (see lib/biquad16.h),
+ * before it's forwarded, compressed (SAMPLE_FWD_BSMP_DELTA),
+ * previewed, or searched for spikes. The filter sees every board
+ * sample the client could get, whatever sample_cfg_decimate() or
+ * sample_cfg_tee() say, so its output doesn't depend on which ones
+ * it actually gets. Changing this or the channels starts the filter
+ * over. Raw packets and subsamples aren't filtered.
+ *
+ * @param smpl Sample handler
+ * @param sos nsections * BIQUAD16_SOS_LEN coefficients, laid out like
+ *            scipy.signal's "sos" filters; copied.
+ * @param nsections Number of sections, at most BIQUAD16_MAX_SECTIONS;
+ *                  0 (the default) turns filtering off.
+ * @return 0 on success, -1 if the filter is invalid, e.g. unstable.
+ */
+int sample_cfg_filter(struct sample_session *smpl, const float *sos,
+                      size_t nsections);
+
+/**
+ * Re-reference the client's protobuf board samples.
+ *
+ * Board sample channels are split into groups, and for each sample,
+ * each channel in a group gets the mean or median of the group's
+ * channels subtracted (see lib/reref16.h). References come from
+ * every channel in the board sample, not just the ones from
+ * sample_cfg_channels(). This happens first, before filtering (see
+ * sample_cfg_filter()). For example, groups[i] = i / 32 references
+ * each chip's channels to that chip. Changing this starts the filter,
+ * compression, previews, and spike detection over. Raw packets and
+ * subsamples aren't re-referenced.
+ *
+ * @param smpl Sample handler
+ * @param groups Each board sample channel's group number, less than
+ *               RAW_BSMP_NSAMP, or UINT16_MAX to leave the channel
+ *               alone; copied.
+ * @param nchans Length of groups, at most RAW_BSMP_NSAMP. Channels
+ *               past its end are left alone. 0 (the default) turns
+ *               re-referencing off.
+ * @param median If nonzero, subtract group medians instead of means.
+ * @return 0 on success, -1 on invalid arguments.
+ */
+int sample_cfg_reref(struct sample_session *smpl, const uint16_t *groups,
+                     size_t nchans, int median);
+
+/** Most subscribers there can be, besides the client. */
+#define SAMPLE_MAX_SUBS 7
+
+/** Subscriber configuration; see sample_subscribe(). */
+struct sample_sub_cfg {
+    /** What to forward; mustn't be SAMPLE_FWD_NOTHING. */
+    enum sample_forward what;
+    /** As for sample_cfg_decimate(). */
+    unsigned decimate;
+    /** As for sample_cfg_tee(). */
+    unsigned tee_every;
+    /** As for sample_cfg_channels(); copied by sample_subscribe(). */
+    const uint16_t *chans;
+    /** As for sample_cfg_channels(). */
+    size_t nchans;
+    /** As for sample_cfg_forward_batch(). */
+    unsigned batch_size;
+    /** As for sample_cfg_forward_batch(). */
+    unsigned batch_max_usec;
+    /** As for sample_cfg_preview(). */
+    unsigned preview_window;
+    /** As for sample_cfg_spikes(); NULL for the default. */
+    const struct spike16_cfg *spikes;
+    /** As for sample_cfg_filter(); copied by sample_subscribe(). */
+    const float *filter_sos;
+    /** As for sample_cfg_filter(). */
+    size_t filter_nsections;
+    /** As for sample_cfg_reref(); copied by sample_subscribe(). */
+    const uint16_t *reref_groups;
+    /** As for sample_cfg_reref(). */
+    size_t reref_nchans;
+    /** As for sample_cfg_reref(). */
+    int reref_median;
+    /** If nonzero, connect to the subscriber (over TCP, or to a
+     * Unix-domain stream socket if its address is AF_UNIX) and send
+     * it length-prefixed DnodeSamples through a bounded queue; see
+     * ControlCmdForward.transport in control.proto. Stream
+     * subscribers can't have raw "what"s or batching. */
+    int stream;
+};
+
+/**
+ * Forward live data to another destination ("subscriber"), as well
+ * as to the client.
+ *
+ * Each subscriber gets its own stream, as configured by "cfg", of
+ * whatever the data node is sending. Subscribing doesn't change what
+ * the data node sends, so a subscriber asking for board samples gets
+ * nothing while the data node is sending subsamples, and vice versa.
+ * Each packet is only packed once, however many subscribers want it.
+ *
+ * If there's already a subscriber at "addr", this reconfigures it.
+ * A stream subscriber whose connection fails is dropped.
+ *
+ * @param smpl Sample handler
+ * @param addr Subscriber's address.
+ * @param cfg Subscriber configuration.
+ * @return 0 on success, -1 on failure, e.g. if there are already
+ *         SAMPLE_MAX_SUBS subscribers.
+ * @see sample_unsubscribe()
+ */
+int sample_subscribe(struct sample_session *smpl, struct sockaddr *addr,
+                     const struct sample_sub_cfg *cfg);
+
+/**
+ * Stop forwarding to a subscriber from sample_subscribe().
+ *
+ * @param smpl Sample handler
+ * @param addr Subscriber's address.
+ * @return 0 on success, -1 if there's no subscriber at addr.
+ */
+int sample_unsubscribe(struct sample_session *smpl, struct sockaddr *addr);
+
 struct ch_storage;
 
 /**
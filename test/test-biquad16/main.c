@@ -0,0 +1,307 @@
+#include "biquad16.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "type_attrs.h"
+
+#define NCHANS BIQUAD16_MAX_CHANS
+#define NSAMPS 3000
+#define FS 30000.0
+
+struct biquad16 bq;
+struct biquad16 bq_scalar;
+uint16_t in[NCHANS];
+uint16_t out[NCHANS];
+uint16_t out_scalar[NCHANS];
+
+static void teardown(void)
+{
+    biquad16_use(BIQUAD16_AUTO);
+}
+
+/* Section k of sos: an RBJ "Audio EQ Cookbook" filter at f0 Hz. */
+enum rbj { RBJ_LOWPASS, RBJ_HIGHPASS, RBJ_NOTCH };
+static void rbj(float *sos, size_t k, enum rbj type, double f0, double q)
+{
+    double w0 = 2 * M_PI * f0 / FS;
+    double alpha = sin(w0) / (2 * q);
+    double cw = cos(w0);
+    float *s = sos + k * BIQUAD16_SOS_LEN;
+    switch (type) {
+    case RBJ_LOWPASS:
+        s[0] = (float)((1 - cw) / 2);
+        s[1] = (float)(1 - cw);
+        s[2] = (float)((1 - cw) / 2);
+        break;
+    case RBJ_HIGHPASS:
+        s[0] = (float)((1 + cw) / 2);
+        s[1] = (float)(-(1 + cw));
+        s[2] = (float)((1 + cw) / 2);
+        break;
+    case RBJ_NOTCH:
+        s[0] = 1;
+        s[1] = (float)(-2 * cw);
+        s[2] = 1;
+        break;
+    }
+    s[3] = (float)(1 + alpha);
+    s[4] = (float)(-2 * cw);
+    s[5] = (float)(1 - alpha);
+}
+
+/* One cycle of a 60 Hz hum. */
+#define HUM_LEN 500
+double hum[HUM_LEN];
+
+static void hum_init(void)
+{
+    for (size_t i = 0; i < HUM_LEN; i++) {
+        hum[i] = 300 * sin(2 * M_PI * (double)i / HUM_LEN);
+    }
+}
+
+/* Channel j's sample k: a DC offset, the hum, some spikes, and some
+ * noise. */
+static uint16_t samp(unsigned k, size_t j)
+{
+    double v = 0x8000 + (double)(j % 17) * 200;
+    v += hum[(k + j * 37) % HUM_LEN];
+    if (k % 300 == j % 50) {
+        v -= 1000;
+    }
+    v += rand() % 41 - 20;
+    return (uint16_t)v;
+}
+
+#define NFILTERS 3
+float filters[NFILTERS][BIQUAD16_MAX_SECTIONS * BIQUAD16_SOS_LEN];
+size_t filter_nsections[NFILTERS];
+
+/* A 300 Hz high-pass, a 300-6000 Hz band-pass with a 60 Hz notch,
+ * and a 16th order 250 Hz low-pass. */
+static void filters_init(void)
+{
+    hum_init();
+    rbj(filters[0], 0, RBJ_HIGHPASS, 300, M_SQRT1_2);
+    filter_nsections[0] = 1;
+    rbj(filters[1], 0, RBJ_HIGHPASS, 300, 0.54);
+    rbj(filters[1], 1, RBJ_HIGHPASS, 300, 1.31);
+    rbj(filters[1], 2, RBJ_LOWPASS, 6000, M_SQRT1_2);
+    rbj(filters[1], 3, RBJ_NOTCH, 60, 10);
+    filter_nsections[1] = 4;
+    for (size_t k = 0; k < BIQUAD16_MAX_SECTIONS; k++) {
+        rbj(filters[2], k, RBJ_LOWPASS, 250, 0.5 + 0.1 * (double)k);
+    }
+    filter_nsections[2] = BIQUAD16_MAX_SECTIONS;
+}
+
+/* Every implementation has to give exactly the same outputs as the
+ * scalar one. */
+static void check_impl(void)
+{
+    const size_t nchans[] = { 1, 7, 8, 9, 100, NCHANS };
+    filters_init();
+    srand(1);
+    for (size_t f = 0; f < NFILTERS; f++) {
+        for (size_t i = 0; i < sizeof(nchans) / sizeof(nchans[0]); i++) {
+            size_t n = nchans[i];
+            ck_assert_int_eq(biquad16_configure(&bq, filters[f],
+                                                filter_nsections[f]), 0);
+            ck_assert_int_eq(biquad16_configure(&bq_scalar, filters[f],
+                                                filter_nsections[f]), 0);
+            biquad16_restart(&bq, n);
+            biquad16_restart(&bq_scalar, n);
+            for (unsigned k = 0; k < NSAMPS; k++) {
+                for (size_t j = 0; j < n; j++) {
+                    in[j] = samp(k, j);
+                }
+                biquad16_run(&bq, out, in);
+                biquad16_use(BIQUAD16_SCALAR);
+                biquad16_run(&bq_scalar, out_scalar, in);
+                teardown();
+                ck_assert_msg(!memcmp(out, out_scalar,
+                                      n * sizeof(uint16_t)),
+                              "filter %zu, %zu chans: sample %u differs",
+                              f, n, k);
+            }
+        }
+    }
+}
+
+START_TEST(test_scalar)
+{
+    ck_assert_int_eq(biquad16_use(BIQUAD16_SCALAR), 0);
+    ck_assert_str_eq(biquad16_impl_str(), "scalar");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_auto)
+{
+    check_impl();
+}
+END_TEST
+
+/* The outputs should be within a count of filtering in double
+ * precision. */
+START_TEST(test_reference)
+{
+    const size_t n = 16;
+    double z1[BIQUAD16_MAX_SECTIONS][16];
+    double z2[BIQUAD16_MAX_SECTIONS][16];
+    filters_init();
+    srand(2);
+    for (size_t f = 0; f < NFILTERS; f++) {
+        size_t ns = filter_nsections[f];
+        ck_assert_int_eq(biquad16_configure(&bq, filters[f], ns), 0);
+        biquad16_restart(&bq, n);
+        for (unsigned k = 0; k < NSAMPS; k++) {
+            for (size_t j = 0; j < n; j++) {
+                in[j] = samp(k, j);
+            }
+            biquad16_run(&bq, out, in);
+            for (size_t j = 0; j < n; j++) {
+                double x = (double)in[j] - 0x8000;
+                for (size_t s = 0; s < ns; s++) {
+                    const float *c = bq.coef[s];
+                    if (k == 0) {
+                        double y = x * (c[0] + c[1] + c[2]) /
+                            (1 + (double)c[3] + c[4]);
+                        z1[s][j] = y - c[0] * x;
+                        z2[s][j] = c[2] * x - c[4] * y;
+                    }
+                    double y = c[0] * x + z1[s][j];
+                    z1[s][j] = c[1] * x - c[3] * y + z2[s][j];
+                    z2[s][j] = c[2] * x - c[4] * y;
+                    x = y;
+                }
+                double want = x + 0x8000;
+                want = want < 0 ? 0 : want > 65535 ? 65535 : want;
+                ck_assert_msg(fabs(out[j] - want) <= 1.0,
+                              "filter %zu, sample %u, chan %zu: "
+                              "got %u, want %f", f, k, j, out[j], want);
+            }
+        }
+    }
+}
+END_TEST
+
+/* A channel that doesn't change should come straight out at the
+ * filter's DC gain, without any ringing at the start. */
+START_TEST(test_dc)
+{
+    filters_init();
+    for (size_t f = 0; f < NFILTERS; f++) {
+        ck_assert_int_eq(biquad16_configure(&bq, filters[f],
+                                            filter_nsections[f]), 0);
+        biquad16_restart(&bq, NCHANS);
+        for (size_t j = 0; j < NCHANS; j++) {
+            in[j] = (uint16_t)(j * 58);
+        }
+        biquad16_run(&bq, out_scalar, in);
+        for (size_t j = 0; j < NCHANS; j++) {
+            /* High-passes take out the DC offset, and low-passes
+             * keep it (give or take their coefficients' rounding). */
+            int want = f == 0 || f == 1 ? 0x8000 : in[j];
+            ck_assert_msg(abs((int)out_scalar[j] - want) <= 8,
+                          "filter %zu, chan %zu: %u", f, j, out_scalar[j]);
+        }
+        /* It should stay there. Rounding in the narrow low-pass's
+         * state moves it a few counts; without priming, it'd be off
+         * by thousands. */
+        for (unsigned k = 0; k < NSAMPS; k++) {
+            biquad16_run(&bq, out, in);
+            for (size_t j = 0; j < NCHANS; j++) {
+                ck_assert_msg(abs((int)out[j] - out_scalar[j]) <= 10,
+                              "filter %zu, sample %u, chan %zu: %u",
+                              f, k, j, out[j]);
+            }
+        }
+    }
+    /* Filtering in place works, too. */
+    biquad16_restart(&bq, NCHANS);
+    biquad16_run(&bq, in, in);
+    ck_assert(abs((int)in[NCHANS - 1] - (NCHANS - 1) * 58) <= 8);
+}
+END_TEST
+
+START_TEST(test_clamp)
+{
+    /* A gain of 4 pushes everything away from 32768. */
+    float sos[BIQUAD16_SOS_LEN] = { 4, 0, 0, 1, 0, 0 };
+    ck_assert_int_eq(biquad16_configure(&bq, sos, 1), 0);
+    biquad16_restart(&bq, 4);
+    in[0] = 0;
+    in[1] = 0x7000;
+    in[2] = 0x8001;
+    in[3] = 0xF000;
+    biquad16_run(&bq, out, in);
+    ck_assert_int_eq(out[0], 0);
+    ck_assert_int_eq(out[1], 0x4000);
+    ck_assert_int_eq(out[2], 0x8004);
+    ck_assert_int_eq(out[3], 0xFFFF);
+}
+END_TEST
+
+START_TEST(test_config)
+{
+    float sos[(BIQUAD16_MAX_SECTIONS + 1) * BIQUAD16_SOS_LEN];
+    for (size_t k = 0; k <= BIQUAD16_MAX_SECTIONS; k++) {
+        rbj(sos, k, RBJ_HIGHPASS, 300, M_SQRT1_2);
+    }
+    ck_assert_int_eq(biquad16_configure(&bq, sos, 0), -1);
+    ck_assert_int_eq(biquad16_configure(&bq, sos,
+                                        BIQUAD16_MAX_SECTIONS + 1), -1);
+    ck_assert_int_eq(biquad16_configure(&bq, sos,
+                                        BIQUAD16_MAX_SECTIONS), 0);
+    ck_assert_int_eq(bq.nsections, BIQUAD16_MAX_SECTIONS);
+
+    /* Coefficients get normalized by a0. */
+    float a0 = sos[3];
+    ck_assert(fabsf(bq.coef[0][0] - sos[0] / a0) < 1e-6f);
+    ck_assert(fabsf(bq.coef[0][4] - sos[5] / a0) < 1e-6f);
+
+    sos[3] = 0;
+    ck_assert_int_eq(biquad16_configure(&bq, sos, 1), -1);
+    sos[3] = a0;
+    sos[1] = NAN;
+    ck_assert_int_eq(biquad16_configure(&bq, sos, 1), -1);
+    sos[1] = INFINITY;
+    ck_assert_int_eq(biquad16_configure(&bq, sos, 1), -1);
+    /* A pole on the unit circle, then outside it. */
+    float integrator[BIQUAD16_SOS_LEN] = { 1, 0, 0, 1, -1, 0 };
+    ck_assert_int_eq(biquad16_configure(&bq, integrator, 1), -1);
+    float unstable[BIQUAD16_SOS_LEN] = { 1, 0, 0, 1, 0, 1.5f };
+    ck_assert_int_eq(biquad16_configure(&bq, unstable, 1), -1);
+    /* None of those changed the configuration. */
+    ck_assert_int_eq(bq.nsections, BIQUAD16_MAX_SECTIONS);
+}
+END_TEST
+
+Suite* biquad16_suite(void)
+{
+    Suite *s = suite_create("biquad16");
+    TCase *tc = tcase_create("core");
+    tcase_add_checked_fixture(tc, NULL, teardown);
+    tcase_add_test(tc, test_scalar);
+    tcase_add_test(tc, test_auto);
+    tcase_add_test(tc, test_reference);
+    tcase_add_test(tc, test_dc);
+    tcase_add_test(tc, test_clamp);
+    tcase_add_test(tc, test_config);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = biquad16_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
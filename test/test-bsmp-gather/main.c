@@ -0,0 +1,126 @@
+#include "bsmp_gather.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "raw_packets.h"
+#include "test.h"
+#include "type_attrs.h"
+
+#define MAXLEN 100              /* long enough for every loop in each impl */
+#define MAXOFF 3                /* misalign by up to this many bytes */
+
+struct raw_pkt_bsmp bsmp;
+uint16_t chans[RAW_BSMP_NSAMP];
+/* Aligned, so dst + off is misaligned exactly when off is odd. */
+raw_samp_t dst_arr[RAW_BSMP_NSAMP + MAXOFF + 1];
+uint8_t *dst = (uint8_t*)dst_arr;
+raw_samp_t expected[RAW_BSMP_NSAMP];
+
+static void setup_bufs(void)
+{
+    raw_packet_init(&bsmp, RAW_MTYPE_BSMP, 0);
+    bsmp.b_chip_live = 0xdeadbeef;
+    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+        bsmp.b_samps[i] = (raw_samp_t)(i * 0x0101 + 0x1234);
+    }
+}
+
+static void teardown_bufs(void)
+{
+    bsmp_gather_use(BSMP_GATHER_AUTO);
+}
+
+/* Gather chans[0..n) with and without swapping, at every byte
+ * alignment (including odd ones, as in a protobuf message), and
+ * compare against a scalar reference. */
+static void check_chans(size_t n)
+{
+    for (int swap = 0; swap <= 1; swap++) {
+        for (size_t i = 0; i < n; i++) {
+            raw_samp_t v = bsmp.b_samps[chans[i]];
+            expected[i] = swap ? (raw_samp_t)(v << 8 | v >> 8) : v;
+        }
+        for (size_t off = 0; off <= MAXOFF; off++) {
+            memset(dst_arr, 0, sizeof(dst_arr));
+            bsmp_gather(dst + off, &bsmp, chans, n, swap);
+            ck_assert_msg(!memcmp(dst + off, expected,
+                                  n * sizeof(raw_samp_t)),
+                          "%s: wrong result, n=%zu, off=%zu, swap=%d",
+                          bsmp_gather_impl_str(), n, off, swap);
+            /* Nothing outside the result gets touched. */
+            for (size_t i = 0; i < off; i++) {
+                ck_assert_int_eq(dst[i], 0);
+            }
+            for (size_t i = off + n * sizeof(raw_samp_t);
+                 i < sizeof(dst_arr); i++) {
+                ck_assert_int_eq(dst[i], 0);
+            }
+        }
+    }
+}
+
+static void check_impl(void)
+{
+    /* Every length, with channels scattered all over, including the
+     * first and last ones. */
+    for (size_t n = 0; n <= MAXLEN; n++) {
+        for (size_t i = 0; i < n; i++) {
+            chans[i] = (uint16_t)((i * 421 + (n & 1 ? 0 : 1119)) %
+                                  RAW_BSMP_NSAMP);
+        }
+        check_chans(n);
+    }
+    /* All of them, backwards. */
+    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+        chans[i] = (uint16_t)(RAW_BSMP_NSAMP - 1 - i);
+    }
+    check_chans(RAW_BSMP_NSAMP);
+}
+
+START_TEST(test_scalar)
+{
+    ck_assert_int_eq(bsmp_gather_use(BSMP_GATHER_SCALAR), 0);
+    ck_assert_str_eq(bsmp_gather_impl_str(), "scalar");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_avx2)
+{
+    if (bsmp_gather_use(BSMP_GATHER_AVX2)) {
+        return;                 /* not supported here */
+    }
+    ck_assert_str_eq(bsmp_gather_impl_str(), "avx2");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_auto)
+{
+    ck_assert_int_eq(bsmp_gather_use(BSMP_GATHER_AUTO), 0);
+    check_impl();
+}
+END_TEST
+
+Suite* bsmp_gather_suite(void)
+{
+    Suite *s = suite_create("bsmp_gather");
+    TCase *tc = tcase_create("bsmp_gather");
+    tcase_add_checked_fixture(tc, setup_bufs, teardown_bufs);
+    tcase_add_test(tc, test_scalar);
+    tcase_add_test(tc, test_avx2);
+    tcase_add_test(tc, test_auto);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = bsmp_gather_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,113 @@
+#include "bsmp_split.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "raw_packets.h"
+#include "test.h"
+#include "type_attrs.h"
+
+#define NSAMPS 5
+#define NCHANS 1024
+#define NAUX (RAW_BSMP_NSAMP - NCHANS)
+
+struct raw_pkt_bsmp bsamps[NSAMPS];
+uint32_t sidx[NSAMPS + 1];
+uint32_t chip_live[NSAMPS + 1];
+raw_samp_t chans[(NSAMPS + 1) * NCHANS];
+raw_samp_t aux[(NSAMPS + 1) * RAW_BSMP_NSAMP]; /* room for every sample */
+
+static void setup_bufs(void)
+{
+    for (size_t i = 0; i < NSAMPS; i++) {
+        raw_packet_init(&bsamps[i], RAW_MTYPE_BSMP, 0);
+        bsamps[i].b_sidx = (uint32_t)(1000 + i);
+        bsamps[i].b_chip_live = (uint32_t)(0xdead0000 + i);
+        for (size_t j = 0; j < RAW_BSMP_NSAMP; j++) {
+            bsamps[i].b_samps[j] = (raw_samp_t)(i * 0x1000 + j);
+        }
+    }
+    memset(sidx, 0, sizeof(sidx));
+    memset(chip_live, 0, sizeof(chip_live));
+    memset(chans, 0, sizeof(chans));
+    memset(aux, 0, sizeof(aux));
+}
+
+START_TEST(test_split)
+{
+    struct bsmp_split_cols cols = {
+        .sidx = sidx,
+        .chip_live = chip_live,
+        .chans = chans,
+        .nchans = NCHANS,
+        .aux = aux,
+    };
+    bsmp_split(&cols, bsamps, NSAMPS);
+    for (size_t i = 0; i < NSAMPS; i++) {
+        ck_assert_int_eq(sidx[i], 1000 + i);
+        ck_assert_int_eq(chip_live[i], 0xdead0000 + i);
+        for (size_t j = 0; j < NCHANS; j++) {
+            ck_assert_int_eq(chans[i * NCHANS + j], i * 0x1000 + j);
+        }
+        for (size_t j = 0; j < NAUX; j++) {
+            ck_assert_int_eq(aux[i * NAUX + j], i * 0x1000 + NCHANS + j);
+        }
+    }
+    /* Nothing past the end gets touched. */
+    ck_assert_int_eq(sidx[NSAMPS], 0);
+    ck_assert_int_eq(chip_live[NSAMPS], 0);
+    ck_assert_int_eq(chans[NSAMPS * NCHANS], 0);
+    ck_assert_int_eq(aux[NSAMPS * NAUX], 0);
+}
+END_TEST
+
+START_TEST(test_some_cols)
+{
+    /* Just the samples, split somewhere else. */
+    struct bsmp_split_cols cols = {
+        .chans = chans,
+        .nchans = 3,
+        .aux = aux,
+    };
+    bsmp_split(&cols, bsamps, NSAMPS);
+    ck_assert_int_eq(sidx[0], 0);
+    ck_assert_int_eq(chip_live[0], 0);
+    ck_assert_int_eq(chans[3], 0x1000);
+    ck_assert_int_eq(aux[0], 3);
+    ck_assert_int_eq(aux[RAW_BSMP_NSAMP - 3], 0x1003);
+
+    /* Everything in "aux". */
+    cols.chans = NULL;
+    cols.nchans = 0;
+    bsmp_split(&cols, bsamps, NSAMPS);
+    ck_assert(!memcmp(aux + 2 * RAW_BSMP_NSAMP, bsamps[2].b_samps,
+                      sizeof(bsamps[2].b_samps)));
+
+    /* Nothing at all. */
+    setup_bufs();
+    memset(&cols, 0, sizeof(cols));
+    bsmp_split(&cols, bsamps, NSAMPS);
+    ck_assert_int_eq(aux[0], 0);
+}
+END_TEST
+
+Suite* bsmp_split_suite(void)
+{
+    Suite *s = suite_create("bsmp_split");
+    TCase *tc = tcase_create("core");
+    tcase_add_checked_fixture(tc, setup_bufs, NULL);
+    tcase_add_test(tc, test_split);
+    tcase_add_test(tc, test_some_cols);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = bsmp_split_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
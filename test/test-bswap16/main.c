@@ -0,0 +1,156 @@
+#include "bswap16.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "raw_packets.h"
+#include "test.h"
+#include "type_attrs.h"
+
+#define MAXLEN 200              /* long enough for every loop in each impl */
+#define MAXOFF 4                /* misalign by up to this many values */
+
+uint16_t src[MAXLEN + MAXOFF];
+uint16_t dst[MAXLEN + MAXOFF];
+uint16_t expected[MAXLEN];
+
+static void setup_bufs(void)
+{
+    for (size_t i = 0; i < MAXLEN + MAXOFF; i++) {
+        src[i] = (uint16_t)(i * 0x0101 + 0x1234);
+    }
+}
+
+static void teardown_bufs(void)
+{
+    bswap16_use(BSWAP16_AUTO);
+}
+
+/* Compare the current implementation against a scalar reference, for
+ * every length and alignment, out of place and in place. */
+static void check_impl(void)
+{
+    for (size_t off = 0; off < MAXOFF; off++) {
+        for (size_t n = 0; n <= MAXLEN; n++) {
+            for (size_t i = 0; i < n; i++) {
+                expected[i] = (uint16_t)((src[off + i] << 8) |
+                                         (src[off + i] >> 8));
+            }
+            memset(dst, 0, sizeof(dst));
+            bswap16_buf(dst + off, src + off, n);
+            ck_assert_msg(!memcmp(dst + off, expected, n * sizeof(uint16_t)),
+                          "%s: wrong result, n=%zu, off=%zu",
+                          bswap16_impl_str(), n, off);
+            /* Nothing past the end gets touched. */
+            ck_assert_int_eq(dst[off + n], 0);
+
+            memcpy(dst, src, sizeof(dst));
+            bswap16_buf(dst + off, dst + off, n);
+            ck_assert_msg(!memcmp(dst + off, expected, n * sizeof(uint16_t)),
+                          "%s: wrong in-place result, n=%zu, off=%zu",
+                          bswap16_impl_str(), n, off);
+        }
+    }
+}
+
+START_TEST(test_scalar)
+{
+    ck_assert_int_eq(bswap16_use(BSWAP16_SCALAR), 0);
+    ck_assert_str_eq(bswap16_impl_str(), "scalar");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_ssse3)
+{
+    if (bswap16_use(BSWAP16_SSSE3)) {
+        return;                 /* not supported here */
+    }
+    ck_assert_str_eq(bswap16_impl_str(), "ssse3");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_avx2)
+{
+    if (bswap16_use(BSWAP16_AVX2)) {
+        return;                 /* not supported here */
+    }
+    ck_assert_str_eq(bswap16_impl_str(), "avx2");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_auto)
+{
+    ck_assert_int_eq(bswap16_use(BSWAP16_AUTO), 0);
+    check_impl();
+}
+END_TEST
+
+/* Board sample samples come out in host byte order. */
+START_TEST(test_bsmp_ntoh)
+{
+    static struct raw_pkt_bsmp bsmp;
+    raw_packet_init(&bsmp, RAW_MTYPE_BSMP, 0);
+    uint8_t *samps = (uint8_t*)bsmp.b_samps;
+    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+        samps[2 * i] = (uint8_t)(i >> 8); /* big-endian i */
+        samps[2 * i + 1] = (uint8_t)i;
+    }
+    ck_assert_int_eq(raw_pkt_ntoh(&bsmp), 0);
+    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+        ck_assert_int_eq(bsmp.b_samps[i], i);
+    }
+    ck_assert_int_eq(raw_pkt_hton(&bsmp), 0);
+    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+        ck_assert_int_eq(samps[2 * i], (uint8_t)(i >> 8));
+        ck_assert_int_eq(samps[2 * i + 1], (uint8_t)i);
+    }
+}
+END_TEST
+
+/* raw_pkt_ntoh_hdr() swaps the header but leaves samples alone. */
+START_TEST(test_bsmp_ntoh_hdr)
+{
+    static struct raw_pkt_bsmp bsmp;
+    raw_packet_init(&bsmp, RAW_MTYPE_BSMP, 0);
+    bsmp.b_sidx = htonl(0x01020304);
+    bsmp.b_id = htonl(0x05060708);
+    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+        bsmp.b_samps[i] = (uint16_t)(i * 0x0101 + 0x1234);
+    }
+    ck_assert_int_eq(raw_pkt_ntoh_hdr(&bsmp), 0);
+    ck_assert_int_eq(bsmp.b_sidx, 0x01020304);
+    ck_assert_int_eq(bsmp.b_id, 0x05060708);
+    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+        ck_assert_int_eq(bsmp.b_samps[i], (uint16_t)(i * 0x0101 + 0x1234));
+    }
+}
+END_TEST
+
+Suite* bswap16_suite(void)
+{
+    Suite *s = suite_create("bswap16");
+    TCase *tc = tcase_create("bswap16");
+    tcase_add_checked_fixture(tc, setup_bufs, teardown_bufs);
+    tcase_add_test(tc, test_scalar);
+    tcase_add_test(tc, test_ssse3);
+    tcase_add_test(tc, test_avx2);
+    tcase_add_test(tc, test_auto);
+    tcase_add_test(tc, test_bsmp_ntoh);
+    tcase_add_test(tc, test_bsmp_ntoh_hdr);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = bswap16_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
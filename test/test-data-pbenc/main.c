@@ -0,0 +1,579 @@
+#include "data_pbenc.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta16.h"
+#include "raw_packets.h"
+#include "sng.h"
+#include "spike16.h"
+#include "test.h"
+#include "type_attrs.h"
+#include "proto/data.pb-c.h"
+
+#define BUF_SIZE 16384
+
+/* Values that land on either side of each varint length boundary */
+static const uint32_t edge_vals[] = {
+    0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 0x1FFFFF, 0x200000,
+    0xFFFFFFF, 0x10000000, 0xFFFFFFFF,
+};
+#define N_EDGE_VALS (sizeof(edge_vals) / sizeof(edge_vals[0]))
+
+uint8_t ours[BUF_SIZE];
+uint8_t theirs[BUF_SIZE];
+uint8_t bsmp_samps[RAW_BSMP_NSAMP * sizeof(raw_samp_t)];
+uint32_t bsub_chips[RAW_BSUB_NSAMP];
+uint32_t bsub_chans[RAW_BSUB_NSAMP];
+uint32_t bsub_samps[RAW_BSUB_NSAMP];
+uint16_t chans[RAW_BSMP_NSAMP];
+struct data_pbenc_chans dchans;
+uint32_t bsmp_chans[RAW_BSMP_NSAMP];
+uint16_t delta_samps[RAW_BSMP_NSAMP];
+uint16_t preview_vals[4][RAW_BSMP_NSAMP];
+uint16_t snippets[DATA_PBENC_SPIKES_MAX_EVENTS * SPIKE16_SNIPPET_MAX];
+uint8_t delta_buf[DELTA16_MAX_LEN(RAW_BSMP_NSAMP)];
+struct sng_bsmp_decoder decoder;
+
+/*
+ * Reference encodings, the protobuf-c way
+ */
+
+/* If n is nonzero, only pack chans[0..n). */
+static size_t pack_bsmp_chans(const struct raw_pkt_bsmp *bsmp, size_t n)
+{
+    uint8_t pflags = raw_pflags(bsmp);
+    BoardSample msg = BOARD_SAMPLE__INIT;
+    msg.has_is_live = 1;
+    msg.is_live = !!(pflags & RAW_PFLAG_B_LIVE);
+    msg.has_is_last = 1;
+    msg.is_last = !!(pflags & RAW_PFLAG_B_LAST);
+    msg.has_is_err = 1;
+    msg.is_err = !!raw_pkt_is_err(bsmp);
+    msg.has_exp_cookie = 1;
+    msg.exp_cookie = raw_exp_cookie(bsmp);
+    msg.has_board_id = 1;
+    msg.board_id = bsmp->b_id;
+    msg.has_samp_idx = 1;
+    msg.samp_idx = bsmp->b_sidx;
+    msg.has_chip_live = 1;
+    msg.chip_live = bsmp->b_chip_live;
+    msg.has_samples = 1;
+    msg.samples.data = bsmp_samps;
+    if (n) {
+        raw_samp_t *samps = (raw_samp_t*)bsmp_samps;
+        for (size_t i = 0; i < n; i++) {
+            samps[i] = bsmp->b_samps[chans[i]];
+            bsmp_chans[i] = chans[i];
+        }
+        msg.samples.len = n * sizeof(raw_samp_t);
+        msg.n_channels = n;
+        msg.channels = bsmp_chans;
+    } else {
+        msg.samples.len = sizeof(bsmp_samps);
+        memcpy(bsmp_samps, bsmp->b_samps, sizeof(bsmp_samps));
+    }
+    DnodeSample dnsample = DNODE_SAMPLE__INIT;
+    dnsample.has_type = 1;
+    dnsample.type = DNODE_SAMPLE__TYPE__SAMPLE;
+    dnsample.sample = &msg;
+    size_t len = dnode_sample__get_packed_size(&dnsample);
+    ck_assert(len <= BUF_SIZE);
+    ck_assert_int_eq(dnode_sample__pack(&dnsample, theirs), len);
+    return len;
+}
+
+static size_t pack_bsmp(const struct raw_pkt_bsmp *bsmp)
+{
+    return pack_bsmp_chans(bsmp, 0);
+}
+
+/* Fills in msg, for sng_bsmp_decode(). If n is nonzero, the samples
+ * are from chans[0..n). */
+static size_t pack_bsmp_delta(BoardSample *msg,
+                              const struct raw_pkt_bsmp *bsmp, size_t n,
+                              const struct data_pbenc_delta *delta)
+{
+    uint8_t pflags = raw_pflags(bsmp);
+    *msg = (BoardSample)BOARD_SAMPLE__INIT;
+    msg->has_is_live = 1;
+    msg->is_live = !!(pflags & RAW_PFLAG_B_LIVE);
+    msg->has_is_last = 1;
+    msg->is_last = !!(pflags & RAW_PFLAG_B_LAST);
+    msg->has_is_err = 1;
+    msg->is_err = !!raw_pkt_is_err(bsmp);
+    msg->has_exp_cookie = 1;
+    msg->exp_cookie = raw_exp_cookie(bsmp);
+    msg->has_board_id = 1;
+    msg->board_id = bsmp->b_id;
+    msg->has_samp_idx = 1;
+    msg->samp_idx = bsmp->b_sidx;
+    msg->has_chip_live = 1;
+    msg->chip_live = bsmp->b_chip_live;
+    for (size_t i = 0; i < n; i++) {
+        bsmp_chans[i] = chans[i];
+    }
+    msg->n_channels = n;
+    msg->channels = bsmp_chans;
+    msg->has_samples_delta = 1;
+    msg->samples_delta.data = (uint8_t*)delta->data;
+    msg->samples_delta.len = delta->len;
+    msg->has_delta_ref = delta->has_ref;
+    msg->delta_ref = delta->ref;
+    DnodeSample dnsample = DNODE_SAMPLE__INIT;
+    dnsample.has_type = 1;
+    dnsample.type = DNODE_SAMPLE__TYPE__SAMPLE;
+    dnsample.sample = msg;
+    size_t len = dnode_sample__get_packed_size(&dnsample);
+    ck_assert(len <= BUF_SIZE);
+    ck_assert_int_eq(dnode_sample__pack(&dnsample, theirs), len);
+    return len;
+}
+
+static size_t pack_bsub(const struct raw_pkt_bsub *bsub)
+{
+    uint8_t pflags = raw_pflags(bsub);
+    BoardSubsample msg = BOARD_SUBSAMPLE__INIT;
+    msg.has_is_live = 1;
+    msg.is_live = !!(pflags & RAW_PFLAG_B_LIVE);
+    msg.has_is_last = 1;
+    msg.is_last = !!(pflags & RAW_PFLAG_B_LAST);
+    msg.has_is_err = 1;
+    msg.is_err = !!raw_pkt_is_err(bsub);
+    msg.has_exp_cookie = 1;
+    msg.exp_cookie = raw_exp_cookie(bsub);
+    msg.has_board_id = 1;
+    msg.board_id = bsub->b_id;
+    msg.has_samp_idx = 1;
+    msg.samp_idx = bsub->b_sidx;
+    msg.has_chip_live = 1;
+    msg.chip_live = bsub->b_chip_live;
+    msg.n_chips = msg.n_channels = msg.n_samples = RAW_BSUB_NSAMP;
+    msg.chips = bsub_chips;
+    msg.channels = bsub_chans;
+    msg.samples = bsub_samps;
+    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
+        bsub_chips[i] = bsub->b_cfg[i].bs_chip;
+        bsub_chans[i] = bsub->b_cfg[i].bs_chan;
+        bsub_samps[i] = bsub->b_samps[i];
+    }
+    msg.has_gpio = 1;
+    msg.gpio = bsub->b_gpio;
+    msg.has_dac_channel = 1;
+    msg.dac_channel = bsub->b_dac_cfg;
+    msg.has_dac_value = 1;
+    msg.dac_value = bsub->b_dac;
+    DnodeSample dnsample = DNODE_SAMPLE__INIT;
+    dnsample.has_type = 1;
+    dnsample.type = DNODE_SAMPLE__TYPE__SUBSAMPLE;
+    dnsample.subsample = &msg;
+    size_t len = dnode_sample__get_packed_size(&dnsample);
+    ck_assert(len <= BUF_SIZE);
+    ck_assert_int_eq(dnode_sample__pack(&dnsample, theirs), len);
+    return len;
+}
+
+/*
+ * Test packets
+ */
+
+/* Works for a raw_pkt_bsmp or raw_pkt_bsub. */
+#define fill_header(pkt, i) do {                                        \
+    raw_pflags(pkt) = (uint8_t)((i) & (RAW_PFLAG_B_LIVE |               \
+                                       RAW_PFLAG_B_LAST));              \
+    if ((i) % 5 == 4) {                                                 \
+        raw_pflags(pkt) |= RAW_PFLAG_ERR;                               \
+    }                                                                   \
+    (pkt)->b_cookie_h = edge_vals[(i) % N_EDGE_VALS];                   \
+    (pkt)->b_cookie_l = edge_vals[((i) + 3) % N_EDGE_VALS];             \
+    (pkt)->b_id = edge_vals[((i) + 5) % N_EDGE_VALS];                   \
+    (pkt)->b_sidx = edge_vals[((i) + 7) % N_EDGE_VALS];                 \
+    (pkt)->b_chip_live = edge_vals[((i) + 9) % N_EDGE_VALS];            \
+} while (0)
+
+static void init_bsmp(struct raw_pkt_bsmp *bsmp, unsigned i)
+{
+    raw_packet_init(bsmp, RAW_MTYPE_BSMP, 0);
+    fill_header(bsmp, i);
+    for (size_t j = 0; j < RAW_BSMP_NSAMP; j++) {
+        bsmp->b_samps[j] = (raw_samp_t)(i * 0x9E37 + j * 0x0101);
+    }
+}
+
+static void init_bsub(struct raw_pkt_bsub *bsub, unsigned i)
+{
+    raw_packet_init(bsub, i % 7 == 6 ? RAW_MTYPE_ERR : RAW_MTYPE_BSUB, 0);
+    fill_header(bsub, i);
+    for (size_t j = 0; j < RAW_BSUB_NSAMP; j++) {
+        bsub->b_cfg[j].bs_chip = (uint8_t)(i * 37 + j * 8);
+        bsub->b_cfg[j].bs_chan = (uint8_t)(i % 2 ? j : 255 - j);
+        bsub->b_samps[j] = (raw_samp_t)(i % 3 ? (i * 0x9E37 + j * 0x0101) :
+                                        j);
+    }
+    bsub->b_gpio = (uint16_t)edge_vals[(i + 1) % N_EDGE_VALS];
+    bsub->b_dac_cfg = (uint8_t)edge_vals[(i + 2) % N_EDGE_VALS];
+    bsub->b_dac = (uint8_t)edge_vals[(i + 4) % N_EDGE_VALS];
+}
+
+static void check_same(size_t our_len, size_t their_len, size_t size,
+                       const char *what, unsigned i)
+{
+    ck_assert_msg(our_len == their_len,
+                  "%s %u: length %zu, expected %zu",
+                  what, i, our_len, their_len);
+    ck_assert_msg(size == their_len,
+                  "%s %u: size %zu, expected %zu",
+                  what, i, size, their_len);
+    ck_assert_msg(!memcmp(ours, theirs, their_len),
+                  "%s %u: packed bytes differ", what, i);
+}
+
+START_TEST(test_bsmp)
+{
+    struct raw_pkt_bsmp bsmp;
+    for (unsigned i = 0; i < 4 * N_EDGE_VALS; i++) {
+        init_bsmp(&bsmp, i);
+        size_t their_len = pack_bsmp(&bsmp);
+        size_t size = data_pbenc_bsmp_size(&bsmp);
+        ck_assert(size <= DATA_PBENC_BSMP_MAX);
+        memset(ours, 0, sizeof(ours));
+        size_t our_len = data_pbenc_bsmp(ours, &bsmp, 0);
+        check_same(our_len, their_len, size, "bsmp", i);
+    }
+}
+END_TEST
+
+START_TEST(test_bsmp_wire)
+{
+    struct raw_pkt_bsmp bsmp;
+    struct raw_pkt_bsmp wire;
+    for (unsigned i = 0; i < N_EDGE_VALS; i++) {
+        init_bsmp(&bsmp, i);
+        size_t their_len = pack_bsmp(&bsmp);
+        memcpy(&wire, &bsmp, sizeof(wire));
+        for (size_t j = 0; j < RAW_BSMP_NSAMP; j++) {
+            wire.b_samps[j] = htons(wire.b_samps[j]);
+        }
+        /* Pack at an odd address, like in the middle of a batch. */
+        memset(ours, 0, sizeof(ours));
+        size_t our_len = data_pbenc_bsmp(ours + 1, &wire, 1);
+        memmove(ours, ours + 1, our_len);
+        check_same(our_len, their_len, data_pbenc_bsmp_size(&wire),
+                   "wire bsmp", i);
+    }
+}
+END_TEST
+
+START_TEST(test_bsmp_chans)
+{
+    struct raw_pkt_bsmp bsmp;
+    struct raw_pkt_bsmp wire;
+    /* Channel list lengths, and so varint lengths, at the edges. */
+    const size_t ns[] = { 1, 2, 63, 64, 65, 127, 128, RAW_BSMP_NSAMP };
+    for (unsigned i = 0; i < sizeof(ns) / sizeof(ns[0]); i++) {
+        size_t n = ns[i];
+        for (size_t j = 0; j < n; j++) {
+            chans[j] = (uint16_t)((j * 421 + i) % RAW_BSMP_NSAMP);
+        }
+        ck_assert_int_eq(data_pbenc_chans_init(&dchans, chans, n), 0);
+        init_bsmp(&bsmp, i);
+        size_t their_len = pack_bsmp_chans(&bsmp, n);
+        size_t size = data_pbenc_bsmp_chans_size(&bsmp, &dchans);
+        ck_assert(size <= DATA_PBENC_BSMP_CHANS_MAX);
+        memset(ours, 0, sizeof(ours));
+        size_t our_len = data_pbenc_bsmp_chans(ours, &bsmp, &dchans, 0);
+        check_same(our_len, their_len, size, "bsmp chans", i);
+
+        memcpy(&wire, &bsmp, sizeof(wire));
+        for (size_t j = 0; j < RAW_BSMP_NSAMP; j++) {
+            wire.b_samps[j] = htons(wire.b_samps[j]);
+        }
+        memset(ours, 0, sizeof(ours));
+        our_len = data_pbenc_bsmp_chans(ours + 1, &wire, &dchans, 1);
+        memmove(ours, ours + 1, our_len);
+        check_same(our_len, their_len, size, "wire bsmp chans", i);
+    }
+}
+END_TEST
+
+START_TEST(test_bsmp_delta)
+{
+    struct raw_pkt_bsmp bsmp;
+    const size_t ns[] = { 0, 1, 100, RAW_BSMP_NSAMP };
+    for (unsigned i = 0; i < sizeof(ns) / sizeof(ns[0]); i++) {
+        size_t n = ns[i];
+        size_t nsamps = n ? n : RAW_BSMP_NSAMP;
+        for (size_t j = 0; j < n; j++) {
+            chans[j] = (uint16_t)((j * 421 + i) % RAW_BSMP_NSAMP);
+        }
+        ck_assert_int_eq(data_pbenc_chans_init(&dchans, chans, n), 0);
+        sng_bsmp_decoder_init(&decoder);
+        /* A key frame, then deltas from each sample to the next. */
+        for (unsigned k = 0; k < 3; k++) {
+            init_bsmp(&bsmp, i * 3 + k);
+            for (size_t j = 0; j < nsamps; j++) {
+                bsmp.b_samps[j] = (raw_samp_t)(0x8000 + j * 3 + k * 7);
+            }
+            const uint16_t *samps = bsmp.b_samps;
+            if (n) {
+                for (size_t j = 0; j < n; j++) {
+                    delta_samps[j] = bsmp.b_samps[chans[j]];
+                }
+                samps = delta_samps;
+            }
+            struct data_pbenc_delta delta = {
+                .data = delta_buf,
+                .has_ref = k > 0,
+                .ref = decoder.samp_idx,
+            };
+            delta.len = delta16_encode(delta_buf, samps,
+                                       k ? decoder.samps : NULL, nsamps);
+            BoardSample msg;
+            size_t their_len = pack_bsmp_delta(&msg, &bsmp, n, &delta);
+            const struct data_pbenc_chans *dc = n ? &dchans : NULL;
+            size_t size = data_pbenc_bsmp_delta_size(&bsmp, dc, &delta);
+            ck_assert(size <= DATA_PBENC_BSMP_DELTA_MAX);
+            memset(ours, 0, sizeof(ours));
+            size_t our_len = data_pbenc_bsmp_delta(ours, &bsmp, dc, &delta);
+            check_same(our_len, their_len, size, "bsmp delta", i * 3 + k);
+
+            ck_assert_int_eq(sng_bsmp_decode(&decoder, &msg), 0);
+            ck_assert_int_eq(decoder.nsamps, nsamps);
+            ck_assert_int_eq(decoder.samp_idx, bsmp.b_sidx);
+            ck_assert(!memcmp(decoder.samps, samps,
+                              nsamps * sizeof(uint16_t)));
+
+            /* A decoder that missed the reference has to wait. */
+            if (k) {
+                struct sng_bsmp_decoder fresh;
+                sng_bsmp_decoder_init(&fresh);
+                ck_assert_int_eq(sng_bsmp_decode(&fresh, &msg), 1);
+            }
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_chans_init)
+{
+    chans[0] = 0;
+    chans[1] = RAW_BSMP_NSAMP - 1;
+    ck_assert_int_eq(data_pbenc_chans_init(&dchans, chans, 2), 0);
+    ck_assert_int_eq(dchans.n, 2);
+    ck_assert_int_eq(dchans.packed_len, 3);
+    chans[1] = RAW_BSMP_NSAMP;
+    ck_assert_int_eq(data_pbenc_chans_init(&dchans, chans, 2), -1);
+    ck_assert_int_eq(data_pbenc_chans_init(&dchans, chans,
+                                           RAW_BSMP_NSAMP + 1), -1);
+    ck_assert_int_eq(data_pbenc_chans_init(&dchans, chans, 0), 0);
+    ck_assert_int_eq(dchans.n, 0);
+}
+END_TEST
+
+START_TEST(test_bsub)
+{
+    struct raw_pkt_bsub bsub;
+    for (unsigned i = 0; i < 4 * N_EDGE_VALS; i++) {
+        init_bsub(&bsub, i);
+        size_t their_len = pack_bsub(&bsub);
+        size_t size = data_pbenc_bsub_size(&bsub);
+        ck_assert(size <= DATA_PBENC_BSUB_MAX);
+        memset(ours, 0, sizeof(ours));
+        size_t our_len = data_pbenc_bsub(ours, &bsub);
+        check_same(our_len, their_len, size, "bsub", i);
+    }
+}
+END_TEST
+
+START_TEST(test_preview)
+{
+    const size_t ns[] = { 0, 1, 100, RAW_BSMP_NSAMP };
+    for (unsigned i = 0; i < 4 * N_EDGE_VALS; i++) {
+        size_t n = ns[i % (sizeof(ns) / sizeof(ns[0]))];
+        size_t nvals = n ? n : RAW_BSMP_NSAMP;
+        for (size_t j = 0; j < n; j++) {
+            chans[j] = (uint16_t)((j * 421 + i) % RAW_BSMP_NSAMP);
+            bsmp_chans[j] = chans[j];
+        }
+        ck_assert_int_eq(data_pbenc_chans_init(&dchans, chans, n), 0);
+        for (size_t k = 0; k < 4; k++) {
+            for (size_t j = 0; j < nvals; j++) {
+                preview_vals[k][j] = (uint16_t)(i * 0x9E37 + j * 0x0101 +
+                                                k * 0x3333);
+            }
+        }
+        struct data_pbenc_preview pv = {
+            .exp_cookie = ((uint64_t)edge_vals[i % N_EDGE_VALS] << 32 |
+                           edge_vals[(i + 3) % N_EDGE_VALS]),
+            .board_id = edge_vals[(i + 5) % N_EDGE_VALS],
+            .chip_live = edge_vals[(i + 9) % N_EDGE_VALS],
+            .samp_idx = edge_vals[(i + 7) % N_EDGE_VALS],
+            .nsamples = edge_vals[(i + 1) % N_EDGE_VALS],
+            .dchans = n ? &dchans : NULL,
+            .nchans = nvals,
+            .min = preview_vals[0],
+            .max = preview_vals[1],
+            .mean = preview_vals[2],
+            .rms = preview_vals[3],
+        };
+
+        BoardPreview msg = BOARD_PREVIEW__INIT;
+        msg.has_exp_cookie = 1;
+        msg.exp_cookie = pv.exp_cookie;
+        msg.has_board_id = 1;
+        msg.board_id = pv.board_id;
+        msg.has_chip_live = 1;
+        msg.chip_live = pv.chip_live;
+        msg.has_samp_idx = 1;
+        msg.samp_idx = pv.samp_idx;
+        msg.has_nsamples = 1;
+        msg.nsamples = pv.nsamples;
+        msg.n_channels = n;
+        msg.channels = bsmp_chans;
+        ProtobufCBinaryData *fields[] = {
+            &msg.min, &msg.max, &msg.mean, &msg.rms,
+        };
+        msg.has_min = msg.has_max = msg.has_mean = msg.has_rms = 1;
+        for (size_t k = 0; k < 4; k++) {
+            fields[k]->data = (uint8_t*)preview_vals[k];
+            fields[k]->len = nvals * sizeof(uint16_t);
+        }
+        DnodeSample dnsample = DNODE_SAMPLE__INIT;
+        dnsample.has_type = 1;
+        dnsample.type = DNODE_SAMPLE__TYPE__PREVIEW;
+        dnsample.preview = &msg;
+        size_t their_len = dnode_sample__get_packed_size(&dnsample);
+        ck_assert(their_len <= BUF_SIZE);
+        ck_assert_int_eq(dnode_sample__pack(&dnsample, theirs), their_len);
+
+        size_t size = data_pbenc_preview_size(&pv);
+        ck_assert(size <= DATA_PBENC_PREVIEW_MAX);
+        memset(ours, 0, sizeof(ours));
+        size_t our_len = data_pbenc_preview(ours, &pv);
+        check_same(our_len, their_len, size, "preview", i);
+    }
+}
+END_TEST
+
+START_TEST(test_spikes)
+{
+    const size_t ns[] = { 1, 2, 17, DATA_PBENC_SPIKES_MAX_EVENTS };
+    const size_t lens[] = { 0, 1, 40, SPIKE16_SNIPPET_MAX };
+    for (unsigned i = 0; i < 4 * N_EDGE_VALS; i++) {
+        size_t n = ns[i % (sizeof(ns) / sizeof(ns[0]))];
+        size_t len = lens[(i / 4) % (sizeof(lens) / sizeof(lens[0]))];
+        for (size_t j = 0; j < n; j++) {
+            chans[j] = (uint16_t)((j * 421 + i * 31) % RAW_BSMP_NSAMP);
+            bsmp_chans[j] = chans[j];
+        }
+        for (size_t j = 0; j < n * len; j++) {
+            snippets[j] = (uint16_t)(i * 0x9E37 + j * 0x0101);
+        }
+        struct data_pbenc_spikes sp = {
+            .exp_cookie = ((uint64_t)edge_vals[i % N_EDGE_VALS] << 32 |
+                           edge_vals[(i + 3) % N_EDGE_VALS]),
+            .board_id = edge_vals[(i + 5) % N_EDGE_VALS],
+            .samp_idx = edge_vals[(i + 7) % N_EDGE_VALS],
+            .chans = chans,
+            .n = n,
+            .snippets = snippets,
+            .snippet_len = len,
+            .snippet_pre = (unsigned)(len / 3),
+        };
+
+        BoardSpikes msg = BOARD_SPIKES__INIT;
+        msg.has_exp_cookie = 1;
+        msg.exp_cookie = sp.exp_cookie;
+        msg.has_board_id = 1;
+        msg.board_id = sp.board_id;
+        msg.has_samp_idx = 1;
+        msg.samp_idx = sp.samp_idx;
+        msg.n_channels = n;
+        msg.channels = bsmp_chans;
+        if (len) {
+            msg.has_snippets = 1;
+            msg.snippets.data = (uint8_t*)snippets;
+            msg.snippets.len = n * len * sizeof(uint16_t);
+            msg.has_snippet_pre = 1;
+            msg.snippet_pre = sp.snippet_pre;
+        }
+        DnodeSample dnsample = DNODE_SAMPLE__INIT;
+        dnsample.has_type = 1;
+        dnsample.type = DNODE_SAMPLE__TYPE__SPIKES;
+        dnsample.spikes = &msg;
+        size_t their_len = dnode_sample__get_packed_size(&dnsample);
+        ck_assert(their_len <= BUF_SIZE);
+        ck_assert_int_eq(dnode_sample__pack(&dnsample, theirs), their_len);
+
+        size_t size = data_pbenc_spikes_size(&sp);
+        ck_assert(size <= DATA_PBENC_SPIKES_MAX);
+        memset(ours, 0, sizeof(ours));
+        size_t our_len = data_pbenc_spikes(ours, &sp);
+        check_same(our_len, their_len, size, "spikes", i);
+    }
+}
+END_TEST
+
+START_TEST(test_gap)
+{
+    for (unsigned i = 0; i < N_EDGE_VALS; i++) {
+        DnodeSample dnsample = DNODE_SAMPLE__INIT;
+        dnsample.has_type = 1;
+        dnsample.type = DNODE_SAMPLE__TYPE__GAP;
+        dnsample.has_gap_nsamples = 1;
+        dnsample.gap_nsamples = edge_vals[i];
+        size_t their_len = dnode_sample__get_packed_size(&dnsample);
+        ck_assert_int_eq(dnode_sample__pack(&dnsample, theirs), their_len);
+        memset(ours, 0, sizeof(ours));
+        size_t our_len = data_pbenc_gap(ours, edge_vals[i]);
+        ck_assert(our_len <= DATA_PBENC_GAP_MAX);
+        check_same(our_len, their_len, their_len, "gap", i);
+    }
+}
+END_TEST
+
+START_TEST(test_varint)
+{
+    for (size_t i = 0; i < N_EDGE_VALS; i++) {
+        uint64_t v = (uint64_t)edge_vals[i] << 32 | edge_vals[i];
+        uint8_t buf[DATA_PBENC_VARINT_MAX];
+        size_t len = data_pbenc_varint(buf, v);
+        ck_assert(len >= 1 && len <= DATA_PBENC_VARINT_MAX);
+        uint64_t got = 0;
+        for (size_t j = 0; j < len; j++) {
+            ck_assert_int_eq(!!(buf[j] & 0x80), j != len - 1);
+            got |= (uint64_t)(buf[j] & 0x7F) << (7 * j);
+        }
+        ck_assert(got == v);
+    }
+}
+END_TEST
+
+Suite* data_pbenc_suite(void)
+{
+    Suite *s = suite_create("data_pbenc");
+    TCase *tc = tcase_create("data_pbenc");
+    tcase_add_test(tc, test_varint);
+    tcase_add_test(tc, test_bsmp);
+    tcase_add_test(tc, test_bsmp_wire);
+    tcase_add_test(tc, test_chans_init);
+    tcase_add_test(tc, test_bsmp_chans);
+    tcase_add_test(tc, test_bsmp_delta);
+    tcase_add_test(tc, test_bsub);
+    tcase_add_test(tc, test_preview);
+    tcase_add_test(tc, test_spikes);
+    tcase_add_test(tc, test_gap);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = data_pbenc_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,155 @@
+#include "delta16.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "type_attrs.h"
+
+#define MAXLEN 1120             /* one board sample */
+
+uint16_t cur[MAXLEN];
+uint16_t ref[MAXLEN];
+uint16_t got[MAXLEN];
+uint8_t enc[DELTA16_MAX_LEN(MAXLEN) + 1];
+uint8_t enc_scalar[DELTA16_MAX_LEN(MAXLEN)];
+
+/* Like a board sample: a slowly wandering value per channel. max_step
+ * picks how big the differences get; 0x10000 means anything. */
+static void fill(unsigned seed, unsigned max_step)
+{
+    srand(seed);
+    for (size_t i = 0; i < MAXLEN; i++) {
+        ref[i] = (uint16_t)(0x8000 + rand() % 2000 - 1000);
+        cur[i] = (uint16_t)(ref[i] + (unsigned)rand() % max_step -
+                            max_step / 2);
+    }
+}
+
+static void teardown(void)
+{
+    delta16_use(DELTA16_AUTO);
+}
+
+/* Round trip against ref and against zero, for lengths around each
+ * block boundary, and check the current implementation writes
+ * exactly what the scalar one does. */
+static void check_impl(void)
+{
+    const unsigned steps[] = { 1, 2, 3, 64, 1000, 0x10000 };
+    enum delta16_impl impl = (!strcmp(delta16_impl_str(), "avx2") ?
+                              DELTA16_AVX2 : DELTA16_SCALAR);
+    for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+        fill((unsigned)s, steps[s]);
+        for (size_t n = 0; n <= MAXLEN; n += (n < 100 ? 1 : 31)) {
+            for (int use_ref = 0; use_ref <= 1; use_ref++) {
+                const uint16_t *r = use_ref ? ref : NULL;
+                memset(enc, 0xA5, sizeof(enc));
+                size_t len = delta16_encode(enc, cur, r, n);
+                ck_assert(len <= DELTA16_MAX_LEN(n));
+                ck_assert_int_eq(enc[len], 0xA5);
+
+                delta16_use(DELTA16_SCALAR);
+                size_t slen = delta16_encode(enc_scalar, cur, r, n);
+                delta16_use(impl);
+                ck_assert_int_eq(len, slen);
+                ck_assert_msg(!memcmp(enc, enc_scalar, len),
+                              "%s: differs from scalar, n=%zu",
+                              delta16_impl_str(), n);
+
+                memset(got, 0, sizeof(got));
+                ck_assert_int_eq(delta16_decode(got, enc, len, r, n), 0);
+                ck_assert_msg(!memcmp(got, cur, n * sizeof(uint16_t)),
+                              "%s: round trip failed, n=%zu, ref=%d",
+                              delta16_impl_str(), n, use_ref);
+            }
+        }
+    }
+}
+
+START_TEST(test_scalar)
+{
+    ck_assert_int_eq(delta16_use(DELTA16_SCALAR), 0);
+    ck_assert_str_eq(delta16_impl_str(), "scalar");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_avx2)
+{
+    if (delta16_use(DELTA16_AVX2)) {
+        return;                 /* not supported here */
+    }
+    ck_assert_str_eq(delta16_impl_str(), "avx2");
+    check_impl();
+}
+END_TEST
+
+/* Small differences take few bits. */
+START_TEST(test_width)
+{
+    for (size_t i = 0; i < DELTA16_BLOCK; i++) {
+        ref[i] = 0x8000;
+        cur[i] = (uint16_t)(0x8000 + (i & 1 ? 3 : -4)); /* zigzag 6 : 7 */
+    }
+    ck_assert_int_eq(delta16_encode(enc, cur, ref, DELTA16_BLOCK),
+                     1 + 3 * 4);
+    ck_assert_int_eq(enc[0], 3);
+    /* Bit 0 plane: set for even values (zigzag 7). */
+    ck_assert_int_eq(enc[1], 0x55);
+    ck_assert_int_eq(delta16_encode(enc, ref, ref, DELTA16_BLOCK), 1);
+    ck_assert_int_eq(enc[0], 0);
+    /* Wrapping differences are small too. */
+    ref[0] = 0xFFFF;
+    cur[0] = 0x0001;
+    ck_assert_int_eq(delta16_encode(enc, cur, ref, 1), 1 + 3 * 4);
+    ck_assert_int_eq(delta16_decode(got, enc, 1 + 3 * 4, ref, 1), 0);
+    ck_assert_int_eq(got[0], 0x0001);
+}
+END_TEST
+
+/* Decoding in place, the way a client keeps its previous sample. */
+START_TEST(test_in_place)
+{
+    fill(42, 100);
+    size_t len = delta16_encode(enc, cur, ref, MAXLEN);
+    ck_assert_int_eq(delta16_decode(ref, enc, len, ref, MAXLEN), 0);
+    ck_assert(!memcmp(ref, cur, sizeof(cur)));
+}
+END_TEST
+
+START_TEST(test_malformed)
+{
+    fill(7, 100);
+    size_t len = delta16_encode(enc, cur, ref, 100);
+    ck_assert_int_eq(delta16_decode(got, enc, len - 1, ref, 100), -1);
+    ck_assert_int_eq(delta16_decode(got, enc, len, ref, 99 - 31), -1);
+    ck_assert_int_eq(delta16_decode(got, enc, len, ref, 101 + 31), -1);
+    enc[0] = 17;
+    ck_assert_int_eq(delta16_decode(got, enc, len, ref, 100), -1);
+}
+END_TEST
+
+Suite* delta16_suite(void)
+{
+    Suite *s = suite_create("delta16");
+    TCase *tc = tcase_create("delta16");
+    tcase_add_checked_fixture(tc, NULL, teardown);
+    tcase_add_test(tc, test_scalar);
+    tcase_add_test(tc, test_avx2);
+    tcase_add_test(tc, test_width);
+    tcase_add_test(tc, test_in_place);
+    tcase_add_test(tc, test_malformed);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = delta16_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
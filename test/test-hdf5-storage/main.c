@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <hdf5.h>
@@ -59,11 +60,94 @@ START_TEST(test_hdf5_end_to_end)
 }
 END_TEST
 
+#define NWRITE 7001              /* samples per write; not a chunk's worth */
+#define NTOTAL 40000             /* several chunks, and then some */
+#define NSYNC  3                 /* datasync after this many writes */
+
+static struct raw_pkt_bsmp bsamps[NWRITE];
+
+static raw_samp_t samp_val(size_t sidx, size_t j)
+{
+    return (raw_samp_t)(sidx * 7 + j);
+}
+
+static void read_dset(hid_t file, const char *name, hid_t type, void *buf,
+                      hsize_t nrows)
+{
+    hid_t dset = H5Dopen2(file, name, H5P_DEFAULT);
+    ck_assert(dset >= 0);
+    hid_t space = H5Dget_space(dset);
+    hsize_t dims[2] = { 0, 0 };
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    ck_assert_int_eq(dims[0], nrows);
+    ck_assert(H5Dread(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf) >= 0);
+    H5Sclose(space);
+    H5Dclose(dset);
+}
+
+/* Samples written in pieces that don't line up with the chunks, with
+ * a datasync partway through, all come back in order. */
+START_TEST(test_hdf5_staged)
+{
+    struct ch_storage *chns = hdf5_ch_storage_alloc(H5FILE, H5DNAME);
+    ck_assert(chns != NULL);
+    ck_assert(ch_storage_open(chns, H5F_ACC_TRUNC) == 0);
+
+    size_t sidx = 0;
+    for (unsigned w = 0; sidx < NTOTAL; w++) {
+        size_t n = NTOTAL - sidx < NWRITE ? NTOTAL - sidx : NWRITE;
+        for (size_t i = 0; i < n; i++) {
+            memcpy(&bsamps[i], &bsmp, sizeof(bsmp));
+            bsamps[i].b_sidx = (uint32_t)(sidx + i);
+            for (size_t j = 0; j < RAW_BSMP_NSAMP; j++) {
+                bsamps[i].b_samps[j] = samp_val(sidx + i, j);
+            }
+        }
+        ck_assert(ch_storage_write(chns, bsamps, n) == 0);
+        sidx += n;
+        if (w == NSYNC) {
+            ck_assert(ch_storage_datasync(chns) == 0);
+        }
+    }
+    ck_assert(ch_storage_close(chns) == 0);
+
+    struct hdf5_ch_stats stats;
+    hdf5_ch_storage_get_stats(chns, &stats);
+    ck_assert_int_eq(stats.nsamps, NTOTAL);
+    ck_assert(stats.nwrites > NTOTAL / 15000);
+    ch_storage_free(chns);
+
+    uint32_t *sidxs = malloc(NTOTAL * sizeof(uint32_t));
+    raw_samp_t *chans = malloc(NTOTAL * 1024 * sizeof(raw_samp_t));
+    raw_samp_t *aux = malloc(NTOTAL * 96 * sizeof(raw_samp_t));
+    ck_assert(sidxs && chans && aux);
+    hid_t file = H5Fopen(H5FILE, H5F_ACC_RDONLY, H5P_DEFAULT);
+    ck_assert(file >= 0);
+    read_dset(file, "sample_index", H5T_NATIVE_UINT32, sidxs, NTOTAL);
+    read_dset(file, "channel_data", H5T_NATIVE_UINT16, chans, NTOTAL);
+    read_dset(file, "aux_data", H5T_NATIVE_UINT16, aux, NTOTAL);
+    H5Fclose(file);
+    for (size_t i = 0; i < NTOTAL; i++) {
+        ck_assert_int_eq(sidxs[i], i);
+        for (size_t j = 0; j < 1024; j++) {
+            ck_assert_int_eq(chans[i * 1024 + j], samp_val(i, j));
+        }
+        for (size_t j = 0; j < 96; j++) {
+            ck_assert_int_eq(aux[i * 96 + j], samp_val(i, 1024 + j));
+        }
+    }
+    free(sidxs);
+    free(chans);
+    free(aux);
+}
+END_TEST
+
 Suite* hdf5_suite(void)
 {
     Suite *s = suite_create("hdf5");
     TCase *tc_hdf5 = tcase_create("hdf5");
     tcase_add_test(tc_hdf5, test_hdf5_end_to_end);
+    tcase_add_test(tc_hdf5, test_hdf5_staged);
     suite_add_tcase(s, tc_hdf5);
     return s;
 }
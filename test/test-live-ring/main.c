@@ -0,0 +1,142 @@
+#include "live_ring.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "type_attrs.h"
+
+#define NSLOTS 16
+
+static char name[64];
+struct live_ring *lr;
+struct live_ring_reader rd;
+
+static void setup_ring(void)
+{
+    snprintf(name, sizeof(name), "/leafysd-test-live-%d", (int)getpid());
+    lr = live_ring_new(name, NSLOTS);
+    ck_assert(lr != NULL);
+    ck_assert_int_eq(live_ring_open(&rd, name), 0);
+}
+
+static void teardown_ring(void)
+{
+    live_ring_close(&rd);
+    live_ring_free(lr);
+}
+
+static void publish(uint32_t i)
+{
+    struct raw_pkt_bsmp *bsmp = live_ring_reserve(lr);
+    raw_packet_init(bsmp, RAW_MTYPE_BSMP, 0);
+    bsmp->b_sidx = i;
+    for (size_t j = 0; j < RAW_BSMP_NSAMP; j++) {
+        bsmp->b_samps[j] = (raw_samp_t)(i + j);
+    }
+    live_ring_publish(lr);
+}
+
+static void check_next(uint32_t i)
+{
+    const struct raw_pkt_bsmp *bsmp = live_ring_peek(&rd);
+    ck_assert(bsmp != NULL);
+    ck_assert_int_eq(bsmp->b_sidx, i);
+    ck_assert_int_eq(bsmp->b_samps[0], (raw_samp_t)i);
+    ck_assert_int_eq(bsmp->b_samps[RAW_BSMP_NSAMP - 1],
+                     (raw_samp_t)(i + RAW_BSMP_NSAMP - 1));
+    ck_assert_int_eq(live_ring_done(&rd), 0);
+}
+
+START_TEST(test_in_order)
+{
+    ck_assert(live_ring_peek(&rd) == NULL);
+    for (uint32_t i = 0; i < 10 * NSLOTS; i++) {
+        publish(i);
+        if (i % 3 == 2) {
+            for (uint32_t j = i - 2; j <= i; j++) {
+                check_next(j);
+            }
+        }
+    }
+    check_next(10 * NSLOTS - 1);
+    ck_assert(live_ring_peek(&rd) == NULL);
+    ck_assert_int_eq(rd.nlost, 0);
+}
+END_TEST
+
+START_TEST(test_lapped)
+{
+    for (uint32_t i = 0; i < 3 * NSLOTS; i++) {
+        publish(i);
+    }
+    /* Everything but the newest nslots - 1 is gone. */
+    for (uint32_t i = 2 * NSLOTS + 1; i < 3 * NSLOTS; i++) {
+        check_next(i);
+    }
+    ck_assert(live_ring_peek(&rd) == NULL);
+    ck_assert_int_eq(rd.nlost, 2 * NSLOTS + 1);
+}
+END_TEST
+
+START_TEST(test_overwritten_while_reading)
+{
+    publish(0);
+    ck_assert(live_ring_peek(&rd) != NULL);
+    for (uint32_t i = 1; i <= NSLOTS; i++) {
+        publish(i);
+    }
+    ck_assert_int_eq(live_ring_done(&rd), -1);
+    ck_assert_int_eq(rd.nlost, 1);
+}
+END_TEST
+
+START_TEST(test_late_reader)
+{
+    struct live_ring_reader late;
+    publish(0);
+    publish(1);
+    ck_assert_int_eq(live_ring_open(&late, name), 0);
+    ck_assert_int_eq(late.hdr->nslots, NSLOTS);
+    ck_assert(live_ring_peek(&late) == NULL);
+    publish(2);
+    const struct raw_pkt_bsmp *bsmp = live_ring_peek(&late);
+    ck_assert(bsmp != NULL);
+    ck_assert_int_eq(bsmp->b_sidx, 2);
+    ck_assert_int_eq(live_ring_done(&late), 0);
+    live_ring_close(&late);
+}
+END_TEST
+
+START_TEST(test_no_ring)
+{
+    struct live_ring_reader none;
+    ck_assert_int_eq(live_ring_open(&none, "/leafysd-test-live-none"), -1);
+}
+END_TEST
+
+Suite* live_ring_suite(void)
+{
+    Suite *s = suite_create("live_ring");
+    TCase *tc = tcase_create("core");
+    tcase_add_checked_fixture(tc, setup_ring, teardown_ring);
+    tcase_add_test(tc, test_in_order);
+    tcase_add_test(tc, test_lapped);
+    tcase_add_test(tc, test_overwritten_while_reading);
+    tcase_add_test(tc, test_late_reader);
+    tcase_add_test(tc, test_no_ring);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = live_ring_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
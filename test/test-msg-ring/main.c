@@ -0,0 +1,137 @@
+#include "msg_ring.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "type_attrs.h"
+
+#define RING_BYTES 1024
+#define NMSGS 100000
+
+struct msg_ring ring;
+
+static void setup_ring(void)
+{
+    ck_assert_int_eq(msg_ring_init(&ring, RING_BYTES), 0);
+}
+
+static void teardown_ring(void)
+{
+    msg_ring_free(&ring);
+}
+
+/* Message "i" is i's low byte, repeated msg_len(i) times. */
+static size_t msg_len(unsigned i)
+{
+    return (i * 37) % 211;
+}
+
+static void push_msg(unsigned i)
+{
+    uint8_t msg[256];
+    memset(msg, (uint8_t)i, msg_len(i));
+    ck_assert(msg_ring_push(&ring, msg, msg_len(i)) >= 0);
+}
+
+static int msg_ok(const struct iovec *iov, unsigned i)
+{
+    if (iov->iov_len != msg_len(i)) {
+        return 0;
+    }
+    for (size_t j = 0; j < iov->iov_len; j++) {
+        if (((uint8_t*)iov->iov_base)[j] != (uint8_t)i) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+START_TEST(test_fifo)
+{
+    struct iovec iovs[4];
+    ck_assert_int_eq(msg_ring_peek(&ring, iovs, 4), 0);
+    /* Keep it at a few messages, so it goes around many times. */
+    unsigned next = 0;
+    for (unsigned i = 0; i < NMSGS; i++) {
+        push_msg(i);
+        if (msg_ring_count(&ring) < 3) {
+            continue;
+        }
+        ck_assert_int_eq(msg_ring_peek(&ring, iovs, 2), 2);
+        ck_assert(msg_ok(&iovs[0], next));
+        ck_assert(msg_ok(&iovs[1], next + 1));
+        msg_ring_pop(&ring, 2);
+        next += 2;
+    }
+    size_t n = msg_ring_peek(&ring, iovs, 4);
+    ck_assert_int_eq(n, msg_ring_count(&ring));
+    for (size_t j = 0; j < n; j++) {
+        ck_assert(msg_ok(&iovs[j], next + (unsigned)j));
+    }
+}
+END_TEST
+
+START_TEST(test_drop_oldest)
+{
+    /* Never pop; the ring should always hold the newest messages
+     * that fit. */
+    struct iovec iovs[RING_BYTES / 4];
+    for (unsigned i = 0; i < NMSGS; i++) {
+        uint8_t msg[256];
+        memset(msg, (uint8_t)i, msg_len(i));
+        size_t before = msg_ring_count(&ring);
+        ssize_t dropped = msg_ring_push(&ring, msg, msg_len(i));
+        ck_assert(dropped >= 0);
+        ck_assert_int_eq(msg_ring_count(&ring), before + 1 - dropped);
+        size_t n = msg_ring_peek(&ring, iovs, RING_BYTES / 4);
+        ck_assert_int_eq(n, msg_ring_count(&ring));
+        size_t used = 0;
+        for (size_t j = 0; j < n; j++) {
+            ck_assert(msg_ok(&iovs[j], i + 1 - (unsigned)(n - j)));
+            used += 4 + ((iovs[j].iov_len + 3) & ~(size_t)3);
+        }
+        ck_assert(used <= RING_BYTES);
+    }
+    ck_assert(msg_ring_count(&ring) > 1);
+}
+END_TEST
+
+START_TEST(test_too_big)
+{
+    static uint8_t big[RING_BYTES];
+    push_msg(1);
+    ck_assert_int_eq(msg_ring_push(&ring, big, RING_BYTES), -1);
+    ck_assert_int_eq(msg_ring_count(&ring), 1);
+    /* The largest that fits pushes everything else out. */
+    ck_assert_int_eq(msg_ring_push(&ring, big, RING_BYTES - 4), 1);
+    ck_assert_int_eq(msg_ring_count(&ring), 1);
+    push_msg(1);
+    ck_assert_int_eq(msg_ring_count(&ring), 1);
+    msg_ring_clear(&ring);
+    ck_assert_int_eq(msg_ring_count(&ring), 0);
+}
+END_TEST
+
+Suite* msg_ring_suite(void)
+{
+    Suite *s = suite_create("msg_ring");
+    TCase *tc = tcase_create("core");
+    tcase_add_checked_fixture(tc, setup_ring, teardown_ring);
+    tcase_add_test(tc, test_fifo);
+    tcase_add_test(tc, test_drop_oldest);
+    tcase_add_test(tc, test_too_big);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = msg_ring_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
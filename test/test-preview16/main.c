@@ -0,0 +1,153 @@
+#include "preview16.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "type_attrs.h"
+
+#define NCHANS PREVIEW16_MAX_CHANS
+
+struct preview16 pv;
+struct preview16 pv_scalar;
+uint16_t samps[NCHANS];
+uint16_t out[4][NCHANS];
+uint16_t out_scalar[4][NCHANS];
+/* Reference totals, done the slow way. */
+double ref_sum[NCHANS];
+double ref_sumsq[NCHANS];
+uint16_t ref_min[NCHANS];
+uint16_t ref_max[NCHANS];
+
+static void teardown(void)
+{
+    preview16_use(PREVIEW16_AUTO);
+}
+
+/* Channel j wanders around its own offset; every so often one jumps
+ * to the top or bottom of the range. */
+static void fill(unsigned k, size_t nchans)
+{
+    for (size_t j = 0; j < nchans; j++) {
+        int v = 0x8000 + (int)(j * 17) - 9000 + rand() % (1 + (int)j);
+        if (rand() % 1000 == 0) {
+            v = rand() % 2 ? 0xFFFF : 0;
+        }
+        samps[j] = (uint16_t)v;
+        if (k == 0 || samps[j] < ref_min[j]) {
+            ref_min[j] = samps[j];
+        }
+        if (k == 0 || samps[j] > ref_max[j]) {
+            ref_max[j] = samps[j];
+        }
+        ref_sum[j] = (k ? ref_sum[j] : 0) + samps[j];
+        ref_sumsq[j] = ((k ? ref_sumsq[j] : 0) +
+                        (double)samps[j] * samps[j]);
+    }
+}
+
+static void check_window(size_t nchans, unsigned nsamps)
+{
+    preview16_finish(&pv, out[0], out[1], out[2], out[3]);
+    for (size_t j = 0; j < nchans; j++) {
+        double mean = ref_sum[j] / nsamps;
+        double var = ref_sumsq[j] / nsamps - mean * mean;
+        double rms = sqrt(var > 0 ? var : 0);
+        ck_assert_int_eq(out[0][j], ref_min[j]);
+        ck_assert_int_eq(out[1][j], ref_max[j]);
+        ck_assert_msg(fabs(out[2][j] - mean) <= 0.5 + 1e-9,
+                      "chan %zu: mean %u, expected %f", j, out[2][j], mean);
+        ck_assert_msg(fabs(out[3][j] - rms) <= 1.0,
+                      "chan %zu: rms %u, expected %f", j, out[3][j], rms);
+    }
+}
+
+/* Windows of a few lengths and channel counts, including ones that
+ * aren't a multiple of the vector width. Every implementation has to
+ * match the scalar one exactly. */
+static void check_impl(void)
+{
+    const size_t nchans[] = { 1, 15, 17, 100, NCHANS };
+    const unsigned nsamps[] = { 1, 2, 300, 3001 };
+    srand(1);
+    for (size_t c = 0; c < sizeof(nchans) / sizeof(nchans[0]); c++) {
+        for (size_t s = 0; s < sizeof(nsamps) / sizeof(nsamps[0]); s++) {
+            size_t n = nchans[c];
+            preview16_reset(&pv, n);
+            preview16_reset(&pv_scalar, n);
+            for (unsigned k = 0; k < nsamps[s]; k++) {
+                fill(k, n);
+                preview16_add(&pv, samps);
+                preview16_use(PREVIEW16_SCALAR);
+                preview16_add(&pv_scalar, samps);
+                teardown();
+            }
+            ck_assert_int_eq(pv.nsamps, nsamps[s]);
+            check_window(n, nsamps[s]);
+            preview16_finish(&pv_scalar, out_scalar[0], out_scalar[1],
+                             out_scalar[2], out_scalar[3]);
+            for (size_t i = 0; i < 4; i++) {
+                ck_assert(!memcmp(out[i], out_scalar[i],
+                                  n * sizeof(uint16_t)));
+            }
+        }
+    }
+}
+
+START_TEST(test_scalar)
+{
+    ck_assert_int_eq(preview16_use(PREVIEW16_SCALAR), 0);
+    ck_assert_str_eq(preview16_impl_str(), "scalar");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_auto)
+{
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_extremes)
+{
+    /* Half the samples at 0 and half at 0xFFFF, for (nearly) the
+     * longest window: the biggest sums and RMS there can be. */
+    preview16_reset(&pv, 2);
+    for (unsigned k = 0; k < PREVIEW16_MAX_WINDOW - 1; k++) {
+        samps[0] = k % 2 ? 0xFFFF : 0;
+        samps[1] = 0xFFFF;
+        preview16_add(&pv, samps);
+    }
+    preview16_finish(&pv, out[0], out[1], out[2], out[3]);
+    ck_assert_int_eq(out[0][0], 0);
+    ck_assert_int_eq(out[1][0], 0xFFFF);
+    ck_assert_int_eq(out[2][0], 0x8000);
+    ck_assert_int_eq(out[3][0], 0x8000);
+    ck_assert_int_eq(out[0][1], 0xFFFF);
+    ck_assert_int_eq(out[2][1], 0xFFFF);
+    ck_assert_int_eq(out[3][1], 0);
+}
+END_TEST
+
+Suite* preview16_suite(void)
+{
+    Suite *s = suite_create("preview16");
+    TCase *tc = tcase_create("core");
+    tcase_add_checked_fixture(tc, NULL, teardown);
+    tcase_add_test(tc, test_scalar);
+    tcase_add_test(tc, test_auto);
+    tcase_add_test(tc, test_extremes);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = preview16_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,280 @@
+#include "reref16.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "type_attrs.h"
+
+#define NCHANS REREF16_MAX_CHANS
+#define NSAMPS 200
+
+struct reref16 rr;
+uint16_t groups[NCHANS];
+uint16_t in[NCHANS];
+uint16_t out[NCHANS];
+uint16_t out_scalar[NCHANS];
+
+static void teardown(void)
+{
+    reref16_use(REREF16_AUTO);
+}
+
+/* Ways to group the channels. */
+enum grouping {
+    BY_CHIP,                    /* 32 at a time, like a board sample */
+    BY_SHANK,                   /* Uneven runs, skipping some */
+    INTERLEAVED,                /* Every fourth channel together */
+    ALL,                        /* One big group */
+    SINGLES,                    /* Every channel on its own */
+    NGROUPINGS,
+};
+
+static void group(enum grouping how, size_t n)
+{
+    for (size_t j = 0; j < n; j++) {
+        switch (how) {
+        case BY_CHIP:
+            groups[j] = (uint16_t)(j / 32);
+            break;
+        case BY_SHANK:
+            groups[j] = (j % 100 < 7 ? REREF16_NO_GROUP :
+                         (uint16_t)(1000 - j / 37));
+            break;
+        case INTERLEAVED:
+            groups[j] = (uint16_t)(j % 4);
+            break;
+        case ALL:
+            groups[j] = 5;
+            break;
+        default:
+            groups[j] = (uint16_t)j;
+            break;
+        }
+    }
+}
+
+/* Channels share some noise with the rest of their chip, and every
+ * so often one is at the top or bottom of the range. */
+static void fill(size_t n)
+{
+    int common = rand() % 2001 - 1000;
+    for (size_t j = 0; j < n; j++) {
+        int v = 0x8000 + (int)(j % 32) * 100 - 1600 + common +
+            rand() % 201 - 100;
+        if (rand() % 500 == 0) {
+            v = rand() % 2 ? 0xFFFF : 0;
+        }
+        in[j] = (uint16_t)(v < 0 ? 0 : v > 0xFFFF ? 0xFFFF : v);
+    }
+}
+
+static int cmp_u16(const void *a, const void *b)
+{
+    return (int)*(const uint16_t*)a - (int)*(const uint16_t*)b;
+}
+
+/* Channels in order of their groups, for expect(). */
+size_t order[NCHANS];
+
+static int cmp_group(const void *a, const void *b)
+{
+    uint16_t ga = groups[*(const size_t*)a], gb = groups[*(const size_t*)b];
+    return (int)ga - (int)gb;
+}
+
+static void sort_groups(size_t n)
+{
+    for (size_t j = 0; j < n; j++) {
+        order[j] = j;
+    }
+    qsort(order, n, sizeof(order[0]), cmp_group);
+}
+
+/* Re-reference in[] into want[] the slow way. */
+static void expect(uint16_t *want, size_t n, enum reref16_method method)
+{
+    uint16_t vals[NCHANS];
+    for (size_t start = 0, end; start < n; start = end) {
+        uint16_t g = groups[order[start]];
+        size_t m = 0;
+        for (end = start; end < n && groups[order[end]] == g; end++) {
+            vals[m++] = in[order[end]];
+        }
+        long ref;
+        if (method == REREF16_MEAN) {
+            long sum = 0;
+            for (size_t i = 0; i < m; i++) {
+                sum += vals[i];
+            }
+            ref = (sum + (long)m / 2) / (long)m;
+        } else {
+            qsort(vals, m, sizeof(vals[0]), cmp_u16);
+            ref = (m % 2 ? vals[m / 2] :
+                   ((long)vals[m / 2 - 1] + vals[m / 2] + 1) / 2);
+        }
+        for (size_t i = start; i < end; i++) {
+            size_t j = order[i];
+            long v = in[j] - ref + 0x8000;
+            want[j] = (g == REREF16_NO_GROUP ? in[j] :
+                       (uint16_t)(v < 0 ? 0 : v > 0xFFFF ? 0xFFFF : v));
+        }
+    }
+}
+
+/* Every implementation has to give the same results as
+ * re-referencing the slow way. */
+static void check_impl(void)
+{
+    const size_t nchans[] = { 1, 15, 33, 100, NCHANS };
+    srand(1);
+    for (int method = REREF16_MEAN; method <= REREF16_MEDIAN; method++) {
+        for (int how = 0; how < NGROUPINGS; how++) {
+            for (size_t c = 0; c < sizeof(nchans) / sizeof(nchans[0]);
+                 c++) {
+                size_t n = nchans[c];
+                group((enum grouping)how, n);
+                sort_groups(n);
+                ck_assert_int_eq(reref16_configure(&rr, method, groups, n),
+                                 0);
+                for (unsigned k = 0; k < NSAMPS; k++) {
+                    fill(n);
+                    reref16_run(&rr, out, in);
+                    expect(out_scalar, n, method);
+                    for (size_t j = 0; j < n; j++) {
+                        ck_assert_msg(out[j] == out_scalar[j],
+                                      "method %d, grouping %d, %zu chans, "
+                                      "chan %zu: got %u, want %u",
+                                      method, how, n, j, out[j],
+                                      out_scalar[j]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+START_TEST(test_scalar)
+{
+    ck_assert_int_eq(reref16_use(REREF16_SCALAR), 0);
+    ck_assert_str_eq(reref16_impl_str(), "scalar");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_auto)
+{
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_in_place)
+{
+    srand(2);
+    group(BY_CHIP, NCHANS);
+    for (int method = REREF16_MEAN; method <= REREF16_MEDIAN; method++) {
+        ck_assert_int_eq(reref16_configure(&rr, method, groups, NCHANS), 0);
+        fill(NCHANS);
+        reref16_run(&rr, out_scalar, in);
+        reref16_run(&rr, in, in);
+        ck_assert(!memcmp(in, out_scalar, sizeof(in)));
+    }
+}
+END_TEST
+
+START_TEST(test_common_noise)
+{
+    /* Two chips, each at its own offset, moving together: all that's
+     * left is each channel's offset from its chip's median. */
+    group(BY_CHIP, 64);
+    ck_assert_int_eq(reref16_configure(&rr, REREF16_MEDIAN, groups, 64), 0);
+    for (int common = -3000; common <= 3000; common += 1000) {
+        for (size_t j = 0; j < 64; j++) {
+            in[j] = (uint16_t)(0x8000 + common + (j < 32 ? -5000 : 7000) +
+                               (int)(j % 32) * 2);
+        }
+        reref16_run(&rr, out, in);
+        for (size_t j = 0; j < 64; j++) {
+            /* The median of 0, 2, ..., 62 is 31. */
+            ck_assert_int_eq(out[j], 0x8000 + (int)(j % 32) * 2 - 31);
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_clamp)
+{
+    uint16_t g[3] = { 0, 0, 0 };
+    ck_assert_int_eq(reref16_configure(&rr, REREF16_MEAN, g, 3), 0);
+    in[0] = 0;
+    in[1] = 0xFFFF;
+    in[2] = 0xFFFF;
+    reref16_run(&rr, out, in);
+    ck_assert_int_eq(out[0], 0);
+    ck_assert_int_eq(out[1], 0xFFFF - 0xAAAA + 0x8000);
+    g[0] = REREF16_NO_GROUP;
+    ck_assert_int_eq(reref16_configure(&rr, REREF16_MEAN, g, 3), 0);
+    in[1] = 0;
+    in[2] = 0xFFFF;
+    reref16_run(&rr, out, in);
+    ck_assert_int_eq(out[0], 0);
+    ck_assert_int_eq(out[1], 0);
+    ck_assert_int_eq(out[2], 0xFFFF);
+}
+END_TEST
+
+START_TEST(test_config)
+{
+    group(BY_CHIP, NCHANS);
+    ck_assert_int_eq(reref16_configure(&rr, REREF16_MEAN, groups, NCHANS),
+                     0);
+    ck_assert_int_eq(rr.ngroups, NCHANS / 32);
+    ck_assert_int_eq(rr.nruns, NCHANS / 32);
+    ck_assert_int_eq(reref16_configure(&rr, REREF16_MEAN, groups, 0), -1);
+    ck_assert_int_eq(reref16_configure(&rr, REREF16_MEAN, groups,
+                                       NCHANS + 1), -1);
+    ck_assert_int_eq(reref16_configure(&rr, (enum reref16_method)2,
+                                       groups, NCHANS), -1);
+    groups[7] = NCHANS;
+    ck_assert_int_eq(reref16_configure(&rr, REREF16_MEDIAN, groups, NCHANS),
+                     -1);
+    /* None of those changed the configuration. */
+    ck_assert_int_eq(rr.method, REREF16_MEAN);
+    ck_assert_int_eq(rr.nchans, NCHANS);
+
+    /* Nothing grouped is fine; it's a copy. */
+    memset(groups, 0xFF, sizeof(groups));
+    ck_assert_int_eq(reref16_configure(&rr, REREF16_MEAN, groups, 10), 0);
+    ck_assert_int_eq(rr.ngroups, 0);
+    for (size_t j = 0; j < 10; j++) {
+        in[j] = (uint16_t)(j * 1000);
+    }
+    reref16_run(&rr, out, in);
+    ck_assert(!memcmp(in, out, 10 * sizeof(in[0])));
+}
+END_TEST
+
+Suite* reref16_suite(void)
+{
+    Suite *s = suite_create("reref16");
+    TCase *tc = tcase_create("core");
+    tcase_add_checked_fixture(tc, NULL, teardown);
+    tcase_add_test(tc, test_scalar);
+    tcase_add_test(tc, test_auto);
+    tcase_add_test(tc, test_in_place);
+    tcase_add_test(tc, test_common_noise);
+    tcase_add_test(tc, test_clamp);
+    tcase_add_test(tc, test_config);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = reref16_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
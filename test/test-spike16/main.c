@@ -0,0 +1,325 @@
+#include "spike16.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "type_attrs.h"
+
+#define NCHANS SPIKE16_MAX_CHANS
+#define BASELINE 0x8000
+
+struct spike16 sp;
+struct spike16 sp_scalar;
+uint16_t samps[NCHANS];
+uint32_t ev_sidx;
+uint16_t ev_chans[NCHANS];
+uint16_t ev_snips[NCHANS * SPIKE16_SNIPPET_MAX];
+uint16_t ev_chans_scalar[NCHANS];
+uint16_t ev_snips_scalar[NCHANS * SPIKE16_SNIPPET_MAX];
+
+static void teardown(void)
+{
+    spike16_use(SPIKE16_AUTO);
+}
+
+/* Roughly Gaussian noise, with a standard deviation of about 11,
+ * that never goes more than 60 from 0. Making it is slower than
+ * detecting spikes in it, so it comes from a table. */
+#define NOISE_LEN 65536
+int noise_tab[NOISE_LEN];
+unsigned noise_at;
+
+static void noise_init(unsigned seed)
+{
+    srand(seed);
+    for (size_t i = 0; i < NOISE_LEN; i++) {
+        int v = 0;
+        for (int j = 0; j < 12; j++) {
+            v += rand() % 11;
+        }
+        noise_tab[i] = v - 12 * 5;
+    }
+    noise_at = 0;
+}
+
+static int noise(void)
+{
+    noise_at = noise_at * 1103515245 + 12345;
+    return noise_tab[(noise_at >> 8) % NOISE_LEN];
+}
+
+/* Sample k of channel j: noise, and a spike on some channels every
+ * so often, which only lasts one sample. */
+static uint16_t samp(unsigned k, size_t j)
+{
+    int v = BASELINE + (int)(j % 13) * 100 + noise();
+    if (k % 500 == 250 + j % 7) {
+        v -= 200;
+    }
+    return (uint16_t)v;
+}
+
+/* Every implementation has to find exactly the same events, with the
+ * same snippets, as the scalar one. */
+static void check_impl(void)
+{
+    const size_t nchans[] = { 1, 7, 8, 9, 100, NCHANS };
+    const int32_t fixed = -80;
+    struct spike16_cfg cfgs[] = {
+        { .sigmas = -4.5f },
+        { .sigmas = -3.0f, .snippet_pre = 30, .snippet_post = 2 },
+        { .thresholds = &fixed, .nthresholds = 1, .snippet_post = 1 },
+    };
+    noise_init(1);
+    for (size_t c = 0; c < sizeof(cfgs) / sizeof(cfgs[0]); c++) {
+        size_t len = cfgs[c].snippet_pre + cfgs[c].snippet_post;
+        for (size_t i = 0; i < sizeof(nchans) / sizeof(nchans[0]); i++) {
+            size_t n = nchans[i];
+            size_t nevents = 0;
+            ck_assert_int_eq(spike16_configure(&sp, &cfgs[c]), 0);
+            ck_assert_int_eq(spike16_configure(&sp_scalar, &cfgs[c]), 0);
+            ck_assert_int_eq(spike16_restart(&sp, n), 0);
+            ck_assert_int_eq(spike16_restart(&sp_scalar, n), 0);
+            for (unsigned k = 0; k < SPIKE16_WARMUP + 5000; k++) {
+                for (size_t j = 0; j < n; j++) {
+                    samps[j] = samp(k, j);
+                }
+                spike16_add(&sp, samps, k + 7);
+                spike16_use(SPIKE16_SCALAR);
+                spike16_add(&sp_scalar, samps, k + 7);
+                teardown();
+                size_t got;
+                do {
+                    uint32_t sidx_scalar;
+                    got = spike16_ready(&sp, &ev_sidx, ev_chans, ev_snips,
+                                        NCHANS);
+                    size_t got_scalar = spike16_ready(&sp_scalar,
+                                                      &sidx_scalar,
+                                                      ev_chans_scalar,
+                                                      ev_snips_scalar,
+                                                      NCHANS);
+                    ck_assert_int_eq(got, got_scalar);
+                    if (!got) {
+                        break;
+                    }
+                    ck_assert_int_eq(ev_sidx, sidx_scalar);
+                    ck_assert(!memcmp(ev_chans, ev_chans_scalar,
+                                      got * sizeof(uint16_t)));
+                    ck_assert(!memcmp(ev_snips, ev_snips_scalar,
+                                      got * len * sizeof(uint16_t)));
+                    nevents += got;
+                } while (got);
+            }
+            ck_assert(!memcmp(sp.med, sp_scalar.med, n * sizeof(int32_t)));
+            ck_assert(!memcmp(sp.mad, sp_scalar.mad, n * sizeof(int32_t)));
+            ck_assert_msg(nevents > 0, "cfg %zu, %zu chans: no events",
+                          c, n);
+            ck_assert_int_eq(sp.nlost, 0);
+        }
+    }
+}
+
+START_TEST(test_scalar)
+{
+    ck_assert_int_eq(spike16_use(SPIKE16_SCALAR), 0);
+    ck_assert_str_eq(spike16_impl_str(), "scalar");
+    check_impl();
+}
+END_TEST
+
+START_TEST(test_auto)
+{
+    check_impl();
+}
+END_TEST
+
+/* With adaptive thresholds well above the noise, we should find
+ * every spike, on the sample it happened, and nothing else, with the
+ * snippets around it. */
+START_TEST(test_adaptive)
+{
+    const size_t n = 64;
+    const struct spike16_cfg cfg = {
+        .sigmas = -7.0f,
+        .snippet_pre = 3,
+        .snippet_post = 5,
+    };
+    static uint16_t hist[SPIKE16_WARMUP + 20000][64];
+    size_t nevents = 0;
+    noise_init(2);
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), 0);
+    ck_assert_int_eq(spike16_restart(&sp, n), 0);
+    for (unsigned k = 0; k < SPIKE16_WARMUP + 20000; k++) {
+        for (size_t j = 0; j < n; j++) {
+            hist[k][j] = samps[j] = samp(k, j);
+        }
+        spike16_add(&sp, samps, k);
+        size_t got;
+        while ((got = spike16_ready(&sp, &ev_sidx, ev_chans, ev_snips,
+                                    NCHANS))) {
+            /* Spikes are only ready once we've got the rest of the
+             * snippet. */
+            ck_assert_int_eq(ev_sidx + cfg.snippet_post - 1, k);
+            for (size_t e = 0; e < got; e++) {
+                uint16_t j = ev_chans[e];
+                ck_assert_msg(ev_sidx % 500 == 250 + j % 7U,
+                              "false spike on %u at %u", j, ev_sidx);
+                for (size_t s = 0; s < 8; s++) {
+                    ck_assert_int_eq(ev_snips[e * 8 + s],
+                                     hist[ev_sidx - 3 + s][j]);
+                }
+            }
+            nevents += got;
+        }
+    }
+    /* Every channel spikes once every 500 samples. */
+    ck_assert_int_eq(nevents, n * 20000 / 500);
+    /* The noise's MAD is about 0.67 of its standard deviation, in
+     * 8.8 fixed point. */
+    ck_assert(sp.mad[0] > 5 * 256 && sp.mad[0] < 9 * 256);
+}
+END_TEST
+
+/* Fixed thresholds: per channel, in either direction, with a
+ * refractory period, and only counting fresh crossings. */
+START_TEST(test_fixed)
+{
+    const int32_t thr[] = { -50, 50, 0, -50 };
+    const struct spike16_cfg cfg = { .thresholds = thr, .nthresholds = 4 };
+    size_t counts[4] = { 0 };
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), 0);
+    ck_assert_int_eq(spike16_restart(&sp, 4), 0);
+    for (unsigned k = 0; k < SPIKE16_WARMUP + 1000; k++) {
+        int excursion = 0;
+        if (k >= SPIKE16_WARMUP && k % 100 < 40) {
+            excursion = (k % 100) % 2 ? 100 : 0;
+        }
+        samps[0] = (uint16_t)(BASELINE - excursion); /* every 100 */
+        samps[1] = (uint16_t)(BASELINE + excursion); /* every 100 */
+        samps[2] = (uint16_t)(BASELINE - excursion); /* off */
+        samps[3] = (uint16_t)(BASELINE + excursion); /* wrong way */
+        spike16_add(&sp, samps, k);
+        size_t got;
+        while ((got = spike16_ready(&sp, &ev_sidx, ev_chans, ev_snips,
+                                    NCHANS))) {
+            ck_assert_int_eq(ev_sidx, k);
+            for (size_t e = 0; e < got; e++) {
+                counts[ev_chans[e]]++;
+            }
+        }
+    }
+    /* Each burst goes past the thresholds at samples 1, 3, ... 39;
+     * the refractory period lets through the first, then 33. */
+    ck_assert_int_eq(counts[0], 10 * 2);
+    ck_assert_int_eq(counts[1], 10 * 2);
+    ck_assert_int_eq(counts[2], 0);
+    ck_assert_int_eq(counts[3], 0);
+
+    /* Constant offsets hold their thresholds; staying past one isn't
+     * a new crossing. */
+    ck_assert_int_eq(spike16_restart(&sp, 4), 0);
+    for (unsigned k = 0; k < SPIKE16_WARMUP + 1000; k++) {
+        for (size_t j = 0; j < 4; j++) {
+            samps[j] = (uint16_t)(k < SPIKE16_WARMUP ? BASELINE :
+                                  BASELINE - 1000);
+        }
+        spike16_add(&sp, samps, k);
+        while ((spike16_ready(&sp, &ev_sidx, ev_chans, ev_snips, NCHANS))) {
+            ck_assert_int_eq(ev_sidx, SPIKE16_WARMUP);
+            ck_assert(ev_chans[0] == 0 || ev_chans[0] == 3);
+        }
+    }
+}
+END_TEST
+
+/* Every channel at once: too many to keep waiting for snippets, and
+ * more than one call to collect what's ready. */
+START_TEST(test_pending)
+{
+    const int32_t thr = 100;
+    const struct spike16_cfg cfg = {
+        .thresholds = &thr,
+        .nthresholds = 1,
+        .snippet_pre = 1,
+        .snippet_post = 2,
+    };
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), 0);
+    ck_assert_int_eq(spike16_restart(&sp, NCHANS), 0);
+    size_t nevents = 0;
+    for (unsigned k = 0; k < SPIKE16_WARMUP + 2; k++) {
+        for (size_t j = 0; j < NCHANS; j++) {
+            samps[j] = (uint16_t)(k == SPIKE16_WARMUP ? BASELINE + 500 :
+                                  BASELINE);
+        }
+        spike16_add(&sp, samps, k);
+        size_t got;
+        while ((got = spike16_ready(&sp, &ev_sidx, ev_chans, ev_snips,
+                                    100))) {
+            ck_assert(got <= 100);
+            for (size_t e = 0; e < got; e++) {
+                ck_assert_int_eq(ev_chans[e], nevents + e);
+                ck_assert_int_eq(ev_snips[e * 3], BASELINE);
+                ck_assert_int_eq(ev_snips[e * 3 + 1], BASELINE + 500);
+                ck_assert_int_eq(ev_snips[e * 3 + 2], BASELINE);
+            }
+            nevents += got;
+        }
+    }
+    ck_assert_int_eq(nevents, SPIKE16_MAX_PENDING);
+    ck_assert_int_eq(sp.nlost, NCHANS - SPIKE16_MAX_PENDING);
+}
+END_TEST
+
+START_TEST(test_config)
+{
+    int32_t thr[3] = { 10, 20, 30 };
+    struct spike16_cfg cfg = { .sigmas = -4.5f };
+    cfg.snippet_pre = SPIKE16_SNIPPET_MAX;
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), -1);
+    cfg.snippet_pre = SPIKE16_SNIPPET_MAX - 1;
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), 0);
+    cfg.snippet_post = 2;
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), -1);
+    cfg.snippet_post = 1;
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), 0);
+    cfg.sigmas = 1e6f;
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), -1);
+    cfg.thresholds = thr;
+    cfg.nthresholds = 3;
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), 0);
+    ck_assert_int_eq(spike16_restart(&sp, 3), 0);
+    ck_assert_int_eq(spike16_restart(&sp, 4), -1);
+    thr[1] = 0x10000;
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), -1);
+    cfg.nthresholds = 1;
+    ck_assert_int_eq(spike16_configure(&sp, &cfg), 0);
+    ck_assert_int_eq(spike16_restart(&sp, NCHANS), 0);
+    ck_assert_int_eq(spike16_restart(&sp, NCHANS + 1), -1);
+}
+END_TEST
+
+Suite* spike16_suite(void)
+{
+    Suite *s = suite_create("spike16");
+    TCase *tc = tcase_create("core");
+    tcase_add_checked_fixture(tc, NULL, teardown);
+    tcase_add_test(tc, test_scalar);
+    tcase_add_test(tc, test_auto);
+    tcase_add_test(tc, test_adaptive);
+    tcase_add_test(tc, test_fixed);
+    tcase_add_test(tc, test_pending);
+    tcase_add_test(tc, test_config);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = spike16_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
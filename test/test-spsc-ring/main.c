@@ -0,0 +1,129 @@
+#include "spsc_ring.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "type_attrs.h"
+
+#define RING_SIZE 64
+#define NPASS 200000
+
+struct spsc_ring ring;
+unsigned slots[RING_SIZE];
+
+static void setup_ring(void)
+{
+    spsc_ring_init(&ring, RING_SIZE);
+}
+
+static void teardown_ring(void)
+{
+}
+
+START_TEST(test_empty_full)
+{
+    size_t idx;
+    ck_assert_int_eq(spsc_ring_count(&ring), 0);
+    ck_assert_int_eq(spsc_ring_peek(&ring, &idx), 0);
+    ck_assert_int_eq(spsc_ring_reserve(&ring, &idx), RING_SIZE);
+    ck_assert_int_eq(idx, 0);
+    spsc_ring_push(&ring, RING_SIZE);
+    ck_assert_int_eq(spsc_ring_count(&ring), RING_SIZE);
+    ck_assert_int_eq(spsc_ring_reserve(&ring, &idx), 0);
+    ck_assert_int_eq(spsc_ring_peek(&ring, &idx), RING_SIZE);
+    spsc_ring_pop(&ring, RING_SIZE);
+    ck_assert_int_eq(spsc_ring_count(&ring), 0);
+}
+END_TEST
+
+START_TEST(test_wraparound)
+{
+    size_t idx;
+    /* Leave the head 3/4 of the way around, with the first half free. */
+    spsc_ring_push(&ring, 3 * RING_SIZE / 4);
+    spsc_ring_pop(&ring, RING_SIZE / 2);
+    /* Spans stop at the end of the slot array. */
+    ck_assert_int_eq(spsc_ring_reserve(&ring, &idx), RING_SIZE / 4);
+    ck_assert_int_eq(idx, 3 * RING_SIZE / 4);
+    spsc_ring_push(&ring, RING_SIZE / 4);
+    ck_assert_int_eq(spsc_ring_reserve(&ring, &idx), RING_SIZE / 2);
+    ck_assert_int_eq(idx, 0);
+    ck_assert_int_eq(spsc_ring_peek(&ring, &idx), RING_SIZE / 2);
+    ck_assert_int_eq(idx, RING_SIZE / 2);
+    spsc_ring_pop(&ring, RING_SIZE / 2);
+    ck_assert_int_eq(spsc_ring_count(&ring), 0);
+    ck_assert_int_eq(spsc_ring_peek(&ring, &idx), 0);
+    ck_assert_int_eq(idx, 0);
+}
+END_TEST
+
+static void* producer_main(__unused void *arg)
+{
+    unsigned next = 0;
+    while (next < NPASS) {
+        size_t idx;
+        size_t n = spsc_ring_reserve(&ring, &idx);
+        if (n > 7) {
+            n = 7;              /* odd span sizes exercise wraparound */
+        }
+        if (n > NPASS - next) {
+            n = NPASS - next;
+        }
+        if (n == 0) {
+            sched_yield();
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            slots[idx + i] = next++;
+        }
+        spsc_ring_push(&ring, n);
+    }
+    return NULL;
+}
+
+START_TEST(test_threads)
+{
+    pthread_t producer;
+    ck_assert_int_eq(pthread_create(&producer, NULL, producer_main, NULL),
+                     0);
+    unsigned expected = 0;
+    while (expected < NPASS) {
+        size_t idx;
+        size_t n = spsc_ring_peek(&ring, &idx);
+        if (n == 0) {
+            sched_yield();
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            ck_assert_int_eq(slots[idx + i], expected++);
+        }
+        spsc_ring_pop(&ring, n);
+    }
+    ck_assert_int_eq(pthread_join(producer, NULL), 0);
+    ck_assert_int_eq(spsc_ring_count(&ring), 0);
+}
+END_TEST
+
+Suite* spsc_ring_suite(void)
+{
+    Suite *s = suite_create("spsc_ring");
+    TCase *tc = tcase_create("spsc_ring");
+    tcase_add_checked_fixture(tc, setup_ring, teardown_ring);
+    tcase_add_test(tc, test_empty_full);
+    tcase_add_test(tc, test_wraparound);
+    tcase_add_test(tc, test_threads);
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(__unused int argc, __unused char *argv[])
+{
+    Suite *s = spsc_ring_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int n_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,289 @@
+"""Test forwarding board samples to several subscribers at once.
+
+Each destination should get what it asked for, whatever the ones
+before it asked for. Samples can go missing over UDP, so this only
+compares the ones that got everywhere they were sent."""
+
+import fcntl
+import os
+import socket
+import struct
+import time
+
+import test_helpers
+from daemon_control import *
+from data_pb2 import DnodeSample
+
+DATA_SEC = 1.0
+LOCALHOST = 0x7f000001
+MAIN_PORT = test_helpers.PROTO2BYTES_DEFAULT_PORT
+NCHANS = 1120
+DELTA16_BLOCK = 32
+MID = 32768
+
+def make_nonblocking(sckt):
+    fd = sckt.fileno()
+    fl = fcntl.fcntl(fd, fcntl.F_GETFL)
+    fcntl.fcntl(fd, fcntl.F_SETFL, fl | os.O_NONBLOCK)
+
+def unpack16(data):
+    """The 16-bit values in a bytes field (e.g. BoardSample.samples),
+    as a tuple of ints."""
+    return struct.unpack('<%dH' % (len(data) // 2), data)
+
+def clamp16(v):
+    return max(0, min(0xffff, v))
+
+def isqrt(v):
+    """floor(sqrt(v)), like lib/preview16.c's."""
+    x = v
+    y = (x + 1) // 2
+    while y < x:
+        x = y
+        y = (x + v // x) // 2
+    return x
+
+def delta16_decode(data, ref, n):
+    """Python version of lib/delta16.h's delta16_decode(), with ref
+    None for a key frame. Returns a tuple of n ints."""
+    data = bytearray(data)
+    ret = []
+    pos = 0
+    for i in range(0, n, DELTA16_BLOCK):
+        w = data[pos]
+        words = struct.unpack_from('<%dI' % w, data, pos + 1)
+        pos += 1 + 4 * w
+        for j in range(min(DELTA16_BLOCK, n - i)):
+            z = 0
+            for b, word in enumerate(words):
+                z |= ((word >> j) & 1) << b
+            d = (z >> 1) ^ -(z & 1)
+            r = ref[i + j] if ref is not None else 0
+            ret.append((r + d) & 0xffff)
+    assert pos == len(data)
+    return tuple(ret)
+
+class TestFanout(test_helpers.DaemonTest):
+
+    def __init__(self, *args, **kwargs):
+        kwargs['start_dnode'] = True
+        kwargs['start_sampstreamer'] = not test_helpers.DO_IT_LIVE
+        super(TestFanout, self).__init__(*args, **kwargs)
+
+    def do_forward(self, what, **kwargs):
+        cmd = ControlCommand(type=ControlCommand.FORWARD,
+                             forward=ControlCmdForward(**kwargs))
+        resps = do_control_cmds([cmd])
+        self.assertIsNotNone(resps)
+        self.assertEqual(resps[0].type, ControlResponse.SUCCESS,
+                         msg='\n%s resp:\n%s' % (what, resps[0]))
+
+    def open_sckt(self, port):
+        sckt = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sckt.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 22)
+        sckt.bind(('localhost', port))
+        make_nonblocking(sckt)
+        return sckt
+
+    def recv_samples(self, sckt, got):
+        """Add the DnodeSamples waiting on sckt to got, by sample
+        index (for previews, of the window's first sample)."""
+        while True:
+            try:
+                data = sckt.recv(65536)
+            except socket.error:
+                return
+            dsamp = DnodeSample()
+            dsamp.ParseFromString(data)
+            if dsamp.type == DnodeSample.PREVIEW:
+                got[dsamp.preview.samp_idx] = dsamp
+            elif dsamp.type == DnodeSample.SPIKES:
+                idx = dsamp.spikes.samp_idx
+                if idx in got:
+                    # A board sample's spikes can be split up.
+                    spikes = got[idx].spikes
+                    spikes.channels.extend(dsamp.spikes.channels)
+                    spikes.snippets += dsamp.spikes.snippets
+                else:
+                    got[idx] = dsamp
+            else:
+                got[dsamp.sample.samp_idx] = dsamp
+
+    def fan_out(self, *subs):
+        """Subscribe a destination for each dict of ControlCmdForward
+        fields in subs, in order, then a plain BOARD_SAMPLE one, and
+        stream to a plain main destination for a while.
+
+        Returns what each destination got (see recv_samples()): the
+        main destination's first, then subs', then the plain
+        subscriber's."""
+        subs = list(subs) + [dict(sample_type=BOARD_SAMPLE)]
+        ports = [MAIN_PORT + i for i in range(len(subs) + 1)]
+        sckts = [self.open_sckt(port) for port in ports]
+        got = [{} for port in ports]
+        try:
+            for port, sub in zip(ports[1:], subs):
+                self.do_forward('subscribe',
+                                op=ControlCmdForward.SUBSCRIBE,
+                                dest_udp_addr4=LOCALHOST,
+                                dest_udp_port=port, **sub)
+            self.do_forward('enable', dest_udp_addr4=LOCALHOST,
+                            dest_udp_port=MAIN_PORT, enable=True,
+                            sample_type=BOARD_SAMPLE,
+                            force_daq_reset=True)
+            start = time.time()
+            while time.time() - start < DATA_SEC:
+                for sckt, g in zip(sckts, got):
+                    self.recv_samples(sckt, g)
+            self.do_forward('disable', dest_udp_addr4=LOCALHOST,
+                            dest_udp_port=MAIN_PORT, enable=False,
+                            sample_type=BOARD_SAMPLE)
+            for port in ports[1:]:
+                self.do_forward('unsubscribe',
+                                op=ControlCmdForward.UNSUBSCRIBE,
+                                dest_udp_addr4=LOCALHOST,
+                                dest_udp_port=port)
+        finally:
+            for sckt in sckts:
+                sckt.close()
+        # Spikes subscribers get nothing from samples without any
+        # (e.g. sampstreamer's).
+        for port, sub, g in zip(ports, [{}] + subs, got):
+            if sub.get('sample_type') != BOARD_SAMPLE_SPIKES:
+                self.assertTrue(g, msg='nothing sent to port %d' % port)
+        return got
+
+    def common_idxs(self, main, got):
+        idxs = sorted(set(main) & set(got))
+        self.assertTrue(idxs, msg='no samples in common with main')
+        return idxs
+
+    def check_plain(self, main, got):
+        """Check that a plain subscriber got the main destination's
+        samples."""
+        for idx in self.common_idxs(main, got):
+            self.assertEqual(got[idx].type, DnodeSample.SAMPLE)
+            self.assertEqual(len(got[idx].sample.samples), 2 * NCHANS)
+            self.assertFalse(got[idx].sample.channels)
+            self.assertEqual(got[idx].sample.samples,
+                             main[idx].sample.samples, msg=str(idx))
+
+    def testChannelSubset(self):
+        chans = [7, 2]
+        main, subset, plain = self.fan_out(dict(sample_type=BOARD_SAMPLE,
+                                                channels=chans))
+        self.check_plain(main, main)
+        self.check_plain(main, plain)
+        for idx in self.common_idxs(main, subset):
+            self.assertEqual(list(subset[idx].sample.channels), chans)
+            main_samps = unpack16(main[idx].sample.samples)
+            self.assertEqual(unpack16(subset[idx].sample.samples),
+                             tuple(main_samps[c] for c in chans),
+                             msg=str(idx))
+
+    def testDelta(self):
+        main, delta, plain = self.fan_out(
+            dict(sample_type=BOARD_SAMPLE_DELTA))
+        self.check_plain(main, plain)
+        decoded = {}
+        for idx in sorted(delta):
+            bsmp = delta[idx].sample
+            self.assertFalse(bsmp.samples)
+            if not bsmp.HasField('delta_ref'):
+                ref = None
+            elif bsmp.delta_ref in decoded:
+                ref = decoded[bsmp.delta_ref]
+            else:
+                continue        # lost the reference; wait for a key frame
+            decoded[idx] = delta16_decode(bsmp.samples_delta, ref, NCHANS)
+        for idx in self.common_idxs(main, decoded):
+            self.assertEqual(decoded[idx], unpack16(main[idx].sample.samples),
+                             msg=str(idx))
+
+    def testPreview(self):
+        chans = [7, 2, 100]
+        main, preview, plain = self.fan_out(
+            dict(sample_type=BOARD_SAMPLE_PREVIEW, channels=chans,
+                 preview_window=10))
+        self.check_plain(main, plain)
+        nchecked = 0
+        for idx in sorted(preview):
+            self.assertEqual(preview[idx].type, DnodeSample.PREVIEW)
+            pv = preview[idx].preview
+            self.assertEqual(list(pv.channels), chans)
+            n = pv.nsamples
+            self.assertTrue(0 < n <= 10, msg=str(idx))
+            if not all(i in main for i in range(idx, idx + n)):
+                continue
+            window = [unpack16(main[i].sample.samples)
+                      for i in range(idx, idx + n)]
+            exp = ([], [], [], [])
+            for c in chans:
+                vals = [s[c] for s in window]
+                total = sum(vals)
+                var_n2 = n * sum(v * v for v in vals) - total * total
+                exp[0].append(min(vals))
+                exp[1].append(max(vals))
+                exp[2].append((total + n // 2) // n)
+                exp[3].append((isqrt(var_n2) + n // 2) // n)
+            got = (pv.min, pv.max, pv.mean, pv.rms)
+            for field, e, g in zip(('min', 'max', 'mean', 'rms'), exp, got):
+                self.assertEqual(unpack16(g), tuple(e),
+                                 msg='%s at %d' % (field, idx))
+            nchecked += 1
+        self.assertTrue(nchecked, msg='no complete windows in main')
+
+    def testSpikes(self):
+        pre, post = 4, 4
+        main, spikes, plain = self.fan_out(
+            dict(sample_type=BOARD_SAMPLE_SPIKES, spike_thresholds=[1],
+                 spike_snippet_pre=pre, spike_snippet_post=post))
+        self.check_plain(main, plain)
+        for idx in sorted(spikes):
+            self.assertEqual(spikes[idx].type, DnodeSample.SPIKES)
+            sp = spikes[idx].spikes
+            self.assertEqual(sp.snippet_pre, pre)
+            snippets = unpack16(sp.snippets)
+            self.assertEqual(len(snippets), len(sp.channels) * (pre + post))
+            idxs = range(idx - pre, idx + post)
+            if not all(i in main for i in idxs):
+                continue
+            window = [unpack16(main[i].sample.samples) for i in idxs]
+            for k, c in enumerate(sp.channels):
+                run = snippets[k * (pre + post):(k + 1) * (pre + post)]
+                self.assertEqual(run, tuple(s[c] for s in window),
+                                 msg='channel %d at %d' % (c, idx))
+
+    def testFilter(self):
+        # A gain of 2 about MID: exact in single-precision float.
+        chans = [7, 2]
+        main, filt, plain = self.fan_out(
+            dict(sample_type=BOARD_SAMPLE, channels=chans,
+                 filter_sos=[2, 0, 0, 1, 0, 0]))
+        self.check_plain(main, plain)
+        for idx in self.common_idxs(main, filt):
+            self.assertEqual(list(filt[idx].sample.channels), chans)
+            main_samps = unpack16(main[idx].sample.samples)
+            exp = tuple(clamp16(2 * (main_samps[c] - MID) + MID)
+                        for c in chans)
+            self.assertEqual(unpack16(filt[idx].sample.samples), exp,
+                             msg=str(idx))
+
+    def testReref(self):
+        # One group per chip; references use every channel, even the
+        # ones not forwarded.
+        chans = [7, 2, 40]
+        main, reref, plain = self.fan_out(
+            dict(sample_type=BOARD_SAMPLE, channels=chans,
+                 reref_group_size=32))
+        self.check_plain(main, plain)
+        for idx in self.common_idxs(main, reref):
+            self.assertEqual(list(reref[idx].sample.channels), chans)
+            main_samps = unpack16(main[idx].sample.samples)
+            exp = []
+            for c in chans:
+                group = main_samps[c // 32 * 32:c // 32 * 32 + 32]
+                ref = (sum(group) + 16) // 32
+                exp.append(clamp16(main_samps[c] - ref + MID))
+            self.assertEqual(unpack16(reref[idx].sample.samples),
+                             tuple(exp), msg=str(idx))
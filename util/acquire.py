@@ -54,6 +54,10 @@ def save_stored(args):
     cmd.store.path = fpath
     if args.backend is not None:
         cmd.store.backend = BACKENDS[args.backend]
+    if args.wire_byte_order:
+        cmd.store.wire_byte_order = True
+    if args.filter_sos is not None:
+        cmd.store.filter_sos.extend(parse_filter(args.filter_sos))
     return [cmd]
 
 def save_stream(args):
@@ -64,8 +68,36 @@ def save_stream(args):
     cmd.store.nsamples = nsamples
     if args.backend is not None:
         cmd.store.backend = BACKENDS[args.backend]
+    if args.wire_byte_order:
+        cmd.store.wire_byte_order = True
+    if args.filter_sos is not None:
+        cmd.store.filter_sos.extend(parse_filter(args.filter_sos))
     return [cmd]
 
+def parse_channels(spec):
+    """Parse a channel list like '0-15,64,100-103'."""
+    chans = []
+    for part in spec.split(','):
+        if '-' in part:
+            first, last = part.split('-', 1)
+            chans.extend(range(int(first), int(last) + 1))
+        else:
+            chans.append(int(part))
+    return chans
+
+def parse_filter(spec):
+    """Parse comma-separated second-order sections, six coefficients
+    (b0,b1,b2,a0,a1,a2) per section, as scipy.signal's sos filters
+    have them."""
+    try:
+        sos = [float(c) for c in spec.split(',')]
+    except ValueError:
+        sos = []
+    if not sos or len(sos) % 6:
+        print('Invalid filter', spec, file=sys.stderr)
+        sys.exit(1)
+    return sos
+
 def forward(args):
     cmd = ControlCommand(type=ControlCommand.FORWARD)
     if args.type == 'sample':
@@ -76,11 +108,72 @@ def forward(args):
         cmd.forward.sample_type = BOARD_SAMPLE_RAW
     elif args.type == 'subsample_raw':
         cmd.forward.sample_type = BOARD_SUBSAMPLE_RAW
+    elif args.type == 'sample_delta':
+        cmd.forward.sample_type = BOARD_SAMPLE_DELTA
+    elif args.type == 'sample_preview':
+        cmd.forward.sample_type = BOARD_SAMPLE_PREVIEW
+    elif args.type == 'sample_spikes':
+        cmd.forward.sample_type = BOARD_SAMPLE_SPIKES
     else:
         print('Invalid sample type:', args.type, file=sys.stderr)
         sys.exit(1)
     if args.force_daq_reset:
         cmd.forward.force_daq_reset = True
+    if args.tee_every is not None:
+        cmd.forward.tee_every = args.tee_every
+    if args.batch_size is not None:
+        cmd.forward.batch_size = args.batch_size
+        cmd.forward.batch_max_latency_us = args.batch_latency
+    if args.decimate is not None:
+        cmd.forward.decimate = args.decimate
+    if args.preview_window is not None:
+        cmd.forward.preview_window = args.preview_window
+    if args.spike_thresholds is not None:
+        try:
+            cmd.forward.spike_thresholds.extend(
+                int(t) for t in args.spike_thresholds.split(','))
+        except ValueError:
+            print('Invalid spike thresholds', args.spike_thresholds,
+                  file=sys.stderr)
+            sys.exit(1)
+    if args.spike_sigmas is not None:
+        cmd.forward.spike_threshold_sigmas = args.spike_sigmas
+    if args.spike_snippet is not None:
+        try:
+            pre, post = (int(n) for n in args.spike_snippet.split(','))
+        except ValueError:
+            print('Invalid spike snippet', args.spike_snippet,
+                  file=sys.stderr)
+            sys.exit(1)
+        cmd.forward.spike_snippet_pre = pre
+        cmd.forward.spike_snippet_post = post
+    if args.filter_sos == 'none':
+        cmd.forward.no_filter = True
+    elif args.filter_sos is not None:
+        cmd.forward.filter_sos.extend(parse_filter(args.filter_sos))
+    if args.reref == 'none':
+        cmd.forward.no_reref = True
+    elif args.reref is not None:
+        try:
+            groups = [int(g) for g in args.reref.split(',')]
+        except ValueError:
+            print('Invalid re-referencing groups', args.reref,
+                  file=sys.stderr)
+            sys.exit(1)
+        if len(groups) == 1:
+            cmd.forward.reref_group_size = groups[0]
+        else:
+            cmd.forward.reref_groups.extend(groups)
+        if args.reref_median:
+            cmd.forward.reref_median = True
+    if args.channels == 'all':
+        cmd.forward.all_channels = True
+    elif args.channels is not None:
+        try:
+            cmd.forward.channels.extend(parse_channels(args.channels))
+        except ValueError:
+            print('Invalid channel list', args.channels, file=sys.stderr)
+            sys.exit(1)
     try:
         aton = socket.inet_aton(args.address)
     except socket.error:
@@ -91,7 +184,20 @@ def forward(args):
         print('Invalid port', args.port, file=sys.stderr)
         sys.exit(1)
     cmd.forward.dest_udp_port = args.port
-    cmd.forward.enable = (args.enable == 'start')
+    if args.transport == 'tcp':
+        cmd.forward.transport = ControlCmdForward.TCP
+    elif args.transport == 'unix':
+        if args.unix_path is None:
+            print('--transport unix needs --unix-path', file=sys.stderr)
+            sys.exit(1)
+        cmd.forward.transport = ControlCmdForward.UNIX
+        cmd.forward.dest_unix_path = args.unix_path
+    if args.enable == 'subscribe':
+        cmd.forward.op = ControlCmdForward.SUBSCRIBE
+    elif args.enable == 'unsubscribe':
+        cmd.forward.op = ControlCmdForward.UNSUBSCRIBE
+    else:
+        cmd.forward.enable = (args.enable == 'start')
     return [cmd]
 
 def subsamples(args):
@@ -171,6 +277,16 @@ save_stored_parser.add_argument(
     default=None,
     choices=BACKEND_CHOICES,
     help='Storage backend')
+save_stored_parser.add_argument(
+    '-w', '--wire-byte-order',
+    action='store_true',
+    help="Store samples big-endian, as the data node sends them")
+save_stored_parser.add_argument(
+    '--filter-sos',
+    default=None,
+    help=('Also store a copy of the samples run through this IIR '
+          'filter (HDF5 only): comma-separated b0,b1,b2,a0,a1,a2 for '
+          'each of up to 8 second-order sections'))
 
 
 save_stream_parser = argparse.ArgumentParser(
@@ -185,6 +301,16 @@ save_stream_parser.add_argument(
     default=None,
     choices=BACKEND_CHOICES,
     help='Storage backend')
+save_stream_parser.add_argument(
+    '-w', '--wire-byte-order',
+    action='store_true',
+    help="Store samples big-endian, as the data node sends them")
+save_stream_parser.add_argument(
+    '--filter-sos',
+    default=None,
+    help=('Also store a copy of the samples run through this IIR '
+          'filter (HDF5 only): comma-separated b0,b1,b2,a0,a1,a2 for '
+          'each of up to 8 second-order sections'))
 
 subsamples_parser = argparse.ArgumentParser(
     prog='subsamples',
@@ -211,7 +337,8 @@ forward_parser.add_argument(
     help='[DANGEROUS] force DAQ module reset')
 forward_parser.add_argument(
     '-t', '--type',
-    choices=['sample', 'subsample', 'sample_raw', 'subsample_raw'],
+    choices=['sample', 'subsample', 'sample_raw', 'subsample_raw',
+             'sample_delta', 'sample_preview', 'sample_spikes'],
     default=DEFAULT_FORWARD_TYPE,
     help='Type of packets to forward (default %s)' % DEFAULT_FORWARD_TYPE)
 forward_parser.add_argument(
@@ -224,10 +351,90 @@ forward_parser.add_argument(
     default=DEFAULT_FORWARD_PORT,
     help=('Port to forward packets to, default %s' %
           DEFAULT_FORWARD_PORT))
+forward_parser.add_argument(
+    '-e', '--tee-every',
+    type=int,
+    default=None,
+    help=('While storing, keep forwarding board samples whose index '
+          'is a multiple of this (0 to stop)'))
+forward_parser.add_argument(
+    '-B', '--batch-size',
+    type=int,
+    default=None,
+    help='Send up to this many samples per datagram (0 for one each)')
+forward_parser.add_argument(
+    '-L', '--batch-latency',
+    type=int,
+    default=0,
+    help='Longest time, in microseconds, to hold a batch (default 0)')
+forward_parser.add_argument(
+    '-d', '--decimate',
+    type=int,
+    default=None,
+    help=('Only forward live samples whose index is a multiple of '
+          'this (0 or 1 for all)'))
+forward_parser.add_argument(
+    '-w', '--preview-window',
+    type=int,
+    default=None,
+    help=('With --type sample_preview, summarize this many board '
+          'samples at a time (0 for the default, 300)'))
+forward_parser.add_argument(
+    '--spike-thresholds',
+    default=None,
+    help=('With --type sample_spikes, fixed thresholds in ADC counts '
+          'from each channel\'s baseline, e.g. -80 or -80,-95,...: '
+          'one, or one per forwarded channel; negative looks down'))
+forward_parser.add_argument(
+    '--spike-sigmas',
+    type=float,
+    default=None,
+    help=('With --type sample_spikes and no --spike-thresholds, '
+          'threshold in standard deviations of each channel\'s noise '
+          '(default -4.5)'))
+forward_parser.add_argument(
+    '--spike-snippet',
+    default=None,
+    help=('With --type sample_spikes, send PRE,POST samples from '
+          'before and after each crossing, e.g. 10,22'))
+forward_parser.add_argument(
+    '--filter-sos',
+    default=None,
+    help=('Run board samples through this IIR filter first: '
+          'comma-separated b0,b1,b2,a0,a1,a2 for each of up to 8 '
+          'second-order sections, or "none" to stop filtering'))
+forward_parser.add_argument(
+    '--reref',
+    default=None,
+    help=('Subtract each group of channels\' mean from them first: '
+          'a group size, e.g. 32 for one group per chip, a group '
+          'number for each board sample channel, e.g. 0,0,1,1,..., '
+          'or "none" to stop re-referencing'))
+forward_parser.add_argument(
+    '--reref-median',
+    default=False,
+    action='store_true',
+    help='With --reref, subtract group medians instead of means')
+forward_parser.add_argument(
+    '-c', '--channels',
+    default=None,
+    help=('Only forward these board sample channels, e.g. 0-15,64, '
+          'or "all" for every channel'))
+forward_parser.add_argument(
+    '-T', '--transport',
+    choices=['udp', 'tcp', 'unix'],
+    default='udp',
+    help=('How to send to a subscriber (default udp); tcp and unix '
+          'connect to it and queue samples if it falls behind'))
+forward_parser.add_argument(
+    '-u', '--unix-path',
+    default=None,
+    help='Unix domain socket to connect to, with --transport unix')
 forward_parser.add_argument(
     'enable',
-    choices=['start', 'stop'],
-    help='Start or stop live sample forwarding')
+    choices=['start', 'stop', 'subscribe', 'unsubscribe'],
+    help=('Start or stop live sample forwarding, or add or remove '
+          'another destination for it'))
 
 def nop_resp_map(resps):
     return resps
@@ -0,0 +1,269 @@
+/* Copyright (c) 2013 LeafLabs, LLC.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark: packing DnodeSamples with protobuf-c, the way the
+ * daemon used to, versus with lib/data_pbenc. The compressed board
+ * sample benchmarks include the compression.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bsmp_gather.h"
+#include "data_pbenc.h"
+#include "delta16.h"
+#include "raw_packets.h"
+#include "proto/data.pb-c.h"
+
+#define PROGRAM_NAME "pbenc-bench"
+#define DEFAULT_ITERS 1000000
+
+static struct raw_pkt_bsmp bsmp;
+static struct raw_pkt_bsub bsub;
+static uint8_t out[DATA_PBENC_BSMP_DELTA_MAX];
+static uint8_t bsmp_samps[RAW_BSMP_NSAMP * sizeof(raw_samp_t)];
+static uint32_t bsub_chips[RAW_BSUB_NSAMP];
+static uint32_t bsub_chans[RAW_BSUB_NSAMP];
+static uint32_t bsub_samps[RAW_BSUB_NSAMP];
+static struct data_pbenc_chans dchans;
+static uint16_t delta_ref[RAW_BSMP_NSAMP];
+static uint8_t delta_buf[DELTA16_MAX_LEN(RAW_BSMP_NSAMP)];
+static volatile size_t sink;    /* keep the compiler honest */
+
+static void usage(int exit_status)
+{
+    fprintf(exit_status == EXIT_SUCCESS ? stdout : stderr,
+            "Usage: %s [-n <iters>]\n"
+            "Options:\n"
+            "  -h, --help"
+            "\tPrint this message\n"
+            "  -n, --iters"
+            "\tMessages to pack per benchmark, default %d\n",
+            PROGRAM_NAME, DEFAULT_ITERS);
+    exit(exit_status);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void init_packets(void)
+{
+    raw_packet_init(&bsmp, RAW_MTYPE_BSMP, RAW_PFLAG_B_LIVE);
+    bsmp.b_cookie_h = 0x12345678;
+    bsmp.b_cookie_l = 0x9abcdef0;
+    bsmp.b_id = 0xdeadbeef;
+    bsmp.b_chip_live = 0xffffffff;
+    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+        bsmp.b_samps[i] = (raw_samp_t)(i * 0x0101 + 0x8000);
+    }
+    raw_packet_init(&bsub, RAW_MTYPE_BSUB, RAW_PFLAG_B_LIVE);
+    bsub.b_cookie_h = bsmp.b_cookie_h;
+    bsub.b_cookie_l = bsmp.b_cookie_l;
+    bsub.b_id = bsmp.b_id;
+    bsub.b_chip_live = bsmp.b_chip_live;
+    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
+        bsub.b_cfg[i].bs_chip = (uint8_t)(i / 4);
+        bsub.b_cfg[i].bs_chan = (uint8_t)i;
+        bsub.b_samps[i] = (raw_samp_t)(i * 0x0101 + 0x8000);
+    }
+}
+
+static size_t protobuf_c_bsmp(void)
+{
+    uint8_t pflags = raw_pflags(&bsmp);
+    BoardSample msg = BOARD_SAMPLE__INIT;
+    msg.has_is_live = 1;
+    msg.is_live = !!(pflags & RAW_PFLAG_B_LIVE);
+    msg.has_is_last = 1;
+    msg.is_last = !!(pflags & RAW_PFLAG_B_LAST);
+    msg.has_is_err = 1;
+    msg.is_err = !!raw_pkt_is_err(&bsmp);
+    msg.has_exp_cookie = 1;
+    msg.exp_cookie = raw_exp_cookie(&bsmp);
+    msg.has_board_id = 1;
+    msg.board_id = bsmp.b_id;
+    msg.has_samp_idx = 1;
+    msg.samp_idx = bsmp.b_sidx;
+    msg.has_chip_live = 1;
+    msg.chip_live = bsmp.b_chip_live;
+    msg.has_samples = 1;
+    msg.samples.data = bsmp_samps;
+    msg.samples.len = sizeof(bsmp_samps);
+    memcpy(bsmp_samps, bsmp.b_samps, sizeof(bsmp_samps));
+    DnodeSample dnsample = DNODE_SAMPLE__INIT;
+    dnsample.has_type = 1;
+    dnsample.type = DNODE_SAMPLE__TYPE__SAMPLE;
+    dnsample.sample = &msg;
+    size_t len = dnode_sample__get_packed_size(&dnsample);
+    dnode_sample__pack(&dnsample, out);
+    return len;
+}
+
+static size_t protobuf_c_bsub(void)
+{
+    uint8_t pflags = raw_pflags(&bsub);
+    BoardSubsample msg = BOARD_SUBSAMPLE__INIT;
+    msg.has_is_live = 1;
+    msg.is_live = !!(pflags & RAW_PFLAG_B_LIVE);
+    msg.has_is_last = 1;
+    msg.is_last = !!(pflags & RAW_PFLAG_B_LAST);
+    msg.has_is_err = 1;
+    msg.is_err = !!raw_pkt_is_err(&bsub);
+    msg.has_exp_cookie = 1;
+    msg.exp_cookie = raw_exp_cookie(&bsub);
+    msg.has_board_id = 1;
+    msg.board_id = bsub.b_id;
+    msg.has_samp_idx = 1;
+    msg.samp_idx = bsub.b_sidx;
+    msg.has_chip_live = 1;
+    msg.chip_live = bsub.b_chip_live;
+    msg.n_chips = msg.n_channels = msg.n_samples = RAW_BSUB_NSAMP;
+    msg.chips = bsub_chips;
+    msg.channels = bsub_chans;
+    msg.samples = bsub_samps;
+    for (size_t i = 0; i < RAW_BSUB_NSAMP; i++) {
+        bsub_chips[i] = bsub.b_cfg[i].bs_chip;
+        bsub_chans[i] = bsub.b_cfg[i].bs_chan;
+        bsub_samps[i] = bsub.b_samps[i];
+    }
+    msg.has_gpio = 1;
+    msg.gpio = bsub.b_gpio;
+    msg.has_dac_channel = 1;
+    msg.dac_channel = bsub.b_dac_cfg;
+    msg.has_dac_value = 1;
+    msg.dac_value = bsub.b_dac;
+    DnodeSample dnsample = DNODE_SAMPLE__INIT;
+    dnsample.has_type = 1;
+    dnsample.type = DNODE_SAMPLE__TYPE__SUBSAMPLE;
+    dnsample.subsample = &msg;
+    size_t len = dnode_sample__get_packed_size(&dnsample);
+    dnode_sample__pack(&dnsample, out);
+    return len;
+}
+
+static size_t pbenc_bsmp(void)
+{
+    size_t len = data_pbenc_bsmp_size(&bsmp);
+    data_pbenc_bsmp(out, &bsmp, 0);
+    return len;
+}
+
+static size_t pbenc_bsmp_chans(void)
+{
+    size_t len = data_pbenc_bsmp_chans_size(&bsmp, &dchans);
+    data_pbenc_bsmp_chans(out, &bsmp, &dchans, 0);
+    return len;
+}
+
+/* Each sample is compressed against one that's a little different,
+ * like consecutive samples from a quiet board. */
+static size_t pbenc_bsmp_delta(void)
+{
+    struct data_pbenc_delta delta = {
+        .data = delta_buf,
+        .has_ref = 1,
+        .ref = bsmp.b_sidx - 1,
+    };
+    delta.len = delta16_encode(delta_buf, bsmp.b_samps, delta_ref,
+                               RAW_BSMP_NSAMP);
+    size_t len = data_pbenc_bsmp_delta_size(&bsmp, NULL, &delta);
+    data_pbenc_bsmp_delta(out, &bsmp, NULL, &delta);
+    return len;
+}
+
+static size_t pbenc_bsub(void)
+{
+    size_t len = data_pbenc_bsub_size(&bsub);
+    data_pbenc_bsub(out, &bsub);
+    return len;
+}
+
+static void bench(const char *name, size_t (*pack)(void), size_t iters)
+{
+    double start = now_sec();
+    for (size_t i = 0; i < iters; i++) {
+        bsmp.b_sidx = bsub.b_sidx = (uint32_t)i;
+        sink = pack();
+    }
+    double elapsed = now_sec() - start;
+    printf("%-18s %8.1f ns/msg  %8.1f MB/s\n", name,
+           elapsed * 1e9 / iters, sink * iters / elapsed / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t iters = DEFAULT_ITERS;
+    const char shortopts[] = "hn:";
+    struct option longopts[] = {
+        /* name, has_arg, flag, val */
+        { "help", no_argument, NULL, 'h' },
+        { "iters", required_argument, NULL, 'n' },
+        { 0, 0, 0, 0 },
+    };
+    int option_idx;
+    int c;
+    while ((c = getopt_long(argc, argv, shortopts, longopts,
+                            &option_idx)) != -1) {
+        switch (c) {
+        case 'h':
+            usage(EXIT_SUCCESS);
+            break;
+        case 'n':
+            iters = strtoul(optarg, NULL, 10);
+            if (iters == 0) {
+                usage(EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage(EXIT_FAILURE);
+        }
+    }
+
+    init_packets();
+    printf("channel gather: %s\n", bsmp_gather_impl_str());
+    bench("bsmp protobuf-c", protobuf_c_bsmp, iters);
+    bench("bsmp data_pbenc", pbenc_bsmp, iters);
+    /* Spread the channels over the board sample, like a client
+     * watching a few per chip would. */
+    const size_t chan_counts[] = { 16, 128 };
+    for (size_t i = 0; i < sizeof(chan_counts) / sizeof(chan_counts[0]);
+         i++) {
+        uint16_t chans[RAW_BSMP_NSAMP];
+        char name[32];
+        size_t n = chan_counts[i];
+        for (size_t j = 0; j < n; j++) {
+            chans[j] = (uint16_t)(j * (RAW_BSMP_NSAMP / n));
+        }
+        data_pbenc_chans_init(&dchans, chans, n);
+        snprintf(name, sizeof(name), "bsmp %zu chans", n);
+        bench(name, pbenc_bsmp_chans, iters);
+    }
+    printf("delta compression: %s\n", delta16_impl_str());
+    for (size_t i = 0; i < RAW_BSMP_NSAMP; i++) {
+        delta_ref[i] = (uint16_t)(bsmp.b_samps[i] + (i % 61) - 30);
+    }
+    bench("bsmp delta", pbenc_bsmp_delta, iters);
+    bench("bsub protobuf-c", protobuf_c_bsub, iters);
+    bench("bsub data_pbenc", pbenc_bsub, iters);
+    return EXIT_SUCCESS;
+}
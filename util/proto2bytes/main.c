@@ -45,10 +45,12 @@ static const char* out_type_str(enum out_type type)
 static void usage(int exit_status)
 {
     fprintf(exit_status == EXIT_SUCCESS ? stdout : stderr,
-            "Usage: %s [-d|-c <ch>] [-p <port>] [-s]\n"
+            "Usage: %s [-d|-c <ch>] [-p <port>] [-s] [-b]\n"
             "Options:\n"
             "  -A, --all-sub"
             "\tOutput all 32 channels. Implies subsamples.\n"
+            "  -b, --batched"
+            "\tExpect DnodeSampleBatch messages (forwarding batch_size)\n"
             "  -c, --channel"
             "\t(16-bit) channel to output\n"
             "  -d, --dac"
@@ -73,6 +75,7 @@ static void usage(int exit_status)
       .enable_string = 0,          \
       .board_samples = 0,          \
       .all_sub_channels = 0,       \
+      .batched = 0,                \
     }
 
 struct arguments {
@@ -82,18 +85,23 @@ struct arguments {
     int enable_string;
     int board_samples;
     int all_sub_channels;
+    int batched;
 };
 
 static void parse_args(struct arguments* args, int argc, char *const argv[])
 {
     int print_usage = 0;
-    const char shortopts[] = "Ac:dhMp:s";
+    const char shortopts[] = "Abc:dhMp:s";
     struct option longopts[] = {
         /* Keep these sorted with shortopts. */
         { .name = "all-sub",
           .has_arg = no_argument,
           .flag = NULL,
           .val = 'A' },
+        { .name = "batched",
+          .has_arg = no_argument,
+          .flag = NULL,
+          .val = 'b' },
         { .name = "channel",
           .has_arg = required_argument,
           .flag = NULL,
@@ -137,6 +145,9 @@ static void parse_args(struct arguments* args, int argc, char *const argv[])
         case 'A':
             args->all_sub_channels = 1;
             break;
+        case 'b':
+            args->batched = 1;
+            break;
         case 'c':
             args->output = OUT_CHANNEL;
             int ch = strtol(optarg, (char**)0, 10);
@@ -244,6 +255,30 @@ uint32_t handle_subsample(DnodeSample *samp, struct arguments *args)
     return samp->subsample->samp_idx;
 }
 
+/* Returns the new last sample index. */
+static uint32_t handle_dnode_sample(DnodeSample *samp,
+                                    struct arguments *args,
+                                    uint32_t last_sidx)
+{
+    if (args->board_samples) {
+        if (samp->sample == NULL && samp->subsample) {
+            fprintf(stderr, "got subsample, but expected board sample\n");
+            return last_sidx;
+        }
+    } else if (samp->subsample == NULL && samp->sample) {
+        fprintf(stderr, "got board sample, but expected subsample\n");
+        return last_sidx;
+    }
+    uint32_t cur_idx = (args->board_samples ?
+                        handle_sample(samp, args) :
+                        handle_subsample(samp, args));
+    uint32_t gap = cur_idx - last_sidx - 1;
+    if (gap) {
+        fprintf(stderr, "GAP: %d\n", gap);
+    }
+    return cur_idx;
+}
+
 int main(int argc, char *argv[])
 {
     uint8_t buf[1024*1024];
@@ -266,6 +301,10 @@ int main(int argc, char *argv[])
 
     uint32_t last_sidx = 0;
     while (1) {
+        DnodeSample **samps;
+        size_t nsamps;
+        DnodeSampleBatch *batch = NULL;
+        DnodeSample *samp = NULL;
         ssize_t n = recvfrom(sockfd, buf, sizeof(buf), 0, NULL, NULL);
         if (n == -1) {
             if (errno == EINTR) {
@@ -274,29 +313,27 @@ int main(int argc, char *argv[])
             perror("recvfrom");
             exit(EXIT_FAILURE);
         }
-        DnodeSample *samp = dnode_sample__unpack(NULL, (size_t)n, buf);
-        if (!samp) {
+        if (args.batched) {
+            batch = dnode_sample_batch__unpack(NULL, (size_t)n, buf);
+            samps = batch ? batch->samples : NULL;
+            nsamps = batch ? batch->n_samples : 0;
+        } else {
+            samp = dnode_sample__unpack(NULL, (size_t)n, buf);
+            samps = &samp;
+            nsamps = 1;
+        }
+        if (!batch && !samp) {
             fprintf(stderr, "unpacking failed; skipping packet\n");
             continue;
         }
-        if (args.board_samples) {
-            if (samp->sample == NULL && samp->subsample) {
-                fprintf(stderr, "got subsample, but expected board sample\n");
-                continue;
-            }
-        } else if (samp->subsample == NULL && samp->sample) {
-            fprintf(stderr, "got board sample, but expected subsample\n");
-            continue;
+        for (size_t i = 0; i < nsamps; i++) {
+            last_sidx = handle_dnode_sample(samps[i], &args, last_sidx);
         }
-        uint32_t cur_idx = (args.board_samples ?
-                            handle_sample(samp, &args) :
-                            handle_subsample(samp, &args));
-        uint32_t gap = cur_idx - last_sidx - 1;
-        if (gap) {
-            fprintf(stderr, "GAP: %d\n", gap);
+        if (batch) {
+            dnode_sample_batch__free_unpacked(batch, NULL);
+        } else {
+            dnode_sample__free_unpacked(samp, NULL);
         }
-        last_sidx = cur_idx;
-        dnode_sample__free_unpacked(samp, NULL);
     }
 
     exit(EXIT_SUCCESS);         /* placate compiler */